@@ -0,0 +1,80 @@
+/**
+ * Common utilities for the lotman-bench benchmarks
+ */
+
+#ifndef LOTMAN_BENCH_UTILS_H
+#define LOTMAN_BENCH_UTILS_H
+
+#include "../src/lotman.h"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <memory>
+#include <string>
+
+// RAII wrappers for C-style memory management
+struct CStringDeleter {
+	void operator()(char *ptr) const {
+		if (ptr)
+			free(ptr);
+	}
+};
+using UniqueCString = std::unique_ptr<char, CStringDeleter>;
+
+struct StringListDeleter {
+	void operator()(char **ptr) const {
+		if (ptr)
+			lotman_free_string_list(ptr);
+	}
+};
+using UniqueStringList = std::unique_ptr<char *, StringListDeleter>;
+
+namespace lotman_bench {
+
+/**
+ * The largest hierarchy the benchmarks generate, from $LOTMAN_BENCH_MAX_LOTS. Defaults to a million lots.
+ */
+inline int64_t max_lots() {
+	const char *env = std::getenv("LOTMAN_BENCH_MAX_LOTS");
+	if (env && *env) {
+		long long value = std::atoll(env);
+		if (value > 0) {
+			return value;
+		}
+	}
+	return 1000000;
+}
+
+/**
+ * Run a benchmark for hierarchies of 100 lots up to max_lots(), growing tenfold each time. Each size is
+ * combined with every value of extra, when given, as the benchmark's second argument.
+ */
+inline void lot_counts(benchmark::internal::Benchmark *b, std::initializer_list<int64_t> extra = {}) {
+	for (int64_t num_lots = 100; num_lots <= max_lots(); num_lots *= 10) {
+		if (extra.size() == 0) {
+			b->Arg(num_lots);
+		}
+		for (int64_t value : extra) {
+			b->Args({num_lots, value});
+		}
+	}
+}
+
+/**
+ * Stop the benchmark with LotMan's error message if a call failed.
+ * @return Whether the call succeeded
+ */
+inline bool check(benchmark::State &state, int rv, char *err_msg) {
+	UniqueCString err(err_msg);
+	if (rv != 0) {
+		state.SkipWithError(err ? err.get() : "LotMan call failed");
+		return false;
+	}
+	return true;
+}
+
+} // namespace lotman_bench
+
+#endif // LOTMAN_BENCH_UTILS_H
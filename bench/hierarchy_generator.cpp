@@ -0,0 +1,373 @@
+#include "hierarchy_generator.h"
+
+#include "../src/lotman.h"
+#include "../src/lotman_db.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sqlite3.h>
+#include <tuple>
+
+namespace lotman_bench {
+
+namespace {
+
+struct StmtDeleter {
+	void operator()(sqlite3_stmt *stmt) const {
+		sqlite3_finalize(stmt);
+	}
+};
+using UniqueStmt = std::unique_ptr<sqlite3_stmt, StmtDeleter>;
+
+struct Sqlite3Deleter {
+	void operator()(sqlite3 *db) const {
+		sqlite3_close(db);
+	}
+};
+using UniqueSqlite3 = std::unique_ptr<sqlite3, Sqlite3Deleter>;
+
+// A lot as it is written to the database
+struct GeneratedLot {
+	std::string name;
+	std::vector<size_t> parents; // Indices into the generated lots, empty for roots
+	std::vector<std::string> paths;
+	bool exclusion = false;
+	size_t level = 0;
+	bool over_quota = false;
+	bool expired = false;
+	bool deleted = false;
+};
+
+std::pair<bool, std::string> set_context(const std::string &key, const std::string &value) {
+	char *err_msg = nullptr;
+	if (lotman_set_context_str(key.c_str(), value.c_str(), &err_msg) != 0) {
+		std::string err = err_msg ? err_msg : "unknown error";
+		free(err_msg);
+		return std::make_pair(false, "Failed to set " + key + ": " + err);
+	}
+	return std::make_pair(true, "");
+}
+
+std::vector<GeneratedLot> lay_out(const HierarchySpec &spec) {
+	std::mt19937 rng(spec.seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+	// Enough roots that depth levels of fan_out-ary trees below them hold every lot
+	size_t per_tree = 0;
+	size_t level_width = 1;
+	for (size_t level = 0; level <= spec.depth; ++level) {
+		per_tree += level_width;
+		level_width *= std::max<size_t>(spec.fan_out, 1);
+	}
+	size_t num_roots = std::max<size_t>(1, (spec.num_lots + per_tree - 1) / per_tree);
+	num_roots = std::min(num_roots, spec.num_lots);
+
+	std::vector<GeneratedLot> lots(spec.num_lots);
+	// Index of the first lot of every level. Lots are laid out breadth-first, so each level is contiguous.
+	std::vector<size_t> level_starts;
+	for (size_t i = 0; i < spec.num_lots; ++i) {
+		auto &lot = lots[i];
+		lot.name = "lot" + std::to_string(i);
+		if (i < num_roots) {
+			lot.paths.push_back("/store" + std::to_string(i) + "/");
+		} else {
+			// The children of lot p are num_roots + p * fan_out onwards
+			size_t parent = (i - num_roots) / std::max<size_t>(spec.fan_out, 1);
+			lot.parents.push_back(parent);
+			lot.level = lots[parent].level + 1;
+			lot.paths.push_back(lots[parent].paths.front() + "l" + std::to_string(i) + "/");
+		}
+		if (lot.level == level_starts.size()) {
+			level_starts.push_back(i);
+		}
+
+		if (lot.level > 0 && unit(rng) < spec.multi_parent_ratio) {
+			size_t first = level_starts[lot.level - 1];
+			size_t count = level_starts[lot.level] - first;
+			size_t extra = first + std::uniform_int_distribution<size_t>(0, count - 1)(rng);
+			if (extra != lot.parents.front()) {
+				lot.parents.push_back(extra);
+			}
+		}
+
+		for (size_t j = 1; j < spec.paths_per_lot; ++j) {
+			lot.paths.push_back("/aux" + std::to_string(j) + "/" + lot.name + "/");
+		}
+		lot.exclusion = unit(rng) < spec.exclusion_ratio;
+		lot.over_quota = unit(rng) < spec.over_quota_ratio;
+		lot.expired = unit(rng) < spec.expired_ratio;
+		lot.deleted = lot.expired && unit(rng) < 0.5;
+	}
+	return lots;
+}
+
+} // namespace
+
+std::pair<bool, std::string> generate(const HierarchySpec &spec, const std::string &lot_home, Hierarchy &out) {
+	if (spec.num_lots == 0) {
+		return std::make_pair(false, "A hierarchy needs at least one lot");
+	}
+	auto rp = set_context("lot_home", lot_home);
+	if (!rp.first) {
+		return rp;
+	}
+	rp = set_context("caller", "owner1");
+	if (!rp.first) {
+		return rp;
+	}
+
+	auto lots = lay_out(spec);
+
+	// Let LotMan create the schema, then write the rows over a connection of our own
+	std::string db_path;
+	try {
+		lotman::db::StorageManager::get_storage();
+		auto rp_path = lotman::db::StorageManager::get_db_path();
+		if (!rp_path.first) {
+			return rp_path;
+		}
+		db_path = rp_path.second;
+	} catch (std::exception &exc) {
+		return std::make_pair(false, std::string("Failed to create the database: ") + exc.what());
+	}
+
+	sqlite3 *raw_db = nullptr;
+	int rc = sqlite3_open(db_path.c_str(), &raw_db);
+	UniqueSqlite3 db(raw_db);
+	if (rc != SQLITE_OK) {
+		return std::make_pair(false, "Failed to open " + db_path + ": " + sqlite3_errmsg(raw_db));
+	}
+
+	const char *statements[] = {
+		"INSERT INTO owners (lot_name, owner) VALUES (?1, 'owner1');",
+		"INSERT INTO parents (lot_name, parent) VALUES (?1, ?2);",
+		"INSERT INTO paths (lot_name, path, recursive, exclude) VALUES (?1, ?2, 1, ?3);",
+		"INSERT INTO management_policy_attributes (lot_name, dedicated_GB, opportunistic_GB, max_num_objects, "
+		"creation_time, expiration_time, deletion_time) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7);",
+		"INSERT INTO lot_usage (lot_name, self_GB, children_GB, self_objects, children_objects, "
+		"self_GB_being_written, children_GB_being_written, self_objects_being_written, "
+		"children_objects_being_written) VALUES (?1, ?2, 0, ?3, 0, 0, 0, 0, 0);",
+	};
+	std::vector<UniqueStmt> stmts;
+	for (const char *sql : statements) {
+		sqlite3_stmt *stmt = nullptr;
+		if (sqlite3_prepare_v2(db.get(), sql, -1, &stmt, nullptr) != SQLITE_OK) {
+			return std::make_pair(false, std::string("Failed to prepare insert: ") + sqlite3_errmsg(db.get()));
+		}
+		stmts.emplace_back(stmt);
+	}
+	auto &owner_stmt = stmts[0], &parent_stmt = stmts[1], &path_stmt = stmts[2], &policy_stmt = stmts[3],
+		 &usage_stmt = stmts[4];
+
+	auto step = [&](UniqueStmt &stmt) {
+		int step_rc = sqlite3_step(stmt.get());
+		sqlite3_reset(stmt.get());
+		sqlite3_clear_bindings(stmt.get());
+		return step_rc == SQLITE_DONE;
+	};
+	auto bind_text = [](UniqueStmt &stmt, int index, const std::string &value) {
+		sqlite3_bind_text(stmt.get(), index, value.c_str(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+	};
+
+	int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+					  std::chrono::system_clock::now().time_since_epoch())
+					  .count();
+	constexpr int64_t day_ms = 24LL * 60 * 60 * 1000;
+
+	auto insert_lot = [&](const std::string &name, const std::vector<std::string> &parents,
+						  const std::vector<std::string> &paths, bool exclusion, double dedicated_GB,
+						  int64_t max_objects, bool over_quota, bool expired, bool deleted) {
+		bind_text(owner_stmt, 1, name);
+		if (!step(owner_stmt)) {
+			return false;
+		}
+		for (const auto &parent : parents) {
+			bind_text(parent_stmt, 1, name);
+			bind_text(parent_stmt, 2, parent);
+			if (!step(parent_stmt)) {
+				return false;
+			}
+		}
+		std::vector<std::pair<std::string, int>> all_paths;
+		for (const auto &path : paths) {
+			all_paths.emplace_back(path, 0);
+		}
+		if (exclusion) {
+			all_paths.emplace_back(paths.front() + "excluded/", 1);
+		}
+		for (const auto &path : all_paths) {
+			bind_text(path_stmt, 1, name);
+			bind_text(path_stmt, 2, path.first);
+			sqlite3_bind_int(path_stmt.get(), 3, path.second);
+			if (!step(path_stmt)) {
+				return false;
+			}
+		}
+
+		bind_text(policy_stmt, 1, name);
+		sqlite3_bind_double(policy_stmt.get(), 2, dedicated_GB);
+		sqlite3_bind_double(policy_stmt.get(), 3, dedicated_GB / 2);
+		sqlite3_bind_int64(policy_stmt.get(), 4, max_objects);
+		sqlite3_bind_int64(policy_stmt.get(), 5, now - 30 * day_ms);
+		sqlite3_bind_int64(policy_stmt.get(), 6, expired ? now - day_ms : now + 30 * day_ms);
+		sqlite3_bind_int64(policy_stmt.get(), 7, deleted ? now - day_ms / 2 : now + 60 * day_ms);
+		if (!step(policy_stmt)) {
+			return false;
+		}
+
+		// Over-quota lots use twice their dedicated plus opportunistic storage, the rest a tenth of their dedicated
+		bind_text(usage_stmt, 1, name);
+		sqlite3_bind_double(usage_stmt.get(), 2, over_quota ? dedicated_GB * 3 : dedicated_GB / 10);
+		sqlite3_bind_int64(usage_stmt.get(), 3, over_quota ? max_objects * 2 : max_objects / 10);
+		return step(usage_stmt);
+	};
+
+	sqlite3_exec(db.get(), "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
+	bool ok = insert_lot("default", {"default"}, {"/default/"}, false, 1, 10, false, false, false);
+	for (size_t i = 0; ok && i < lots.size(); ++i) {
+		const auto &lot = lots[i];
+		std::vector<std::string> parents;
+		for (size_t parent : lot.parents) {
+			parents.push_back(lots[parent].name);
+		}
+		if (parents.empty()) {
+			parents.push_back(lot.name); // Roots are their own parent
+		}
+		// Quotas shrink by fan_out per level, so a lot's quota roughly covers its subtree
+		double dedicated_GB = 10 * std::pow(static_cast<double>(std::max<size_t>(spec.fan_out, 1)),
+											static_cast<double>(spec.depth - std::min(lot.level, spec.depth)));
+		int64_t max_objects = static_cast<int64_t>(dedicated_GB * 100);
+		ok = insert_lot(lot.name, parents, lot.paths, lot.exclusion, dedicated_GB, max_objects, lot.over_quota,
+						lot.expired, lot.deleted);
+	}
+	if (!ok) {
+		std::string err = sqlite3_errmsg(db.get());
+		sqlite3_exec(db.get(), "ROLLBACK;", nullptr, nullptr, nullptr);
+		return std::make_pair(false, "Failed to insert the generated lots: " + err);
+	}
+	if (sqlite3_exec(db.get(), "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+		return std::make_pair(false, std::string("Failed to commit the generated lots: ") + sqlite3_errmsg(db.get()));
+	}
+	stmts.clear();
+	db.reset();
+
+	try {
+		auto &storage = lotman::db::StorageManager::get_storage();
+		lotman::db::rebuild_lot_closure(storage);
+		lotman::db::recompute_children_usage(storage);
+	} catch (std::exception &exc) {
+		return std::make_pair(false, std::string("Failed to derive the hierarchy tables: ") + exc.what());
+	}
+
+	// Setting the lot home again drops every cache that was filled before the rows were written
+	rp = set_context("lot_home", lot_home);
+	if (!rp.first) {
+		return rp;
+	}
+
+	out.lot_home = lot_home;
+	out.db_path = db_path;
+	out.lots.clear();
+	out.leaves.clear();
+	out.dirs.clear();
+	std::vector<bool> has_children(lots.size(), false);
+	for (const auto &lot : lots) {
+		for (size_t parent : lot.parents) {
+			has_children[parent] = true;
+		}
+	}
+	for (size_t i = 0; i < lots.size(); ++i) {
+		out.lots.push_back(lots[i].name);
+		out.dirs.push_back(lots[i].paths.front());
+		if (!has_children[i]) {
+			out.leaves.push_back(lots[i].name);
+		}
+	}
+	return std::make_pair(true, "");
+}
+
+namespace {
+
+// Removes the generated lot homes when the process exits
+struct LotHomes {
+	std::map<std::tuple<size_t, size_t, size_t, double, size_t, double, double, double, uint32_t>, Hierarchy>
+		hierarchies;
+
+	~LotHomes() {
+		for (const auto &entry : hierarchies) {
+			std::error_code ec;
+			std::filesystem::remove_all(entry.second.lot_home, ec);
+		}
+	}
+};
+
+} // namespace
+
+const Hierarchy &cached_hierarchy(const HierarchySpec &spec) {
+	static LotHomes homes;
+	static const Hierarchy *current = nullptr;
+
+	auto key = std::make_tuple(spec.num_lots, spec.depth, spec.fan_out, spec.multi_parent_ratio, spec.paths_per_lot,
+							   spec.exclusion_ratio, spec.over_quota_ratio, spec.expired_ratio, spec.seed);
+	auto it = homes.hierarchies.find(key);
+	if (it != homes.hierarchies.end() && current == &it->second) {
+		return it->second;
+	}
+
+	if (it != homes.hierarchies.end()) {
+		auto rp = set_context("lot_home", it->second.lot_home);
+		if (!rp.first) {
+			std::cerr << rp.second << std::endl;
+			std::exit(1);
+		}
+	} else {
+		const char *tmp = std::getenv("TMPDIR");
+		std::string lot_home_template = std::string(tmp && *tmp ? tmp : "/tmp") + "/lotman_bench_XXXXXX";
+		std::vector<char> lot_home(lot_home_template.begin(), lot_home_template.end());
+		lot_home.push_back('\0');
+		if (mkdtemp(lot_home.data()) == nullptr) {
+			std::cerr << "Failed to create a temporary lot home: " << std::strerror(errno) << std::endl;
+			std::exit(1);
+		}
+
+		Hierarchy hierarchy;
+		auto rp = generate(spec, lot_home.data(), hierarchy);
+		if (!rp.first) {
+			std::filesystem::remove_all(lot_home.data());
+			std::cerr << "Failed to generate a hierarchy of " << spec.num_lots << " lots: " << rp.second << std::endl;
+			std::exit(1);
+		}
+		it = homes.hierarchies.emplace(key, std::move(hierarchy)).first;
+	}
+	current = &it->second;
+
+	// Changing the lot home empties LotMan's caches. Fill them again before anything is timed: the path trie
+	// loads on the first directory lookup, and the hierarchy graph on the second walk of the hierarchy.
+	const auto &leaf = current->leaves.front();
+	for (int i = 0; i < 2; ++i) {
+		char **output = nullptr;
+		char *err_msg = nullptr;
+		lotman_get_parent_names(leaf.c_str(), true, false, &output, &err_msg);
+		if (output) {
+			lotman_free_string_list(output);
+		}
+		free(err_msg);
+	}
+	char **output = nullptr;
+	char *err_msg = nullptr;
+	lotman_get_lots_from_dir(current->dirs.front().c_str(), false, &output, &err_msg);
+	if (output) {
+		lotman_free_string_list(output);
+	}
+	free(err_msg);
+	return *current;
+}
+
+} // namespace lotman_bench
@@ -0,0 +1,78 @@
+/**
+ * Synthetic lot hierarchies for the lotman-bench benchmarks
+ *
+ * Building a hierarchy of a million lots through lotman_add_lot would take far
+ * longer than the benchmarks that use it, so the generator writes the rows of
+ * every table directly, in one transaction, and then lets LotMan derive the
+ * lot_closure table and the children usage from them. The result is the same
+ * database LotMan would have built from the same lots.
+ */
+
+#ifndef LOTMAN_BENCH_HIERARCHY_GENERATOR_H
+#define LOTMAN_BENCH_HIERARCHY_GENERATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lotman_bench {
+
+/**
+ * The shape of a generated hierarchy. Lots are laid out as a forest of fan_out-ary trees that are depth
+ * levels deep below their roots, with as many roots as it takes to hold num_lots lots. Every lot is owned
+ * by "owner1", and the "default" lot is created alongside them.
+ */
+struct HierarchySpec {
+	size_t num_lots = 1000;
+	size_t depth = 4;
+	size_t fan_out = 8;
+
+	// Fraction of non-root lots that get a second parent from the level above their first
+	double multi_parent_ratio = 0.1;
+
+	// Recursive paths attributed to each lot. The first nests under the first path of the lot's first parent.
+	size_t paths_per_lot = 1;
+
+	// Fraction of lots that exclude a subdirectory of their first path
+	double exclusion_ratio = 0.05;
+
+	// Fraction of lots whose own usage exceeds their dedicated, opportunistic and object quotas
+	double over_quota_ratio = 0.1;
+
+	// Fraction of lots past their expiration time. Half of them are past their deletion time as well.
+	double expired_ratio = 0.1;
+
+	uint32_t seed = 42;
+};
+
+struct Hierarchy {
+	std::string lot_home;
+	std::string db_path;
+
+	// Every generated lot except "default", in breadth-first order, so roots come first
+	std::vector<std::string> lots;
+	std::vector<std::string> leaves;
+
+	// The first path of every lot, in the same order as lots
+	std::vector<std::string> dirs;
+};
+
+/**
+ * Generate a hierarchy in lot_home, which must not hold a LotMan database yet, and leave lot_home set as
+ * the current context's lot home with "owner1" as the caller.
+ * @return Pair of (success, error_message)
+ */
+std::pair<bool, std::string> generate(const HierarchySpec &spec, const std::string &lot_home, Hierarchy &out);
+
+/**
+ * The hierarchy of spec, generated in a temporary lot home the first time it is asked for and reused after
+ * that. Makes its lot home the current one, with LotMan's caches loaded. Exits the process if the hierarchy
+ * cannot be generated. The lot homes are removed when the process exits.
+ */
+const Hierarchy &cached_hierarchy(const HierarchySpec &spec);
+
+} // namespace lotman_bench
+
+#endif // LOTMAN_BENCH_HIERARCHY_GENERATOR_H
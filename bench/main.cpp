@@ -0,0 +1,195 @@
+/**
+ * Benchmarks of the LotMan C API against generated hierarchies of growing size
+ *
+ * Every benchmark takes the number of lots as its first argument. Hierarchies are
+ * generated once per size and shared by the benchmarks that use it, so the ones
+ * that write (adding lots, reporting usage) leave their changes behind for the
+ * benchmarks after them; none of them changes the shape of the hierarchy enough
+ * to matter.
+ */
+
+#include "bench_utils.h"
+#include "hierarchy_generator.h"
+
+#include <benchmark/benchmark.h>
+#include <random>
+#include <string>
+
+using namespace lotman_bench;
+
+namespace {
+
+HierarchySpec spec_for(const benchmark::State &state) {
+	HierarchySpec spec;
+	spec.num_lots = static_cast<size_t>(state.range(0));
+	return spec;
+}
+
+// Picks lots or directories at random, the same sequence on every run
+class Picker {
+  public:
+	explicit Picker(const std::vector<std::string> &items) : m_items(items), m_dist(0, items.size() - 1) {}
+
+	const std::string &next() {
+		return m_items[m_dist(m_rng)];
+	}
+
+  private:
+	const std::vector<std::string> &m_items;
+	std::mt19937 m_rng{1234};
+	std::uniform_int_distribution<size_t> m_dist;
+};
+
+} // namespace
+
+static void BM_AddLot(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	Picker parents(hierarchy.lots);
+
+	// Lot names must be unique across every run of the benchmark on the same hierarchy
+	static size_t next_lot = 0;
+	for (auto _ : state) {
+		std::string name = "bench_lot" + std::to_string(next_lot++);
+		std::string lot_JSON = R"({"lot_name": ")" + name + R"(", "owner": "owner1", "parents": [")" +
+							   parents.next() + R"("], "paths": [{"path": "/bench/)" + name +
+							   R"(", "recursive": true}], "management_policy_attrs": {"dedicated_GB": 1, )"
+							   R"("opportunistic_GB": 1, "max_num_objects": 10, "creation_time": 0, )"
+							   R"("expiration_time": 1, "deletion_time": 2}})";
+		char *err_msg = nullptr;
+		if (!check(state, lotman_add_lot(lot_JSON.c_str(), &err_msg), err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AddLot)->ArgName("lots")->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+static void BM_UpdateLotUsage(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	Picker leaves(hierarchy.leaves);
+	bool delta_mode = state.range(1);
+
+	for (auto _ : state) {
+		std::string update_JSON = R"({"lot_name": ")" + leaves.next() + R"(", "self_GB": 0.5, "self_objects": 2})";
+		char *err_msg = nullptr;
+		if (!check(state, lotman_update_lot_usage(update_JSON.c_str(), delta_mode, &err_msg), err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_UpdateLotUsage)
+	->ArgNames({"lots", "delta_mode"})
+	->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b, {0, 1}); });
+
+static void BM_UpdateLotUsageByDir(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	Picker dirs(hierarchy.dirs);
+
+	// A lot's directory holding one subdirectory that belongs to no lot of its own
+	for (auto _ : state) {
+		std::string update_JSON = R"([{"path": ")" + dirs.next() + R"(", "size_GB": 0.5, "num_obj": 2, )"
+								  R"("includes_subdirs": true, "subdirs": [{"path": "data", "size_GB": 0.25, )"
+								  R"("num_obj": 1, "includes_subdirs": false, "subdirs": []}]}])";
+		char *err_msg = nullptr;
+		if (!check(state, lotman_update_lot_usage_by_dir(update_JSON.c_str(), true, &err_msg), err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_UpdateLotUsageByDir)
+	->ArgName("lots")
+	->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+static void BM_GetLotsFromDir(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	Picker dirs(hierarchy.dirs);
+	bool recursive = state.range(1);
+
+	for (auto _ : state) {
+		std::string dir = dirs.next() + "some/file";
+		char **output = nullptr;
+		char *err_msg = nullptr;
+		int rv = lotman_get_lots_from_dir(dir.c_str(), recursive, &output, &err_msg);
+		UniqueStringList lots(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetLotsFromDir)
+	->ArgNames({"lots", "recursive"})
+	->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b, {0, 1}); });
+
+static void BM_GetLotAsJson(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	Picker lots(hierarchy.lots);
+	bool recursive = state.range(1);
+
+	for (auto _ : state) {
+		char *output = nullptr;
+		char *err_msg = nullptr;
+		int rv = lotman_get_lot_as_json(lots.next().c_str(), recursive, &output, &err_msg);
+		UniqueCString lot_JSON(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetLotAsJson)
+	->ArgNames({"lots", "recursive"})
+	->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b, {0, 1}); });
+
+/*
+The get_lots_past_* sweeps scan every lot, so each iteration is a full pass over the hierarchy. Their second
+argument sets every recursive flag of the call at once.
+*/
+
+template <int (*Sweep)(const bool, char ***, char **)> static void BM_TimeSweep(benchmark::State &state) {
+	cached_hierarchy(spec_for(state));
+	bool recursive = state.range(1);
+
+	for (auto _ : state) {
+		char **output = nullptr;
+		char *err_msg = nullptr;
+		int rv = Sweep(recursive, &output, &err_msg);
+		UniqueStringList lots(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+template <int (*Sweep)(const bool, const bool, char ***, char **)>
+static void BM_QuotaSweep(benchmark::State &state) {
+	cached_hierarchy(spec_for(state));
+	bool recursive = state.range(1);
+
+	for (auto _ : state) {
+		char **output = nullptr;
+		char *err_msg = nullptr;
+		int rv = Sweep(recursive, recursive, &output, &err_msg);
+		UniqueStringList lots(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+#define LOTMAN_SWEEP_BENCHMARK(bench, sweep)                                                                          \
+	BENCHMARK_TEMPLATE(bench, sweep)                                                                                   \
+		->ArgNames({"lots", "recursive"})                                                                              \
+		->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b, {0, 1}); })
+
+LOTMAN_SWEEP_BENCHMARK(BM_TimeSweep, lotman_get_lots_past_exp);
+LOTMAN_SWEEP_BENCHMARK(BM_TimeSweep, lotman_get_lots_past_del);
+LOTMAN_SWEEP_BENCHMARK(BM_QuotaSweep, lotman_get_lots_past_opp);
+LOTMAN_SWEEP_BENCHMARK(BM_QuotaSweep, lotman_get_lots_past_ded);
+LOTMAN_SWEEP_BENCHMARK(BM_QuotaSweep, lotman_get_lots_past_obj);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,443 @@
+/**
+ * Benchmarks that compare LotMan's lookup strategies with the ones they replaced
+ *
+ * Each pair runs the same lookup twice over the same generated hierarchy: once
+ * through the C API, and once straight from the database, the way LotMan used
+ * to answer it or still answers it while its caches are cold. The gap between
+ * the two is what the caches and the precomputed tables buy at each size.
+ */
+
+#include "../src/lotman_db.h"
+#include "bench_utils.h"
+#include "hierarchy_generator.h"
+
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <random>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+using namespace lotman_bench;
+
+namespace {
+
+HierarchySpec spec_for(const benchmark::State &state) {
+	HierarchySpec spec;
+	spec.num_lots = static_cast<size_t>(state.range(0));
+	return spec;
+}
+
+struct StmtDeleter {
+	void operator()(sqlite3_stmt *stmt) const {
+		sqlite3_finalize(stmt);
+	}
+};
+using UniqueStmt = std::unique_ptr<sqlite3_stmt, StmtDeleter>;
+
+struct Sqlite3Deleter {
+	void operator()(sqlite3 *db) const {
+		sqlite3_close(db);
+	}
+};
+using UniqueSqlite3 = std::unique_ptr<sqlite3, Sqlite3Deleter>;
+
+// A read-only connection of our own to a generated hierarchy's database
+UniqueSqlite3 open_db(benchmark::State &state, const Hierarchy &hierarchy) {
+	sqlite3 *db = nullptr;
+	if (sqlite3_open_v2(hierarchy.db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+		state.SkipWithError(("Failed to open " + hierarchy.db_path).c_str());
+		sqlite3_close(db);
+		return nullptr;
+	}
+	return UniqueSqlite3(db);
+}
+
+UniqueStmt prepare(benchmark::State &state, sqlite3 *db, const char *sql) {
+	sqlite3_stmt *stmt = nullptr;
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+		state.SkipWithError(sqlite3_errmsg(db));
+		return nullptr;
+	}
+	return UniqueStmt(stmt);
+}
+
+// One run of a catalogued walk (db::Query::WalkParents or WalkChildren): every ancestor or descendant of lot_name
+std::vector<std::string> run_walk(sqlite3_stmt *stmt, const std::string &lot_name) {
+	std::vector<std::string> names;
+	sqlite3_bind_text(stmt, 1, lot_name.c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int(stmt, 2, 0); // get_self
+	sqlite3_bind_int(stmt, 3, 1); // recursive
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		names.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+	}
+	sqlite3_reset(stmt);
+	return names;
+}
+
+// A deep hierarchy (binary trees, up to 20 levels) for wide == 0, a wide one (100-ary trees, 2 levels) otherwise
+HierarchySpec shape_spec_for(const benchmark::State &state) {
+	HierarchySpec spec = spec_for(state);
+	bool wide = state.range(1) != 0;
+	spec.depth = wide ? 2 : 20;
+	spec.fan_out = wide ? 100 : 2;
+	return spec;
+}
+
+} // namespace
+
+/*
+Lot lookup by directory. LotMan resolves directories with an in-memory trie of the paths table (PathCache);
+before that, every lookup matched the directory against every stored path with LIKE.
+*/
+
+static void BM_LotFromDirPathCache(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<size_t> pick(0, hierarchy.dirs.size() - 1);
+
+	for (auto _ : state) {
+		std::string dir = hierarchy.dirs[pick(rng)] + "some";
+		char **output = nullptr;
+		char *err_msg = nullptr;
+		int rv = lotman_get_lots_from_dir(dir.c_str(), false, &output, &err_msg);
+		UniqueStringList lots(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LotFromDirPathCache)->ArgName("lots")->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+static void BM_LotFromDirLikeQuery(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	auto db = open_db(state, hierarchy);
+	if (!db) {
+		return;
+	}
+	auto stmt = prepare(state, db.get(),
+						"SELECT lot_name FROM paths p WHERE (p.path = ?1 OR ?2 LIKE p.path || '%') "
+						"AND (p.recursive OR p.path = ?3) AND p.exclude = 0 AND NOT EXISTS ("
+						"SELECT 1 FROM paths e WHERE e.lot_name = p.lot_name AND e.exclude = 1 "
+						"AND (e.path = ?1 OR ?2 LIKE e.path || '%') AND (e.recursive OR e.path = ?3) "
+						"AND LENGTH(e.path) > LENGTH(p.path)) ORDER BY LENGTH(p.path) DESC LIMIT 1;");
+	if (!stmt) {
+		return;
+	}
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<size_t> pick(0, hierarchy.dirs.size() - 1);
+
+	for (auto _ : state) {
+		std::string dir = hierarchy.dirs[pick(rng)] + "some";
+		std::string dir_with_slash = dir + "/";
+		sqlite3_bind_text(stmt.get(), 1, dir_with_slash.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_text(stmt.get(), 2, dir.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_text(stmt.get(), 3, dir_with_slash.c_str(), -1, SQLITE_TRANSIENT);
+		std::string lot_name;
+		while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+			lot_name = reinterpret_cast<const char *>(sqlite3_column_text(stmt.get(), 0));
+		}
+		benchmark::DoNotOptimize(lot_name);
+		sqlite3_reset(stmt.get());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LotFromDirLikeQuery)->ArgName("lots")->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+/*
+Recursive ancestors. LotMan walks HierarchyCache, adjacency lists loaded from the parents table; the first lookup
+of a cold cache runs the catalogue's recursive WalkParents query instead. Before either, it issued one SELECT per
+level of parents.
+*/
+
+static void BM_AncestorsHierarchyCache(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<size_t> pick(0, hierarchy.leaves.size() - 1);
+
+	for (auto _ : state) {
+		char **output = nullptr;
+		char *err_msg = nullptr;
+		int rv = lotman_get_parent_names(hierarchy.leaves[pick(rng)].c_str(), true, false, &output, &err_msg);
+		UniqueStringList parents(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AncestorsHierarchyCache)
+	->ArgName("lots")
+	->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+static void BM_AncestorsPerLevelSelect(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	auto db = open_db(state, hierarchy);
+	if (!db) {
+		return;
+	}
+	auto stmt = prepare(state, db.get(), "SELECT parent FROM parents WHERE lot_name = ?1 AND parent != lot_name;");
+	if (!stmt) {
+		return;
+	}
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<size_t> pick(0, hierarchy.leaves.size() - 1);
+
+	for (auto _ : state) {
+		std::vector<std::string> ancestors;
+		std::vector<std::string> level{hierarchy.leaves[pick(rng)]};
+		while (!level.empty()) {
+			std::vector<std::string> next_level;
+			for (const auto &lot_name : level) {
+				sqlite3_bind_text(stmt.get(), 1, lot_name.c_str(), -1, SQLITE_TRANSIENT);
+				while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+					next_level.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt.get(), 0)));
+				}
+				sqlite3_reset(stmt.get());
+			}
+			ancestors.insert(ancestors.end(), next_level.begin(), next_level.end());
+			level = std::move(next_level);
+		}
+		benchmark::DoNotOptimize(ancestors);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AncestorsPerLevelSelect)
+	->ArgName("lots")
+	->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+static void BM_AncestorsRecursiveQuery(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	auto db = open_db(state, hierarchy);
+	if (!db) {
+		return;
+	}
+	auto stmt = prepare(state, db.get(), lotman::db::query_sql(lotman::db::Query::WalkParents));
+	if (!stmt) {
+		return;
+	}
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<size_t> pick(0, hierarchy.leaves.size() - 1);
+
+	for (auto _ : state) {
+		auto ancestors = run_walk(stmt.get(), hierarchy.leaves[pick(rng)]);
+		benchmark::DoNotOptimize(ancestors);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AncestorsRecursiveQuery)
+	->ArgName("lots")
+	->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+/*
+Hierarchy walks on deep and wide hierarchies, each run as one ancestor walk from a leaf and one descendant walk
+from any lot. A cold HierarchyCache answers a walk with the catalogue's recursive WalkParents/WalkChildren query;
+a warm one walks its in-memory graph.
+*/
+
+static void BM_WalkWarmHierarchyCache(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(shape_spec_for(state));
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<size_t> pick_leaf(0, hierarchy.leaves.size() - 1);
+	std::uniform_int_distribution<size_t> pick_lot(0, hierarchy.lots.size() - 1);
+
+	for (auto _ : state) {
+		char **output = nullptr;
+		char *err_msg = nullptr;
+		int rv = lotman_get_parent_names(hierarchy.leaves[pick_leaf(rng)].c_str(), true, false, &output, &err_msg);
+		UniqueStringList parents(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+		output = nullptr;
+		err_msg = nullptr;
+		rv = lotman_get_children_names(hierarchy.lots[pick_lot(rng)].c_str(), true, false, &output, &err_msg);
+		UniqueStringList children(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WalkWarmHierarchyCache)
+	->ArgNames({"lots", "wide"})
+	->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b, {0, 1}); });
+
+static void BM_WalkColdRecursiveQuery(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(shape_spec_for(state));
+	auto db = open_db(state, hierarchy);
+	if (!db) {
+		return;
+	}
+	auto parents_stmt = prepare(state, db.get(), lotman::db::query_sql(lotman::db::Query::WalkParents));
+	auto children_stmt = prepare(state, db.get(), lotman::db::query_sql(lotman::db::Query::WalkChildren));
+	if (!parents_stmt || !children_stmt) {
+		return;
+	}
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<size_t> pick_leaf(0, hierarchy.leaves.size() - 1);
+	std::uniform_int_distribution<size_t> pick_lot(0, hierarchy.lots.size() - 1);
+
+	for (auto _ : state) {
+		auto parents = run_walk(parents_stmt.get(), hierarchy.leaves[pick_leaf(rng)]);
+		benchmark::DoNotOptimize(parents);
+		auto children = run_walk(children_stmt.get(), hierarchy.lots[pick_lot(rng)]);
+		benchmark::DoNotOptimize(children);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WalkColdRecursiveQuery)
+	->ArgNames({"lots", "wide"})
+	->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b, {0, 1}); });
+
+/*
+Usage round trips through the JSON API and the binary struct API: a delta for a leaf, then the leaf's usage.
+*/
+
+static void BM_UsageRoundTripJson(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<size_t> pick(0, hierarchy.leaves.size() - 1);
+
+	for (auto _ : state) {
+		const auto &lot_name = hierarchy.leaves[pick(rng)];
+		std::string update_JSON = R"({"lot_name": ")" + lot_name + R"(", "self_GB": 0.5, "self_objects": 2})";
+		char *err_msg = nullptr;
+		if (!check(state, lotman_update_lot_usage(update_JSON.c_str(), true, &err_msg), err_msg)) {
+			break;
+		}
+		std::string usage_JSON = R"({"lot_name": ")" + lot_name + R"(", "total_GB": true, "num_objects": true})";
+		char *output = nullptr;
+		err_msg = nullptr;
+		int rv = lotman_get_lot_usage(usage_JSON.c_str(), &output, &err_msg);
+		UniqueCString usage(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_UsageRoundTripJson)->ArgName("lots")->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+static void BM_UsageRoundTripStruct(benchmark::State &state) {
+	const auto &hierarchy = cached_hierarchy(spec_for(state));
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<size_t> pick(0, hierarchy.leaves.size() - 1);
+
+	for (auto _ : state) {
+		const auto &lot_name = hierarchy.leaves[pick(rng)];
+		lotman_usage_delta_t update{lot_name.c_str(), LOTMAN_USAGE_SELF_GB | LOTMAN_USAGE_SELF_OBJECTS, 0.5, 2, 0, 0};
+		char *err_msg = nullptr;
+		if (!check(state, lotman_update_lot_usage_struct(&update, 1, true, nullptr, &err_msg), err_msg)) {
+			break;
+		}
+		lotman_usage_t usage;
+		err_msg = nullptr;
+		if (!check(state, lotman_get_lot_usage_struct(lot_name.c_str(), &usage, &err_msg), err_msg)) {
+			break;
+		}
+		benchmark::DoNotOptimize(usage);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_UsageRoundTripStruct)->ArgName("lots")->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+/*
+Eviction ranking, which combines each lot's own usage with the most restricting policy of its ancestors.
+*/
+
+static void BM_EvictionCandidates(benchmark::State &state) {
+	cached_hierarchy(spec_for(state));
+
+	for (auto _ : state) {
+		lotman_eviction_candidate_t *candidates = nullptr;
+		size_t num_candidates = 0;
+		char *err_msg = nullptr;
+		int rv = lotman_get_eviction_candidates(0, 100, &candidates, &num_candidates, &err_msg);
+		lotman_free_eviction_candidates(candidates, num_candidates);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EvictionCandidates)->ArgName("lots")->Apply([](benchmark::internal::Benchmark *b) { lot_counts(b); });
+
+/*
+Usage calls from many threads at once, with each thread using connections from the shared pool or keeping its own
+(db_thread_affinity). Runs on a hierarchy of 10000 lots, or max_lots() if that is smaller.
+
+Delta writes each take an IMMEDIATE transaction, which SQLite serializes, so BM_ConcurrentUsageWrites measures the
+database's write lock more than LotMan. BM_ConcurrentUsageReads runs lotman_get_lot_usage, whose queries go through
+SQL_get_matches and can run in parallel, so how it scales shows the contention on the connection pool and statement
+cache locks.
+*/
+
+namespace {
+
+const Hierarchy *concurrent_hierarchy = nullptr;
+
+// Set up the hierarchy and the affinity mode on thread 0. The other threads wait for thread 0 before their first
+// iteration, so concurrent_hierarchy is only read inside the benchmark loop.
+void concurrent_setup(benchmark::State &state) {
+	if (state.thread_index() == 0) {
+		HierarchySpec spec;
+		spec.num_lots = static_cast<size_t>(std::min<int64_t>(10000, max_lots()));
+		concurrent_hierarchy = &cached_hierarchy(spec);
+		char *err_msg = nullptr;
+		check(state, lotman_set_context_int("db_thread_affinity", static_cast<int>(state.range(0)), &err_msg),
+			  err_msg);
+	}
+}
+
+void concurrent_teardown(benchmark::State &state) {
+	if (state.thread_index() == 0) {
+		char *err_msg = nullptr;
+		lotman_set_context_int("db_thread_affinity", 0, &err_msg);
+		free(err_msg);
+	}
+}
+
+} // namespace
+
+static void BM_ConcurrentUsageWrites(benchmark::State &state) {
+	concurrent_setup(state);
+	std::mt19937 rng(1234 + state.thread_index());
+	std::uniform_int_distribution<size_t> pick;
+
+	for (auto _ : state) {
+		const auto &leaves = concurrent_hierarchy->leaves;
+		const auto &lot_name = leaves[pick(rng) % leaves.size()];
+		std::string update_JSON = R"({"lot_name": ")" + lot_name + R"(", "self_GB": 0.5, "self_objects": 2})";
+		char *err_msg = nullptr;
+		if (!check(state, lotman_update_lot_usage(update_JSON.c_str(), true, &err_msg), err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+	concurrent_teardown(state);
+}
+BENCHMARK(BM_ConcurrentUsageWrites)->ArgName("thread_affinity")->Arg(0)->Arg(1)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_ConcurrentUsageReads(benchmark::State &state) {
+	concurrent_setup(state);
+	std::mt19937 rng(1234 + state.thread_index());
+	std::uniform_int_distribution<size_t> pick;
+
+	for (auto _ : state) {
+		const auto &lots = concurrent_hierarchy->lots;
+		const auto &lot_name = lots[pick(rng) % lots.size()];
+		std::string usage_JSON = R"({"lot_name": ")" + lot_name + R"(", "total_GB": true, "num_objects": true})";
+		char *output = nullptr;
+		char *err_msg = nullptr;
+		int rv = lotman_get_lot_usage(usage_JSON.c_str(), &output, &err_msg);
+		UniqueCString usage(output);
+		if (!check(state, rv, err_msg)) {
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+	concurrent_teardown(state);
+}
+BENCHMARK(BM_ConcurrentUsageReads)->ArgName("thread_affinity")->Arg(0)->Arg(1)->ThreadRange(1, 64)->UseRealTime();
@@ -0,0 +1,110 @@
+/**
+ * Benchmarks for JSON schema validation at each C API entry point
+ *
+ * Every entry point that takes JSON validates it against its schema before
+ * doing anything else. Each entry point gets a pair of benchmarks over a small,
+ * valid document of the kind it is usually called with: one that builds a
+ * validator from the schema on every call, as the entry points used to, and
+ * one that validates against the shared lotman_schemas::validators(). The gap
+ * between the two is the per-call overhead the shared validators remove.
+ */
+
+#include "../src/schemas.h"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct EntryPoint {
+	const char *api;
+	const json &schema;
+	const json_validator lotman_schemas::compiled_validators::*validator;
+	const char *document;
+};
+
+using lotman_schemas::compiled_validators;
+
+const std::vector<EntryPoint> &entry_points() {
+	static const std::vector<EntryPoint> instance{
+		{"lotman_add_lot", lotman_schemas::new_lot_schema, &compiled_validators::new_lot,
+		 R"({"lot_name": "lot2", "owner": "owner1", "parents": ["lot1"],
+			 "paths": [{"path": "/foo/bar", "recursive": true}],
+			 "management_policy_attrs": {"dedicated_GB": 5, "opportunistic_GB": 2.5, "max_num_objects": 20,
+										 "creation_time": 123, "expiration_time": 234, "deletion_time": 345}})"},
+		{"lotman_update_lot", lotman_schemas::lot_update_schema, &compiled_validators::lot_update,
+		 R"({"lot_name": "lot2", "owner": "owner2",
+			 "paths": [{"current": "/foo/bar", "new": "/foo/baz", "recursive": false}]})"},
+		{"lotman_rm_parents_from_lot", lotman_schemas::lot_rm_parents_schema, &compiled_validators::lot_rm_parents,
+		 R"({"lot_name": "lot2", "parents": ["lot1"]})"},
+		{"lotman_rm_paths_from_lots", lotman_schemas::lot_rm_paths_schema, &compiled_validators::lot_rm_paths,
+		 R"({"paths": ["/foo/bar"]})"},
+		{"lotman_add_to_lot", lotman_schemas::lot_additions_schema, &compiled_validators::lot_additions,
+		 R"({"lot_name": "lot2", "paths": [{"path": "/foo/qux", "recursive": false}]})"},
+		{"lotman_get_policy_attributes", lotman_schemas::get_policy_attrs_schema,
+		 &compiled_validators::get_policy_attrs, R"({"lot_name": "lot2", "dedicated_GB": true})"},
+		{"lotman_get_lot_usage", lotman_schemas::get_usage_schema, &compiled_validators::get_usage,
+		 R"({"lot_name": "lot2", "total_GB": true, "num_objects": true})"},
+		{"lotman_update_lot_usage", lotman_schemas::update_usage_schema, &compiled_validators::update_usage,
+		 R"({"lot_name": "lot2", "self_GB": 0.5, "self_objects": 2})"},
+		{"lotman_update_lot_usage/delta", lotman_schemas::update_usage_delta_schema,
+		 &compiled_validators::update_usage_delta, R"({"lot_name": "lot2", "self_GB": -0.5, "self_objects": -2})"},
+		{"lotman_update_lot_usage_batch", lotman_schemas::update_usage_batch_schema,
+		 &compiled_validators::update_usage_batch,
+		 R"([{"lot_name": "lot2", "self_GB": 0.5}, {"lot_name": "lot3", "self_objects": 2}])"},
+		{"lotman_update_lot_usage_batch/delta", lotman_schemas::update_usage_batch_delta_schema,
+		 &compiled_validators::update_usage_batch_delta,
+		 R"([{"lot_name": "lot2", "self_GB": -0.5}, {"lot_name": "lot3", "self_objects": 2}])"},
+		{"lotman_update_lot_usage_by_dir", lotman_schemas::update_usage_by_dir_schema,
+		 &compiled_validators::update_usage_by_dir,
+		 R"({"path": "/foo/bar", "size_GB": 1.5, "num_obj": 3, "includes_subdirs": true,
+			 "subdirs": [{"path": "baz", "size_GB": 0.5, "num_obj": 1, "includes_subdirs": false}]})"},
+		{"lotman_update_lot_usage_by_dir/delta", lotman_schemas::update_usage_by_dir_delta_schema,
+		 &compiled_validators::update_usage_by_dir_delta,
+		 R"({"path": "/foo/bar", "size_GB": -1.5, "num_obj": -3, "includes_subdirs": false})"},
+	};
+	return instance;
+}
+
+// What an entry point used to do on every call: build a validator, compiling its schema
+void BM_ValidateFresh(benchmark::State &state, const EntryPoint &entry) {
+	const json document = json::parse(entry.document);
+	for (auto _ : state) {
+		try {
+			json_validator validator(entry.schema);
+			validator.validate(document);
+		} catch (const std::exception &e) {
+			state.SkipWithError(e.what());
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// What an entry point does now: validate against the validator compiled once for the process
+void BM_ValidateShared(benchmark::State &state, const EntryPoint &entry) {
+	const json document = json::parse(entry.document);
+	const json_validator &validator = lotman_schemas::validators().*entry.validator;
+	for (auto _ : state) {
+		try {
+			validator.validate(document);
+		} catch (const std::exception &e) {
+			state.SkipWithError(e.what());
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+const bool registered = [] {
+	for (const auto &entry : entry_points()) {
+		benchmark::RegisterBenchmark((std::string("BM_ValidateFresh/") + entry.api).c_str(), BM_ValidateFresh,
+									 entry);
+		benchmark::RegisterBenchmark((std::string("BM_ValidateShared/") + entry.api).c_str(), BM_ValidateShared,
+									 entry);
+	}
+	return true;
+}();
+
+} // namespace
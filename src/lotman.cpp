@@ -1,9 +1,16 @@
 #include "lotman.h"
 
+#include "lotman_accumulator.h"
+#include "lotman_ctx.h"
+#include "lotman_db.h"
 #include "lotman_internal.h"
+#include "lotman_metrics.h"
+#include "lotman_trace.h"
 #include "lotman_version.h"
 #include "schemas.h"
 
+#include <array>
+#include <fstream>
 #include <nlohmann/json-schema.hpp>
 #include <nlohmann/json.hpp>
 #include <string.h>
@@ -12,16 +19,31 @@
 Initialize some context globals
 */
 
-// caller
-std::shared_ptr<std::string> lotman::Context::m_caller = std::make_shared<std::string>("");
+// Per-thread caller override
+thread_local std::string lotman::Context::t_caller;
 
-// Lot home
-std::shared_ptr<std::string> lotman::Context::m_home = std::make_shared<std::string>("");
-
-std::shared_ptr<int> lotman_db_timeout = std::make_shared<int>(5000); // in ms
+std::shared_ptr<std::atomic<int>> lotman_db_timeout = std::make_shared<std::atomic<int>>(5000); // in ms
 
 using json = nlohmann::json;
 
+namespace {
+
+// Write the pending usage deltas before an operation that reads or rewrites usage, so that it sees them
+bool flush_pending_usage(char **err_msg) {
+	auto rp = lotman::UsageAccumulator::flush();
+	if (!rp.first) {
+		if (err_msg) {
+			std::string int_err = rp.second;
+			std::string ext_err = "Failed to flush pending usage updates: ";
+			*err_msg = strdup((ext_err + int_err).c_str());
+		}
+		return false;
+	}
+	return true;
+}
+
+} // namespace
+
 const char *lotman_version() {
 	std::string major = std::to_string(Lotman_VERSION_MAJOR);
 	std::string minor = std::to_string(Lotman_VERSION_MINOR);
@@ -32,13 +54,12 @@ const char *lotman_version() {
 }
 
 int lotman_add_lot(const char *lotman_JSON_str, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::AddLot, err_msg);
 	try {
 		json lot_JSON_obj = json::parse(lotman_JSON_str);
 
 		// Validate the incoming JSON
-		json_validator validator;
-		validator.set_root_schema(lotman_schemas::new_lot_schema);
-		validator.validate(lot_JSON_obj);
+		lotman_schemas::validators().new_lot.validate(lot_JSON_obj);
 
 		// Data checks
 		auto rp = lotman::Lot::lot_exists("default");
@@ -114,7 +135,12 @@ int lotman_add_lot(const char *lotman_JSON_str, char **err_msg) {
 int lotman_remove_lot(const char *lot_name, const bool assign_LTBR_parent_as_parent_to_orphans,
 					  const bool assign_LTBR_parent_as_parent_to_non_orphans, const bool assign_policy_to_children,
 					  const bool override_policy, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::RemoveLot, err_msg);
 	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
 		auto rp = lotman::Lot::lot_exists(lot_name);
 		if (!rp.first) {
 			if (err_msg) {
@@ -209,7 +235,12 @@ int lotman_remove_lot(const char *lot_name, const bool assign_LTBR_parent_as_par
 }
 
 int lotman_remove_lots_recursive(const char *lot_name, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::RemoveLotsRecursive, err_msg);
 	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
 		auto rp = lotman::Lot::lot_exists(lot_name);
 		if (!rp.first) {
 			if (err_msg) {
@@ -258,13 +289,16 @@ int lotman_remove_lots_recursive(const char *lot_name, char **err_msg) {
 }
 
 int lotman_update_lot(const char *lotman_JSON_str, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::UpdateLot, err_msg);
 	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
 		json update_JSON_obj = json::parse(lotman_JSON_str);
 
 		// Validate the incoming JSON
-		json_validator validator;
-		validator.set_root_schema(lotman_schemas::lot_update_schema);
-		validator.validate(update_JSON_obj);
+		lotman_schemas::validators().lot_update.validate(update_JSON_obj);
 
 		// Check that lot exists
 		auto rp = lotman::Lot::lot_exists(update_JSON_obj["lot_name"]);
@@ -357,12 +391,15 @@ int lotman_update_lot(const char *lotman_JSON_str, char **err_msg) {
 }
 
 int lotman_rm_parents_from_lot(const char *lotman_JSON_str, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::RmParentsFromLot, err_msg);
 	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
 		json subtraction_JSON_obj = json::parse(lotman_JSON_str);
 		// Validate the incoming JSON
-		json_validator validator;
-		validator.set_root_schema(lotman_schemas::lot_rm_parents_schema);
-		validator.validate(subtraction_JSON_obj);
+		lotman_schemas::validators().lot_rm_parents.validate(subtraction_JSON_obj);
 
 		// Check that lot exists
 		auto rp = lotman::Lot::lot_exists(subtraction_JSON_obj["lot_name"]);
@@ -414,12 +451,11 @@ int lotman_rm_parents_from_lot(const char *lotman_JSON_str, char **err_msg) {
 }
 
 int lotman_rm_paths_from_lots(const char *lotman_JSON_str, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::RmPathsFromLots, err_msg);
 	try {
 		json subtraction_JSON_obj = json::parse(lotman_JSON_str);
 		// Validate the incoming JSON
-		json_validator validator;
-		validator.set_root_schema(lotman_schemas::lot_rm_paths_schema);
-		validator.validate(subtraction_JSON_obj);
+		lotman_schemas::validators().lot_rm_paths.validate(subtraction_JSON_obj);
 
 		// For each path, figure out which lot it belongs to
 		// Knowing the lot name is required for context checking
@@ -480,13 +516,16 @@ int lotman_rm_paths_from_lots(const char *lotman_JSON_str, char **err_msg) {
 }
 
 int lotman_add_to_lot(const char *lotman_JSON_str, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::AddToLot, err_msg);
 	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
 		json addition_obj = json::parse(lotman_JSON_str);
 
 		// Validate the incoming JSON
-		json_validator validator;
-		validator.set_root_schema(lotman_schemas::lot_additions_schema);
-		validator.validate(addition_obj);
+		lotman_schemas::validators().lot_additions.validate(addition_obj);
 
 		// Assert lot exists
 		auto rp = lotman::Lot::lot_exists(addition_obj["lot_name"]);
@@ -558,6 +597,7 @@ int lotman_add_to_lot(const char *lotman_JSON_str, char **err_msg) {
 }
 
 int lotman_is_root(const char *lot_name, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::IsRoot, err_msg);
 	if (!lot_name) {
 		if (err_msg) {
 			*err_msg = strdup("Name for the lot whose rootness is to be determined must not be nullpointer.");
@@ -601,6 +641,7 @@ int lotman_is_root(const char *lot_name, char **err_msg) {
 }
 
 int lotman_lot_exists(const char *lot_name, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::LotExists, err_msg);
 	if (!lot_name) {
 		if (err_msg) {
 			*err_msg = strdup("Name for the lot whose existence is to be determined must not be nullpointer.");
@@ -630,6 +671,7 @@ int lotman_lot_exists(const char *lot_name, char **err_msg) {
 }
 
 int lotman_get_owners(const char *lot_name, const bool recursive, char ***output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetOwners, err_msg);
 	if (!lot_name) {
 		if (err_msg) {
 			*err_msg = strdup("Name for the lot whose owners are to be obtained must not be nullpointer.");
@@ -689,15 +731,15 @@ int lotman_get_owners(const char *lot_name, const bool recursive, char ***output
 }
 
 void lotman_free_string_list(char **str_list) {
-	int idx = 0;
-	do {
-		free(str_list[idx++]);
-	} while (str_list[idx]);
+	for (int idx = 0; str_list[idx]; idx++) {
+		free(str_list[idx]);
+	}
 	free(str_list);
 }
 
 int lotman_get_parent_names(const char *lot_name, const bool recursive, const bool get_self, char ***output,
 							char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetParentNames, err_msg);
 	if (!lot_name) {
 		if (err_msg) {
 			*err_msg = strdup("Name for the lot whose parents are to be obtained must not be nullpointer.");
@@ -763,6 +805,7 @@ int lotman_get_parent_names(const char *lot_name, const bool recursive, const bo
 
 int lotman_get_children_names(const char *lot_name, const bool recursive, const bool get_self, char ***output,
 							  char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetChildrenNames, err_msg);
 	if (!lot_name) {
 		if (err_msg) {
 			*err_msg = strdup("Name for the lot whose children are to be obtained must not be nullpointer.");
@@ -827,13 +870,12 @@ int lotman_get_children_names(const char *lot_name, const bool recursive, const
 }
 
 int lotman_get_policy_attributes(const char *policy_attributes_JSON_str, char **output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetPolicyAttributes, err_msg);
 	try {
 		json get_attrs_obj = json::parse(policy_attributes_JSON_str);
 
 		// Validate the incoming JSON
-		json_validator validator;
-		validator.set_root_schema(lotman_schemas::get_policy_attrs_schema);
-		validator.validate(get_attrs_obj);
+		lotman_schemas::validators().get_policy_attrs.validate(get_attrs_obj);
 
 		// Assert lot exists
 		auto rp = lotman::Lot::lot_exists(get_attrs_obj["lot_name"]);
@@ -886,6 +928,7 @@ int lotman_get_policy_attributes(const char *policy_attributes_JSON_str, char **
 }
 
 int lotman_get_lot_dirs(const char *lot_name, const bool recursive, char **output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotDirs, err_msg);
 	if (!lot_name) {
 		if (err_msg) {
 			*err_msg = strdup("Name for the lot whose directories are to be obtained must not be nullpointer.");
@@ -936,13 +979,13 @@ int lotman_get_lot_dirs(const char *lot_name, const bool recursive, char **outpu
 }
 
 int lotman_update_lot_usage(const char *update_JSON_str, bool deltaMode, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::UpdateLotUsage, err_msg);
 	try {
 		json update_usage_JSON = json::parse(update_JSON_str);
 
 		// Validate the incoming JSON
-		json_validator validator;
-		validator.set_root_schema(deltaMode ? lotman_schemas::update_usage_delta_schema
-											: lotman_schemas::update_usage_schema);
+		const auto &validator = deltaMode ? lotman_schemas::validators().update_usage_delta
+										  : lotman_schemas::validators().update_usage;
 		validator.validate(update_usage_JSON);
 
 		// Assert lot exists
@@ -974,6 +1017,30 @@ int lotman_update_lot_usage(const char *update_JSON_str, bool deltaMode, char **
 			return -1;
 		}
 
+		if (deltaMode && lotman::UsageAccumulator::enabled()) {
+			std::map<std::string, double> deltas;
+			for (const auto &pair : update_usage_JSON.items()) {
+				if (pair.key() != "lot_name") {
+					deltas[pair.key()] = pair.value().get<double>();
+				}
+			}
+			rp = lotman::UsageAccumulator::add(lot.lot_name, deltas);
+			if (!rp.first) {
+				if (err_msg) {
+					std::string int_err = rp.second;
+					std::string ext_err = "Failure on call to UsageAccumulator::add: ";
+					*err_msg = strdup((ext_err + int_err).c_str());
+				}
+				return -1;
+			}
+			return 0;
+		}
+
+		// Absolute values must not be overtaken by deltas that are still pending
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
 		for (const auto &pair : update_usage_JSON.items()) {
 			if (pair.key() != "lot_name") {
 				rp = lot.update_self_usage(pair.key(), pair.value(), deltaMode);
@@ -997,14 +1064,178 @@ int lotman_update_lot_usage(const char *update_JSON_str, bool deltaMode, char **
 	}
 }
 
+int lotman_update_lot_usage_batch(const char *update_JSON_arr_str, bool deltaMode, char **output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::UpdateLotUsageBatch, err_msg);
+	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
+		json update_arr = json::parse(update_JSON_arr_str);
+
+		// Validate the whole batch up front
+		const auto &validator = deltaMode ? lotman_schemas::validators().update_usage_batch_delta
+										  : lotman_schemas::validators().update_usage_batch;
+		validator.validate(update_arr);
+
+		auto rp = lotman::Lot::update_usage_batch(update_arr, deltaMode);
+		if (!rp.second.empty()) {
+			if (err_msg) {
+				std::string int_err = rp.second;
+				std::string ext_err = "Failure on call to update_usage_batch: ";
+				*err_msg = strdup((ext_err + int_err).c_str());
+			}
+			return -1;
+		}
+
+		json status_arr = json::array();
+		for (size_t i = 0; i < update_arr.size(); ++i) {
+			json status = {{"lot_name", update_arr[i]["lot_name"]}, {"success", rp.first[i].empty()}};
+			if (!rp.first[i].empty()) {
+				status["error"] = rp.first[i];
+			}
+			status_arr.push_back(status);
+		}
+
+		std::string output_str = status_arr.dump();
+		*output = strdup(output_str.c_str());
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
+int lotman_update_lot_usage_struct(const lotman_usage_delta_t *updates, size_t num_updates, bool deltaMode,
+								   int *statuses, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::UpdateLotUsageStruct, err_msg);
+	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
+		if (num_updates > 0 && !updates) {
+			if (err_msg) {
+				*err_msg = strdup("No updates were provided.");
+			}
+			return -1;
+		}
+
+		// The checks the JSON schemas perform for lotman_update_lot_usage_batch
+		const std::array<std::pair<unsigned int, const char *>, 4> usage_fields = {
+			{{LOTMAN_USAGE_SELF_GB, "self_GB"},
+			 {LOTMAN_USAGE_SELF_OBJECTS, "self_objects"},
+			 {LOTMAN_USAGE_SELF_GB_BEING_WRITTEN, "self_GB_being_written"},
+			 {LOTMAN_USAGE_SELF_OBJECTS_BEING_WRITTEN, "self_objects_being_written"}}};
+		std::vector<lotman::UsageUpdate> items;
+		items.reserve(num_updates);
+		for (size_t i = 0; i < num_updates; ++i) {
+			const auto &update = updates[i];
+			if (!update.lot_name || !*update.lot_name) {
+				if (err_msg) {
+					*err_msg = strdup(("Update " + std::to_string(i) + " does not name a lot.").c_str());
+				}
+				return -1;
+			}
+
+			const std::array<double, 4> values = {update.self_GB, static_cast<double>(update.self_objects),
+												  update.self_GB_being_written,
+												  static_cast<double>(update.self_objects_being_written)};
+			lotman::UsageUpdate item{update.lot_name, {}, {}, ""};
+			for (size_t f = 0; f < usage_fields.size(); ++f) {
+				if (!(update.fields & usage_fields[f].first)) {
+					continue;
+				}
+				if (!deltaMode && values[f] < 0) {
+					if (err_msg) {
+						*err_msg = strdup(("Update " + std::to_string(i) + " has a negative value for " +
+										   usage_fields[f].second + ", which is only allowed in delta mode.")
+											  .c_str());
+					}
+					return -1;
+				}
+				item.values[usage_fields[f].second] = values[f];
+			}
+			items.push_back(std::move(item));
+		}
+
+		auto rp = lotman::Lot::update_usage_batch(items, deltaMode);
+		if (!rp.second.empty()) {
+			if (err_msg) {
+				std::string int_err = rp.second;
+				std::string ext_err = "Failure on call to update_usage_batch: ";
+				*err_msg = strdup((ext_err + int_err).c_str());
+			}
+			return -1;
+		}
+
+		// Rejected updates are reported through statuses only; the batch itself was processed
+		if (statuses) {
+			for (size_t i = 0; i < num_updates; ++i) {
+				statuses[i] = rp.first[i].empty() ? 0 : -1;
+			}
+		}
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
+int lotman_get_lot_usage_struct(const char *lot_name, lotman_usage_t *output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotUsageStruct, err_msg);
+	try {
+		if (!lot_name || !output) {
+			if (err_msg) {
+				*err_msg = strdup("A lot name and an output struct must be provided.");
+			}
+			return -1;
+		}
+
+		lotman::UsageRecord record;
+		auto rp = lotman::UsageAccumulator::get_usage_record(lot_name, record);
+		if (!rp.first) {
+			if (err_msg) {
+				std::string int_err = rp.second;
+				std::string ext_err = "Failure on call to get_usage_record: ";
+				*err_msg = strdup((ext_err + int_err).c_str());
+			}
+			return -1;
+		}
+
+		output->self_GB = record.self_GB;
+		output->children_GB = record.children_GB;
+		output->self_objects = record.self_objects;
+		output->children_objects = record.children_objects;
+		output->self_GB_being_written = record.self_GB_being_written;
+		output->children_GB_being_written = record.children_GB_being_written;
+		output->self_objects_being_written = record.self_objects_being_written;
+		output->children_objects_being_written = record.children_objects_being_written;
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
 int lotman_update_lot_usage_by_dir(const char *update_JSON_str, bool deltaMode, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::UpdateLotUsageByDir, err_msg);
 	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
 		json update_JSON = json::parse(update_JSON_str);
 
 		// Validate the incoming JSON
-		json_validator validator;
-		validator.set_root_schema(deltaMode ? lotman_schemas::update_usage_by_dir_delta_schema
-											: lotman_schemas::update_usage_by_dir_schema);
+		const auto &validator = deltaMode ? lotman_schemas::validators().update_usage_by_dir_delta
+										  : lotman_schemas::validators().update_usage_by_dir;
 
 		// Current schema only works to validate each update obj.
 		// Eventually, the schema should be updated to correctly work on the whole array
@@ -1032,14 +1263,82 @@ int lotman_update_lot_usage_by_dir(const char *update_JSON_str, bool deltaMode,
 	}
 }
 
+int lotman_update_lot_usage_by_dir_file(const char *update_JSON_path, bool deltaMode, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::UpdateLotUsageByDirFile, err_msg);
+	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
+		std::ifstream update_stream(update_JSON_path);
+		if (!update_stream.is_open()) {
+			if (err_msg) {
+				*err_msg = strdup(("Could not open update file " + std::string(update_JSON_path)).c_str());
+			}
+			return -1;
+		}
+
+		// Each directory object is validated on its own as it streams past
+		const auto &validator = deltaMode ? lotman_schemas::validators().update_usage_by_dir_delta
+										  : lotman_schemas::validators().update_usage_by_dir;
+		auto validate_dir = [&validator](const json &dir) { validator.validate(dir); };
+
+		auto rp = lotman::Lot::update_usage_by_dirs(update_stream, deltaMode, validate_dir);
+
+		if (!rp.first) {
+			if (err_msg) {
+				std::string int_err = rp.second;
+				std::string ext_err = "Failure on call to update_usage_by_dirs: ";
+				*err_msg = strdup((ext_err + int_err).c_str());
+			}
+			return -1;
+		}
+
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
+int lotman_repair_children_usage(char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::RepairChildrenUsage, err_msg);
+	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
+		auto rp = lotman::Lot::update_db_children_usage();
+		if (!rp.first) {
+			if (err_msg) {
+				std::string int_err = rp.second;
+				std::string ext_err = "Failure on call to update_db_children_usage: ";
+				*err_msg = strdup((ext_err + int_err).c_str());
+			}
+			return -1;
+		}
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
 int lotman_get_lot_usage(const char *usage_attributes_JSON_str, char **output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotUsage, err_msg);
 	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
 		json get_usage_obj = json::parse(usage_attributes_JSON_str);
 
 		// Validate the incoming JSON
-		json_validator validator;
-		validator.set_root_schema(lotman_schemas::get_usage_schema);
-		validator.validate(get_usage_obj);
+		lotman_schemas::validators().get_usage.validate(get_usage_obj);
 
 		// Assert lot exists
 		auto rp = lotman::Lot::lot_exists(get_usage_obj["lot_name"]);
@@ -1057,16 +1356,6 @@ int lotman_get_lot_usage(const char *usage_attributes_JSON_str, char **output, c
 			}
 		}
 
-		auto rp_bool_str = lotman::Lot::update_db_children_usage();
-		if (!rp_bool_str.first) {
-			if (err_msg) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to update_db_children_usage()";
-				*err_msg = strdup((ext_err + int_err).c_str());
-			}
-			return -1;
-		}
-
 		lotman::Lot lot(get_usage_obj["lot_name"].get<std::string>());
 
 		json output_obj;
@@ -1107,17 +1396,8 @@ int lotman_check_db_health(char **err_msg) {
 }
 
 int lotman_get_lots_past_exp(const bool recursive, char ***output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotsPastExp, err_msg);
 	try {
-		auto rp_bool_str = lotman::Lot::update_db_children_usage();
-		if (!rp_bool_str.first) {
-			if (err_msg) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to update_db_children_usage()";
-				*err_msg = strdup((ext_err + int_err).c_str());
-			}
-			return -1;
-		}
-
 		auto rp = lotman::Lot::get_lots_past_exp(recursive);
 		if (!rp.second.empty()) {
 			if (err_msg) {
@@ -1154,17 +1434,8 @@ int lotman_get_lots_past_exp(const bool recursive, char ***output, char **err_ms
 }
 
 int lotman_get_lots_past_del(const bool recursive, char ***output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotsPastDel, err_msg);
 	try {
-		auto rp_bool_str = lotman::Lot::update_db_children_usage();
-		if (!rp_bool_str.first) {
-			if (err_msg) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to update_db_children_usage()";
-				*err_msg = strdup((ext_err + int_err).c_str());
-			}
-			return -1;
-		}
-
 		auto rp = lotman::Lot::get_lots_past_del(recursive);
 		if (!rp.second.empty()) {
 			if (err_msg) {
@@ -1203,14 +1474,9 @@ int lotman_get_lots_past_del(const bool recursive, char ***output, char **err_ms
 
 int lotman_get_lots_past_opp(const bool recursive_quota, const bool recursive_children, char ***output,
 							 char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotsPastOpp, err_msg);
 	try {
-		auto rp_bool_str = lotman::Lot::update_db_children_usage();
-		if (!rp_bool_str.first) {
-			if (err_msg) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to update_db_children_usage()";
-				*err_msg = strdup((ext_err + int_err).c_str());
-			}
+		if (!flush_pending_usage(err_msg)) {
 			return -1;
 		}
 
@@ -1252,14 +1518,9 @@ int lotman_get_lots_past_opp(const bool recursive_quota, const bool recursive_ch
 
 int lotman_get_lots_past_ded(const bool recursive_quota, const bool recursive_children, char ***output,
 							 char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotsPastDed, err_msg);
 	try {
-		auto rp_bool_str = lotman::Lot::update_db_children_usage();
-		if (!rp_bool_str.first) {
-			if (err_msg) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to update_db_children_usage()";
-				*err_msg = strdup((ext_err + int_err).c_str());
-			}
+		if (!flush_pending_usage(err_msg)) {
 			return -1;
 		}
 
@@ -1301,14 +1562,9 @@ int lotman_get_lots_past_ded(const bool recursive_quota, const bool recursive_ch
 
 int lotman_get_lots_past_obj(const bool recursive_quota, const bool recursive_children, char ***output,
 							 char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotsPastObj, err_msg);
 	try {
-		auto rp_bool_str = lotman::Lot::update_db_children_usage();
-		if (!rp_bool_str.first) {
-			if (err_msg) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to update_db_children_usage()";
-				*err_msg = strdup((ext_err + int_err).c_str());
-			}
+		if (!flush_pending_usage(err_msg)) {
 			return -1;
 		}
 
@@ -1348,7 +1604,136 @@ int lotman_get_lots_past_obj(const bool recursive_quota, const bool recursive_ch
 	}
 }
 
+int lotman_get_policy_violations(const bool recursive_quota, const bool recursive_children,
+								 lotman_policy_violation_t **output, size_t *num_violations, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetPolicyViolations, err_msg);
+	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
+		if (!output || !num_violations) {
+			if (err_msg) {
+				*err_msg = strdup("An output array and a count must be provided.");
+			}
+			return -1;
+		}
+
+		auto rp = lotman::Lot::get_policy_violations(recursive_quota, recursive_children);
+		if (!rp.second.empty()) {
+			if (err_msg) {
+				std::string int_err = rp.second;
+				std::string ext_err = "Failure on call to get_policy_violations: ";
+				*err_msg = strdup((ext_err + int_err).c_str());
+			}
+			return -1;
+		}
+
+		const auto &violations = rp.first;
+		// calloc so that a partially filled array can be freed if a copy fails
+		auto violations_c =
+			static_cast<lotman_policy_violation_t *>(calloc(violations.size() + 1, sizeof(lotman_policy_violation_t)));
+		for (size_t idx = 0; idx < violations.size(); idx++) {
+			violations_c[idx].lot_name = strdup(violations[idx].lot_name.c_str());
+			if (!violations_c[idx].lot_name) {
+				lotman_free_policy_violations(violations_c, idx);
+				if (err_msg) {
+					*err_msg = strdup("Failed to create a copy of string entry in list");
+				}
+				return -1;
+			}
+			violations_c[idx].flags = violations[idx].flags;
+			violations_c[idx].inherited_flags = violations[idx].inherited_flags;
+			violations_c[idx].opportunistic_overage_GB = violations[idx].opportunistic_overage_GB;
+			violations_c[idx].dedicated_overage_GB = violations[idx].dedicated_overage_GB;
+			violations_c[idx].objects_overage = violations[idx].objects_overage;
+		}
+		*output = violations_c;
+		*num_violations = violations.size();
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
+void lotman_free_policy_violations(lotman_policy_violation_t *violations, size_t num_violations) {
+	if (!violations) {
+		return;
+	}
+	for (size_t idx = 0; idx < num_violations; idx++) {
+		free(violations[idx].lot_name);
+	}
+	free(violations);
+}
+
+int lotman_get_eviction_candidates(const double target_GB, const size_t k, lotman_eviction_candidate_t **output,
+								   size_t *num_candidates, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetEvictionCandidates, err_msg);
+	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
+		if (!output || !num_candidates) {
+			if (err_msg) {
+				*err_msg = strdup("An output array and a count must be provided.");
+			}
+			return -1;
+		}
+
+		auto rp = lotman::Lot::get_eviction_candidates(target_GB, k);
+		if (!rp.second.empty()) {
+			if (err_msg) {
+				std::string int_err = rp.second;
+				std::string ext_err = "Failure on call to get_eviction_candidates: ";
+				*err_msg = strdup((ext_err + int_err).c_str());
+			}
+			return -1;
+		}
+
+		const auto &candidates = rp.first;
+		auto candidates_c = static_cast<lotman_eviction_candidate_t *>(
+			calloc(candidates.size() + 1, sizeof(lotman_eviction_candidate_t)));
+		for (size_t idx = 0; idx < candidates.size(); idx++) {
+			candidates_c[idx].lot_name = strdup(candidates[idx].lot_name.c_str());
+			if (!candidates_c[idx].lot_name) {
+				lotman_free_eviction_candidates(candidates_c, idx);
+				if (err_msg) {
+					*err_msg = strdup("Failed to create a copy of string entry in list");
+				}
+				return -1;
+			}
+			candidates_c[idx].reason = candidates[idx].reason;
+			candidates_c[idx].deadline = candidates[idx].deadline;
+			candidates_c[idx].reclaimable_GB = candidates[idx].reclaimable_GB;
+			candidates_c[idx].cumulative_GB = candidates[idx].cumulative_GB;
+		}
+		*output = candidates_c;
+		*num_candidates = candidates.size();
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
+void lotman_free_eviction_candidates(lotman_eviction_candidate_t *candidates, size_t num_candidates) {
+	if (!candidates) {
+		return;
+	}
+	for (size_t idx = 0; idx < num_candidates; idx++) {
+		free(candidates[idx].lot_name);
+	}
+	free(candidates);
+}
+
 int lotman_list_all_lots(char ***output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::ListAllLots, err_msg);
 	try {
 		auto rp = lotman::Lot::list_all_lots();
 		if (!rp.second.empty()) { // There was an error
@@ -1390,7 +1775,12 @@ int lotman_list_all_lots(char ***output, char **err_msg) {
 // indicates that we want to look up/down the tree of lots to determine the most restrictive values associated with
 // parents/children.
 int lotman_get_lot_as_json(const char *lot_name, const bool recursive, char **output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotAsJson, err_msg);
 	try {
+		if (!flush_pending_usage(err_msg)) {
+			return -1;
+		}
+
 		if (!lot_name) {
 			if (err_msg) {
 				*err_msg = strdup("Name for the lot to be returned as JSON must not be nullpointer.");
@@ -1413,16 +1803,6 @@ int lotman_get_lot_as_json(const char *lot_name, const bool recursive, char **ou
 			}
 		}
 
-		auto rp_bool_str = lotman::Lot::update_db_children_usage();
-		if (!rp_bool_str.first) {
-			if (err_msg) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to update_db_children_usage()";
-				*err_msg = strdup((ext_err + int_err).c_str());
-			}
-			return -1;
-		}
-
 		lotman::Lot lot(lot_name);
 
 		json output_obj;
@@ -1571,6 +1951,7 @@ int lotman_get_lot_as_json(const char *lot_name, const bool recursive, char **ou
 }
 
 int lotman_get_lots_from_dir(const char *dir, const bool recursive, char ***output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetLotsFromDir, err_msg);
 	try {
 
 		auto rp = lotman::Lot::get_lots_from_dir(dir, recursive);
@@ -1610,6 +1991,7 @@ int lotman_get_lots_from_dir(const char *dir, const bool recursive, char ***outp
 }
 
 int lotman_set_context_str(const char *key, const char *value, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::SetContextStr, err_msg);
 	try {
 		if (!key) {
 			if (err_msg) {
@@ -1620,6 +2002,8 @@ int lotman_set_context_str(const char *key, const char *value, char **err_msg) {
 
 		if (strcmp(key, "caller") == 0) {
 			lotman::Context::set_caller(value);
+		} else if (strcmp(key, "thread_caller") == 0) {
+			lotman::Context::set_thread_caller(value);
 		} else if (strcmp(key, "lot_home") == 0) {
 			lotman::Context::set_lot_home(value);
 		}
@@ -1641,6 +2025,7 @@ int lotman_set_context_str(const char *key, const char *value, char **err_msg) {
 }
 
 int lotman_get_context_str(const char *key, char **output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetContextStr, err_msg);
 	try {
 		if (!key) {
 			if (err_msg) {
@@ -1651,6 +2036,8 @@ int lotman_get_context_str(const char *key, char **output, char **err_msg) {
 
 		if (strcmp(key, "caller") == 0) {
 			*output = strdup(lotman::Context::get_caller().c_str());
+		} else if (strcmp(key, "thread_caller") == 0) {
+			*output = strdup(lotman::Context::get_thread_caller().c_str());
 		} else if (strcmp(key, "lot_home") == 0) {
 			*output = strdup(lotman::Context::get_lot_home().c_str());
 		} else {
@@ -1670,6 +2057,7 @@ int lotman_get_context_str(const char *key, char **output, char **err_msg) {
 }
 
 int lotman_set_context_int(const char *key, const int value, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::SetContextInt, err_msg);
 	try {
 		if (!key) {
 			if (err_msg) {
@@ -1679,7 +2067,35 @@ int lotman_set_context_int(const char *key, const int value, char **err_msg) {
 		}
 
 		if (strcmp(key, "db_timeout") == 0) {
-			*lotman_db_timeout = value;
+			lotman_db_timeout->store(value);
+		} else if (strcmp(key, "db_pool_min_connections") == 0) {
+			if (value < 0) {
+				if (err_msg) {
+					*err_msg = strdup("The minimum number of pooled connections must not be negative.");
+				}
+				return -1;
+			}
+			lotman::db::ConnectionPool::set_min_size(value);
+		} else if (strcmp(key, "db_thread_affinity") == 0) {
+			lotman::db::ConnectionPool::set_thread_affinity(value != 0);
+		} else if (strcmp(key, "usage_flush_interval_ms") == 0) {
+			auto rp = lotman::UsageAccumulator::set_interval(value);
+			if (!rp.first) {
+				if (err_msg) {
+					std::string int_err = rp.second;
+					std::string ext_err = "Failure on call to UsageAccumulator::set_interval: ";
+					*err_msg = strdup((ext_err + int_err).c_str());
+				}
+				return -1;
+			}
+		} else if (strcmp(key, "usage_flush_max_updates") == 0) {
+			if (value < 1) {
+				if (err_msg) {
+					*err_msg = strdup("The number of pending usage updates that triggers a flush must be positive.");
+				}
+				return -1;
+			}
+			lotman::UsageAccumulator::set_max_pending(value);
 		}
 
 		else {
@@ -1699,6 +2115,7 @@ int lotman_set_context_int(const char *key, const int value, char **err_msg) {
 }
 
 int lotman_get_context_int(const char *key, int *output, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::GetContextInt, err_msg);
 	try {
 		if (!key) {
 			if (err_msg) {
@@ -1708,7 +2125,15 @@ int lotman_get_context_int(const char *key, int *output, char **err_msg) {
 		}
 
 		if (strcmp(key, "db_timeout") == 0) {
-			*output = *lotman_db_timeout;
+			*output = lotman_db_timeout->load();
+		} else if (strcmp(key, "db_pool_min_connections") == 0) {
+			*output = static_cast<int>(lotman::db::ConnectionPool::get_min_size());
+		} else if (strcmp(key, "db_thread_affinity") == 0) {
+			*output = lotman::db::ConnectionPool::get_thread_affinity() ? 1 : 0;
+		} else if (strcmp(key, "usage_flush_interval_ms") == 0) {
+			*output = lotman::UsageAccumulator::get_interval();
+		} else if (strcmp(key, "usage_flush_max_updates") == 0) {
+			*output = static_cast<int>(lotman::UsageAccumulator::get_max_pending());
 		} else {
 			if (err_msg) {
 				std::string err = "Unrecognized key: " + static_cast<std::string>(key);
@@ -1724,3 +2149,252 @@ int lotman_get_context_int(const char *key, int *output, char **err_msg) {
 		return -1;
 	}
 }
+
+int lotman_flush(char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::Flush, err_msg);
+	try {
+		auto rp = lotman::UsageAccumulator::flush();
+		if (!rp.first) {
+			if (err_msg) {
+				std::string int_err = rp.second;
+				std::string ext_err = "Failure on call to UsageAccumulator::flush: ";
+				*err_msg = strdup((ext_err + int_err).c_str());
+			}
+			return -1;
+		}
+
+		auto rejected = lotman::UsageAccumulator::take_rejected();
+		if (!rejected.empty()) {
+			if (err_msg) {
+				std::string err = "Some pending usage updates were dropped: " + rejected[0];
+				if (rejected.size() > 1) {
+					err += " (and " + std::to_string(rejected.size() - 1) + " more)";
+				}
+				*err_msg = strdup(err.c_str());
+			}
+			return -1;
+		}
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
+int lotman_get_metrics(char **output, char **err_msg) {
+	try {
+		if (!output) {
+			if (err_msg) {
+				*err_msg = strdup("A place to store the metrics must be provided.");
+			}
+			return -1;
+		}
+		*output = strdup(lotman::Metrics::to_json().c_str());
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
+int lotman_get_metrics_prometheus(char **output, char **err_msg) {
+	try {
+		if (!output) {
+			if (err_msg) {
+				*err_msg = strdup("A place to store the metrics must be provided.");
+			}
+			return -1;
+		}
+		*output = strdup(lotman::Metrics::to_prometheus().c_str());
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
+int lotman_set_sql_trace_callback(lotman_sql_trace_callback_t callback, void *user_data, const int64_t threshold_us,
+								  char **err_msg) {
+	if (threshold_us < 0) {
+		if (err_msg) {
+			*err_msg = strdup("The slow statement threshold must not be negative.");
+		}
+		return -1;
+	}
+	lotman::SqlTrace::set_callback(callback, user_data, threshold_us);
+	return 0;
+}
+
+namespace {
+
+// Runs f, one of the lotman_* functions, with ctx bound to the calling thread
+template <typename F> int run_in_ctx(lotman_ctx_t *ctx, char **err_msg, F f) {
+	if (!ctx) {
+		if (err_msg) {
+			*err_msg = strdup("A LotMan context must be provided.");
+		}
+		return -1;
+	}
+	lotman::CtxScope scope(ctx);
+	return f();
+}
+
+} // namespace
+
+int lotman_ctx_create(const char *lot_home, lotman_ctx_t **ctx, char **err_msg) {
+	lotman::ApiCallTimer timer(lotman::ApiCall::CtxCreate, err_msg);
+	try {
+		if (!lot_home || strlen(lot_home) == 0) {
+			if (err_msg) {
+				*err_msg = strdup("A lot home must be provided for a new context.");
+			}
+			return -1;
+		}
+		if (!ctx) {
+			if (err_msg) {
+				*err_msg = strdup("A place to store the new context must be provided.");
+			}
+			return -1;
+		}
+
+		std::unique_ptr<lotman_ctx> new_ctx(new lotman_ctx());
+		{
+			lotman::CtxScope scope(new_ctx.get());
+			auto rp = lotman::Context::set_lot_home(lot_home);
+			if (!rp.first) {
+				if (err_msg) {
+					std::string int_err = rp.second;
+					std::string ext_err = "Failed to set the lot home of the new context: ";
+					*err_msg = strdup((ext_err + int_err).c_str());
+				}
+				lotman::db::StorageManager::reset();
+				return -1;
+			}
+		}
+
+		*ctx = new_ctx.release();
+		return 0;
+	} catch (std::exception &exc) {
+		if (err_msg) {
+			*err_msg = strdup(exc.what());
+		}
+		return -1;
+	}
+}
+
+void lotman_ctx_free(lotman_ctx_t *ctx) {
+	if (!ctx) {
+		return;
+	}
+	{
+		// Write what is pending and close the context's connections while its state is still there
+		lotman::CtxScope scope(ctx);
+		lotman::UsageAccumulator::stop();
+		lotman::UsageAccumulator::flush();
+		lotman::db::StorageManager::reset();
+	}
+	delete ctx;
+}
+
+int lotman_ctx_make_current(lotman_ctx_t *ctx, char **err_msg) {
+	// Null binds the default context again
+	if (ctx && !lotman::ctx_alive(ctx)) {
+		if (err_msg) {
+			*err_msg = strdup("The LotMan context is not a live context handle.");
+		}
+		return -1;
+	}
+	lotman::CtxScope::bind(ctx);
+	return 0;
+}
+
+int lotman_ctx_set_context_str(lotman_ctx_t *ctx, const char *key, const char *value, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_set_context_str(key, value, err_msg); });
+}
+
+int lotman_ctx_get_context_str(lotman_ctx_t *ctx, const char *key, char **output, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_get_context_str(key, output, err_msg); });
+}
+
+int lotman_ctx_set_context_int(lotman_ctx_t *ctx, const char *key, const int value, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_set_context_int(key, value, err_msg); });
+}
+
+int lotman_ctx_get_context_int(lotman_ctx_t *ctx, const char *key, int *output, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_get_context_int(key, output, err_msg); });
+}
+
+int lotman_ctx_add_lot(lotman_ctx_t *ctx, const char *lotman_JSON_str, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_add_lot(lotman_JSON_str, err_msg); });
+}
+
+int lotman_ctx_remove_lots_recursive(lotman_ctx_t *ctx, const char *lot_name, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_remove_lots_recursive(lot_name, err_msg); });
+}
+
+int lotman_ctx_lot_exists(lotman_ctx_t *ctx, const char *lot_name, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_lot_exists(lot_name, err_msg); });
+}
+
+int lotman_ctx_get_lot_usage(lotman_ctx_t *ctx, const char *usage_attributes_JSON_str, char **output,
+							 char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_get_lot_usage(usage_attributes_JSON_str, output, err_msg); });
+}
+
+int lotman_ctx_get_lot_usage_struct(lotman_ctx_t *ctx, const char *lot_name, lotman_usage_t *output,
+									char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_get_lot_usage_struct(lot_name, output, err_msg); });
+}
+
+int lotman_ctx_update_lot_usage(lotman_ctx_t *ctx, const char *update_JSON_str, bool delta_mode, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_update_lot_usage(update_JSON_str, delta_mode, err_msg); });
+}
+
+int lotman_ctx_update_lot_usage_batch(lotman_ctx_t *ctx, const char *update_JSON_arr_str, bool delta_mode,
+									  char **output, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] {
+		return lotman_update_lot_usage_batch(update_JSON_arr_str, delta_mode, output, err_msg);
+	});
+}
+
+int lotman_ctx_update_lot_usage_struct(lotman_ctx_t *ctx, const lotman_usage_delta_t *updates, size_t num_updates,
+									   bool delta_mode, int *statuses, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] {
+		return lotman_update_lot_usage_struct(updates, num_updates, delta_mode, statuses, err_msg);
+	});
+}
+
+int lotman_ctx_update_lot_usage_by_dir(lotman_ctx_t *ctx, const char *update_JSON_str, bool delta_mode,
+									   char **err_msg) {
+	return run_in_ctx(ctx, err_msg,
+					  [&] { return lotman_update_lot_usage_by_dir(update_JSON_str, delta_mode, err_msg); });
+}
+
+int lotman_ctx_get_lots_from_dir(lotman_ctx_t *ctx, const char *dir, const bool recursive, char ***output,
+								 char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_get_lots_from_dir(dir, recursive, output, err_msg); });
+}
+
+int lotman_ctx_get_policy_violations(lotman_ctx_t *ctx, const bool recursive_quota, const bool recursive_children,
+									 lotman_policy_violation_t **output, size_t *num_violations, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] {
+		return lotman_get_policy_violations(recursive_quota, recursive_children, output, num_violations, err_msg);
+	});
+}
+
+int lotman_ctx_get_eviction_candidates(lotman_ctx_t *ctx, const double target_GB, const size_t k,
+									   lotman_eviction_candidate_t **output, size_t *num_candidates, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] {
+		return lotman_get_eviction_candidates(target_GB, k, output, num_candidates, err_msg);
+	});
+}
+
+int lotman_ctx_flush(lotman_ctx_t *ctx, char **err_msg) {
+	return run_in_ctx(ctx, err_msg, [&] { return lotman_flush(err_msg); });
+}
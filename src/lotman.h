@@ -2,6 +2,12 @@
  * Public header for the LotMan C Library
  */
 
+#ifndef LOTMAN_H
+#define LOTMAN_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 
 #ifdef __cplusplus
@@ -9,7 +15,20 @@ extern "C" {
 #endif
 
 // DB timeout
-extern std::shared_ptr<int> lotman_db_timeout;
+extern std::shared_ptr<std::atomic<int>> lotman_db_timeout;
+
+/*
+THREAD SAFETY
+
+Every function below may be called from several threads at once. Each thread gets its own database
+connection, so read-only calls run in parallel; writes are serialized by SQLite (see "db_timeout").
+Context values are process-wide and may be read and changed at any time, with one exception:
+"lot_home" must not be changed while other threads are inside a LotMan call, because changing it
+closes the open database. The "thread_caller" context key gives each thread its own caller identity,
+which suits servers that handle requests for different callers on a pool of threads. All of this applies
+to each context handle (see CONTEXT HANDLES below) separately; changing "lot_home" on one handle never
+affects calls on another.
+*/
 
 /*
 APIs
@@ -540,6 +559,9 @@ int lotman_update_lot_usage(const char *update_JSON_str, bool delta_mode, char *
 /**
 	DESCRIPTION: A function for reporting lot usage metrics to LotMan. The function can either interpret
 		the input JSON as an absolute accounting of metrics, or as a delta (if deltaMode is set to true).
+		When "usage_flush_interval_ms" is set (see lotman_set_context_int), deltas are checked and queued
+		in memory, and written in the background; see lotman_flush. A delta that would make usage negative,
+		counting the deltas still queued for the lot, is rejected by the call itself.
 
 	RETURNS: Returns 0 on success. Any other values indicate an error.
 
@@ -580,13 +602,129 @@ int lotman_update_lot_usage(const char *update_JSON_str, bool delta_mode, char *
 }
 */
 
+int lotman_update_lot_usage_batch(const char *update_JSON_arr_str, bool delta_mode, char **output, char **err_msg);
+/**
+	DESCRIPTION: A function for reporting usage metrics for many lots at once. Each element of the input array
+		is an update object as accepted by lotman_update_lot_usage. Updates for the same lot are coalesced
+		(summed in delta mode, last value wins otherwise) and all lots, including the children usage of
+		their ancestors, are updated in a single database transaction.
+
+	RETURNS: Returns 0 if the batch was processed, in which case output holds the status of every update
+		object. Updates for a lot that could not be applied (e.g. the lot does not exist, the caller does
+		not own it, or a delta would make its usage negative) are rejected without affecting the other lots.
+		Any other values indicate an error that prevented the whole batch from being applied.
+
+	INPUTS:
+	update_JSON_arr_str:
+		A string indicating a JSON array of update objects (see lotman_update_lot_usage for their specification).
+
+	delta_mode:
+		A boolean indicating whether the update objects should be interpreted as an absolute accounting or as
+		deltas.
+
+	output:
+		A reference to a char array that stores the JSON array of per-update statuses, in input order:
+		[{"lot_name": <name>, "success": <bool>, "error": <string, only present when success is false>}, ...]
+		The caller is responsible for freeing it.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+/*
+Binary usage API
+
+The functions below mirror lotman_update_lot_usage_batch and lotman_get_lot_usage for high-frequency callers.
+They exchange plain structs instead of JSON strings, so no JSON is built, parsed or validated on either side,
+but they are backed by the same update and storage engine as their JSON counterparts.
+*/
+
+// Flags for lotman_usage_delta_t.fields, selecting which of the struct's values are applied
+#define LOTMAN_USAGE_SELF_GB 0x1
+#define LOTMAN_USAGE_SELF_OBJECTS 0x2
+#define LOTMAN_USAGE_SELF_GB_BEING_WRITTEN 0x4
+#define LOTMAN_USAGE_SELF_OBJECTS_BEING_WRITTEN 0x8
+
+typedef struct lotman_usage_delta {
+	const char *lot_name;
+	unsigned int fields; // Bitwise OR of the LOTMAN_USAGE_* flags for the values that should be applied
+	double self_GB;
+	int64_t self_objects;
+	double self_GB_being_written;
+	int64_t self_objects_being_written;
+} lotman_usage_delta_t;
+
+typedef struct lotman_usage {
+	double self_GB;
+	double children_GB;
+	int64_t self_objects;
+	int64_t children_objects;
+	double self_GB_being_written;
+	double children_GB_being_written;
+	int64_t self_objects_being_written;
+	int64_t children_objects_being_written;
+} lotman_usage_t;
+
+int lotman_update_lot_usage_struct(const lotman_usage_delta_t *updates, size_t num_updates, bool delta_mode,
+								   int *statuses, char **err_msg);
+/**
+	DESCRIPTION: The binary counterpart of lotman_update_lot_usage_batch. Each element of updates sets (or, in
+		delta mode, changes) the self usage of one lot. Updates for the same lot are coalesced, and all lots,
+		including the children usage of their ancestors, are updated in a single database transaction.
+
+	RETURNS: Returns 0 if the batch was processed, in which case statuses holds the outcome of every update.
+		Updates that could not be applied (e.g. the lot does not exist, the caller does not own it, or a delta
+		would make its usage negative) are rejected without affecting the other lots, and are only reported
+		through statuses. Any other values indicate an error that prevented the whole batch from being applied.
+		lotman_update_lot_usage_batch reports the reason each update was rejected.
+
+	INPUTS:
+	updates:
+		An array of num_updates usage updates. Only the values whose LOTMAN_USAGE_* flag is set in fields are
+		applied. Outside of delta mode, applied values must not be negative.
+
+	num_updates:
+		The number of elements in updates.
+
+	delta_mode:
+		A boolean indicating whether the values should be interpreted as an absolute accounting or as deltas.
+
+	statuses:
+		An array of num_updates ints that receives 0 for every applied update and -1 for every rejected one,
+		in input order. May be null if the caller does not need to know which updates were rejected.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+int lotman_get_lot_usage_struct(const char *lot_name, lotman_usage_t *output, char **err_msg);
+/**
+	DESCRIPTION: The binary counterpart of lotman_get_lot_usage. Reads a lot's raw usage counters: the usage
+		attributed to the lot itself and the usage of all of its descendants. Totals are the sum of the two.
+		Values that depend on the lot's management policy, such as dedicated or opportunistic GB, are only
+		available through lotman_get_lot_usage.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	lot_name:
+		The name of the lot whose usage is requested.
+
+	output:
+		A reference to a lotman_usage_t that receives the usage counters.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
 int lotman_update_lot_usage_by_dir(const char *update_JSON_str, bool delta_mode, char **err_msg);
 /**
 	DESCRIPTION: A function for reporting lot usage metrics to LotMan by directory tree. Unlike
 		lotman_update_lot_usage, this function only takes a JSON-encoded directory tree, with no
 		requirement that the user is aware of which directories belong to which lots. The function
 		can either interpret the input JSON as an absolute accounting of metrics, or as a delta
-		(if deltaMode is set to true).
+		(if deltaMode is set to true). The usage of every affected lot is stored in a single
+		transaction, so if any lot's update is rejected, no usage is stored at all.
 
 	RETURNS: Returns 0 on success. Any other values indicate an error.
 
@@ -631,6 +769,68 @@ int lotman_update_lot_usage_by_dir(const char *update_JSON_str, bool delta_mode,
 ]
 */
 
+int lotman_update_lot_usage_by_dir_file(const char *update_JSON_path, bool delta_mode, char **err_msg);
+/**
+	DESCRIPTION: A streaming variant of lotman_update_lot_usage_by_dir that reads the directory tree from a
+		file. The file is never loaded as a whole: each directory object is validated and attributed as soon
+		as it has been read, so memory use depends on the depth of the tree rather than its size. The per-lot
+		results are the same as lotman_update_lot_usage_by_dir's for the same tree, and as with that function,
+		nothing is stored if any part of the update fails.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	update_JSON_path:
+		The path to a file holding a Directory Update JSON array (see lotman_update_lot_usage_by_dir). Within
+		each directory object, "path" and "includes_subdirs" must appear before "subdirs". Writers that emit
+		object keys in alphabetical order, such as nlohmann::json's dump(), always satisfy this.
+
+	delta_mode:
+		A boolean indicating whether the update object should be interpreted as an absolute accounting or as a
+		delta.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+int lotman_repair_children_usage(char **err_msg);
+/**
+	DESCRIPTION: Recomputes every lot's children usage (the usage contributed by all of its descendants) from
+		the lots' self usage and the lot hierarchy. Usage updates keep these values current as they happen,
+		so this is only needed to repair a database whose children usage has drifted, e.g. after it was
+		modified outside of LotMan.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+int lotman_flush(char **err_msg);
+/**
+	DESCRIPTION: Writes the usage deltas that lotman_update_lot_usage queued while "usage_flush_interval_ms"
+		is set, in a single transaction, and returns once they are committed. Queued deltas are otherwise
+		written every "usage_flush_interval_ms" milliseconds, or as soon as "usage_flush_max_updates" of them
+		are pending. A caller that finds twice that many pending writes them itself.
+		Queued deltas are also appended to a journal file next to the database, and a process that dies
+		before writing them leaves the journal behind. The next process to open the database applies it,
+		so no delta is lost or applied twice. The journal is kept in the operating system's page cache,
+		which outlives the process but not a crash of the machine; call this to make deltas as durable as
+		the database itself. Only one process, and one context, can journal updates to a database at a time.
+		Usage reads and usage writes other than queued deltas flush first, or, in the case of
+		lotman_get_lot_usage_struct, add the queued deltas to what they read, so they always see them.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error. If the deltas cannot be written they
+		stay queued. Queued deltas that turned out to be invalid when they were written, because their lot
+		was removed or because usage set directly in the meantime left too little for them, are dropped,
+		and the next call reports them as an error.
+
+	INPUTS:
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
 void lotman_free_string_list(char **str_list);
 /**
 	DESCRIPTION: A function for freeing char ** arrays allocated internally by LotMan. Use on the output
@@ -776,6 +976,127 @@ int lotman_get_lots_past_obj(const bool recursive_quota, const bool recursive_ch
 		A reference to a char array that can store any error messages.
 */
 
+// Flags for lotman_policy_violation_t, one per policy a lot can violate
+#define LOTMAN_VIOLATION_EXPIRED 0x1	   // Past expiration, as in lotman_get_lots_past_exp
+#define LOTMAN_VIOLATION_DELETION 0x2	   // Past deletion, as in lotman_get_lots_past_del
+#define LOTMAN_VIOLATION_OPPORTUNISTIC 0x4 // Past opportunistic storage, as in lotman_get_lots_past_opp
+#define LOTMAN_VIOLATION_DEDICATED 0x8	   // Past dedicated storage, as in lotman_get_lots_past_ded
+#define LOTMAN_VIOLATION_OBJECTS 0x10	   // Past the object quota, as in lotman_get_lots_past_obj
+
+typedef struct lotman_policy_violation {
+	char *lot_name;
+	unsigned int flags;			  // Bitwise OR of the LOTMAN_VIOLATION_* flags for policies the lot itself violates
+	unsigned int inherited_flags; // Bitwise OR of the flags of the lot's offending ancestors
+	// Amounts by which usage exceeds each quota, or 0 if it does not
+	double opportunistic_overage_GB;
+	double dedicated_overage_GB;
+	int64_t objects_overage;
+} lotman_policy_violation_t;
+
+int lotman_get_policy_violations(const bool recursive_quota, const bool recursive_children,
+								 lotman_policy_violation_t **output, size_t *num_violations, char **err_msg);
+/**
+	DESCRIPTION: A function for determining, in a single pass over the database, every lot that violates any of
+		its management policies. It combines lotman_get_lots_past_exp, _del, _opp, _ded and _obj: a lot has a
+		flag set exactly when the corresponding function would return it, and for storage and object quotas the
+		amount by which its usage exceeds the quota is reported alongside.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	recursive_quota:
+		A boolean indicating whether quotas should be treated recursively, ie whether the usage of a lot's children
+		should be counted against its own usage (recursive_quota = true) or whether only a lot's personal usage
+		should be counted (recursive_quota = false). Overages are computed from the same usage.
+
+	recursive_children:
+		A boolean indicating whether all recursive children of an offending lot should also be returned. Such a
+		lot has the flags of its offending ancestors in inherited_flags, and may have no flags of its own. When
+		recursive_children is false, inherited_flags is always 0.
+
+	output:
+		A reference to a lotman_policy_violation_t * that receives an array of num_violations entries, sorted
+		by lot name. Each lot appears at most once.
+		NOTE: Requires the use of lotman_free_policy_violations to free the memory allocated for this array.
+
+	num_violations:
+		A reference to a size_t that receives the number of entries in output.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+void lotman_free_policy_violations(lotman_policy_violation_t *violations, size_t num_violations);
+/**
+	DESCRIPTION: A function for freeing arrays allocated by lotman_get_policy_violations.
+
+	RETURNS: Void
+
+	INPUTS:
+	violations:
+		The array to be freed.
+
+	num_violations:
+		The number of entries in the array.
+*/
+
+typedef struct lotman_eviction_candidate {
+	char *lot_name;
+	unsigned int reason;   // LOTMAN_VIOLATION_DELETION, LOTMAN_VIOLATION_EXPIRED or LOTMAN_VIOLATION_OPPORTUNISTIC
+	int64_t deadline;	   // The deletion or expiration time that passed, or 0 for opportunistic data
+	double reclaimable_GB; // GB freed by purging the lot's own data that the reason applies to
+	double cumulative_GB;  // GB freed by purging this and every higher ranked candidate
+} lotman_eviction_candidate_t;
+
+int lotman_get_eviction_candidates(const double target_GB, const size_t k, lotman_eviction_candidate_t **output,
+								   size_t *num_candidates, char **err_msg);
+/**
+	DESCRIPTION: A function for ranking the lots whose data should be purged first, and how much each would free.
+		Only a lot's own usage (self_GB) is considered, and each restricting attribute is the most restricting
+		value over the lot and all of its ancestors:
+		- Lots past their deletion time come first, with all of their data reclaimable, longest overdue first.
+		- Lots past their expiration time follow, with all of their data reclaimable, longest expired first.
+		- Any other lot storing more than its dedicated_GB follows, with the excess reclaimable, largest first.
+		Data within a lot's dedicated guarantee is never reported.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	target_GB:
+		The number of GB the caller needs to free. The list stops at the first candidate whose cumulative_GB
+		reaches it, or ends early if all candidates together free less. A value of 0 or less returns every
+		candidate, up to k.
+
+	k:
+		The maximum number of candidates to return, or 0 for no limit. Ranking across n lots costs
+		O(n log k).
+
+	output:
+		A reference to a lotman_eviction_candidate_t * that receives an array of num_candidates entries in
+		ranked order.
+		NOTE: Requires the use of lotman_free_eviction_candidates to free the memory allocated for this array.
+
+	num_candidates:
+		A reference to a size_t that receives the number of entries in output.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+void lotman_free_eviction_candidates(lotman_eviction_candidate_t *candidates, size_t num_candidates);
+/**
+	DESCRIPTION: A function for freeing arrays allocated by lotman_get_eviction_candidates.
+
+	RETURNS: Void
+
+	INPUTS:
+	candidates:
+		The array to be freed.
+
+	num_candidates:
+		The number of entries in the array.
+*/
+
 int lotman_list_all_lots(char ***output, char **err_msg);
 /**
 	DESCRIPTION: A function for listing all lots in the LotMan database.
@@ -879,6 +1200,8 @@ int lotman_set_context_str(const char *key, const char *value, char **err_msg);
 		(ie identity of who's calling a LotMan function, needed in some cases when determining whether a
 		particular call should be allowed) and "lot_home", which is used for setting the location of the
 		generated LotMan SQLite database.
+		"thread_caller" sets a caller for the calling thread only, which takes precedence over "caller" for
+		every call that thread makes. Set it to "" to fall back to "caller" again.
 
 	value:
 		The intended value to be assumed by whichever key is provided
@@ -898,7 +1221,9 @@ int lotman_get_context_str(const char *key, char **output, char **err_msg);
 		A string indicating which context key is being set. Currently, possible context keys are the "caller"
 		(ie identity of who's calling a LotMan function, needed in some cases when determining whether a
 		particular call should be allowed) and "lot_home", which is used for setting the location of the
-		generated LotMan SQLite database.
+		generated LotMan SQLite database. "caller" returns the caller the calling thread's functions run as,
+		which is its "thread_caller" if one is set. "thread_caller" returns only the calling thread's own
+		caller, or "" if it has none.
 
 	output:
 		A buffer for storing the output from the operation
@@ -915,7 +1240,22 @@ int lotman_set_context_int(const char *key, const int value, char **err_msg);
 
 	INPUTS:
 	key:
-		A string indicating which context key is being set.
+		A string indicating which context key is being set. Valid keys are:
+		"db_timeout": see lotman_get_context_int.
+		"db_pool_min_connections": the number of database connections LotMan opens ahead of use whenever the
+			database is (re)opened, so that the first requests do not pay for opening it. Defaults to 1 and
+			is capped at the size of the connection pool (5). Must not be negative.
+		"db_thread_affinity": when non-zero, each thread keeps a database connection and prepared statement
+			cache of its own, so that many threads calling LotMan concurrently do not contend on the shared
+			connection pool. Defaults to 0. Each thread's connection stays open until the thread exits, so
+			this suits a fixed set of long-lived worker threads.
+		"usage_flush_interval_ms": when positive, delta-mode lotman_update_lot_usage calls no longer write to
+			the database. Their deltas are summed per lot in memory and written by a background thread in a
+			single transaction every so many milliseconds (see lotman_flush). Defaults to 0, which writes
+			every update as it is made. Setting it back to 0 writes what is queued. Fails if the usage
+			journal is held by another process or context (see lotman_flush).
+		"usage_flush_max_updates": the number of queued updates that makes the background thread write them
+			before the interval is up. Defaults to 1000 and must be positive.
 
 	value:
 		The intended value to be assumed by whichever key is provided
@@ -935,7 +1275,8 @@ int lotman_get_context_int(const char *key, int *output, char **err_msg);
 		A string indicating which context key is being set. Currently valid is "db_timeout", a
 		max value in milliseconds that the database should wait when trying to establish a lock
 		on the database. Can be tuned in multiprocess environments to eliminate any potential
-		sqlite error no. 5 complaints (SQLITE_BUSY)
+		sqlite error no. 5 complaints (SQLITE_BUSY). "db_pool_min_connections", "db_thread_affinity",
+		"usage_flush_interval_ms" and "usage_flush_max_updates" are also valid, see lotman_set_context_int.
 
 	output:
 		A buffer for storing the output from the operation
@@ -944,6 +1285,253 @@ int lotman_get_context_int(const char *key, int *output, char **err_msg);
 		A reference to a char array that can store any error messages.
 */
 
+int lotman_get_metrics(char **output, char **err_msg);
+/**
+	DESCRIPTION: Reports what LotMan has done since the process started, across all contexts. Each thread
+		counts into memory of its own, and the counts are added up when this is called, so keeping them
+		costs the calls next to nothing.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	output:
+		Receives a JSON object, which the caller must free, with these keys:
+		"api": for each lotman_* function called at least once, named without its prefix, the number of
+			"calls", the number of "errors" (calls that set err_msg; calls made without err_msg are never
+			counted as errors), "total_seconds" and "max_seconds" spent in them, latency percentiles
+			"p50_seconds", "p90_seconds" and "p99_seconds", and a "histogram" of latencies: the count of
+			calls under each "le_seconds" bound that has any, bounds being a quarter of a power of two apart.
+			lotman_ctx_* functions count as the function they are named after.
+		"sql": the same for the SQL statements run by queries ("query"), by single updates ("update") and
+			by batched usage updates ("usage_batch", one transaction per batch).
+		"connection_pool": the connections handed out from the pool ("hits") and opened for a call
+			("misses").
+		"statement_cache": the SQL statements found already prepared ("hits") and prepared for a call
+			("misses").
+		"busy_retries": how many times a statement waited for another connection, or process, to release
+			the database. See "db_timeout" in lotman_set_context_int.
+		Example: {"api": {"lot_exists": {"calls": 2, "errors": 0, "total_seconds": 0.00004, ...}}, ...}
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+int lotman_get_metrics_prometheus(char **output, char **err_msg);
+/**
+	DESCRIPTION: Reports the metrics of lotman_get_metrics in the Prometheus text exposition format, for
+		serving from a /metrics endpoint. Call counts are lotman_api_calls_total and lotman_api_errors_total,
+		labelled by "call", with their latencies in the lotman_api_latency_seconds histogram; SQL statements
+		are lotman_sql_statements_total, lotman_sql_errors_total and lotman_sql_duration_seconds, labelled by
+		"kind". Histogram buckets are a power of two apart. Every call is reported, including those never
+		made.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	output:
+		Receives the metrics text, which the caller must free.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+typedef struct lotman_sql_trace {
+	const char *sql;		// Text of the statement as prepared, without its bound values
+	int num_params;			// Number of parameters the statement binds
+	int result_code;		// SQLite result code of its last step, SQLITE_DONE (101) if it completed
+	int64_t rows;			// Rows the statement returned
+	int64_t step_ns;		// Time spent stepping the statement, including busy_wait_ns
+	int64_t busy_wait_ns;	// Time spent waiting for other connections to release the database
+	int64_t fullscan_steps; // Steps taken in full table scans (SQLITE_STMTSTATUS_FULLSCAN_STEP)
+	int64_t sorts;			// Sorts performed (SQLITE_STMTSTATUS_SORT)
+	int64_t autoindexes;	// Rows inserted into automatic indexes (SQLITE_STMTSTATUS_AUTOINDEX)
+} lotman_sql_trace_t;
+
+typedef void (*lotman_sql_trace_callback_t)(const lotman_sql_trace_t *trace, void *user_data);
+
+int lotman_set_sql_trace_callback(lotman_sql_trace_callback_t callback, void *user_data, const int64_t threshold_us,
+								  char **err_msg);
+/**
+	DESCRIPTION: Registers a callback that receives every SQL statement LotMan runs that takes at least
+		threshold_us microseconds, across all contexts, for logging slow queries. Each statement is reported
+		once per execution, with SQLite's counters of full table scan steps, sorts and automatic indexes for
+		that execution, so queries that scan whole tables show up without rebuilding LotMan. Tracing is off
+		until a callback is registered, and costs nothing measurable while it is.
+
+		The callback runs on the thread that ran the statement, usually while LotMan holds a database
+		connection and possibly a transaction, so it must return quickly and must not call LotMan. The trace
+		and its sql string are only valid during the call.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	callback:
+		The function to call for each slow statement, replacing any callback registered before, or NULL to
+		turn tracing off.
+
+	user_data:
+		Passed to every call of callback as is.
+
+	threshold_us:
+		The minimum step_ns, in microseconds, of the statements that are reported. 0 reports every statement.
+		Must not be negative.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+/*
+CONTEXT HANDLES
+
+A context handle is a LotMan instance of its own: it has its own lot home (and so its own database), caller,
+connection pool and caches. Calls on different handles share no state, so several databases can be served from
+one process concurrently without changing "lot_home" back and forth. The functions above work on a default
+context, which is always there and is unaffected by any handle.
+
+The lotman_ctx_* functions below take a handle and otherwise behave exactly like the function they are named
+after. Any other function can be run against a handle by binding it to the calling thread with
+lotman_ctx_make_current. "db_timeout" and "thread_caller" are not part of a context and apply to every context.
+Handles that share one lot home do not see each other's changes through their caches, so give each its own.
+*/
+
+typedef struct lotman_ctx lotman_ctx_t;
+
+int lotman_ctx_create(const char *lot_home, lotman_ctx_t **ctx, char **err_msg);
+/**
+	DESCRIPTION: Creates a new context handle whose database lives in the given lot home. The context starts with
+		no caller and default pool settings, just like the default context.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	lot_home:
+		The directory that holds the context's LotMan database. It is created if it does not exist.
+
+	ctx:
+		A reference to a lotman_ctx_t * for storing the new handle.
+		NOTE: Requires the use of lotman_ctx_free to free the handle.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+void lotman_ctx_free(lotman_ctx_t *ctx);
+/**
+	DESCRIPTION: Writes the context's queued usage deltas, closes its database and frees the handle. No other
+		thread may be using the handle, or have it bound with lotman_ctx_make_current, when it is freed.
+		Passing NULL does nothing.
+*/
+
+int lotman_ctx_make_current(lotman_ctx_t *ctx, char **err_msg);
+/**
+	DESCRIPTION: Binds a context to the calling thread, so that every lotman_* function the thread calls from
+		then on works on that context instead of the default one. The lotman_ctx_* functions are not affected.
+		A handle that was already freed with lotman_ctx_free is rejected, and the thread's binding is left as it was.
+
+	RETURNS: Returns 0 on success. Any other values indicate an error.
+
+	INPUTS:
+	ctx:
+		The context to bind, or NULL to bind the default context again.
+
+	err_msg:
+		A reference to a char array that can store any error messages.
+*/
+
+int lotman_ctx_set_context_str(lotman_ctx_t *ctx, const char *key, const char *value, char **err_msg);
+/**
+	DESCRIPTION: lotman_set_context_str on the given context. Setting "lot_home" only reopens this context's
+		database.
+*/
+
+int lotman_ctx_get_context_str(lotman_ctx_t *ctx, const char *key, char **output, char **err_msg);
+/**
+	DESCRIPTION: lotman_get_context_str on the given context.
+*/
+
+int lotman_ctx_set_context_int(lotman_ctx_t *ctx, const char *key, const int value, char **err_msg);
+/**
+	DESCRIPTION: lotman_set_context_int on the given context. Setting "db_timeout" still applies to every context.
+*/
+
+int lotman_ctx_get_context_int(lotman_ctx_t *ctx, const char *key, int *output, char **err_msg);
+/**
+	DESCRIPTION: lotman_get_context_int on the given context.
+*/
+
+int lotman_ctx_add_lot(lotman_ctx_t *ctx, const char *lotman_JSON_str, char **err_msg);
+/**
+	DESCRIPTION: lotman_add_lot on the given context.
+*/
+
+int lotman_ctx_remove_lots_recursive(lotman_ctx_t *ctx, const char *lot_name, char **err_msg);
+/**
+	DESCRIPTION: lotman_remove_lots_recursive on the given context.
+*/
+
+int lotman_ctx_lot_exists(lotman_ctx_t *ctx, const char *lot_name, char **err_msg);
+/**
+	DESCRIPTION: lotman_lot_exists on the given context.
+*/
+
+int lotman_ctx_get_lot_usage(lotman_ctx_t *ctx, const char *usage_attributes_JSON_str, char **output,
+							 char **err_msg);
+/**
+	DESCRIPTION: lotman_get_lot_usage on the given context.
+*/
+
+int lotman_ctx_get_lot_usage_struct(lotman_ctx_t *ctx, const char *lot_name, lotman_usage_t *output,
+									char **err_msg);
+/**
+	DESCRIPTION: lotman_get_lot_usage_struct on the given context.
+*/
+
+int lotman_ctx_update_lot_usage(lotman_ctx_t *ctx, const char *update_JSON_str, bool delta_mode, char **err_msg);
+/**
+	DESCRIPTION: lotman_update_lot_usage on the given context.
+*/
+
+int lotman_ctx_update_lot_usage_batch(lotman_ctx_t *ctx, const char *update_JSON_arr_str, bool delta_mode,
+									  char **output, char **err_msg);
+/**
+	DESCRIPTION: lotman_update_lot_usage_batch on the given context.
+*/
+
+int lotman_ctx_update_lot_usage_struct(lotman_ctx_t *ctx, const lotman_usage_delta_t *updates, size_t num_updates,
+									   bool delta_mode, int *statuses, char **err_msg);
+/**
+	DESCRIPTION: lotman_update_lot_usage_struct on the given context.
+*/
+
+int lotman_ctx_update_lot_usage_by_dir(lotman_ctx_t *ctx, const char *update_JSON_str, bool delta_mode,
+									   char **err_msg);
+/**
+	DESCRIPTION: lotman_update_lot_usage_by_dir on the given context.
+*/
+
+int lotman_ctx_flush(lotman_ctx_t *ctx, char **err_msg);
+/**
+	DESCRIPTION: lotman_flush on the given context.
+*/
+
+int lotman_ctx_get_lots_from_dir(lotman_ctx_t *ctx, const char *dir, const bool recursive, char ***output,
+								 char **err_msg);
+/**
+	DESCRIPTION: lotman_get_lots_from_dir on the given context.
+*/
+
+int lotman_ctx_get_policy_violations(lotman_ctx_t *ctx, const bool recursive_quota, const bool recursive_children,
+									 lotman_policy_violation_t **output, size_t *num_violations, char **err_msg);
+/**
+	DESCRIPTION: lotman_get_policy_violations on the given context.
+*/
+
+int lotman_ctx_get_eviction_candidates(lotman_ctx_t *ctx, const double target_GB, const size_t k,
+									   lotman_eviction_candidate_t **output, size_t *num_candidates, char **err_msg);
+/**
+	DESCRIPTION: lotman_get_eviction_candidates on the given context.
+*/
+
 // int lotman_get_matching_lots(const char *criteria_JSON, char ***output, char **err_msg);
 // int lotman_check_db_health(char **err_msg); // Should eventually check that data structure conforms to expectations.
 // If there's a cycle or a non-self-parent root, something is wrong
@@ -951,3 +1539,5 @@ int lotman_get_context_int(const char *key, int *output, char **err_msg);
 #ifdef __cplusplus
 }
 #endif
+
+#endif // LOTMAN_H
@@ -0,0 +1,475 @@
+#include "lotman_accumulator.h"
+
+#include "lotman_cache.h"
+#include "lotman_ctx.h"
+#include "lotman_internal.h"
+#include "lotman_journal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace lotman {
+
+UsageAccumulator::State &UsageAccumulator::state() {
+	return current_ctx().accumulator;
+}
+
+namespace {
+
+const std::array<std::string, 4> usage_keys = {"self_GB", "self_objects", "self_GB_being_written",
+											   "self_objects_being_written"};
+
+std::array<std::atomic<double> *, 4> counters(UsageAccumulator::PendingUsage &pending) {
+	return {&pending.self_GB, &pending.self_objects, &pending.self_GB_being_written,
+			&pending.self_objects_being_written};
+}
+
+// std::atomic<double> has no fetch_add before C++20
+void atomic_add(std::atomic<double> &counter, double delta) {
+	double current = counter.load(std::memory_order_relaxed);
+	while (!counter.compare_exchange_weak(current, current + delta, std::memory_order_relaxed)) {
+	}
+}
+
+UsageAccumulator::Shard &shard_for(std::array<UsageAccumulator::Shard, UsageAccumulator::num_shards> &shards,
+								   const std::string &lot_name) {
+	return shards[std::hash<std::string>{}(lot_name) % shards.size()];
+}
+
+// Add deltas to a lot's pending counters. num_updates is how many updates the deltas stand for,
+// and is also added to pending_total while the lot's shard is locked, so that a flush never takes
+// more updates than the total counts.
+void apply(UsageAccumulator::PendingUsage &pending, const std::array<double, 4> &deltas, size_t num_updates,
+		   std::atomic<size_t> &pending_total) {
+	auto pending_counters = counters(pending);
+	for (size_t i = 0; i < deltas.size(); ++i) {
+		if (deltas[i] != 0) {
+			atomic_add(*pending_counters[i], deltas[i]);
+		}
+	}
+	pending.num_updates.fetch_add(num_updates);
+	pending_total.fetch_add(num_updates);
+}
+
+// A lot's pending counters, created if needed. The shard must be locked exclusively.
+UsageAccumulator::PendingUsage &pending_for(UsageAccumulator::Shard &shard, const std::string &lot_name) {
+	auto &pending = shard.lots[lot_name];
+	if (!pending) {
+		pending = std::make_unique<UsageAccumulator::PendingUsage>();
+	}
+	return *pending;
+}
+
+// Add deltas to a lot's pending counters, creating them if needed
+void accumulate(UsageAccumulator::Shard &shard, const std::string &lot_name, const std::array<double, 4> &deltas,
+				size_t num_updates, std::atomic<size_t> &pending_total) {
+	{
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		auto iter = shard.lots.find(lot_name);
+		if (iter != shard.lots.end()) {
+			apply(*iter->second, deltas, num_updates, pending_total);
+			return;
+		}
+	}
+
+	std::unique_lock<std::shared_mutex> lock(shard.mutex);
+	apply(pending_for(shard, lot_name), deltas, num_updates, pending_total);
+}
+
+// Check that a lot's stored usage, plus what is pending for it, plus deltas stays non-negative, the way
+// Lot::store_usage_batch checks it when the deltas are flushed. Integer keys are stored truncated.
+std::pair<bool, std::string> check_not_negative(const UsageRecord &record, UsageAccumulator::PendingUsage *pending,
+												 const std::array<double, 4> &deltas) {
+	const std::array<double, 4> stored = {record.self_GB, static_cast<double>(record.self_objects),
+										  record.self_GB_being_written,
+										  static_cast<double>(record.self_objects_being_written)};
+	const std::array<bool, 4> int_keys = {false, true, false, true};
+	std::array<double, 4> queued{};
+	if (pending) {
+		auto pending_counters = counters(*pending);
+		for (size_t i = 0; i < queued.size(); ++i) {
+			queued[i] = pending_counters[i]->load();
+		}
+	}
+
+	for (size_t i = 0; i < deltas.size(); ++i) {
+		if (deltas[i] >= 0) {
+			continue;
+		}
+		double change = queued[i] + deltas[i];
+		if (int_keys[i]) {
+			change = static_cast<double>(static_cast<int64_t>(change));
+		}
+		if (stored[i] + change < 0) {
+			return std::make_pair(false, "The attempted delta update would result in storing negative values for "
+										 "the key " +
+											 usage_keys[i] + ".");
+		}
+	}
+	return std::make_pair(true, "");
+}
+
+} // namespace
+
+bool UsageAccumulator::enabled() {
+	return state().m_interval_ms.load() > 0;
+}
+
+std::pair<bool, std::string> UsageAccumulator::set_interval(int interval_ms) {
+	if (interval_ms < 0) {
+		return std::make_pair(false, "The flush interval must not be negative.");
+	}
+
+	auto &s = state();
+	std::lock_guard<std::mutex> control_lock(s.m_control_mutex);
+	if (interval_ms == 0) {
+		s.m_interval_ms = 0;
+		stop_thread(s);
+
+		// Updates that were queued before they saw the interval change are flushed here. The journal
+		// can only go once nothing it holds is pending.
+		while (true) {
+			auto rp = flush();
+			if (!rp.first) {
+				return rp;
+			}
+			std::unique_lock<std::shared_mutex> flush_lock(s.m_flush_mutex);
+			std::unique_lock<std::shared_mutex> cut_lock(s.m_cut_mutex);
+			if (s.m_pending.load() == 0) {
+				UsageJournal::close();
+				return std::make_pair(true, "");
+			}
+		}
+	}
+
+	auto rp = UsageJournal::open();
+	if (!rp.first) {
+		return std::make_pair(false, "Failed to open the usage journal: " + rp.second);
+	}
+	s.m_interval_ms = interval_ms;
+
+	std::lock_guard<std::mutex> lock(s.m_thread_mutex);
+	if (s.m_thread.joinable()) {
+		// Let the thread pick up the new interval
+		s.m_wake = true;
+		s.m_thread_cv.notify_one();
+	} else {
+		s.m_thread = std::thread(run, &current_ctx());
+	}
+	return std::make_pair(true, "");
+}
+
+int UsageAccumulator::get_interval() {
+	return state().m_interval_ms.load();
+}
+
+void UsageAccumulator::set_max_pending(size_t max_pending) {
+	state().m_max_pending = max_pending;
+}
+
+size_t UsageAccumulator::get_max_pending() {
+	return state().m_max_pending.load();
+}
+
+std::pair<bool, std::string> UsageAccumulator::add(const std::string &lot_name,
+												   const std::map<std::string, double> &values) {
+	std::array<double, 4> deltas{};
+	for (const auto &[key, value] : values) {
+		auto key_iter = std::find(usage_keys.begin(), usage_keys.end(), key);
+		if (key_iter == usage_keys.end()) {
+			return std::make_pair(false, "The key " + key + " is not a valid usage key.");
+		}
+		deltas[key_iter - usage_keys.begin()] += value;
+	}
+
+	auto &s = state();
+	auto &shard = shard_for(s.m_shards, lot_name);
+	bool has_negative = std::any_of(deltas.begin(), deltas.end(), [](double delta) { return delta < 0; });
+	{
+		// A negative delta is checked against the stored usage plus what is pending, so no flush may commit
+		// pending deltas in between, and other negative deltas to the lot wait until this one is queued
+		std::shared_lock<std::shared_mutex> flush_lock(s.m_flush_mutex, std::defer_lock);
+		UsageRecord record;
+		if (has_negative) {
+			flush_lock.lock();
+			auto rp = Lot::get_usage_record(lot_name, record);
+			if (!rp.first) {
+				return std::make_pair(false, "Failed to read the lot's usage: " + rp.second);
+			}
+		}
+
+		std::shared_lock<std::shared_mutex> cut_lock(s.m_cut_mutex);
+		std::unique_lock<std::shared_mutex> check_lock(shard.mutex, std::defer_lock);
+		if (has_negative) {
+			check_lock.lock();
+			auto iter = shard.lots.find(lot_name);
+			auto rp = check_not_negative(record, iter != shard.lots.end() ? iter->second.get() : nullptr, deltas);
+			if (!rp.first) {
+				return rp;
+			}
+		}
+
+		if (s.m_interval_ms.load() > 0 && !UsageJournal::is_open()) {
+			// Closed when the context moved to another database
+			auto rp = UsageJournal::open();
+			if (!rp.first) {
+				return std::make_pair(false, "Failed to open the usage journal: " + rp.second);
+			}
+		}
+		if (UsageJournal::is_open()) {
+			auto rp = UsageJournal::append(lot_name, deltas);
+			if (!rp.first) {
+				return std::make_pair(false, "Failed to journal the update: " + rp.second);
+			}
+		}
+		if (has_negative) {
+			apply(pending_for(shard, lot_name), deltas, 1, s.m_pending);
+		} else {
+			accumulate(shard, lot_name, deltas, 1, s.m_pending);
+		}
+	}
+
+	size_t pending = s.m_pending.load();
+	size_t max_pending = s.m_max_pending.load();
+	if (pending >= 2 * max_pending || s.m_interval_ms.load() == 0) {
+		// The background thread is falling behind, or was stopped while this update was queued
+		return flush();
+	}
+	if (pending >= max_pending) {
+		std::lock_guard<std::mutex> lock(s.m_thread_mutex);
+		s.m_wake = true;
+		s.m_thread_cv.notify_one();
+	}
+	return std::make_pair(true, "");
+}
+
+std::pair<bool, std::string> UsageAccumulator::flush() {
+	auto &s = state();
+	if (s.m_pending.load() == 0) {
+		// Nothing to write, but a flush in progress must be committed before the caller reads usage
+		std::shared_lock<std::shared_mutex> lock(s.m_flush_mutex);
+		return std::make_pair(true, "");
+	}
+
+	std::unique_lock<std::shared_mutex> lock(s.m_flush_mutex);
+	return flush_locked(s);
+}
+
+std::pair<bool, std::string> UsageAccumulator::flush_locked(State &s) {
+	/*
+	Function flow for flush_locked:
+	* Take every shard's pending lots, leaving the shards empty for new updates, and cut the journal
+	* Drop the deltas of lots that no longer exist and look up the ancestors of the rest
+	* Apply everything and the journal checkpoint in a single transaction with Lot::store_usage_batch
+	* If the transaction fails, put the deltas back so the next flush retries them. Otherwise
+	  compact the applied records out of the journal.
+	*/
+	std::array<std::unordered_map<std::string, std::unique_ptr<PendingUsage>>, num_shards> taken_lots;
+	UsageJournal::Cut cut;
+	{
+		std::unique_lock<std::shared_mutex> cut_lock(s.m_cut_mutex);
+		for (size_t i = 0; i < num_shards; ++i) {
+			std::unique_lock<std::shared_mutex> lock(s.m_shards[i].mutex);
+			taken_lots[i].swap(s.m_shards[i].lots);
+		}
+		cut = UsageJournal::cut();
+	}
+
+	std::vector<UsageUpdate> updates;
+	std::vector<size_t> update_counts;
+	size_t taken = 0;
+	for (auto &lots : taken_lots) {
+		for (auto &[lot_name, pending] : lots) {
+			UsageUpdate update{lot_name, {}, {}, ""};
+			auto pending_counters = counters(*pending);
+			for (size_t i = 0; i < usage_keys.size(); ++i) {
+				double delta = pending_counters[i]->load();
+				if (delta != 0) {
+					update.values[usage_keys[i]] = delta;
+				}
+			}
+			size_t num_updates = pending->num_updates.load();
+			taken += num_updates;
+			updates.push_back(std::move(update));
+			update_counts.push_back(num_updates);
+		}
+	}
+	if (updates.empty()) {
+		return std::make_pair(true, "");
+	}
+
+	auto requeue = [&]() {
+		for (size_t u = 0; u < updates.size(); ++u) {
+			std::array<double, 4> deltas{};
+			for (size_t i = 0; i < usage_keys.size(); ++i) {
+				auto value_iter = updates[u].values.find(usage_keys[i]);
+				if (value_iter != updates[u].values.end()) {
+					deltas[i] = value_iter->second;
+				}
+			}
+			// The updates are still counted as pending, so only the lot's own count is restored
+			std::atomic<size_t> uncounted{0};
+			accumulate(shard_for(s.m_shards, updates[u].lot_name), updates[u].lot_name, deltas, update_counts[u],
+					   uncounted);
+		}
+	};
+
+	for (auto &update : updates) {
+		auto rp = Lot::lot_exists(update.lot_name);
+		if (!rp.first) {
+			if (!rp.second.empty()) {
+				requeue();
+				return std::make_pair(false, "Function call to lotman::Lot::lot_exists failed: " + rp.second);
+			}
+			update.error = "The lot " + update.lot_name + " was deleted before its usage was flushed.";
+			continue;
+		}
+
+		auto rp_vec_str = HierarchyCache::get_parents(update.lot_name, true, false);
+		if (!rp_vec_str.second.empty()) {
+			requeue();
+			return std::make_pair(false, "Failure on call to get_parents: " + rp_vec_str.second);
+		}
+		update.ancestors = rp_vec_str.first;
+	}
+
+	int64_t journal_seq = cut.generation ? static_cast<int64_t>(cut.last_seq) : -1;
+	auto rp = Lot::store_usage_batch(updates, true, false, journal_seq);
+	if (!rp.first) {
+		// The records stay in the journal, and the next cut takes them along
+		requeue();
+		return std::make_pair(false, "Failure on call to store_usage_batch: " + rp.second);
+	}
+	UsageJournal::compact(cut);
+	s.m_pending.fetch_sub(taken);
+
+	for (const auto &update : updates) {
+		if (!update.error.empty()) {
+			s.m_rejected.push_back(update.error);
+		}
+	}
+	return std::make_pair(true, "");
+}
+
+std::vector<std::string> UsageAccumulator::take_rejected() {
+	auto &s = state();
+	std::unique_lock<std::shared_mutex> lock(s.m_flush_mutex);
+	std::vector<std::string> rejected;
+	rejected.swap(s.m_rejected);
+	return rejected;
+}
+
+std::pair<bool, std::string> UsageAccumulator::get_usage_record(const std::string &lot_name, UsageRecord &record) {
+	auto &s = state();
+	std::shared_lock<std::shared_mutex> flush_lock(s.m_flush_mutex);
+
+	auto rp = Lot::get_usage_record(lot_name, record);
+	if (!rp.first || s.m_pending.load() == 0) {
+		return rp;
+	}
+
+	// Copy the pending deltas out first, so that no shard stays locked during the hierarchy lookups
+	std::vector<std::pair<std::string, std::array<double, 4>>> pending_deltas;
+	for (auto &shard : s.m_shards) {
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		for (auto &[pending_lot, pending] : shard.lots) {
+			std::array<double, 4> deltas;
+			auto pending_counters = counters(*pending);
+			for (size_t i = 0; i < deltas.size(); ++i) {
+				deltas[i] = pending_counters[i]->load();
+			}
+			pending_deltas.emplace_back(pending_lot, deltas);
+		}
+	}
+
+	for (const auto &[pending_lot, deltas] : pending_deltas) {
+		bool is_self = pending_lot == lot_name;
+		if (!is_self) {
+			// Ancestor lists are sorted
+			auto rp_vec_str = HierarchyCache::get_parents(pending_lot, true, false);
+			if (!rp_vec_str.second.empty()) {
+				return std::make_pair(false, "Failure on call to get_parents: " + rp_vec_str.second);
+			}
+			if (!std::binary_search(rp_vec_str.first.begin(), rp_vec_str.first.end(), lot_name)) {
+				continue;
+			}
+		}
+
+		// Integer columns are stored truncated, like Lot::store_usage_batch does
+		if (is_self) {
+			record.self_GB += deltas[0];
+			record.self_objects += static_cast<int64_t>(deltas[1]);
+			record.self_GB_being_written += deltas[2];
+			record.self_objects_being_written += static_cast<int64_t>(deltas[3]);
+		} else {
+			record.children_GB += deltas[0];
+			record.children_objects += static_cast<int64_t>(deltas[1]);
+			record.children_GB_being_written += deltas[2];
+			record.children_objects_being_written += static_cast<int64_t>(deltas[3]);
+		}
+	}
+	return std::make_pair(true, "");
+}
+
+void UsageAccumulator::stop() {
+	auto &s = state();
+	std::lock_guard<std::mutex> control_lock(s.m_control_mutex);
+	stop_thread(s);
+}
+
+void UsageAccumulator::detach() {
+	auto &s = state();
+	std::unique_lock<std::shared_mutex> flush_lock(s.m_flush_mutex);
+	std::unique_lock<std::shared_mutex> cut_lock(s.m_cut_mutex);
+	if (UsageJournal::is_open()) {
+		for (auto &shard : s.m_shards) {
+			std::unique_lock<std::shared_mutex> lock(shard.mutex);
+			shard.lots.clear();
+		}
+		s.m_pending = 0;
+	}
+	UsageJournal::close();
+}
+
+void UsageAccumulator::stop_thread(State &s) {
+	std::thread thread;
+	{
+		std::lock_guard<std::mutex> lock(s.m_thread_mutex);
+		if (!s.m_thread.joinable()) {
+			return;
+		}
+		s.m_stop = true;
+		s.m_thread_cv.notify_one();
+		thread = std::move(s.m_thread);
+	}
+	thread.join();
+
+	std::lock_guard<std::mutex> lock(s.m_thread_mutex);
+	s.m_stop = false;
+}
+
+void UsageAccumulator::run(lotman_ctx *ctx) {
+	CtxScope scope(ctx);
+	auto &s = state();
+
+	std::unique_lock<std::mutex> lock(s.m_thread_mutex);
+	while (true) {
+		auto interval = std::chrono::milliseconds(std::max(s.m_interval_ms.load(), 1));
+		s.m_thread_cv.wait_for(lock, interval, [&s] { return s.m_stop || s.m_wake; });
+		bool stopping = s.m_stop;
+		s.m_wake = false;
+
+		// A failed flush leaves the deltas pending, and the next one retries them
+		lock.unlock();
+		flush();
+		lock.lock();
+
+		if (stopping) {
+			break;
+		}
+	}
+}
+
+} // namespace lotman
@@ -0,0 +1,170 @@
+/**
+ * Write-behind accumulation of usage deltas
+ *
+ * When a flush interval is configured, delta-mode usage updates are not written
+ * to the database as they arrive. They are summed in memory per lot and written
+ * by a background thread in a single transaction, either once the interval has
+ * passed or once enough updates are pending, whichever comes first. Usage
+ * reads either merge the pending deltas or flush them first, so callers see
+ * the same totals they would without write-behind.
+ */
+
+#ifndef LOTMAN_ACCUMULATOR_H
+#define LOTMAN_ACCUMULATOR_H
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct lotman_ctx;
+
+namespace lotman {
+
+struct UsageRecord;
+
+/**
+ * Pending usage deltas of one context, and the thread that writes them.
+ *
+ * Pending deltas live in a fixed number of shards, picked by hashing the lot name. Each lot's
+ * deltas are atomic counters, so updates to a lot that already has pending deltas only take
+ * their shard's lock shared; the lock is taken exclusively to add a lot to the shard and by
+ * flushes, which take all of a shard's lots at once.
+ *
+ * Once max_pending updates are pending the background thread is woken to flush them, and a
+ * caller that finds twice as many pending flushes them itself. While write-behind is enabled,
+ * every queued update is also appended to the context's UsageJournal, so the pending deltas
+ * of a process that dies are applied when the database is next opened.
+ *
+ * Thread-safe.
+ */
+class UsageAccumulator {
+  public:
+	/**
+	 * Whether delta-mode usage updates are currently accumulated rather than written directly.
+	 */
+	static bool enabled();
+
+	/**
+	 * Set how often, in milliseconds, the background thread flushes pending deltas. A positive
+	 * interval opens the usage journal and starts the thread for the calling thread's context.
+	 * Zero flushes whatever is pending, stops the thread, closes the journal and goes back to
+	 * writing every update directly.
+	 * @return Pair of (success, error_message)
+	 */
+	static std::pair<bool, std::string> set_interval(int interval_ms);
+	static int get_interval();
+
+	/**
+	 * Set the number of pending updates at which the background thread flushes early.
+	 */
+	static void set_max_pending(size_t max_pending);
+	static size_t get_max_pending();
+
+	/**
+	 * Queue deltas for a lot. The caller has already checked that the lot exists and that it may
+	 * be updated. values maps self_* usage keys to deltas. A negative delta is rejected on the spot,
+	 * without queuing any of the update, if it would take the lot's stored usage plus what is pending
+	 * for it below zero.
+	 * @return Pair of (success, error_message). Fails if the update was rejected, if it could not be
+	 * journaled, or if a flush the caller had to run failed.
+	 */
+	static std::pair<bool, std::string> add(const std::string &lot_name, const std::map<std::string, double> &values);
+
+	/**
+	 * Write every pending delta in a single transaction, or wait for the flush already in progress.
+	 * If the transaction fails, the deltas stay pending. Deltas that cannot be applied, because
+	 * their lot was deleted in the meantime or because usage written directly since they were
+	 * queued leaves too little for them, are dropped and kept for take_rejected().
+	 * @return Pair of (success, error_message)
+	 */
+	static std::pair<bool, std::string> flush();
+
+	/**
+	 * Get and forget the reasons deltas were dropped by the flushes since the last call.
+	 */
+	static std::vector<std::string> take_rejected();
+
+	/**
+	 * Read a lot's usage record from the database and add the deltas still pending for the lot
+	 * and its descendants, as if they had been written.
+	 * @return Pair of (success, error_message)
+	 */
+	static std::pair<bool, std::string> get_usage_record(const std::string &lot_name, UsageRecord &record);
+
+	/**
+	 * Stop the background thread of the calling thread's context. The thread flushes what is
+	 * pending before it exits. Must be called before the context is destroyed.
+	 */
+	static void stop();
+
+	/**
+	 * Close the usage journal before the context lets go of its database. Journaled deltas that
+	 * are still pending are dropped from memory, as they are replayed from the journal the next
+	 * time the database is opened.
+	 */
+	static void detach();
+
+	// The pending deltas of one lot
+	struct PendingUsage {
+		std::atomic<double> self_GB{0};
+		std::atomic<double> self_objects{0};
+		std::atomic<double> self_GB_being_written{0};
+		std::atomic<double> self_objects_being_written{0};
+		std::atomic<size_t> num_updates{0};
+	};
+
+	struct Shard {
+		std::shared_mutex mutex;
+		std::unordered_map<std::string, std::unique_ptr<PendingUsage>> lots;
+	};
+
+	static constexpr size_t num_shards = 16;
+
+	// The accumulator of one context, held by its lotman_ctx (see lotman_ctx.h)
+	struct State {
+		std::array<Shard, num_shards> m_shards;
+		std::atomic<size_t> m_pending{0};
+		std::atomic<int> m_interval_ms{0};
+		std::atomic<size_t> m_max_pending{1000};
+
+		// Taken exclusively by a flush from taking the deltas until they are committed, and shared by
+		// readers that merge pending deltas, so that no reader sees a delta twice or not at all
+		std::shared_mutex m_flush_mutex;
+		// Reasons deltas were dropped, guarded by m_flush_mutex
+		std::vector<std::string> m_rejected;
+
+		// Shared by updates while they journal and queue their deltas, and taken exclusively by a flush
+		// while it takes the deltas and cuts the journal, so that both hold exactly the same updates
+		std::shared_mutex m_cut_mutex;
+
+		// Serializes starting and stopping the background thread
+		std::mutex m_control_mutex;
+
+		// The background thread and its wake-up signal
+		std::mutex m_thread_mutex;
+		std::condition_variable m_thread_cv;
+		std::thread m_thread;
+		bool m_stop = false;
+		bool m_wake = false;
+	};
+
+  private:
+	// The calling thread's current context's accumulator
+	static State &state();
+
+	static void run(lotman_ctx *ctx);
+	static void stop_thread(State &s);
+	static std::pair<bool, std::string> flush_locked(State &s);
+};
+
+} // namespace lotman
+
+#endif // LOTMAN_ACCUMULATOR_H
@@ -0,0 +1,907 @@
+#include "lotman_cache.h"
+
+#include "lotman_ctx.h"
+#include "lotman_db.h"
+#include "lotman_internal.h"
+
+#include <algorithm>
+#include <map>
+
+namespace lotman {
+
+HierarchyCache::State &HierarchyCache::state() {
+	return current_ctx().hierarchy;
+}
+
+AuthorizationCache::State &AuthorizationCache::state() {
+	return current_ctx().authorization;
+}
+
+PathCache::State &PathCache::state() {
+	return current_ctx().paths;
+}
+
+namespace {
+
+void add_edge(std::vector<uint32_t> &edges, uint32_t id) {
+	if (std::find(edges.begin(), edges.end(), id) == edges.end()) {
+		edges.push_back(id);
+	}
+}
+
+void remove_edge(std::vector<uint32_t> &edges, uint32_t id) {
+	edges.erase(std::remove(edges.begin(), edges.end(), id), edges.end());
+}
+
+// Split a path on '/', dropping the empty component after a trailing slash. "/foo/bar/" yields "", "foo" and
+// "bar", so a stored path is a prefix of a directory exactly when its components prefix the directory's.
+std::vector<std::string> split_path(const std::string &path) {
+	std::vector<std::string> components;
+	size_t start = 0;
+	while (true) {
+		size_t pos = path.find('/', start);
+		if (pos == std::string::npos) {
+			if (start < path.size()) {
+				components.push_back(path.substr(start));
+			}
+			break;
+		}
+		components.push_back(path.substr(start, pos - start));
+		start = pos + 1;
+	}
+	return components;
+}
+
+// Check the cache generation (see db::CacheGeneration) against the one the cache in s reflects, and drop the
+// cache if it moved. drop runs with s.m_mutex held exclusively.
+template <class State, class Drop> std::string check_generation_of(State &s, Drop drop) {
+	auto rp = db::cache_generation();
+	if (!rp.second.empty()) {
+		return rp.second;
+	}
+	{
+		std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+		if (s.m_db_generation == rp.first) {
+			return "";
+		}
+	}
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	if (s.m_db_generation != rp.first) {
+		drop();
+		s.m_db_generation = rp.first;
+	}
+	return "";
+}
+
+template <class State> void advance_generation_of(State &s, int64_t before, int64_t after) {
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	if (s.m_db_generation == before) {
+		s.m_db_generation = after;
+	}
+}
+
+} // namespace
+
+void HierarchyCache::load_locked() {
+	auto &s = state();
+	if (s.m_loaded) {
+		return;
+	}
+
+	auto &storage = db::StorageManager::get_storage();
+	auto parent_records = storage.get_all<db::Parent>();
+
+	s.m_ids.clear();
+	s.m_names.clear();
+	s.m_parents.clear();
+	s.m_children.clear();
+	for (const auto &record : parent_records) {
+		uint32_t child_id = intern_locked(record.lot_name);
+		uint32_t parent_id = intern_locked(record.parent);
+		add_edge(s.m_parents[child_id], parent_id);
+		add_edge(s.m_children[parent_id], child_id);
+	}
+	s.m_loaded = true;
+}
+
+uint32_t HierarchyCache::intern_locked(const std::string &lot_name) {
+	auto &s = state();
+	auto it = s.m_ids.find(lot_name);
+	if (it != s.m_ids.end()) {
+		return it->second;
+	}
+
+	uint32_t id = static_cast<uint32_t>(s.m_names.size());
+	s.m_ids.emplace(lot_name, id);
+	s.m_names.push_back(lot_name);
+	s.m_parents.emplace_back();
+	s.m_children.emplace_back();
+	return id;
+}
+
+std::string HierarchyCache::check_generation() {
+	return check_generation_of(state(), drop_locked);
+}
+
+void HierarchyCache::advance_generation(int64_t before, int64_t after) {
+	advance_generation_of(state(), before, after);
+}
+
+void HierarchyCache::bump_version_locked() {
+	auto &s = state();
+	++s.m_version;
+	s.m_ancestors.clear();
+}
+
+std::vector<std::string> HierarchyCache::walk_locked(const std::string &lot_name, bool up, bool recursive,
+													  bool get_self) {
+	auto &s = state();
+	std::vector<std::string> names;
+	auto it = s.m_ids.find(lot_name);
+	if (it == s.m_ids.end()) {
+		return names;
+	}
+
+	const auto &edges = up ? s.m_parents : s.m_children;
+	uint32_t start = it->second;
+	std::vector<bool> visited(s.m_names.size(), false);
+	std::vector<uint32_t> frontier;
+
+	// The first hop is the only one where a self edge can be reported, mirroring the per-level
+	// queries this replaces, which filter self edges on every hop after the first.
+	for (uint32_t next : edges[start]) {
+		if (next == start && !get_self) {
+			continue;
+		}
+		if (!visited[next]) {
+			visited[next] = true;
+			frontier.push_back(next);
+		}
+	}
+
+	if (recursive) {
+		for (size_t i = 0; i < frontier.size(); ++i) {
+			uint32_t current = frontier[i];
+			for (uint32_t next : edges[current]) {
+				if (next != current && !visited[next]) {
+					visited[next] = true;
+					frontier.push_back(next);
+				}
+			}
+		}
+	}
+
+	names.reserve(frontier.size());
+	for (uint32_t id : frontier) {
+		names.push_back(s.m_names[id]);
+	}
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+std::pair<std::vector<std::string>, std::string> HierarchyCache::walk_db(const std::string &lot_name, bool up,
+																		 bool recursive, bool get_self) {
+	// Same walk as walk_locked(), in a single recursive query (see db::Query::WalkParents)
+	std::map<std::string, std::vector<int>> str_map{{lot_name, {1}}};
+	std::map<int64_t, std::vector<int>> int_map;
+	int_map[get_self].push_back(2);
+	int_map[recursive].push_back(3);
+	auto rp = db::SQL_get_matches(up ? db::Query::WalkParents : db::Query::WalkChildren, str_map, int_map);
+	if (!rp.second.empty()) {
+		return std::make_pair(std::vector<std::string>(), "Failed to query lot hierarchy: " + rp.second);
+	}
+	return rp;
+}
+
+std::pair<std::vector<std::string>, std::string> HierarchyCache::get_parents(const std::string &lot_name,
+																			 bool recursive, bool get_self) {
+	auto &s = state();
+	try {
+		auto error = check_generation();
+		if (!error.empty()) {
+			return std::make_pair(std::vector<std::string>(), error);
+		}
+
+		{
+			std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+			if (s.m_loaded) {
+				if (!recursive || get_self) {
+					return std::make_pair(walk_locked(lot_name, true, recursive, get_self), "");
+				}
+				auto id_it = s.m_ids.find(lot_name);
+				if (id_it == s.m_ids.end()) {
+					return std::make_pair(std::vector<std::string>(), "");
+				}
+				auto memo_it = s.m_ancestors.find(id_it->second);
+				if (memo_it != s.m_ancestors.end()) {
+					return std::make_pair(memo_it->second, "");
+				}
+			}
+		}
+
+		// Loading the graph or memoizing a new ancestor set needs the lock exclusively
+		std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+		if (!s.m_loaded && !s.m_cold_lookup_done) {
+			s.m_cold_lookup_done = true;
+			return walk_db(lot_name, true, recursive, get_self);
+		}
+		load_locked();
+		if (!recursive || get_self) {
+			return std::make_pair(walk_locked(lot_name, true, recursive, get_self), "");
+		}
+
+		// Full ancestor sets are what every usage update needs, so they are memoized until the graph changes
+		auto id_it = s.m_ids.find(lot_name);
+		if (id_it == s.m_ids.end()) {
+			return std::make_pair(std::vector<std::string>(), "");
+		}
+		auto memo_it = s.m_ancestors.find(id_it->second);
+		if (memo_it == s.m_ancestors.end()) {
+			memo_it = s.m_ancestors.emplace(id_it->second, walk_locked(lot_name, true, true, false)).first;
+		}
+		return std::make_pair(memo_it->second, "");
+	} catch (const std::exception &e) {
+		return std::make_pair(std::vector<std::string>(), std::string("Failed to load lot hierarchy: ") + e.what());
+	}
+}
+
+std::pair<std::vector<std::string>, std::string> HierarchyCache::get_children(const std::string &lot_name,
+																			  bool recursive, bool get_self) {
+	auto &s = state();
+	try {
+		auto error = check_generation();
+		if (!error.empty()) {
+			return std::make_pair(std::vector<std::string>(), error);
+		}
+
+		{
+			std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+			if (s.m_loaded) {
+				return std::make_pair(walk_locked(lot_name, false, recursive, get_self), "");
+			}
+		}
+
+		std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+		if (!s.m_loaded && !s.m_cold_lookup_done) {
+			s.m_cold_lookup_done = true;
+			return walk_db(lot_name, false, recursive, get_self);
+		}
+		load_locked();
+		return std::make_pair(walk_locked(lot_name, false, recursive, get_self), "");
+	} catch (const std::exception &e) {
+		return std::make_pair(std::vector<std::string>(), std::string("Failed to load lot hierarchy: ") + e.what());
+	}
+}
+
+std::pair<bool, std::string> HierarchyCache::ancestors_contain_any(const std::vector<std::string> &start_lots,
+																   const std::vector<std::string> &targets) {
+	auto &s = state();
+	try {
+		auto error = check_generation();
+		if (!error.empty()) {
+			return std::make_pair(false, error);
+		}
+
+		{
+			std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+			if (s.m_loaded) {
+				return std::make_pair(ancestors_contain_any_locked(start_lots, targets), "");
+			}
+		}
+
+		std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+		load_locked();
+		return std::make_pair(ancestors_contain_any_locked(start_lots, targets), "");
+	} catch (const std::exception &e) {
+		return std::make_pair(false, std::string("Failed to load lot hierarchy: ") + e.what());
+	}
+}
+
+bool HierarchyCache::ancestors_contain_any_locked(const std::vector<std::string> &start_lots,
+												  const std::vector<std::string> &targets) {
+	auto &s = state();
+	std::vector<bool> is_target(s.m_names.size(), false);
+	for (const auto &target : targets) {
+		if (std::find(start_lots.begin(), start_lots.end(), target) != start_lots.end()) {
+			return true;
+		}
+		auto it = s.m_ids.find(target);
+		if (it != s.m_ids.end()) {
+			is_target[it->second] = true;
+		}
+	}
+
+	std::vector<bool> visited(s.m_names.size(), false);
+	std::vector<uint32_t> frontier;
+	for (const auto &start : start_lots) {
+		auto it = s.m_ids.find(start);
+		if (it != s.m_ids.end() && !visited[it->second]) {
+			visited[it->second] = true;
+			frontier.push_back(it->second);
+		}
+	}
+	for (size_t i = 0; i < frontier.size(); ++i) {
+		uint32_t current = frontier[i];
+		for (uint32_t parent : s.m_parents[current]) {
+			if (parent == current || visited[parent]) {
+				continue;
+			}
+			if (is_target[parent]) {
+				return true;
+			}
+			visited[parent] = true;
+			frontier.push_back(parent);
+		}
+	}
+	return false;
+}
+
+uint64_t HierarchyCache::version() {
+	auto &s = state();
+	std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+	return s.m_version;
+}
+
+std::pair<uint64_t, std::string> HierarchyCache::lookup_ids(const std::vector<std::string> &lot_names,
+															std::vector<uint32_t> &ids) {
+	auto &s = state();
+	try {
+		auto error = check_generation();
+		if (!error.empty()) {
+			return std::make_pair(uint64_t{0}, error);
+		}
+
+		{
+			std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+			if (s.m_loaded) {
+				lookup_ids_locked(lot_names, ids);
+				return std::make_pair(s.m_version, "");
+			}
+		}
+
+		std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+		load_locked();
+		lookup_ids_locked(lot_names, ids);
+		return std::make_pair(s.m_version, "");
+	} catch (const std::exception &e) {
+		return std::make_pair(0, std::string("Failed to load lot hierarchy: ") + e.what());
+	}
+}
+
+void HierarchyCache::lookup_ids_locked(const std::vector<std::string> &lot_names, std::vector<uint32_t> &ids) {
+	auto &s = state();
+	ids.clear();
+	ids.reserve(lot_names.size());
+	for (const auto &lot_name : lot_names) {
+		auto it = s.m_ids.find(lot_name);
+		ids.push_back(it == s.m_ids.end() ? no_id : it->second);
+	}
+}
+
+std::pair<uint64_t, std::string> HierarchyCache::descendants_bitmap(const std::vector<std::string> &roots,
+																	std::vector<uint64_t> &bits) {
+	auto &s = state();
+	try {
+		auto error = check_generation();
+		if (!error.empty()) {
+			return std::make_pair(uint64_t{0}, error);
+		}
+
+		{
+			std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+			if (s.m_loaded) {
+				descendants_bitmap_locked(roots, bits);
+				return std::make_pair(s.m_version, "");
+			}
+		}
+
+		std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+		load_locked();
+		descendants_bitmap_locked(roots, bits);
+		return std::make_pair(s.m_version, "");
+	} catch (const std::exception &e) {
+		return std::make_pair(0, std::string("Failed to load lot hierarchy: ") + e.what());
+	}
+}
+
+void HierarchyCache::descendants_bitmap_locked(const std::vector<std::string> &roots, std::vector<uint64_t> &bits) {
+	auto &s = state();
+	bits.assign((s.m_names.size() + 63) / 64, 0);
+	auto mark = [&bits](uint32_t id) {
+		uint64_t mask = uint64_t{1} << (id % 64);
+		if (bits[id / 64] & mask) {
+			return false;
+		}
+		bits[id / 64] |= mask;
+		return true;
+	};
+
+	std::vector<uint32_t> frontier;
+	for (const auto &root : roots) {
+		auto it = s.m_ids.find(root);
+		if (it != s.m_ids.end() && mark(it->second)) {
+			frontier.push_back(it->second);
+		}
+	}
+	for (size_t i = 0; i < frontier.size(); ++i) {
+		for (uint32_t child : s.m_children[frontier[i]]) {
+			if (mark(child)) {
+				frontier.push_back(child);
+			}
+		}
+	}
+}
+
+void HierarchyCache::add_parents(const std::string &lot_name, const std::vector<std::string> &parents) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	bump_version_locked();
+	if (!s.m_loaded) {
+		return; // Nothing to patch, the next load reads the committed rows
+	}
+
+	uint32_t child_id = intern_locked(lot_name);
+	for (const auto &parent : parents) {
+		uint32_t parent_id = intern_locked(parent);
+		add_edge(s.m_parents[child_id], parent_id);
+		add_edge(s.m_children[parent_id], child_id);
+	}
+}
+
+void HierarchyCache::remove_parents(const std::string &lot_name, const std::vector<std::string> &parents) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	bump_version_locked();
+	if (!s.m_loaded) {
+		return;
+	}
+
+	auto child_it = s.m_ids.find(lot_name);
+	if (child_it == s.m_ids.end()) {
+		return;
+	}
+	for (const auto &parent : parents) {
+		auto parent_it = s.m_ids.find(parent);
+		if (parent_it != s.m_ids.end()) {
+			remove_edge(s.m_parents[child_it->second], parent_it->second);
+			remove_edge(s.m_children[parent_it->second], child_it->second);
+		}
+	}
+}
+
+void HierarchyCache::replace_parent(const std::string &lot_name, const std::string &current_parent,
+									const std::string &new_parent) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	bump_version_locked();
+	if (!s.m_loaded) {
+		return;
+	}
+
+	uint32_t child_id = intern_locked(lot_name);
+	auto current_it = s.m_ids.find(current_parent);
+	if (current_it != s.m_ids.end()) {
+		remove_edge(s.m_parents[child_id], current_it->second);
+		remove_edge(s.m_children[current_it->second], child_id);
+	}
+	uint32_t new_id = intern_locked(new_parent);
+	add_edge(s.m_parents[child_id], new_id);
+	add_edge(s.m_children[new_id], child_id);
+}
+
+void HierarchyCache::remove_lot(const std::string &lot_name) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	bump_version_locked();
+	if (!s.m_loaded) {
+		return;
+	}
+
+	auto it = s.m_ids.find(lot_name);
+	if (it == s.m_ids.end()) {
+		return;
+	}
+	uint32_t id = it->second;
+	for (uint32_t parent_id : s.m_parents[id]) {
+		remove_edge(s.m_children[parent_id], id);
+	}
+	s.m_parents[id].clear();
+}
+
+void HierarchyCache::invalidate() {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	drop_locked();
+	s.m_db_generation = -1;
+}
+
+void HierarchyCache::drop_locked() {
+	auto &s = state();
+	bump_version_locked();
+	s.m_loaded = false;
+	s.m_cold_lookup_done = false;
+	s.m_ids.clear();
+	s.m_names.clear();
+	s.m_parents.clear();
+	s.m_children.clear();
+}
+
+void AuthorizationCache::load_locked() {
+	auto &s = state();
+	if (s.m_loaded) {
+		return;
+	}
+
+	auto &storage = db::StorageManager::get_storage();
+	auto owner_records = storage.get_all<db::Owner>();
+
+	s.m_owners.clear();
+	s.m_allowed.clear();
+	for (auto &record : owner_records) {
+		s.m_owners.emplace(std::move(record.lot_name), std::move(record.owner));
+	}
+	s.m_loaded = true;
+}
+
+std::pair<bool, std::string> AuthorizationCache::owns_any_db(const std::string &caller,
+															 const std::vector<std::string> &lot_names) {
+	// One join of the owners table against the closure, which lists every lot along with all of its ancestors
+	std::string owned_query = "SELECT owners.owner FROM lot_closure "
+							  "INNER JOIN owners ON owners.lot_name = lot_closure.ancestor "
+							  "WHERE owners.owner = ? AND lot_closure.descendant IN (";
+	std::map<std::string, std::vector<int>> owned_str_map{{caller, {1}}};
+	for (size_t i = 0; i < lot_names.size(); i++) {
+		owned_query += (i == 0) ? "?" : ", ?";
+		owned_str_map[lot_names[i]].push_back(static_cast<int>(i + 2));
+	}
+	owned_query += ") LIMIT 1;";
+
+	auto rp = db::SQL_get_matches(owned_query, owned_str_map);
+	if (!rp.second.empty()) { // There was an error
+		return std::make_pair(false, rp.second);
+	}
+	return std::make_pair(!rp.first.empty(), "");
+}
+
+namespace {
+
+bool any_bit_set(const std::vector<uint64_t> &bits, const std::vector<uint32_t> &ids) {
+	for (uint32_t id : ids) {
+		if (id / 64 < bits.size() && (bits[id / 64] >> (id % 64)) & 1) {
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace
+
+std::pair<bool, std::string> AuthorizationCache::caller_owns_any(const std::vector<std::string> &lot_names) {
+	if (lot_names.empty()) {
+		return std::make_pair(false, "");
+	}
+
+	auto &s = state();
+	const std::string caller = Context::get_caller();
+	try {
+		// A write from elsewhere drops the owners, and this check goes to the database
+		auto error = check_generation();
+		if (!error.empty()) {
+			return std::make_pair(false, error);
+		}
+
+		std::vector<uint32_t> ids;
+		{
+			std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+			auto it = s.m_allowed.find(caller);
+			if (s.m_loaded && it != s.m_allowed.end()) {
+				auto rp = HierarchyCache::lookup_ids(lot_names, ids);
+				if (!rp.second.empty()) {
+					return std::make_pair(false, rp.second);
+				}
+				if (rp.first == it->second.version) {
+					return std::make_pair(any_bit_set(it->second.bits, ids), "");
+				}
+			}
+		}
+
+		// Loading the owners or computing a new bitmap needs the lock exclusively
+		std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+		if (!s.m_loaded && !s.m_cold_lookup_done) {
+			s.m_cold_lookup_done = true;
+			return owns_any_db(caller, lot_names);
+		}
+		load_locked();
+
+		std::vector<std::string> owned;
+		for (const auto &[lot_name, owner] : s.m_owners) {
+			if (owner == caller) {
+				owned.push_back(lot_name);
+			}
+		}
+
+		// A write through another thread may bump the graph's version between the two lookups, in which
+		// case the IDs and the bitmap cannot be compared and both are taken again
+		Allowed allowed;
+		while (true) {
+			auto rp_bits = HierarchyCache::descendants_bitmap(owned, allowed.bits);
+			if (!rp_bits.second.empty()) {
+				return std::make_pair(false, rp_bits.second);
+			}
+			auto rp_ids = HierarchyCache::lookup_ids(lot_names, ids);
+			if (!rp_ids.second.empty()) {
+				return std::make_pair(false, rp_ids.second);
+			}
+			if (rp_bits.first == rp_ids.first) {
+				allowed.version = rp_bits.first;
+				break;
+			}
+		}
+
+		bool owns = any_bit_set(allowed.bits, ids);
+		if (s.m_allowed.size() >= max_callers && !s.m_allowed.count(caller)) {
+			s.m_allowed.erase(s.m_allowed.begin());
+		}
+		s.m_allowed[caller] = std::move(allowed);
+		return std::make_pair(owns, "");
+	} catch (const std::exception &e) {
+		return std::make_pair(false, std::string("Failed to load lot owners: ") + e.what());
+	}
+}
+
+void AuthorizationCache::set_owner(const std::string &lot_name, const std::string &owner) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	if (!s.m_loaded) {
+		return; // Nothing to patch, the next load reads the committed rows
+	}
+
+	// Only the bitmaps of the previous and the new owner change
+	auto it = s.m_owners.find(lot_name);
+	if (it != s.m_owners.end()) {
+		s.m_allowed.erase(it->second);
+		it->second = owner;
+	} else {
+		s.m_owners.emplace(lot_name, owner);
+	}
+	s.m_allowed.erase(owner);
+}
+
+void AuthorizationCache::remove_lot(const std::string &lot_name) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	if (!s.m_loaded) {
+		return;
+	}
+
+	auto it = s.m_owners.find(lot_name);
+	if (it != s.m_owners.end()) {
+		s.m_allowed.erase(it->second);
+		s.m_owners.erase(it);
+	}
+}
+
+void AuthorizationCache::invalidate() {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	drop_locked();
+	s.m_db_generation = -1;
+}
+
+void AuthorizationCache::drop_locked() {
+	auto &s = state();
+	s.m_loaded = false;
+	s.m_cold_lookup_done = false;
+	s.m_owners.clear();
+	s.m_allowed.clear();
+}
+
+std::string AuthorizationCache::check_generation() {
+	return check_generation_of(state(), drop_locked);
+}
+
+void AuthorizationCache::advance_generation(int64_t before, int64_t after) {
+	advance_generation_of(state(), before, after);
+}
+
+void PathCache::load_locked() {
+	auto &s = state();
+	if (s.m_loaded) {
+		return;
+	}
+
+	auto &storage = db::StorageManager::get_storage();
+	auto path_records = storage.get_all<db::Path>();
+
+	s.m_root = std::make_unique<Node>();
+	s.m_lot_paths.clear();
+	for (const auto &record : path_records) {
+		set_rule_locked(record.path, Rule{record.lot_name, record.recursive != 0, record.exclude != 0});
+	}
+	s.m_loaded = true;
+}
+
+PathCache::Node *PathCache::find_locked(const std::string &path, bool create) {
+	auto &s = state();
+	Node *node = s.m_root.get();
+	for (const auto &component : split_path(path)) {
+		auto it = node->children.find(component);
+		if (it == node->children.end()) {
+			if (!create) {
+				return nullptr;
+			}
+			it = node->children.emplace(component, std::make_unique<Node>()).first;
+		}
+		node = it->second.get();
+	}
+	return node;
+}
+
+void PathCache::set_rule_locked(const std::string &path, Rule rule) {
+	auto &s = state();
+	Node *node = find_locked(path, true);
+	if (node->rule) {
+		auto &old_paths = s.m_lot_paths[node->rule->lot_name];
+		old_paths.erase(std::remove(old_paths.begin(), old_paths.end(), path), old_paths.end());
+	}
+	s.m_lot_paths[rule.lot_name].push_back(path);
+	node->rule = std::move(rule);
+}
+
+void PathCache::clear_rule_locked(const std::string &path) {
+	auto &s = state();
+	Node *node = find_locked(path, false);
+	if (!node || !node->rule) {
+		return;
+	}
+	auto &old_paths = s.m_lot_paths[node->rule->lot_name];
+	old_paths.erase(std::remove(old_paths.begin(), old_paths.end(), path), old_paths.end());
+	node->rule.reset();
+}
+
+std::pair<std::string, std::string> PathCache::resolve(const std::string &dir, bool *recursive) {
+	auto &s = state();
+	if (recursive) {
+		*recursive = false;
+	}
+	try {
+		auto error = check_generation();
+		if (!error.empty()) {
+			return std::make_pair("", error);
+		}
+
+		{
+			std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+			if (s.m_loaded) {
+				return std::make_pair(resolve_locked(dir, recursive), "");
+			}
+		}
+
+		std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+		load_locked();
+		return std::make_pair(resolve_locked(dir, recursive), "");
+	} catch (const std::exception &e) {
+		return std::make_pair("", std::string("Failed to load lot paths: ") + e.what());
+	}
+}
+
+std::string PathCache::resolve_locked(const std::string &dir, bool *recursive) {
+	auto &s = state();
+	// Collect the rules that match dir, shortest path first
+	auto components = split_path(dir);
+	std::vector<const Rule *> matches;
+	const Rule *exact_rule = nullptr;
+	Node *node = s.m_root.get();
+	for (size_t i = 0; i < components.size(); ++i) {
+		auto it = node->children.find(components[i]);
+		if (it == node->children.end()) {
+			break;
+		}
+		node = it->second.get();
+		bool exact = (i == components.size() - 1);
+		if (node->rule && exact) {
+			exact_rule = &*node->rule;
+		}
+		if (node->rule && (node->rule->recursive || exact)) {
+			matches.push_back(&*node->rule);
+		}
+	}
+
+	// The longest inclusion wins, unless a longer exclusion of the same lot overrides it
+	std::vector<const std::string *> excluded_lots;
+	for (auto it = matches.rbegin(); it != matches.rend(); ++it) {
+		const Rule *rule = *it;
+		bool overridden = std::find_if(excluded_lots.begin(), excluded_lots.end(), [rule](const std::string *lot) {
+							  return *lot == rule->lot_name;
+						  }) != excluded_lots.end();
+		if (rule->exclude) {
+			excluded_lots.push_back(&rule->lot_name);
+		} else if (!overridden) {
+			if (recursive) {
+				*recursive = (rule == exact_rule && rule->recursive);
+			}
+			return rule->lot_name;
+		}
+	}
+	return "";
+}
+
+void PathCache::add_path(const std::string &lot_name, const std::string &path, bool recursive, bool exclude) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	if (!s.m_loaded) {
+		return; // Nothing to patch, the next load reads the committed rows
+	}
+	set_rule_locked(path, Rule{lot_name, recursive, exclude});
+}
+
+void PathCache::remove_path(const std::string &path) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	if (!s.m_loaded) {
+		return;
+	}
+	clear_rule_locked(path);
+}
+
+void PathCache::remove_lot(const std::string &lot_name) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	if (!s.m_loaded) {
+		return;
+	}
+
+	auto it = s.m_lot_paths.find(lot_name);
+	if (it == s.m_lot_paths.end()) {
+		return;
+	}
+	for (const auto &path : it->second) {
+		Node *node = find_locked(path, false);
+		if (node) {
+			node->rule.reset();
+		}
+	}
+	s.m_lot_paths.erase(it);
+}
+
+void PathCache::update_path(const std::string &lot_name, const std::string &current_path,
+							const std::string &new_path, bool recursive, std::optional<bool> exclude) {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	if (!s.m_loaded) {
+		return;
+	}
+
+	// The database only rewrites the row when it belongs to lot_name
+	Node *node = find_locked(current_path, false);
+	if (!node || !node->rule || node->rule->lot_name != lot_name) {
+		return;
+	}
+	Rule rule{lot_name, recursive, exclude.value_or(node->rule->exclude)};
+	clear_rule_locked(current_path);
+	set_rule_locked(new_path, std::move(rule));
+}
+
+void PathCache::invalidate() {
+	auto &s = state();
+	std::lock_guard<std::shared_mutex> lock(s.m_mutex);
+	drop_locked();
+	s.m_db_generation = -1;
+}
+
+void PathCache::drop_locked() {
+	auto &s = state();
+	s.m_loaded = false;
+	s.m_root.reset();
+	s.m_lot_paths.clear();
+}
+
+std::string PathCache::check_generation() {
+	return check_generation_of(state(), drop_locked);
+}
+
+void PathCache::advance_generation(int64_t before, int64_t after) {
+	advance_generation_of(state(), before, after);
+}
+
+} // namespace lotman
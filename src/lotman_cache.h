@@ -0,0 +1,366 @@
+/**
+ * In-memory caches for LotMan
+ *
+ * These caches mirror tables that are read far more often than they are
+ * written, so that hot read paths can be answered without a round trip to
+ * SQLite. Every LotMan context has its own copy of each cache, kept coherent
+ * by the write paths in lotman_db.cpp, which patch it after a successful
+ * commit.
+ *
+ * Writes made by other processes, or by other contexts on the same database,
+ * are caught by the cache generation (see db::CacheGeneration), which triggers
+ * bump on every write to the mirrored tables. Each cache remembers the
+ * generation its contents reflect and checks it before they are trusted; if it
+ * has moved, the cache is dropped and reloaded. LotMan's own writes read the
+ * generation inside their transaction and move each cache's copy forward
+ * together with the patch, so they do not force a reload.
+ */
+
+#ifndef LOTMAN_CACHE_H
+#define LOTMAN_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lotman {
+
+/**
+ * Versioned in-memory copy of the lot hierarchy (the parents table).
+ *
+ * Lot names are interned to dense integer IDs and the graph is held as
+ * parent/child adjacency lists, so recursive walks touch memory only instead
+ * of issuing one SELECT per visited node. The graph is loaded lazily on first
+ * use and then patched in place by every write that changes the parents table.
+ * Each change bumps the version, which dependent caches can compare against to
+ * know when they are stale.
+ *
+ * Loading reads the whole parents table, which a process that asks a single
+ * question (e.g. a short-lived CLI call) never earns back. The first lookup
+ * after a load or invalidation is therefore answered by one recursive SQL query
+ * instead, and the graph is only loaded once a second lookup shows it is reused.
+ *
+ * Every lookup first checks the cache generation, so writes from other
+ * processes or contexts are seen by the next lookup after they commit.
+ *
+ * Thread-safe. Lookups on a loaded graph share a reader lock and run in parallel; loading,
+ * memoizing and patching take it exclusively.
+ */
+class HierarchyCache {
+  public:
+	/**
+	 * Get the names of a lot's parents, sorted and deduplicated.
+	 * @param lot_name Lot whose parents are requested
+	 * @param recursive Whether to include all ancestors rather than only immediate parents
+	 * @param get_self Whether to include lot_name itself when it is its own parent
+	 * @return Pair of (parent names, error_message)
+	 *
+	 * Recursive lookups without get_self are memoized per lot until the next version bump.
+	 */
+	static std::pair<std::vector<std::string>, std::string> get_parents(const std::string &lot_name, bool recursive,
+																		bool get_self);
+
+	/**
+	 * Get the names of a lot's children, sorted and deduplicated.
+	 * @param lot_name Lot whose children are requested
+	 * @param recursive Whether to include all descendants rather than only immediate children
+	 * @param get_self Whether to include lot_name itself when it is its own parent
+	 * @return Pair of (children names, error_message)
+	 */
+	static std::pair<std::vector<std::string>, std::string> get_children(const std::string &lot_name, bool recursive,
+																		 bool get_self);
+
+	/**
+	 * Check whether any of the targets is one of the start lots or one of their ancestors.
+	 * Self-parent edges are not followed.
+	 * @return Pair of (found, error_message)
+	 */
+	static std::pair<bool, std::string> ancestors_contain_any(const std::vector<std::string> &start_lots,
+															  const std::vector<std::string> &targets);
+
+	/**
+	 * Current version of the cached graph. Incremented on every patch or invalidation.
+	 */
+	static uint64_t version();
+
+	// ID given by lookup_ids() to lots the graph does not know
+	static constexpr uint32_t no_id = UINT32_MAX;
+
+	/**
+	 * Look up the IDs of lots in the graph, loading it if needed. IDs are dense, starting at 0, and stay
+	 * valid until the next version bump.
+	 * @param lot_names Lots to look up
+	 * @param ids Set to the ID of each lot, in the same order, or no_id for lots the graph does not know
+	 * @return Pair of (version the IDs belong to, error_message)
+	 */
+	static std::pair<uint64_t, std::string> lookup_ids(const std::vector<std::string> &lot_names,
+													   std::vector<uint32_t> &ids);
+
+	/**
+	 * Mark the given lots and all of their descendants in a bitmap indexed by lot ID, loading the graph if
+	 * needed. Bit (id % 64) of bits[id / 64] is set for every marked lot.
+	 * @param roots Lots to start from. Lots the graph does not know are skipped.
+	 * @param bits Set to the bitmap, with one bit for every lot the graph knows
+	 * @return Pair of (version the bitmap belongs to, error_message)
+	 */
+	static std::pair<uint64_t, std::string> descendants_bitmap(const std::vector<std::string> &roots,
+															   std::vector<uint64_t> &bits);
+
+	/**
+	 * Patch the graph after parent rows were added for lot_name.
+	 */
+	static void add_parents(const std::string &lot_name, const std::vector<std::string> &parents);
+
+	/**
+	 * Patch the graph after parent rows were removed for lot_name.
+	 */
+	static void remove_parents(const std::string &lot_name, const std::vector<std::string> &parents);
+
+	/**
+	 * Patch the graph after a parent row of lot_name was rewritten from current_parent to new_parent.
+	 */
+	static void replace_parent(const std::string &lot_name, const std::string &current_parent,
+							   const std::string &new_parent);
+
+	/**
+	 * Patch the graph after a lot was deleted. Like delete_lot_from_db(), this drops only the rows that
+	 * name lot_name as the child; rows naming it as a parent are left for the caller to reassign.
+	 */
+	static void remove_lot(const std::string &lot_name);
+
+	/**
+	 * Drop the cached graph. It is reloaded from the database on next use.
+	 */
+	static void invalidate();
+
+	/**
+	 * Record that a write which moved the cache generation from before to after has been patched in.
+	 * If the graph did not reflect generation before, it is left to be reloaded by the next lookup.
+	 */
+	static void advance_generation(int64_t before, int64_t after);
+
+	// The cached graph of one context, held by its lotman_ctx (see lotman_ctx.h)
+	struct State {
+		std::shared_mutex m_mutex;
+		bool m_loaded = false;
+		bool m_cold_lookup_done = false;
+		uint64_t m_version = 0;
+
+		// The cache generation the graph reflects, or -1 before it was first checked
+		int64_t m_db_generation = -1;
+
+		// Interned lot names: name -> ID and ID -> name
+		std::unordered_map<std::string, uint32_t> m_ids;
+		std::vector<std::string> m_names;
+
+		// Adjacency lists indexed by ID. Self-parent edges are stored like any other edge.
+		std::vector<std::vector<uint32_t>> m_parents;
+		std::vector<std::vector<uint32_t>> m_children;
+
+		// Memoized ancestor sets (recursive, no self), keyed by lot ID. Cleared on every version bump.
+		std::unordered_map<uint32_t, std::vector<std::string>> m_ancestors;
+	};
+
+  private:
+	// The calling thread's current context's graph
+	static State &state();
+
+	static std::string check_generation();
+	static void drop_locked();
+	static void load_locked();
+	static uint32_t intern_locked(const std::string &lot_name);
+	static void bump_version_locked();
+	static std::vector<std::string> walk_locked(const std::string &lot_name, bool up, bool recursive, bool get_self);
+	static bool ancestors_contain_any_locked(const std::vector<std::string> &start_lots,
+											 const std::vector<std::string> &targets);
+	static void lookup_ids_locked(const std::vector<std::string> &lot_names, std::vector<uint32_t> &ids);
+	static void descendants_bitmap_locked(const std::vector<std::string> &roots, std::vector<uint64_t> &bits);
+	static std::pair<std::vector<std::string>, std::string> walk_db(const std::string &lot_name, bool up,
+																	 bool recursive, bool get_self);
+};
+
+/**
+ * Per-caller authorization decisions, answering whether the caller may act on any of a set of lots.
+ *
+ * A caller may act on a lot when it owns the lot or one of its ancestors. For every caller that
+ * has been checked, the cache holds a bitmap over HierarchyCache lot IDs marking the lots it owns
+ * and all of their descendants, so a check costs one bit test per lot. The bitmap is computed
+ * once from the owners table and the cached graph, dropped when the graph's version moves on, and
+ * dropped for the old and new owner whenever a lot changes hands.
+ *
+ * Like HierarchyCache, the owners table is only loaded once a second check shows the cache is
+ * reused; the first check is answered by one join against the lot closure. Every check first
+ * checks the cache generation: after a write from another process or context, the owners and
+ * bitmaps are dropped and the check goes back to the join, so a caller whose ownership was revoked
+ * elsewhere loses access with the next check. Bitmaps are kept for at most max_callers callers.
+ *
+ * Thread-safe. Checks against a computed bitmap share a reader lock; loading, computing and patching
+ * take it exclusively.
+ */
+class AuthorizationCache {
+  public:
+	/**
+	 * Check whether the current caller (see Context::get_caller()) owns any of the given lots or any of
+	 * their ancestors.
+	 * @return Pair of (owned, error_message)
+	 */
+	static std::pair<bool, std::string> caller_owns_any(const std::vector<std::string> &lot_names);
+
+	/**
+	 * Patch the cache after the owner row of lot_name was stored or rewritten.
+	 */
+	static void set_owner(const std::string &lot_name, const std::string &owner);
+
+	/**
+	 * Patch the cache after a lot was deleted.
+	 */
+	static void remove_lot(const std::string &lot_name);
+
+	/**
+	 * Drop the cached owners and bitmaps. They are reloaded from the database on next use.
+	 */
+	static void invalidate();
+
+	/**
+	 * See HierarchyCache::advance_generation().
+	 */
+	static void advance_generation(int64_t before, int64_t after);
+
+	// The most callers whose bitmaps are kept at once. Each bitmap has one bit per lot.
+	static constexpr size_t max_callers = 64;
+
+	// A caller's bitmap over lot IDs, valid for one version of the hierarchy
+	struct Allowed {
+		uint64_t version;
+		std::vector<uint64_t> bits;
+	};
+
+	// The cached decisions of one context, held by its lotman_ctx (see lotman_ctx.h)
+	struct State {
+		std::shared_mutex m_mutex;
+		bool m_loaded = false;
+		bool m_cold_lookup_done = false;
+
+		// Explicit owner of each lot
+		std::unordered_map<std::string, std::string> m_owners;
+
+		// Bitmaps of the callers checked since the last change, keyed by caller
+		std::unordered_map<std::string, Allowed> m_allowed;
+
+		// See HierarchyCache::State::m_db_generation
+		int64_t m_db_generation = -1;
+	};
+
+  private:
+	// The calling thread's current context's decisions
+	static State &state();
+
+	static std::string check_generation();
+	static void drop_locked();
+	static void load_locked();
+	static std::pair<bool, std::string> owns_any_db(const std::string &caller,
+													const std::vector<std::string> &lot_names);
+};
+
+/**
+ * In-memory trie over the paths table, used to resolve a directory to the lot that tracks it.
+ *
+ * Paths are split into '/'-separated components and every trie node holds at most one rule,
+ * since a path can only be stored once across all lots. Resolving a directory visits one node
+ * per path component, so it costs O(path depth) no matter how many paths are stored.
+ *
+ * Like HierarchyCache, the trie is loaded lazily, patched by every write to the paths table
+ * and dropped when the cache generation shows a write from another process or context.
+ *
+ * Thread-safe. Resolving against a loaded trie shares a reader lock; loading and patching take it exclusively.
+ */
+class PathCache {
+  public:
+	/**
+	 * Find the lot that tracks dir. This is the lot with the longest matching inclusion rule that is
+	 * not overridden by a longer matching exclusion rule of the same lot. Recursive rules match their
+	 * path and everything below it, non-recursive rules match their path only.
+	 * @param dir Directory to resolve, with a trailing slash
+	 * @param recursive If given, set to whether dir itself is stored as a recursive path of the returned lot
+	 * @return Pair of (lot name, or an empty string if no rule matches, error_message)
+	 */
+	static std::pair<std::string, std::string> resolve(const std::string &dir, bool *recursive = nullptr);
+
+	/**
+	 * Patch the trie after a path row was stored. A rule already stored at the same path is replaced.
+	 */
+	static void add_path(const std::string &lot_name, const std::string &path, bool recursive, bool exclude);
+
+	/**
+	 * Patch the trie after a path row was removed, whichever lot it belonged to.
+	 */
+	static void remove_path(const std::string &path);
+
+	/**
+	 * Patch the trie after all of a lot's path rows were removed.
+	 */
+	static void remove_lot(const std::string &lot_name);
+
+	/**
+	 * Patch the trie after lot_name's rule at current_path was rewritten. exclude is left as is when unset.
+	 */
+	static void update_path(const std::string &lot_name, const std::string &current_path,
+							const std::string &new_path, bool recursive, std::optional<bool> exclude);
+
+	/**
+	 * Drop the cached trie. It is reloaded from the database on next use.
+	 */
+	static void invalidate();
+
+	/**
+	 * See HierarchyCache::advance_generation().
+	 */
+	static void advance_generation(int64_t before, int64_t after);
+
+  private:
+	struct Rule {
+		std::string lot_name;
+		bool recursive;
+		bool exclude;
+	};
+
+	struct Node {
+		std::unordered_map<std::string, std::unique_ptr<Node>> children;
+		std::optional<Rule> rule;
+	};
+
+  public:
+	// The cached trie of one context, held by its lotman_ctx (see lotman_ctx.h)
+	struct State {
+		std::shared_mutex m_mutex;
+		bool m_loaded = false;
+		std::unique_ptr<Node> m_root;
+
+		// Paths stored for each lot, so a lot's rules can be dropped without walking the whole trie
+		std::unordered_map<std::string, std::vector<std::string>> m_lot_paths;
+
+		// See HierarchyCache::State::m_db_generation
+		int64_t m_db_generation = -1;
+	};
+
+  private:
+	// The calling thread's current context's trie
+	static State &state();
+
+	static std::string check_generation();
+	static void drop_locked();
+	static void load_locked();
+	static Node *find_locked(const std::string &path, bool create);
+	static void set_rule_locked(const std::string &path, Rule rule);
+	static void clear_rule_locked(const std::string &path);
+	static std::string resolve_locked(const std::string &dir, bool *recursive);
+};
+
+} // namespace lotman
+
+#endif // LOTMAN_CACHE_H
@@ -0,0 +1,84 @@
+#include "lotman_ctx.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+
+namespace {
+
+std::atomic<uint64_t> next_ctx_id{1};
+
+// IDs and addresses of every context that has not been destroyed
+struct CtxRegistry {
+	std::mutex mutex;
+	std::unordered_set<uint64_t> ids;
+	std::unordered_set<const lotman_ctx *> handles;
+};
+
+CtxRegistry &registry() {
+	static CtxRegistry registry;
+	return registry;
+}
+
+// Null when the thread works on the default context
+thread_local lotman_ctx *t_current = nullptr;
+
+} // namespace
+
+lotman_ctx::lotman_ctx() : id(next_ctx_id.fetch_add(1, std::memory_order_relaxed)) {
+	auto &reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	reg.ids.insert(id);
+	reg.handles.insert(this);
+}
+
+lotman_ctx::~lotman_ctx() {
+	{
+		// The accumulator's thread works on this context until it is stopped
+		lotman::CtxScope scope(this);
+		lotman::UsageAccumulator::stop();
+		lotman::UsageJournal::close();
+	}
+
+	auto &reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	reg.ids.erase(id);
+	reg.handles.erase(this);
+}
+
+namespace lotman {
+
+lotman_ctx &current_ctx() {
+	return t_current ? *t_current : default_ctx();
+}
+
+lotman_ctx &default_ctx() {
+	static lotman_ctx ctx;
+	return ctx;
+}
+
+bool ctx_alive(uint64_t id) {
+	auto &reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	return reg.ids.count(id) != 0;
+}
+
+bool ctx_alive(const lotman_ctx *ctx) {
+	auto &reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	return reg.handles.count(ctx) != 0;
+}
+
+CtxScope::CtxScope(lotman_ctx *ctx) : m_previous(t_current) {
+	t_current = ctx;
+}
+
+CtxScope::~CtxScope() {
+	t_current = m_previous;
+}
+
+void CtxScope::bind(lotman_ctx *ctx) {
+	t_current = ctx;
+}
+
+} // namespace lotman
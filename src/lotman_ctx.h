@@ -0,0 +1,99 @@
+/**
+ * LotMan contexts
+ *
+ * A context holds everything LotMan keeps about one database: the caller and
+ * lot home, the storage, the connection pool, the in-memory caches, the
+ * pending usage deltas and their journal. The classes that use this state
+ * (Context, StorageManager, ConnectionPool, HierarchyCache, AuthorizationCache,
+ * PathCache, UsageJournal and UsageAccumulator) are static, and find it
+ * through current_ctx(), the context the calling thread is working on.
+ *
+ * The lotman_* API works on a default context that lives for the whole
+ * process. lotman_ctx_create() makes independent contexts, each on a database
+ * of its own, and the lotman_ctx_* API runs a call against one of them. Calls
+ * on different contexts share no state and never reset each other.
+ */
+
+#ifndef LOTMAN_CTX_H
+#define LOTMAN_CTX_H
+
+#include "lotman_accumulator.h"
+#include "lotman_cache.h"
+#include "lotman_db.h"
+#include "lotman_internal.h"
+#include "lotman_journal.h"
+
+#include <cstdint>
+
+struct lotman_ctx {
+	lotman_ctx();
+	~lotman_ctx();
+
+	// Non-copyable
+	lotman_ctx(const lotman_ctx &) = delete;
+	lotman_ctx &operator=(const lotman_ctx &) = delete;
+
+	// Never reused, so per-thread state keyed by it cannot be mistaken for another context's
+	const uint64_t id;
+
+	lotman::Context::State context;
+	lotman::db::StorageManager::State storage;
+	lotman::db::ConnectionPool::State pool;
+	lotman::HierarchyCache::State hierarchy;
+	lotman::AuthorizationCache::State authorization;
+	lotman::PathCache::State paths;
+	lotman::UsageJournal::State journal;
+	lotman::UsageAccumulator::State accumulator;
+};
+
+namespace lotman {
+
+/**
+ * The context the calling thread is working on: the one bound by its innermost CtxScope,
+ * or else the default context.
+ */
+lotman_ctx &current_ctx();
+
+/**
+ * The context the lotman_* API works on when the calling thread has not bound another one.
+ */
+lotman_ctx &default_ctx();
+
+/**
+ * Whether the context with the given ID has not been destroyed yet. Threads use this to drop the
+ * connections they opened for contexts that were freed.
+ */
+bool ctx_alive(uint64_t id);
+
+/**
+ * Whether ctx is the handle of a context that has not been destroyed yet. Only the address is looked
+ * up, so a handle that was already freed can be checked safely.
+ */
+bool ctx_alive(const lotman_ctx *ctx);
+
+/**
+ * Binds a context to the calling thread for the lifetime of the scope. Scopes nest, and the context
+ * that was current before is restored when the scope ends. A null context binds the default context.
+ */
+class CtxScope {
+  public:
+	explicit CtxScope(lotman_ctx *ctx);
+	~CtxScope();
+
+	// Non-copyable
+	CtxScope(const CtxScope &) = delete;
+	CtxScope &operator=(const CtxScope &) = delete;
+
+	/**
+	 * Bind ctx to the calling thread until the next call, outside of any scope.
+	 * Used by lotman_ctx_make_current(). A null context binds the default context again.
+	 */
+	static void bind(lotman_ctx *ctx);
+
+  private:
+	lotman_ctx *m_previous;
+};
+
+} // namespace lotman
+
+#endif // LOTMAN_CTX_H
@@ -9,35 +9,266 @@
 #include "lotman_db.h"
 
 #include "lotman.h"
+#include "lotman_cache.h"
+#include "lotman_ctx.h"
 #include "lotman_internal.h"
+#include "lotman_metrics.h"
+#include "lotman_trace.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <nlohmann/json.hpp>
 #include <pwd.h>
 #include <sqlite3.h>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_set>
 
 using namespace sqlite_orm;
 
 namespace lotman {
 namespace db {
 
-// Static member definitions
-std::unique_ptr<Storage> StorageManager::m_storage = nullptr;
-bool StorageManager::m_initialized = false;
-bool StorageManager::m_wal_enabled = false;
+// Per-thread storage and connections, keyed by context ID
+thread_local std::unordered_map<uint64_t, StorageManager::ThreadStorage> StorageManager::t_storage;
+thread_local std::unordered_map<uint64_t, ConnectionPool::ThreadConnection> ConnectionPool::t_connections;
 
-// Connection pool static members
-std::vector<sqlite3 *> ConnectionPool::m_pool;
-std::mutex ConnectionPool::m_mutex;
-size_t ConnectionPool::m_max_size = 5;
+StorageManager::State &StorageManager::state() {
+	return current_ctx().storage;
+}
+
+ConnectionPool::State &ConnectionPool::state() {
+	return current_ctx().pool;
+}
 
 // Prepared statement cache static members
 std::unordered_map<sqlite3 *, std::unordered_map<std::string, sqlite3_stmt *>> PreparedStatementCache::m_cache;
 std::mutex PreparedStatementCache::m_mutex;
 
+// Query catalogue
+
+namespace {
+
+// Selects every descendant of the lots a query selects (the closure holds a depth 0 row for each lot itself)
+#define WITH_DESCENDANTS(lots_query)                                                                                   \
+	"SELECT DISTINCT descendant FROM lot_closure WHERE ancestor IN (" lots_query ") ORDER BY descendant;"
+
+#define LOTS_PAST_EXPIRATION "SELECT lot_name FROM management_policy_attributes WHERE expiration_time <= ?"
+#define LOTS_PAST_DELETION "SELECT lot_name FROM management_policy_attributes WHERE deletion_time <= ?"
+#define LOTS_PAST_QUOTA(usage, limit)                                                                                  \
+	"SELECT lot_usage.lot_name FROM lot_usage "                                                                        \
+	"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "             \
+	"WHERE " usage " >= " limit
+#define SELF_GB "lot_usage.self_GB"
+#define TOTAL_GB "lot_usage.self_GB + lot_usage.children_GB"
+#define SELF_OBJECTS "lot_usage.self_objects"
+#define TOTAL_OBJECTS "lot_usage.self_objects + lot_usage.children_objects"
+#define OPP_LIMIT "management_policy_attributes.dedicated_GB + management_policy_attributes.opportunistic_GB"
+#define DED_LIMIT "management_policy_attributes.dedicated_GB"
+#define OBJ_LIMIT "management_policy_attributes.max_num_objects"
+
+// The SQL of every catalogued query, in the order of the Query enumerators
+constexpr const char *query_catalogue[] = {
+	// DedicatedUsage
+	"SELECT "
+	"CASE "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN "
+	"management_policy_attributes.dedicated_GB "
+	"ELSE lot_usage.self_GB "
+	"END AS total "
+	"FROM "
+	"lot_usage "
+	"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
+	"WHERE lot_usage.lot_name = ?;",
+	// DedicatedUsageRecursive
+	"SELECT "
+	"CASE "
+	"WHEN lot_usage.self_GB + lot_usage.children_GB <= management_policy_attributes.dedicated_GB THEN "
+	"lot_usage.self_GB + lot_usage.children_GB "
+	"ELSE management_policy_attributes.dedicated_GB "
+	"END AS total, " // For readability, not actually referencing these column names
+	"CASE "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN "
+	"management_policy_attributes.dedicated_GB "
+	"ELSE lot_usage.self_GB "
+	"END AS self_contrib, "
+	"CASE "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN '0' "
+	"WHEN lot_usage.self_GB + lot_usage.children_GB >= management_policy_attributes.dedicated_GB THEN "
+	"management_policy_attributes.dedicated_GB - lot_usage.self_GB "
+	"ELSE lot_usage.children_GB "
+	"END AS children_contrib "
+	"FROM lot_usage "
+	"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
+	"WHERE lot_usage.lot_name = ?;",
+	// OpportunisticUsage
+	"SELECT "
+	"CASE "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB + "
+	"management_policy_attributes.opportunistic_GB THEN management_policy_attributes.opportunistic_GB "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN lot_usage.self_GB = "
+	"management_policy_attributes.dedicated_GB "
+	"ELSE '0' "
+	"END AS total "
+	"FROM "
+	"lot_usage "
+	"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
+	"WHERE lot_usage.lot_name = ?;",
+	// OpportunisticUsageRecursive
+	"SELECT "
+	"CASE "
+	"WHEN lot_usage.self_GB + lot_usage.children_GB >= management_policy_attributes.opportunistic_GB "
+	"+management_policy_attributes.dedicated_GB THEN management_policy_attributes.opportunistic_GB "
+	"WHEN lot_usage.self_GB + lot_usage.children_GB >= management_policy_attributes.dedicated_GB THEN "
+	"lot_usage.self_GB + lot_usage.children_GB - management_policy_attributes.dedicated_GB "
+	"ELSE '0' "
+	"END AS total, "
+	"CASE "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.opportunistic_GB + "
+	"management_policy_attributes.dedicated_GB THEN management_policy_attributes.opportunistic_GB "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN  lot_usage.self_GB - "
+	"management_policy_attributes.dedicated_GB "
+	"ELSE '0' "
+	"END AS self_contrib, "
+	"CASE "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.opportunistic_GB + "
+	"management_policy_attributes.dedicated_GB THEN '0' "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB AND lot_usage.self_GB + "
+	"lot_usage.children_GB >= management_policy_attributes.opportunistic_GB + "
+	"management_policy_attributes.dedicated_GB THEN management_policy_attributes.opportunistic_GB + "
+	"management_policy_attributes.dedicated_GB - lot_usage.self_GB "
+	"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB AND lot_usage.self_GB + "
+	"lot_usage.children_GB < management_policy_attributes.opportunistic_GB + "
+	"management_policy_attributes.dedicated_GB THEN lot_usage.children_GB "
+	"WHEN lot_usage.self_GB < management_policy_attributes.dedicated_GB AND lot_usage.self_GB + "
+	"lot_usage.children_GB >= management_policy_attributes.opportunistic_GB + "
+	"management_policy_attributes.dedicated_GB THEN management_policy_attributes.opportunistic_GB "
+	"WHEN lot_usage.self_GB < management_policy_attributes.dedicated_GB AND lot_usage.self_GB + "
+	"lot_usage.children_GB > management_policy_attributes.dedicated_GB THEN lot_usage.self_GB + "
+	"lot_usage.children_GB - management_policy_attributes.dedicated_GB "
+	"ELSE '0' "
+	"END AS children_contrib "
+	"FROM "
+	"lot_usage "
+	"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
+	"WHERE lot_usage.lot_name = ?;",
+	// TotalUsage, TotalUsageRecursive
+	"SELECT self_GB FROM lot_usage WHERE lot_name = ?;",
+	"SELECT self_GB, children_GB FROM lot_usage WHERE lot_name = ?;",
+	// ObjectUsage, ObjectUsageRecursive
+	"SELECT self_objects FROM lot_usage WHERE lot_name = ?;",
+	"SELECT self_objects, children_objects FROM lot_usage WHERE lot_name = ?;",
+	// GBBeingWritten, GBBeingWrittenRecursive
+	"SELECT self_GB_being_written FROM lot_usage WHERE lot_name = ?;",
+	"SELECT self_GB_being_written, children_GB_being_written FROM lot_usage WHERE lot_name = ?;",
+	// ObjectsBeingWritten, ObjectsBeingWrittenRecursive
+	"SELECT self_objects_being_written FROM lot_usage WHERE lot_name = ?;",
+	"SELECT self_objects_being_written, children_objects_being_written FROM lot_usage WHERE lot_name = ?;",
+
+	// OwnersRecursive: the closure lists the lot itself and all of its ancestors, so this is one indexed join
+	"SELECT DISTINCT owners.owner FROM lot_closure "
+	"INNER JOIN owners ON owners.lot_name = lot_closure.ancestor "
+	"WHERE lot_closure.descendant = ? ORDER BY owners.owner;",
+	// ChildrenUsageSums: one indexed join whatever the size of the subtree. A lot without descendants gets
+	// one row of NULL sums.
+	"SELECT SUM(lot_usage.self_GB), SUM(lot_usage.self_GB_being_written), "
+	"SUM(lot_usage.self_objects), SUM(lot_usage.self_objects_being_written) "
+	"FROM lot_closure INNER JOIN lot_usage ON lot_usage.lot_name = lot_closure.descendant "
+	"WHERE lot_closure.ancestor = ? AND lot_closure.depth > 0;",
+
+	// LotsPastExpiration, LotsPastDeletion and their WithDescendants variants
+	LOTS_PAST_EXPIRATION ";",
+	WITH_DESCENDANTS(LOTS_PAST_EXPIRATION),
+	LOTS_PAST_DELETION ";",
+	WITH_DESCENDANTS(LOTS_PAST_DELETION),
+	// LotsPastOpportunistic variants
+	LOTS_PAST_QUOTA(SELF_GB, OPP_LIMIT) ";",
+	WITH_DESCENDANTS(LOTS_PAST_QUOTA(SELF_GB, OPP_LIMIT)),
+	LOTS_PAST_QUOTA(TOTAL_GB, OPP_LIMIT) ";",
+	WITH_DESCENDANTS(LOTS_PAST_QUOTA(TOTAL_GB, OPP_LIMIT)),
+	// LotsPastDedicated variants
+	LOTS_PAST_QUOTA(SELF_GB, DED_LIMIT) ";",
+	WITH_DESCENDANTS(LOTS_PAST_QUOTA(SELF_GB, DED_LIMIT)),
+	LOTS_PAST_QUOTA(TOTAL_GB, DED_LIMIT) ";",
+	WITH_DESCENDANTS(LOTS_PAST_QUOTA(TOTAL_GB, DED_LIMIT)),
+	// LotsPastObjects variants
+	LOTS_PAST_QUOTA(SELF_OBJECTS, OBJ_LIMIT) ";",
+	WITH_DESCENDANTS(LOTS_PAST_QUOTA(SELF_OBJECTS, OBJ_LIMIT)),
+	LOTS_PAST_QUOTA(TOTAL_OBJECTS, OBJ_LIMIT) ";",
+	WITH_DESCENDANTS(LOTS_PAST_QUOTA(TOTAL_OBJECTS, OBJ_LIMIT)),
+
+	// EvictionCandidates: every lot holding data, with the most restricting dedicated_GB, expiration_time and
+	// deletion_time over the lot and its ancestors
+	"SELECT lot_usage.lot_name, lot_usage.self_GB, MIN(management_policy_attributes.dedicated_GB), "
+	"MIN(management_policy_attributes.expiration_time), MIN(management_policy_attributes.deletion_time) "
+	"FROM lot_usage "
+	"INNER JOIN lot_closure ON lot_closure.descendant = lot_usage.lot_name "
+	"INNER JOIN management_policy_attributes ON management_policy_attributes.lot_name = lot_closure.ancestor "
+	"WHERE lot_usage.self_GB > 0 GROUP BY lot_usage.lot_name;",
+
+	// SelfUsage, UpdateSelfUsage, AddChildrenUsage: the batched usage statements. Their usage columns are in the
+	// order of usage_keys in Lot::store_usage_batch
+	"SELECT self_GB, self_objects, self_GB_being_written, self_objects_being_written "
+	"FROM lot_usage WHERE lot_name = ?;",
+	"UPDATE lot_usage SET self_GB = ?, self_objects = ?, "
+	"self_GB_being_written = ?, self_objects_being_written = ? "
+	"WHERE lot_name = ?;",
+	"UPDATE lot_usage SET children_GB = children_GB + ?, children_objects = children_objects + ?, "
+	"children_GB_being_written = children_GB_being_written + ?, "
+	"children_objects_being_written = children_objects_being_written + ? "
+	"WHERE lot_name = ?;",
+	// UsageRecord
+	"SELECT self_GB, children_GB, self_objects, children_objects, self_GB_being_written, "
+	"children_GB_being_written, self_objects_being_written, children_objects_being_written "
+	"FROM lot_usage WHERE lot_name = ?;",
+
+	// WalkParents, WalkChildren: the anchor is the first hop, which reports a self edge only when ?2 is set,
+	// and the recursive term runs only when ?3 is set and never follows self edges. UNION deduplicates
+	// visited lots, so cycles terminate.
+	"WITH RECURSIVE walk(name) AS ("
+	"SELECT parent FROM parents WHERE lot_name = ?1 AND (parent != ?1 OR ?2) "
+	"UNION "
+	"SELECT parents.parent FROM parents JOIN walk ON parents.lot_name = walk.name "
+	"WHERE ?3 AND parents.parent != parents.lot_name) "
+	"SELECT name FROM walk ORDER BY name;",
+	"WITH RECURSIVE walk(name) AS ("
+	"SELECT lot_name FROM parents WHERE parent = ?1 AND (lot_name != ?1 OR ?2) "
+	"UNION "
+	"SELECT parents.lot_name FROM parents JOIN walk ON parents.parent = walk.name "
+	"WHERE ?3 AND parents.lot_name != parents.parent) "
+	"SELECT name FROM walk ORDER BY name;",
+
+	// JournalCheckpoint, SetJournalCheckpoint: the sequence number of the last usage journal record applied
+	"SELECT applied_seq FROM usage_journal WHERE id = 1;",
+	"INSERT OR REPLACE INTO usage_journal (id, applied_seq) VALUES (1, ?);",
+
+	// CacheGeneration
+	"SELECT generation FROM cache_generation WHERE id = 1;",
+};
+static_assert(std::size(query_catalogue) == QUERY_COUNT, "Every Query needs exactly one entry in query_catalogue");
+
+#undef WITH_DESCENDANTS
+#undef LOTS_PAST_EXPIRATION
+#undef LOTS_PAST_DELETION
+#undef LOTS_PAST_QUOTA
+#undef SELF_GB
+#undef TOTAL_GB
+#undef SELF_OBJECTS
+#undef TOTAL_OBJECTS
+#undef OPP_LIMIT
+#undef DED_LIMIT
+#undef OBJ_LIMIT
+
+} // namespace
+
+const char *query_sql(Query id) {
+	return query_catalogue[static_cast<size_t>(id)];
+}
+
 // Current target database schema version. Increment this when adding new migrations.
-static constexpr int TARGET_DB_VERSION = 1;
+static constexpr int TARGET_DB_VERSION = 6;
 
 /**
  * Helper function to create a Path record from JSON.
@@ -55,6 +286,199 @@ static db::Path create_path_record(const std::string &lot_name, const nlohmann::
 	return db::Path{lot_name, normalized_path, static_cast<int>(recursive), static_cast<int>(exclude)};
 }
 
+void recompute_children_usage(Storage &storage) {
+	immediate_transaction(storage, [&] {
+		auto parent_records = storage.get_all<Parent>();
+		auto usage_records = storage.get_all<LotUsage>();
+
+		std::unordered_map<std::string, size_t> usage_index;
+		for (size_t i = 0; i < usage_records.size(); ++i) {
+			usage_index.emplace(usage_records[i].lot_name, i);
+		}
+		std::unordered_map<std::string, std::vector<std::string>> children;
+		for (const auto &record : parent_records) {
+			if (record.lot_name != record.parent) {
+				children[record.parent].push_back(record.lot_name);
+			}
+		}
+
+		for (auto &usage : usage_records) {
+			// Sum the self_* columns of every distinct descendant
+			double children_GB = 0, children_GB_being_written = 0;
+			int64_t children_objects = 0, children_objects_being_written = 0;
+			std::unordered_set<std::string> visited{usage.lot_name};
+			std::vector<std::string> frontier{usage.lot_name};
+			for (size_t i = 0; i < frontier.size(); ++i) {
+				auto child_it = children.find(frontier[i]);
+				if (child_it == children.end()) {
+					continue;
+				}
+				for (const auto &child : child_it->second) {
+					if (!visited.insert(child).second) {
+						continue;
+					}
+					frontier.push_back(child);
+					auto usage_it = usage_index.find(child);
+					if (usage_it != usage_index.end()) {
+						const auto &child_usage = usage_records[usage_it->second];
+						children_GB += child_usage.self_GB;
+						children_GB_being_written += child_usage.self_GB_being_written;
+						children_objects += child_usage.self_objects;
+						children_objects_being_written += child_usage.self_objects_being_written;
+					}
+				}
+			}
+
+			if (usage.children_GB != children_GB || usage.children_GB_being_written != children_GB_being_written ||
+				usage.children_objects != children_objects ||
+				usage.children_objects_being_written != children_objects_being_written) {
+				usage.children_GB = children_GB;
+				usage.children_GB_being_written = children_GB_being_written;
+				usage.children_objects = children_objects;
+				usage.children_objects_being_written = children_objects_being_written;
+				storage.replace(usage);
+			}
+		}
+		return true; // Commit
+	});
+}
+
+void refresh_lot_closure(Storage &storage, const std::vector<std::string> &lot_names) {
+	// The affected lots are lot_names and everything below them. Their rows towards each other do not
+	// depend on the edges that changed, so the current table still lists the descendants correctly.
+	std::vector<std::string> affected;
+	std::unordered_set<std::string> is_affected;
+	for (const auto &lot_name : lot_names) {
+		if (is_affected.insert(lot_name).second) {
+			affected.push_back(lot_name);
+		}
+		for (auto &descendant :
+			 storage.select(&LotClosure::descendant, where(c(&LotClosure::ancestor) == lot_name))) {
+			if (is_affected.insert(descendant).second) {
+				affected.push_back(std::move(descendant));
+			}
+		}
+	}
+
+	// Order the affected lots so that each one comes after all of its affected parents
+	std::unordered_map<std::string, std::vector<std::string>> parents;
+	std::unordered_map<std::string, std::vector<std::string>> affected_children;
+	std::unordered_map<std::string, size_t> pending_parents;
+	std::vector<std::string> order;
+	for (const auto &lot_name : affected) {
+		auto &lot_parents = parents[lot_name];
+		size_t &pending = pending_parents[lot_name];
+		for (auto &parent : storage.select(&Parent::parent, where(c(&Parent::lot_name) == lot_name))) {
+			if (parent == lot_name) {
+				continue; // Self-parent edges mark roots and are not followed
+			}
+			if (is_affected.count(parent)) {
+				affected_children[parent].push_back(lot_name);
+				++pending;
+			}
+			lot_parents.push_back(std::move(parent));
+		}
+		if (pending == 0) {
+			order.push_back(lot_name);
+		}
+	}
+	for (size_t i = 0; i < order.size(); ++i) {
+		for (const auto &child : affected_children[order[i]]) {
+			if (--pending_parents[child] == 0) {
+				order.push_back(child);
+			}
+		}
+	}
+	if (order.size() != affected.size()) {
+		throw std::runtime_error("The lot hierarchy contains a dependency cycle");
+	}
+
+	// A lot's ancestors are its parents' ancestors one level further up. Unaffected parents are read back
+	// from the table once and kept alongside the freshly computed sets.
+	std::unordered_map<std::string, std::unordered_map<std::string, int>> ancestors;
+	for (const auto &lot_name : order) {
+		std::unordered_map<std::string, int> lot_ancestors{{lot_name, 0}};
+		for (const auto &parent : parents[lot_name]) {
+			auto parent_it = ancestors.find(parent);
+			if (parent_it == ancestors.end()) {
+				std::unordered_map<std::string, int> parent_ancestors{{parent, 0}};
+				for (const auto &row : storage.get_all<LotClosure>(where(c(&LotClosure::descendant) == parent))) {
+					parent_ancestors[row.ancestor] = row.depth;
+				}
+				parent_it = ancestors.emplace(parent, std::move(parent_ancestors)).first;
+			}
+			for (const auto &[ancestor, depth] : parent_it->second) {
+				auto it = lot_ancestors.find(ancestor);
+				if (it == lot_ancestors.end()) {
+					lot_ancestors.emplace(ancestor, depth + 1);
+				} else if (depth + 1 < it->second) {
+					it->second = depth + 1;
+				}
+			}
+		}
+
+		storage.remove_all<LotClosure>(where(c(&LotClosure::descendant) == lot_name));
+		for (const auto &[ancestor, depth] : lot_ancestors) {
+			storage.replace(LotClosure{ancestor, lot_name, depth});
+		}
+		ancestors[lot_name] = std::move(lot_ancestors);
+	}
+}
+
+void rebuild_lot_closure(Storage &storage) {
+	immediate_transaction(storage, [&] {
+		storage.remove_all<LotClosure>();
+		auto lot_names = storage.select(&Parent::lot_name);
+		std::sort(lot_names.begin(), lot_names.end());
+		lot_names.erase(std::unique(lot_names.begin(), lot_names.end()), lot_names.end());
+		refresh_lot_closure(storage, lot_names);
+		return true; // Commit
+	});
+}
+
+int64_t cache_generation(Storage &storage) {
+	auto record = storage.get_pointer<CacheGeneration>(1);
+	return record ? record->generation : 0;
+}
+
+/**
+ * Put the cache_generation row and the triggers that bump it in place, if they are not there yet.
+ * sqlite_orm cannot declare triggers, so they are created with raw SQL on a connection of their own.
+ *
+ * @param db_path Path of the database, whose schema is already in sync
+ * @throws std::runtime_error if the statements fail
+ */
+static void install_cache_generation(const std::string &db_path) {
+	std::string script = "INSERT OR IGNORE INTO cache_generation (id, generation) VALUES (1, 0);";
+	for (const char *table : {"owners", "parents", "paths"}) {
+		for (const char *event : {"INSERT", "UPDATE", "DELETE"}) {
+			script += std::string("CREATE TRIGGER IF NOT EXISTS ") + table + "_" + event + "_generation AFTER " +
+					  event + " ON " + table +
+					  " BEGIN UPDATE cache_generation SET generation = generation + 1 WHERE id = 1; END;";
+		}
+	}
+
+	sqlite3 *conn = nullptr;
+	if (sqlite3_open(db_path.c_str(), &conn) != SQLITE_OK) {
+		std::string error = conn ? sqlite3_errmsg(conn) : "out of memory";
+		sqlite3_close(conn);
+		throw std::runtime_error("Failed to open the database to install the cache generation: " + error);
+	}
+	on_storage_open(conn);
+	script = "BEGIN IMMEDIATE;" + script + "COMMIT;";
+	char *error = nullptr;
+	int rc = sqlite3_exec(conn, script.c_str(), nullptr, nullptr, &error);
+	std::string message = error ? error : "";
+	sqlite3_free(error);
+	if (rc != SQLITE_OK) {
+		sqlite3_exec(conn, "ROLLBACK", nullptr, nullptr, nullptr);
+	}
+	sqlite3_close(conn);
+	if (rc != SQLITE_OK) {
+		throw std::runtime_error("Failed to install the cache generation: " + message);
+	}
+}
+
 /**
  * Perform explicit schema migrations between database versions.
  *
@@ -109,6 +533,43 @@ void migrate_db(Storage &storage, int current_version, int target_version) {
 				}
 				break;
 			}
+			case 2: {
+				// Migration v1 -> v2:
+				// children_* usage columns are now maintained incrementally by usage updates instead of
+				// being recomputed on every read. Databases written by older versions may hold stale
+				// values, so recompute them once here.
+				recompute_children_usage(storage);
+				break;
+			}
+			case 3: {
+				// Migration v2 -> v3:
+				// Secondary indexes on parents(parent), paths(lot_name) and the management policy
+				// expiration/deletion times. Like the 'exclude' column of v1, they are declared in
+				// create_storage() and created by sync_schema(), which runs before migrations and only
+				// issues CREATE INDEX IF NOT EXISTS for them, so no table data is touched and there is
+				// nothing left to do here.
+				break;
+			}
+			case 4: {
+				// Migration v3 -> v4:
+				// The lot_closure table (created by sync_schema()) materializes every lot's ancestors so that
+				// hierarchy-wide queries become single indexed joins. Fill it from the parents table.
+				rebuild_lot_closure(storage);
+				break;
+			}
+			case 5: {
+				// Migration v4 -> v5:
+				// The usage_journal table (created by sync_schema()) holds the checkpoint of the usage journal.
+				// A database without a row has applied no journal records, so there is nothing to fill in.
+				break;
+			}
+			case 6: {
+				// Migration v5 -> v6:
+				// The cache_generation table (created by sync_schema()) counts writes to the owners, parents
+				// and paths tables. Its row and the triggers that bump it are put in place by
+				// install_cache_generation() every time the database is opened, fresh or not.
+				break;
+			}
 			default:
 				throw std::runtime_error("No migration defined for version " + std::to_string(v));
 		}
@@ -116,6 +577,13 @@ void migrate_db(Storage &storage, int current_version, int target_version) {
 }
 
 std::pair<bool, std::string> StorageManager::get_db_path() {
+	// Resolving the path costs a passwd lookup and two mkdir calls, so it is done once per lot home
+	auto &s = state();
+	std::lock_guard<std::mutex> lock(s.m_db_path_mutex);
+	if (!s.m_db_path.empty()) {
+		return std::make_pair(true, s.m_db_path);
+	}
+
 	const char *lot_env_dir = getenv("LOT_HOME");
 
 	auto bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
@@ -154,154 +622,279 @@ std::pair<bool, std::string> StorageManager::get_db_path() {
 		return std::make_pair(false, "Unable to create directory " + lot_db_dir + ": errno: " + std::to_string(errno));
 	}
 
-	return std::make_pair(true, lot_db_dir + "/lotman_cpp.sqlite");
+	s.m_db_path = lot_db_dir + "/lotman_cpp.sqlite";
+	return std::make_pair(true, s.m_db_path);
 }
 
-Storage &StorageManager::get_storage() {
-	if (!m_initialized) {
-		auto db_path_result = get_db_path();
-		if (!db_path_result.first) {
-			throw std::runtime_error("Failed to get database path: " + db_path_result.second);
-		}
+bool StorageManager::initialized() {
+	return state().m_initialized.load(std::memory_order_acquire);
+}
 
-		m_storage = std::make_unique<Storage>(create_storage(db_path_result.second));
+std::unique_ptr<Storage> StorageManager::initialize_storage(const std::string &db_path) {
+	auto storage = std::make_unique<Storage>(create_storage(db_path));
 
-		// Enable WAL mode for better concurrency
-		if (!m_wal_enabled) {
-			m_storage->pragma.journal_mode(journal_mode::WAL);
-			m_wal_enabled = true;
-		}
+	// Enable WAL mode for better concurrency
+	storage->pragma.journal_mode(journal_mode::WAL);
 
-		// Set busy timeout
-		m_storage->busy_timeout(*lotman_db_timeout);
+	// Check for existing database state before syncing schema
+	bool schema_versions_exists = false;
+	bool owners_exists = false;
 
-		// Check for existing database state before syncing schema
-		bool schema_versions_exists = false;
-		bool owners_exists = false;
+	try {
+		storage->count<SchemaVersion>();
+		schema_versions_exists = true;
+	} catch (const std::system_error &) {
+		// Table does not exist - this is expected for fresh or legacy databases
+		schema_versions_exists = false;
+	}
 
+	// If there's no schema_versions table, check for owners table to detect databases
+	// that exist but predate schema_versions
+	if (!schema_versions_exists) {
 		try {
-			m_storage->count<SchemaVersion>();
-			schema_versions_exists = true;
+			storage->count<Owner>();
+			owners_exists = true;
 		} catch (const std::system_error &) {
-			// Table does not exist - this is expected for fresh or legacy databases
-			schema_versions_exists = false;
+			// Table does not exist - this is a fresh database
+			owners_exists = false;
 		}
+	}
 
-		// If there's no schema_versions table, check for owners table to detect databases
-		// that exist but predate schema_versions
-		if (!schema_versions_exists) {
-			try {
-				m_storage->count<Owner>();
-				owners_exists = true;
-			} catch (const std::system_error &) {
-				// Table does not exist - this is a fresh database
-				owners_exists = false;
+	// Determine whether this is a fresh database or existing one
+	bool is_fresh_db = !schema_versions_exists && !owners_exists;
+
+	if (is_fresh_db) {
+		// Fresh database: safe to use sync_schema() to create all tables
+		storage->sync_schema();
+	} else {
+		// Existing database: use sync_schema_simulate() to check what would happen
+		// before making any changes. This protects against accidental data loss.
+		auto simulation = storage->sync_schema_simulate(true); // true = preserve mode
+
+		// Check if any table would be dropped and recreated (data loss!)
+		for (const auto &table_result : simulation) {
+			if (table_result.second == sqlite_orm::sync_schema_result::dropped_and_recreated) {
+				throw std::runtime_error(
+					"Database schema mismatch detected for table '" + table_result.first +
+					"'. The required schema change would cause data loss. "
+					"This may indicate database corruption or an incompatible schema change. "
+					"Please backup your database and contact support, or delete the database to start fresh.");
 			}
 		}
 
-		// Determine whether this is a fresh database or existing one
-		bool is_fresh_db = !schema_versions_exists && !owners_exists;
+		// Safe to proceed - use preserve mode to be extra careful
+		storage->sync_schema(true);
+	}
+
+	// Initialize or migrate database version
+	int current_version = 0;
 
-		if (is_fresh_db) {
-			// Fresh database: safe to use sync_schema() to create all tables
-			m_storage->sync_schema();
+	if (schema_versions_exists) {
+		auto version_ptr = storage->get_pointer<SchemaVersion>(1);
+		if (version_ptr) {
+			current_version = version_ptr->version;
 		} else {
-			// Existing database: use sync_schema_simulate() to check what would happen
-			// before making any changes. This protects against accidental data loss.
-			auto simulation = m_storage->sync_schema_simulate(true); // true = preserve mode
-
-			// Check if any table would be dropped and recreated (data loss!)
-			for (const auto &table_result : simulation) {
-				if (table_result.second == sqlite_orm::sync_schema_result::dropped_and_recreated) {
-					throw std::runtime_error(
-						"Database schema mismatch detected for table '" + table_result.first +
-						"'. The required schema change would cause data loss. "
-						"This may indicate database corruption or an incompatible schema change. "
-						"Please backup your database and contact support, or delete the database to start fresh.");
-				}
+			// Table existed but no row with id=1. Should not happen if we manage it correctly.
+			// Need to check for owners table here since we skipped that check earlier
+			// (owners_exists was only populated when schema_versions_exists was false)
+			bool has_owners = false;
+			try {
+				storage->count<Owner>();
+				has_owners = true;
+			} catch (const std::system_error &) {
+				has_owners = false;
 			}
 
-			// Safe to proceed - use preserve mode to be extra careful
-			m_storage->sync_schema(true);
+			if (has_owners)
+				current_version = 1;
+			else
+				current_version = TARGET_DB_VERSION;
+
+			storage->replace(SchemaVersion{1, current_version});
+		}
+	} else {
+		// schema_versions table did not exist.
+		if (owners_exists) {
+			// Existing v0 database (pre-schema-versioning)
+			// These databases need migration to add trailing slashes to paths
+			current_version = 0;
+			storage->replace(SchemaVersion{1, current_version});
+		} else {
+			// Fresh database
+			current_version = TARGET_DB_VERSION;
+			storage->replace(SchemaVersion{1, current_version});
 		}
+	}
 
-		// Initialize or migrate database version
-		int current_version = 0;
+	if (current_version > TARGET_DB_VERSION) {
+		throw std::runtime_error("Database schema version (" + std::to_string(current_version) +
+								 ") is newer than supported version (" + std::to_string(TARGET_DB_VERSION) +
+								 "). Cannot downgrade. Please use a newer version of the application.");
+	}
 
-		if (schema_versions_exists) {
-			auto version_ptr = m_storage->get_pointer<SchemaVersion>(1);
-			if (version_ptr) {
-				current_version = version_ptr->version;
-			} else {
-				// Table existed but no row with id=1. Should not happen if we manage it correctly.
-				// Need to check for owners table here since we skipped that check earlier
-				// (owners_exists was only populated when schema_versions_exists was false)
-				bool has_owners = false;
-				try {
-					m_storage->count<Owner>();
-					has_owners = true;
-				} catch (const std::system_error &) {
-					has_owners = false;
-				}
+	if (current_version < TARGET_DB_VERSION) {
+		migrate_db(*storage, current_version, TARGET_DB_VERSION);
+		storage->replace(SchemaVersion{1, TARGET_DB_VERSION});
+	}
+	install_cache_generation(db_path);
 
-				if (has_owners)
-					current_version = 1;
-				else
-					current_version = TARGET_DB_VERSION;
+	return storage;
+}
 
-				m_storage->replace(SchemaVersion{1, current_version});
-			}
-		} else {
-			// schema_versions table did not exist.
-			if (owners_exists) {
-				// Existing v0 database (pre-schema-versioning)
-				// These databases need migration to add trailing slashes to paths
-				current_version = 0;
-				m_storage->replace(SchemaVersion{1, current_version});
-			} else {
-				// Fresh database
-				current_version = TARGET_DB_VERSION;
-				m_storage->replace(SchemaVersion{1, current_version});
-			}
+Storage &StorageManager::get_storage() {
+	lotman_ctx &ctx = current_ctx();
+	auto &s = ctx.storage;
+	auto it = t_storage.find(ctx.id);
+	if (it != t_storage.end() && it->second.storage &&
+		it->second.generation == s.m_generation.load(std::memory_order_acquire)) {
+		return *it->second.storage;
+	}
+
+	if (it == t_storage.end()) {
+		// Drop whatever this thread still holds for contexts that were freed since it last got here
+		for (auto stale = t_storage.begin(); stale != t_storage.end();) {
+			stale = ctx_alive(stale->first) ? std::next(stale) : t_storage.erase(stale);
 		}
+		it = t_storage.emplace(ctx.id, ThreadStorage{}).first;
+	}
+	auto &local = it->second;
 
-		if (current_version > TARGET_DB_VERSION) {
-			throw std::runtime_error("Database schema version (" + std::to_string(current_version) +
-									 ") is newer than supported version (" + std::to_string(TARGET_DB_VERSION) +
-									 "). Cannot downgrade. Please use a newer version of the application.");
+	bool initialized_here = false;
+	{
+		std::lock_guard<std::mutex> lock(s.m_init_mutex);
+		auto db_path_result = get_db_path();
+		if (!db_path_result.first) {
+			throw std::runtime_error("Failed to get database path: " + db_path_result.second);
 		}
 
-		if (current_version < TARGET_DB_VERSION) {
-			migrate_db(*m_storage, current_version, TARGET_DB_VERSION);
-			m_storage->replace(SchemaVersion{1, TARGET_DB_VERSION});
+		if (!s.m_initialized.load(std::memory_order_relaxed)) {
+			local.storage = initialize_storage(db_path_result.second);
+			s.m_initialized.store(true, std::memory_order_release);
+			initialized_here = true;
+		} else {
+			// The schema is already in place, this thread only needs its own storage on it
+			local.storage = std::make_unique<Storage>(create_storage(db_path_result.second));
 		}
+		local.generation = s.m_generation.load(std::memory_order_relaxed);
+	}
 
-		m_initialized = true;
+	// Open the minimum number of pooled connections now rather than on the first requests.
+	// Warming acquires pooled connections, which comes back here, so the lock must be released first.
+	if (initialized_here) {
+		ConnectionPool::warm();
+		// Apply whatever a process that died left in the usage journal. Failing to do so leaves the journal
+		// in place for the next attempt, and must not keep the database from being used.
+		UsageJournal::recover();
 	}
 
-	return *m_storage;
+	return *local.storage;
 }
 
 void StorageManager::reset() {
-	// First clear the connection pool and statement cache since they hold
-	// connections/statements for the old database
-	PreparedStatementCache::clear_all();
-	ConnectionPool::clear();
+	// Pending deltas that are journaled stay in the journal of the old database, to be replayed when it is
+	// opened again. The journal is closed before the connections it flushes through go away.
+	UsageAccumulator::detach();
 
-	m_storage.reset();
-	m_initialized = false;
-	m_wal_enabled = false;
+	// First clear the connection pool since it holds connections (and their cached statements)
+	// for the old database. The caches load through get_storage() while holding their own locks,
+	// so they are cleared before the init lock is taken.
+	ConnectionPool::clear();
+	HierarchyCache::invalidate();
+	AuthorizationCache::invalidate();
+	PathCache::invalidate();
+
+	lotman_ctx &ctx = current_ctx();
+	auto &s = ctx.storage;
+	std::lock_guard<std::mutex> lock(s.m_init_mutex);
+	s.m_generation.fetch_add(1, std::memory_order_acq_rel);
+	s.m_initialized.store(false, std::memory_order_release);
+	t_storage.erase(ctx.id);
+
+	std::lock_guard<std::mutex> path_lock(s.m_db_path_mutex);
+	s.m_db_path.clear();
 }
 
 // ConnectionPool implementation
 
-sqlite3 *ConnectionPool::acquire() {
-	std::lock_guard<std::mutex> lock(m_mutex);
+namespace {
+
+// Waits for a lock held by another connection the way sqlite3_busy_timeout() does, backing off up to 100ms at
+// a time until "db_timeout" has passed, but counts every wait. The timeout is read on every call, so a change
+// to it applies to connections that are already open.
+int busy_handler(void *, int count) {
+	static const int delays[] = {1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100};
+	static const int totals[] = {0, 1, 3, 8, 18, 33, 53, 78, 103, 128, 178, 228};
+	constexpr int num_delays = static_cast<int>(std::size(delays));
+
+	int delay = delays[std::min(count, num_delays - 1)];
+	int waited = count < num_delays ? totals[count] : totals[num_delays - 1] + delay * (count - (num_delays - 1));
+	int timeout = lotman_db_timeout->load();
+	if (waited + delay > timeout) {
+		delay = timeout - waited;
+		if (delay <= 0) {
+			return 0;
+		}
+	}
+
+	Metrics::increment(Counter::BusyRetries);
+	SqlTrace::add_busy_wait(std::chrono::milliseconds(delay));
+	std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+	return 1;
+}
+
+} // namespace
 
-	if (!m_pool.empty()) {
-		sqlite3 *conn = m_pool.back();
-		m_pool.pop_back();
-		return conn;
+void on_storage_open(sqlite3 *db) {
+	sqlite3_busy_handler(db, busy_handler, nullptr);
+	SqlTrace::attach(db);
+}
+
+sqlite3 *ConnectionPool::acquire(std::unique_ptr<StatementCatalogue> &catalogue) {
+	// Ensure storage is initialized (creates tables if needed). Initializing warms the pool,
+	// so this has to happen before the pool is locked.
+	StorageManager::get_storage();
+
+	lotman_ctx &ctx = current_ctx();
+	auto &s = ctx.pool;
+	if (s.m_thread_affinity.load(std::memory_order_relaxed)) {
+		auto [it, inserted] = t_connections.try_emplace(ctx.id);
+		if (inserted) {
+			// Close this thread's connections to contexts that were freed
+			for (auto stale = t_connections.begin(); stale != t_connections.end();) {
+				stale = ctx_alive(stale->first) ? std::next(stale) : t_connections.erase(stale);
+			}
+		}
+		auto &local = it->second;
+		uint64_t generation = s.m_generation.load(std::memory_order_acquire);
+		if (local.conn && !local.in_use && local.generation != generation) {
+			local.close();
+		}
+		if (!local.conn) {
+			auto db_path = StorageManager::get_db_path();
+			if (db_path.first) {
+				Metrics::increment(Counter::PoolMisses);
+				local.conn = open_connection(db_path.second, local.catalogue);
+				local.generation = generation;
+			}
+		} else if (!local.in_use) {
+			Metrics::increment(Counter::PoolHits);
+		}
+		if (local.conn && !local.in_use) {
+			local.in_use = true;
+			catalogue = std::move(local.catalogue);
+			return local.conn;
+		}
+		// The thread's own connection is already in use further up its stack, so share one
+	}
+
+	std::lock_guard<std::mutex> lock(s.m_mutex);
+
+	if (!s.m_pool.empty()) {
+		IdleConnection idle = std::move(s.m_pool.back());
+		s.m_pool.pop_back();
+		catalogue = std::move(idle.catalogue);
+		Metrics::increment(Counter::PoolHits);
+		return idle.conn;
 	}
 
 	// No available connections, create a new one
@@ -309,12 +902,13 @@ sqlite3 *ConnectionPool::acquire() {
 	if (!db_path.first) {
 		return nullptr;
 	}
+	Metrics::increment(Counter::PoolMisses);
+	return open_connection(db_path.second, catalogue);
+}
 
-	// Ensure storage is initialized (creates tables if needed)
-	StorageManager::get_storage();
-
+sqlite3 *ConnectionPool::open_connection(const std::string &db_path, std::unique_ptr<StatementCatalogue> &catalogue) {
 	sqlite3 *conn = nullptr;
-	int rc = sqlite3_open(db_path.second.c_str(), &conn);
+	int rc = sqlite3_open(db_path.c_str(), &conn);
 	if (rc != SQLITE_OK) {
 		if (conn) {
 			sqlite3_close(conn);
@@ -324,59 +918,182 @@ sqlite3 *ConnectionPool::acquire() {
 
 	// Enable WAL mode for better concurrency across processes
 	sqlite3_exec(conn, "PRAGMA journal_mode=WAL", nullptr, nullptr, nullptr);
-	sqlite3_busy_timeout(conn, *lotman_db_timeout);
+	sqlite3_busy_handler(conn, busy_handler, nullptr);
+
+	auto prepared = std::make_unique<StatementCatalogue>();
+	if (!prepared->prepare(conn).empty()) {
+		prepared.reset();
+		sqlite3_close(conn);
+		return nullptr;
+	}
+	catalogue = std::move(prepared);
 	return conn;
 }
 
-void ConnectionPool::release(sqlite3 *conn) {
+void ConnectionPool::close_connection(sqlite3 *conn, std::unique_ptr<StatementCatalogue> catalogue) {
+	// Every statement has to be finalized before the connection can close
+	catalogue.reset();
+	PreparedStatementCache::clear_for_connection(conn);
+	sqlite3_close(conn);
+}
+
+void ConnectionPool::release(sqlite3 *conn, std::unique_ptr<StatementCatalogue> catalogue) {
 	if (!conn)
 		return;
 
-	bool should_close = false;
+	auto *local = thread_connection();
+	if (local && conn == local->conn) {
+		local->catalogue = std::move(catalogue);
+		local->in_use = false;
+		return;
+	}
+
+	auto &s = state();
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
+		std::lock_guard<std::mutex> lock(s.m_mutex);
 
-		if (m_pool.size() >= m_max_size) {
-			should_close = true;
-		} else {
-			m_pool.push_back(conn);
+		if (s.m_pool.size() < s.m_max_size) {
+			s.m_pool.push_back(IdleConnection{conn, std::move(catalogue)});
+			return;
 		}
 	}
 
-	if (should_close) {
-		// Clear cached statements outside of ConnectionPool mutex to avoid deadlock
-		PreparedStatementCache::clear_for_connection(conn);
-		sqlite3_close(conn);
-	}
+	// Clear cached statements outside of ConnectionPool mutex to avoid deadlock
+	close_connection(conn, std::move(catalogue));
 }
 
 void ConnectionPool::clear() {
-	std::lock_guard<std::mutex> lock(m_mutex);
+	auto &s = state();
+	// Other threads close their own connections once they notice the new generation
+	s.m_generation.fetch_add(1, std::memory_order_release);
+	auto *local = thread_connection();
+	if (local && !local->in_use) {
+		local->close();
+	}
 
-	for (auto *conn : m_pool) {
-		PreparedStatementCache::clear_for_connection(conn);
-		sqlite3_close(conn);
+	std::lock_guard<std::mutex> lock(s.m_mutex);
+
+	for (auto &idle : s.m_pool) {
+		close_connection(idle.conn, std::move(idle.catalogue));
 	}
-	m_pool.clear();
+	s.m_pool.clear();
 }
 
 void ConnectionPool::set_max_size(size_t size) {
-	std::lock_guard<std::mutex> lock(m_mutex);
-	m_max_size = size;
+	auto &s = state();
+	std::lock_guard<std::mutex> lock(s.m_mutex);
+	s.m_max_size = size;
 
 	// Trim pool if it exceeds new max size
-	while (m_pool.size() > m_max_size) {
-		sqlite3 *conn = m_pool.back();
-		m_pool.pop_back();
-		PreparedStatementCache::clear_for_connection(conn);
+	while (s.m_pool.size() > s.m_max_size) {
+		IdleConnection idle = std::move(s.m_pool.back());
+		s.m_pool.pop_back();
+		close_connection(idle.conn, std::move(idle.catalogue));
+	}
+}
+
+void ConnectionPool::set_min_size(size_t size) {
+	auto &s = state();
+	{
+		std::lock_guard<std::mutex> lock(s.m_mutex);
+		s.m_min_size = size;
+	}
+
+	if (StorageManager::initialized()) {
+		warm();
+	}
+}
+
+size_t ConnectionPool::get_min_size() {
+	auto &s = state();
+	std::lock_guard<std::mutex> lock(s.m_mutex);
+	return s.m_min_size;
+}
+
+void ConnectionPool::warm() {
+	auto &s = state();
+	auto db_path = StorageManager::get_db_path();
+	if (!db_path.first) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(s.m_mutex);
+	while (s.m_pool.size() < std::min(s.m_min_size, s.m_max_size)) {
+		IdleConnection idle;
+		idle.conn = open_connection(db_path.second, idle.catalogue);
+		if (!idle.conn) {
+			// The connection will be retried, and its error reported, when it is acquired
+			return;
+		}
+		s.m_pool.push_back(std::move(idle));
+	}
+}
+
+size_t ConnectionPool::size() {
+	auto &s = state();
+	std::lock_guard<std::mutex> lock(s.m_mutex);
+	return s.m_pool.size();
+}
+
+void ConnectionPool::set_thread_affinity(bool enabled) {
+	state().m_thread_affinity.store(enabled, std::memory_order_relaxed);
+}
+
+bool ConnectionPool::get_thread_affinity() {
+	return state().m_thread_affinity.load(std::memory_order_relaxed);
+}
+
+ConnectionPool::ThreadConnection *ConnectionPool::thread_connection() {
+	auto it = t_connections.find(current_ctx().id);
+	return it != t_connections.end() ? &it->second : nullptr;
+}
+
+void ConnectionPool::ThreadConnection::close() {
+	catalogue.reset();
+	for (auto &[query, cached] : statements) {
+		sqlite3_finalize(cached.stmt);
+	}
+	statements.clear();
+	if (conn) {
 		sqlite3_close(conn);
+		conn = nullptr;
 	}
+	in_use = false;
+}
+
+// StatementCatalogue implementation
+
+StatementCatalogue::~StatementCatalogue() {
+	for (auto *stmt : m_statements) {
+		sqlite3_finalize(stmt); // No-op for statements never prepared
+	}
+}
+
+std::string StatementCatalogue::prepare(sqlite3 *db) {
+	for (size_t i = 0; i < QUERY_COUNT; ++i) {
+		int rc = sqlite3_prepare_v3(db, query_catalogue[i], -1, SQLITE_PREPARE_PERSISTENT, &m_statements[i], nullptr);
+		if (rc != SQLITE_OK) {
+			return "Call to sqlite3_prepare_v3 failed for catalogued query " + std::to_string(i) +
+				   ": sqlite errno: " + std::to_string(rc) + " - " + std::string(sqlite3_errmsg(db));
+		}
+	}
+	return "";
 }
 
 // PreparedStatementCache implementation
 
 std::pair<sqlite3_stmt *, std::string> PreparedStatementCache::get_or_prepare(sqlite3 *db, const std::string &query) {
-	{
+	auto *local = ConnectionPool::thread_connection();
+	if (local && db == local->conn) {
+		// The calling thread owns this connection, so its statements need no locking. A statement stays in
+		// the cache while checked out; a nested use of the same query gets a fresh one.
+		auto it = local->statements.find(query);
+		if (it != local->statements.end() && !it->second.checked_out) {
+			it->second.checked_out = true;
+			Metrics::increment(Counter::StatementCacheHits);
+			return std::make_pair(it->second.stmt, "");
+		}
+	} else {
 		std::lock_guard<std::mutex> lock(m_mutex);
 
 		auto conn_it = m_cache.find(db);
@@ -386,12 +1103,14 @@ std::pair<sqlite3_stmt *, std::string> PreparedStatementCache::get_or_prepare(sq
 				// Found cached statement, remove from cache (will be returned later)
 				sqlite3_stmt *stmt = stmt_it->second;
 				conn_it->second.erase(stmt_it);
+				Metrics::increment(Counter::StatementCacheHits);
 				return std::make_pair(stmt, "");
 			}
 		}
 	}
 
 	// Not in cache, prepare a new statement
+	Metrics::increment(Counter::StatementCacheMisses);
 	sqlite3_stmt *stmt = nullptr;
 	int rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
 	if (rc != SQLITE_OK) {
@@ -406,6 +1125,20 @@ void PreparedStatementCache::return_statement(sqlite3 *db, const std::string &qu
 	if (!stmt)
 		return;
 
+	auto *local = ConnectionPool::thread_connection();
+	if (local && db == local->conn) {
+		auto [it, inserted] = local->statements.try_emplace(query, ConnectionPool::CachedStatement{stmt, false});
+		if (!inserted) {
+			if (it->second.stmt == stmt) {
+				it->second.checked_out = false;
+			} else {
+				// A nested use prepared its own copy
+				sqlite3_finalize(stmt);
+			}
+		}
+		return;
+	}
+
 	std::lock_guard<std::mutex> lock(m_mutex);
 
 	// Check if there's already a statement cached for this query
@@ -418,6 +1151,20 @@ void PreparedStatementCache::return_statement(sqlite3 *db, const std::string &qu
 	}
 }
 
+void PreparedStatementCache::discard_statement(sqlite3 *db, const std::string &query, sqlite3_stmt *stmt) {
+	if (!stmt)
+		return;
+
+	auto *local = ConnectionPool::thread_connection();
+	if (local && db == local->conn) {
+		auto it = local->statements.find(query);
+		if (it != local->statements.end() && it->second.stmt == stmt) {
+			local->statements.erase(it);
+		}
+	}
+	sqlite3_finalize(stmt);
+}
+
 void PreparedStatementCache::clear_for_connection(sqlite3 *db) {
 	std::lock_guard<std::mutex> lock(m_mutex);
 
@@ -444,7 +1191,7 @@ void PreparedStatementCache::clear_all() {
 // PooledConnection implementation
 
 PooledConnection::PooledConnection(TransactionType txn_type) {
-	m_db = ConnectionPool::acquire();
+	m_db = ConnectionPool::acquire(m_catalogue);
 	if (!m_db) {
 		m_error = "Failed to acquire connection from pool";
 		return;
@@ -471,7 +1218,7 @@ PooledConnection::PooledConnection(TransactionType txn_type) {
 			int rc = sqlite3_exec(m_db, txn_cmd, nullptr, nullptr, nullptr);
 			if (rc != SQLITE_OK) {
 				m_error = "Failed to begin transaction: sqlite errno: " + std::to_string(rc);
-				ConnectionPool::release(m_db);
+				ConnectionPool::release(m_db, std::move(m_catalogue));
 				m_db = nullptr;
 				return;
 			}
@@ -482,6 +1229,7 @@ PooledConnection::PooledConnection(TransactionType txn_type) {
 
 PooledConnection::PooledConnection(PooledConnection &&other) noexcept
 	: m_db(other.m_db),
+	  m_catalogue(std::move(other.m_catalogue)),
 	  m_in_transaction(other.m_in_transaction),
 	  m_committed(other.m_committed),
 	  m_error(std::move(other.m_error)) {
@@ -496,10 +1244,11 @@ PooledConnection &PooledConnection::operator=(PooledConnection &&other) noexcept
 			if (m_in_transaction && !m_committed) {
 				sqlite3_exec(m_db, "ROLLBACK", nullptr, nullptr, nullptr);
 			}
-			ConnectionPool::release(m_db);
+			ConnectionPool::release(m_db, std::move(m_catalogue));
 		}
 
 		m_db = other.m_db;
+		m_catalogue = std::move(other.m_catalogue);
 		m_in_transaction = other.m_in_transaction;
 		m_committed = other.m_committed;
 		m_error = std::move(other.m_error);
@@ -515,7 +1264,7 @@ PooledConnection::~PooledConnection() {
 		if (m_in_transaction && !m_committed) {
 			sqlite3_exec(m_db, "ROLLBACK", nullptr, nullptr, nullptr);
 		}
-		ConnectionPool::release(m_db);
+		ConnectionPool::release(m_db, std::move(m_catalogue));
 	}
 }
 
@@ -541,6 +1290,42 @@ void PooledConnection::rollback() {
 	}
 }
 
+// QueryStmt implementation
+
+QueryStmt::QueryStmt(const PooledConnection &conn, Query id) : m_id(id) {
+	if (!conn.valid()) {
+		m_error = conn.error();
+		return;
+	}
+
+	StatementCatalogue *catalogue = conn.catalogue();
+	if (catalogue) {
+		m_stmt = catalogue->checkout(id);
+		if (m_stmt) {
+			m_catalogue = catalogue;
+			Metrics::increment(Counter::StatementCacheHits);
+			return;
+		}
+	}
+
+	// A nested use of the same query needs a statement of its own
+	Metrics::increment(Counter::StatementCacheMisses);
+	int rc = sqlite3_prepare_v2(conn.get(), query_sql(id), -1, &m_stmt, nullptr);
+	if (rc != SQLITE_OK) {
+		m_error = "Call to sqlite3_prepare_v2 failed: sqlite errno: " + std::to_string(rc) + " - " +
+				  std::string(sqlite3_errmsg(conn.get()));
+		m_stmt = nullptr;
+	}
+}
+
+QueryStmt::~QueryStmt() {
+	if (m_catalogue) {
+		m_catalogue->checkin(m_id);
+	} else if (m_stmt) {
+		sqlite3_finalize(m_stmt);
+	}
+}
+
 // ScopedConnection implementation
 
 ScopedConnection::ScopedConnection(TransactionType txn_type) {
@@ -565,7 +1350,7 @@ ScopedConnection::ScopedConnection(TransactionType txn_type) {
 
 	// Enable WAL mode for better concurrency across processes
 	sqlite3_exec(m_db, "PRAGMA journal_mode=WAL", nullptr, nullptr, nullptr);
-	sqlite3_busy_timeout(m_db, *lotman_db_timeout);
+	sqlite3_busy_handler(m_db, busy_handler, nullptr);
 
 	// Begin transaction if requested
 	if (txn_type != TransactionType::None) {
@@ -660,176 +1445,208 @@ void ScopedConnection::rollback() {
 
 // Raw functions for complex SQL queries
 
-std::pair<std::vector<std::string>, std::string> SQL_get_matches(const std::string &dynamic_query,
-																 const std::map<std::string, std::vector<int>> &str_map,
-																 const std::map<int64_t, std::vector<int>> &int_map,
-																 const std::map<double, std::vector<int>> &double_map) {
-	std::vector<std::string> return_vec;
-
-	try {
-		// Use pooled connection with deferred transaction for read consistency
-		PooledConnection conn(PooledConnection::TransactionType::Deferred);
-		if (!conn.valid()) {
-			return std::make_pair(return_vec, conn.error());
-		}
-
-		// Get or prepare the statement (uses cache)
-		auto [stmt, prep_error] = PreparedStatementCache::get_or_prepare(conn.get(), dynamic_query);
-		if (!stmt) {
-			return std::make_pair(return_vec, prep_error);
-		}
-
-		// RAII guard that returns statement to cache on scope exit
-		CachedStmtGuard stmt_guard(conn.get(), dynamic_query, stmt);
-
-		// Bind parameters
-		int rc;
-		for (const auto &[value, positions] : str_map) {
-			for (int pos : positions) {
-				rc = sqlite3_bind_text(stmt, pos, value.c_str(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
-				if (rc != SQLITE_OK) {
-					stmt_guard.discard(); // Don't cache a statement that failed
-					return std::make_pair(return_vec,
-										  "Call to sqlite3_bind_text failed: sqlite3 errno: " + std::to_string(rc));
-				}
+namespace {
+
+// Bind the parameters of a raw query, then step through its rows and hand each to on_row.
+// Returns an empty string on success, otherwise the error.
+template <typename OnRow>
+std::string run_raw_query(sqlite3_stmt *stmt, const std::map<std::string, std::vector<int>> &str_map,
+						  const std::map<int64_t, std::vector<int>> &int_map,
+						  const std::map<double, std::vector<int>> &double_map, OnRow on_row) {
+	SqlTimer timer(SqlKind::Query);
+	int rc;
+	for (const auto &[value, positions] : str_map) {
+		for (int pos : positions) {
+			rc = sqlite3_bind_text(stmt, pos, value.c_str(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+			if (rc != SQLITE_OK) {
+				return "Call to sqlite3_bind_text failed: sqlite3 errno: " + std::to_string(rc);
 			}
 		}
+	}
 
-		for (const auto &[value, positions] : int_map) {
-			for (int pos : positions) {
-				rc = sqlite3_bind_int64(stmt, pos, value);
-				if (rc != SQLITE_OK) {
-					stmt_guard.discard();
-					return std::make_pair(return_vec,
-										  "Call to sqlite3_bind_int64 failed: sqlite3 errno: " + std::to_string(rc));
-				}
+	for (const auto &[value, positions] : int_map) {
+		for (int pos : positions) {
+			rc = sqlite3_bind_int64(stmt, pos, value);
+			if (rc != SQLITE_OK) {
+				return "Call to sqlite3_bind_int64 failed: sqlite3 errno: " + std::to_string(rc);
 			}
 		}
+	}
 
-		for (const auto &[value, positions] : double_map) {
-			for (int pos : positions) {
-				rc = sqlite3_bind_double(stmt, pos, value);
-				if (rc != SQLITE_OK) {
-					stmt_guard.discard();
-					return std::make_pair(return_vec,
-										  "Call to sqlite3_bind_double failed: sqlite3 errno: " + std::to_string(rc));
-				}
+	for (const auto &[value, positions] : double_map) {
+		for (int pos : positions) {
+			rc = sqlite3_bind_double(stmt, pos, value);
+			if (rc != SQLITE_OK) {
+				return "Call to sqlite3_bind_double failed: sqlite3 errno: " + std::to_string(rc);
 			}
 		}
+	}
+
+	// Execute and collect results
+	StmtTrace trace(stmt);
+	while ((rc = trace.step()) == SQLITE_ROW) {
+		on_row(stmt);
+	}
+
+	if (rc != SQLITE_DONE) {
+		return "Error stepping through results: sqlite3 errno: " + std::to_string(rc);
+	}
+	timer.succeeded();
+	return "";
+}
+
+// Run a query built at runtime on a statement from the PreparedStatementCache
+template <typename OnRow>
+std::string run_raw_query(const std::string &dynamic_query, const std::map<std::string, std::vector<int>> &str_map,
+						  const std::map<int64_t, std::vector<int>> &int_map,
+						  const std::map<double, std::vector<int>> &double_map, OnRow on_row) {
+	// Use pooled connection with deferred transaction for read consistency
+	PooledConnection conn(PooledConnection::TransactionType::Deferred);
+	if (!conn.valid()) {
+		return conn.error();
+	}
+
+	// Get or prepare the statement (uses cache)
+	auto [stmt, prep_error] = PreparedStatementCache::get_or_prepare(conn.get(), dynamic_query);
+	if (!stmt) {
+		return prep_error;
+	}
+
+	// RAII guard that returns statement to cache on scope exit
+	CachedStmtGuard stmt_guard(conn.get(), dynamic_query, stmt);
+
+	std::string error = run_raw_query(stmt, str_map, int_map, double_map, on_row);
+	if (!error.empty()) {
+		stmt_guard.discard(); // Don't cache a statement that failed
+		return error;
+	}
+
+	// Commit the transaction
+	conn.commit();
+	return "";
+}
+
+// Run a catalogued query on the statement its connection prepared when it was opened
+template <typename OnRow>
+std::string run_raw_query(Query query, const std::map<std::string, std::vector<int>> &str_map,
+						  const std::map<int64_t, std::vector<int>> &int_map,
+						  const std::map<double, std::vector<int>> &double_map, OnRow on_row) {
+	PooledConnection conn(PooledConnection::TransactionType::Deferred);
+	QueryStmt stmt(conn, query);
+	if (!stmt.get()) {
+		return stmt.error();
+	}
+
+	std::string error = run_raw_query(stmt.get(), str_map, int_map, double_map, on_row);
+	if (!error.empty()) {
+		return error;
+	}
+
+	conn.commit();
+	return "";
+}
+
+template <typename QueryType>
+std::pair<std::vector<std::string>, std::string>
+get_matches(const QueryType &query, const std::map<std::string, std::vector<int>> &str_map,
+			const std::map<int64_t, std::vector<int>> &int_map, const std::map<double, std::vector<int>> &double_map) {
+	std::vector<std::string> return_vec;
 
-		// Execute and collect results
-		while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+	try {
+		std::string error = run_raw_query(query, str_map, int_map, double_map, [&return_vec](sqlite3_stmt *stmt) {
 			const unsigned char *data = sqlite3_column_text(stmt, 0);
 			if (data) {
 				return_vec.push_back(reinterpret_cast<const char *>(data));
 			}
-		}
-
-		if (rc != SQLITE_DONE) {
-			stmt_guard.discard();
-			return std::make_pair(return_vec, "Error stepping through results: sqlite3 errno: " + std::to_string(rc));
-		}
-
-		// Commit the transaction
-		conn.commit();
-
-		return std::make_pair(return_vec, "");
+		});
+		return std::make_pair(return_vec, error);
 	} catch (const std::exception &e) {
 		return std::make_pair(return_vec, std::string("Query failed: ") + e.what());
 	}
 }
 
-std::pair<std::vector<std::vector<std::string>>, std::string> SQL_get_matches_multi_col(
-	const std::string &dynamic_query, int num_returns, const std::map<std::string, std::vector<int>> &str_map,
-	const std::map<int64_t, std::vector<int>> &int_map, const std::map<double, std::vector<int>> &double_map) {
+template <typename QueryType>
+std::pair<std::vector<std::vector<std::string>>, std::string>
+get_matches_multi_col(const QueryType &query, int num_returns, const std::map<std::string, std::vector<int>> &str_map,
+					  const std::map<int64_t, std::vector<int>> &int_map,
+					  const std::map<double, std::vector<int>> &double_map) {
 	std::vector<std::vector<std::string>> return_vec;
 
 	try {
-		// Use pooled connection with deferred transaction for read consistency
-		PooledConnection conn(PooledConnection::TransactionType::Deferred);
-		if (!conn.valid()) {
-			return std::make_pair(return_vec, conn.error());
-		}
-
-		// Get or prepare the statement (uses cache)
-		auto [stmt, prep_error] = PreparedStatementCache::get_or_prepare(conn.get(), dynamic_query);
-		if (!stmt) {
-			return std::make_pair(return_vec, prep_error);
-		}
-
-		// RAII guard that returns statement to cache on scope exit
-		CachedStmtGuard stmt_guard(conn.get(), dynamic_query, stmt);
-
-		// Bind parameters
-		int rc;
-		for (const auto &[value, positions] : str_map) {
-			for (int pos : positions) {
-				rc = sqlite3_bind_text(stmt, pos, value.c_str(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
-				if (rc != SQLITE_OK) {
-					stmt_guard.discard();
-					return std::make_pair(return_vec,
-										  "Call to sqlite3_bind_text failed: sqlite3 errno: " + std::to_string(rc));
+		std::string error =
+			run_raw_query(query, str_map, int_map, double_map, [&return_vec, num_returns](sqlite3_stmt *stmt) {
+				std::vector<std::string> row;
+				row.reserve(num_returns);
+				for (int i = 0; i < num_returns; ++i) {
+					const unsigned char *data = sqlite3_column_text(stmt, i);
+					row.push_back(data ? reinterpret_cast<const char *>(data) : "");
 				}
-			}
-		}
+				return_vec.push_back(std::move(row));
+			});
+		return std::make_pair(return_vec, error);
+	} catch (const std::exception &e) {
+		return std::make_pair(return_vec, std::string("Query failed: ") + e.what());
+	}
+}
 
-		for (const auto &[value, positions] : int_map) {
-			for (int pos : positions) {
-				rc = sqlite3_bind_int64(stmt, pos, value);
-				if (rc != SQLITE_OK) {
-					stmt_guard.discard();
-					return std::make_pair(return_vec,
-										  "Call to sqlite3_bind_int64 failed: sqlite3 errno: " + std::to_string(rc));
-				}
-			}
-		}
+} // namespace
 
-		for (const auto &[value, positions] : double_map) {
-			for (int pos : positions) {
-				rc = sqlite3_bind_double(stmt, pos, value);
-				if (rc != SQLITE_OK) {
-					stmt_guard.discard();
-					return std::make_pair(return_vec,
-										  "Call to sqlite3_bind_double failed: sqlite3 errno: " + std::to_string(rc));
-				}
-			}
-		}
+std::pair<std::vector<std::string>, std::string> SQL_get_matches(const std::string &dynamic_query,
+																 const std::map<std::string, std::vector<int>> &str_map,
+																 const std::map<int64_t, std::vector<int>> &int_map,
+																 const std::map<double, std::vector<int>> &double_map) {
+	return get_matches(dynamic_query, str_map, int_map, double_map);
+}
 
-		// Execute and collect results
-		while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-			std::vector<std::string> row;
-			row.reserve(num_returns);
-			for (int i = 0; i < num_returns; ++i) {
-				const unsigned char *data = sqlite3_column_text(stmt, i);
-				row.push_back(data ? reinterpret_cast<const char *>(data) : "");
-			}
-			return_vec.push_back(std::move(row));
-		}
+std::pair<std::vector<std::string>, std::string> SQL_get_matches(Query query,
+																 const std::map<std::string, std::vector<int>> &str_map,
+																 const std::map<int64_t, std::vector<int>> &int_map,
+																 const std::map<double, std::vector<int>> &double_map) {
+	return get_matches(query, str_map, int_map, double_map);
+}
 
-		if (rc != SQLITE_DONE) {
-			stmt_guard.discard();
-			return std::make_pair(return_vec, "Error stepping through results: sqlite3 errno: " + std::to_string(rc));
-		}
+std::pair<std::vector<std::vector<std::string>>, std::string> SQL_get_matches_multi_col(
+	const std::string &dynamic_query, int num_returns, const std::map<std::string, std::vector<int>> &str_map,
+	const std::map<int64_t, std::vector<int>> &int_map, const std::map<double, std::vector<int>> &double_map) {
+	return get_matches_multi_col(dynamic_query, num_returns, str_map, int_map, double_map);
+}
 
-		// Commit the transaction
-		conn.commit();
+std::pair<std::vector<std::vector<std::string>>, std::string> SQL_get_matches_multi_col(
+	Query query, int num_returns, const std::map<std::string, std::vector<int>> &str_map,
+	const std::map<int64_t, std::vector<int>> &int_map, const std::map<double, std::vector<int>> &double_map) {
+	return get_matches_multi_col(query, num_returns, str_map, int_map, double_map);
+}
 
-		return std::make_pair(return_vec, "");
-	} catch (const std::exception &e) {
-		return std::make_pair(return_vec, std::string("Query failed: ") + e.what());
+std::pair<int64_t, std::string> cache_generation() {
+	auto rp = SQL_get_matches(Query::CacheGeneration);
+	if (!rp.second.empty()) {
+		return std::make_pair(0, "Failed to read the cache generation: " + rp.second);
 	}
+	return std::make_pair(rp.first.empty() ? 0 : std::stoll(rp.first[0]), "");
 }
 
 } // namespace db
 
 // Implementation of Lot and Checks database methods
 
+// Let the caches that were patched for one of LotMan's own writes take its cache generation, so that the write
+// does not make them reload. before and after are read inside the write's transaction.
+static void advance_cache_generation(int64_t before, int64_t after) {
+	HierarchyCache::advance_generation(before, after);
+	AuthorizationCache::advance_generation(before, after);
+	PathCache::advance_generation(before, after);
+}
+
 std::pair<bool, std::string> Lot::write_new() {
 	try {
 		auto &storage = db::StorageManager::get_storage();
 
 		// Use a transaction for atomicity
-		storage.transaction([&] {
+		std::vector<db::Path> path_records;
+		int64_t generation_before = 0;
+		int64_t generation_after = 0;
+		db::immediate_transaction(storage, [&] {
+			generation_before = db::cache_generation(storage);
 			// Use replace() for tables with text primary keys
 			db::Owner owner_record{lot_name, owner};
 			storage.replace(owner_record);
@@ -839,10 +1656,12 @@ std::pair<bool, std::string> Lot::write_new() {
 				db::Parent parent_record{lot_name, parent};
 				storage.replace(parent_record);
 			}
+			db::refresh_lot_closure(storage, {lot_name});
 
 			// Insert paths
 			for (const auto &path : paths) {
-				storage.replace(db::create_path_record(lot_name, path));
+				path_records.push_back(db::create_path_record(lot_name, path));
+				storage.replace(path_records.back());
 			}
 
 			// Insert management policy attributes
@@ -867,8 +1686,15 @@ std::pair<bool, std::string> Lot::write_new() {
 									  usage.children_objects_being_written};
 			storage.replace(usage_record);
 
+			generation_after = db::cache_generation(storage);
 			return true; // Commit transaction
 		});
+		HierarchyCache::add_parents(lot_name, parents);
+		AuthorizationCache::set_owner(lot_name, owner);
+		for (const auto &record : path_records) {
+			PathCache::add_path(record.lot_name, record.path, record.recursive, record.exclude);
+		}
+		advance_cache_generation(generation_before, generation_after);
 
 		return std::make_pair(true, "");
 	} catch (const std::exception &e) {
@@ -880,9 +1706,19 @@ std::pair<bool, std::string> Lot::delete_lot_from_db() {
 	try {
 		auto &storage = db::StorageManager::get_storage();
 
-		storage.transaction([&] {
+		int64_t generation_before = 0;
+		int64_t generation_after = 0;
+		db::immediate_transaction(storage, [&] {
+			generation_before = db::cache_generation(storage);
 			using namespace sqlite_orm;
 
+			// The lot's children keep their rows naming it as a parent, but whatever they inherited
+			// through it is gone from the closure
+			auto children = storage.select(&db::Parent::lot_name, where(c(&db::Parent::parent) == lot_name and
+																		 c(&db::Parent::lot_name) != lot_name));
+			storage.remove_all<db::LotClosure>(where(c(&db::LotClosure::ancestor) == lot_name or
+													 c(&db::LotClosure::descendant) == lot_name));
+
 			// Delete from all tables where lot_name matches
 			storage.remove_all<db::Owner>(where(c(&db::Owner::lot_name) == lot_name));
 			storage.remove_all<db::Parent>(where(c(&db::Parent::lot_name) == lot_name));
@@ -890,9 +1726,15 @@ std::pair<bool, std::string> Lot::delete_lot_from_db() {
 			storage.remove_all<db::ManagementPolicyAttributes>(
 				where(c(&db::ManagementPolicyAttributes::lot_name) == lot_name));
 			storage.remove_all<db::LotUsage>(where(c(&db::LotUsage::lot_name) == lot_name));
+			db::refresh_lot_closure(storage, children);
 
+			generation_after = db::cache_generation(storage);
 			return true; // Commit
 		});
+		HierarchyCache::remove_lot(lot_name);
+		AuthorizationCache::remove_lot(lot_name);
+		PathCache::remove_lot(lot_name);
+		advance_cache_generation(generation_before, generation_after);
 
 		return std::make_pair(true, "");
 	} catch (const std::exception &e) {
@@ -952,12 +1794,14 @@ std::pair<bool, std::string> Lot::store_updates(const std::string &update_stmt,
 			}
 		}
 
-		int rc = sqlite3_step(stmt);
+		SqlTimer timer(SqlKind::Update);
+		int rc = StmtTrace(stmt).step();
 
 		if (rc != SQLITE_DONE) {
 			stmt_guard.discard();
 			return std::make_pair(false, "Failed to execute update: sqlite errno: " + std::to_string(rc));
 		}
+		timer.succeeded();
 
 		// Commit the transaction
 		if (!conn.commit()) {
@@ -970,17 +1814,261 @@ std::pair<bool, std::string> Lot::store_updates(const std::string &update_stmt,
 	}
 }
 
+namespace {
+
+// Column order shared by the batched usage statements (db::Query::SelfUsage, UpdateSelfUsage and AddChildrenUsage)
+const std::array<std::string, 4> usage_keys = {"self_GB", "self_objects", "self_GB_being_written",
+											   "self_objects_being_written"};
+const std::array<bool, 4> int_usage_keys = {false, true, false, true};
+
+// One value per usage column. Integer columns use ints, the others use dbl.
+struct UsageColumns {
+	std::array<double, 4> dbl{};
+	std::array<int64_t, 4> ints{};
+};
+
+} // namespace
+
+std::pair<bool, std::string> Lot::store_usage_batch(std::vector<UsageUpdate> &updates, bool deltaMode,
+													 bool all_or_nothing, int64_t journal_seq) {
+	SqlTimer timer(SqlKind::UsageBatch);
+	try {
+		// Current values are read inside the write transaction so the deltas pushed to ancestors are exact
+		db::PooledConnection conn(db::PooledConnection::TransactionType::Immediate);
+		if (!conn.valid()) {
+			return std::make_pair(false, conn.error());
+		}
+
+		db::QueryStmt get_guard(conn, db::Query::SelfUsage);
+		sqlite3_stmt *get_stmt = get_guard.get();
+		if (!get_stmt) {
+			return std::make_pair(false, get_guard.error());
+		}
+
+		db::QueryStmt update_guard(conn, db::Query::UpdateSelfUsage);
+		sqlite3_stmt *update_stmt = update_guard.get();
+		if (!update_stmt) {
+			return std::make_pair(false, update_guard.error());
+		}
+
+		// Bind the four usage columns followed by a lot name, then run the statement
+		auto run_update = [](sqlite3_stmt *stmt, const UsageColumns &cols,
+							 const std::string &target) -> std::pair<bool, std::string> {
+			for (int i = 0; i < 4; ++i) {
+				int rc = int_usage_keys[i] ? sqlite3_bind_int64(stmt, i + 1, cols.ints[i])
+										   : sqlite3_bind_double(stmt, i + 1, cols.dbl[i]);
+				if (rc != SQLITE_OK) {
+					return std::make_pair(false, "Failed to bind usage parameter");
+				}
+			}
+			if (sqlite3_bind_text(stmt, 5, target.c_str(), static_cast<int>(target.size()), SQLITE_TRANSIENT) !=
+				SQLITE_OK) {
+				return std::make_pair(false, "Failed to bind string parameter");
+			}
+			int rc = sqlite3_step(stmt);
+			sqlite3_reset(stmt);
+			sqlite3_clear_bindings(stmt);
+			if (rc != SQLITE_DONE) {
+				return std::make_pair(false, "Failed to execute update: sqlite errno: " + std::to_string(rc));
+			}
+			return std::make_pair(true, "");
+		};
+
+		// Deltas owed to each ancestor, summed over the whole batch so that every ancestor row is written once
+		std::unordered_map<std::string, UsageColumns> ancestor_deltas;
+
+		for (auto &update : updates) {
+			if (!update.error.empty()) {
+				continue; // Already rejected by the caller
+			}
+
+			if (sqlite3_bind_text(get_stmt, 1, update.lot_name.c_str(), static_cast<int>(update.lot_name.size()),
+								  SQLITE_TRANSIENT) != SQLITE_OK) {
+				return std::make_pair(false, "Failed to bind string parameter");
+			}
+			int rc = sqlite3_step(get_stmt);
+			UsageColumns current;
+			if (rc == SQLITE_ROW) {
+				for (int i = 0; i < 4; ++i) {
+					current.dbl[i] = sqlite3_column_double(get_stmt, i);
+					current.ints[i] = sqlite3_column_int64(get_stmt, i);
+				}
+			}
+			sqlite3_reset(get_stmt);
+			sqlite3_clear_bindings(get_stmt);
+			if (rc == SQLITE_DONE) {
+				update.error = "The lot " + update.lot_name + " has no usage record.";
+				if (all_or_nothing) {
+					conn.rollback();
+					timer.succeeded();
+					return std::make_pair(true, "");
+				}
+				continue;
+			}
+			if (rc != SQLITE_ROW) {
+				return std::make_pair(false, "Failed to read current usage: sqlite errno: " + std::to_string(rc));
+			}
+
+			// Work out the new values and the deltas before writing anything, so a rejected lot leaves no trace
+			UsageColumns next = current;
+			UsageColumns delta;
+			for (const auto &[key, value] : update.values) {
+				auto key_iter = std::find(usage_keys.begin(), usage_keys.end(), key);
+				if (key_iter == usage_keys.end()) {
+					update.error = "The key " + key + " is not a valid usage key.";
+					break;
+				}
+				size_t i = key_iter - usage_keys.begin();
+				bool negative;
+				if (int_usage_keys[i]) {
+					// Integer keys store the value truncated to int64_t, so the delta is computed the same way
+					int64_t int_value = static_cast<int64_t>(value);
+					next.ints[i] = deltaMode ? current.ints[i] + int_value : int_value;
+					delta.ints[i] = next.ints[i] - current.ints[i];
+					negative = next.ints[i] < 0;
+				} else {
+					next.dbl[i] = deltaMode ? current.dbl[i] + value : value;
+					delta.dbl[i] = next.dbl[i] - current.dbl[i];
+					negative = next.dbl[i] < 0;
+				}
+				if (deltaMode && negative) {
+					update.error =
+						"The attempted delta update would result in storing negative values for the key " + key + ".";
+					break;
+				}
+			}
+			if (!update.error.empty()) {
+				if (all_or_nothing) {
+					conn.rollback();
+					timer.succeeded();
+					return std::make_pair(true, "");
+				}
+				continue;
+			}
+
+			auto rp = run_update(update_stmt, next, update.lot_name);
+			if (!rp.first) {
+				return std::make_pair(false, "Failure while updating lot " + update.lot_name + ": " + rp.second);
+			}
+
+			for (const auto &ancestor : update.ancestors) {
+				auto &owed = ancestor_deltas[ancestor];
+				for (int i = 0; i < 4; ++i) {
+					owed.dbl[i] += delta.dbl[i];
+					owed.ints[i] += delta.ints[i];
+				}
+			}
+		}
+
+		if (!ancestor_deltas.empty()) {
+			db::QueryStmt parent_guard(conn, db::Query::AddChildrenUsage);
+			sqlite3_stmt *parent_stmt = parent_guard.get();
+			if (!parent_stmt) {
+				return std::make_pair(false, parent_guard.error());
+			}
+
+			for (const auto &[ancestor, owed] : ancestor_deltas) {
+				if (owed.dbl == std::array<double, 4>{} && owed.ints == std::array<int64_t, 4>{}) {
+					continue;
+				}
+				auto rp = run_update(parent_stmt, owed, ancestor);
+				if (!rp.first) {
+					return std::make_pair(false, "Failure while updating parent " + ancestor + ": " + rp.second);
+				}
+			}
+		}
+
+		if (journal_seq >= 0) {
+			db::QueryStmt checkpoint_guard(conn, db::Query::SetJournalCheckpoint);
+			sqlite3_stmt *checkpoint_stmt = checkpoint_guard.get();
+			if (!checkpoint_stmt) {
+				return std::make_pair(false, checkpoint_guard.error());
+			}
+			if (sqlite3_bind_int64(checkpoint_stmt, 1, journal_seq) != SQLITE_OK) {
+				return std::make_pair(false, "Failed to bind int parameter");
+			}
+			int rc = sqlite3_step(checkpoint_stmt);
+			if (rc != SQLITE_DONE) {
+				return std::make_pair(false, "Failed to store the journal checkpoint: sqlite errno: " +
+												 std::to_string(rc));
+			}
+		}
+
+		if (!conn.commit()) {
+			return std::make_pair(false, conn.error());
+		}
+
+		timer.succeeded();
+		return std::make_pair(true, "");
+	} catch (const std::exception &e) {
+		return std::make_pair(false, std::string("Failed to store usage updates: ") + e.what());
+	}
+}
+
+std::pair<bool, std::string> Lot::get_usage_record(const std::string &lot_name, UsageRecord &record) {
+	try {
+		db::PooledConnection conn;
+		if (!conn.valid()) {
+			return std::make_pair(false, conn.error());
+		}
+
+		db::QueryStmt guard(conn, db::Query::UsageRecord);
+		sqlite3_stmt *stmt = guard.get();
+		if (!stmt) {
+			return std::make_pair(false, guard.error());
+		}
+
+		if (sqlite3_bind_text(stmt, 1, lot_name.c_str(), static_cast<int>(lot_name.size()), SQLITE_TRANSIENT) !=
+			SQLITE_OK) {
+			return std::make_pair(false, "Failed to bind string parameter");
+		}
+		int rc = sqlite3_step(stmt);
+		if (rc == SQLITE_ROW) {
+			record.self_GB = sqlite3_column_double(stmt, 0);
+			record.children_GB = sqlite3_column_double(stmt, 1);
+			record.self_objects = sqlite3_column_int64(stmt, 2);
+			record.children_objects = sqlite3_column_int64(stmt, 3);
+			record.self_GB_being_written = sqlite3_column_double(stmt, 4);
+			record.children_GB_being_written = sqlite3_column_double(stmt, 5);
+			record.self_objects_being_written = sqlite3_column_int64(stmt, 6);
+			record.children_objects_being_written = sqlite3_column_int64(stmt, 7);
+		}
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+		if (rc == SQLITE_DONE) {
+			return std::make_pair(false, "The lot " + lot_name + " has no usage record.");
+		}
+		if (rc != SQLITE_ROW) {
+			return std::make_pair(false, "Failed to read usage: sqlite errno: " + std::to_string(rc));
+		}
+
+		return std::make_pair(true, "");
+	} catch (const std::exception &e) {
+		return std::make_pair(false, std::string("Failed to get usage record: ") + e.what());
+	}
+}
+
 std::pair<bool, std::string> Lot::store_new_paths(const std::vector<nlohmann::json> &new_paths) {
 	try {
 		auto &storage = db::StorageManager::get_storage();
 
 		// Use transaction for batch insert atomicity
-		storage.transaction([&] {
+		std::vector<db::Path> path_records;
+		int64_t generation_before = 0;
+		int64_t generation_after = 0;
+		db::immediate_transaction(storage, [&] {
+			generation_before = db::cache_generation(storage);
 			for (const auto &path : new_paths) {
-				storage.replace(db::create_path_record(lot_name, path));
+				path_records.push_back(db::create_path_record(lot_name, path));
+				storage.replace(path_records.back());
 			}
+			generation_after = db::cache_generation(storage);
 			return true; // Commit
 		});
+		for (const auto &record : path_records) {
+			PathCache::add_path(record.lot_name, record.path, record.recursive, record.exclude);
+		}
+		advance_cache_generation(generation_before, generation_after);
 
 		return std::make_pair(true, "");
 	} catch (const std::exception &e) {
@@ -993,13 +2081,22 @@ std::pair<bool, std::string> Lot::store_new_parents(const std::vector<Lot> &new_
 		auto &storage = db::StorageManager::get_storage();
 
 		// Use transaction for batch insert atomicity
-		storage.transaction([&] {
+		std::vector<std::string> parent_names;
+		int64_t generation_before = 0;
+		int64_t generation_after = 0;
+		db::immediate_transaction(storage, [&] {
+			generation_before = db::cache_generation(storage);
 			for (const auto &parent : new_parents) {
 				db::Parent parent_record{lot_name, parent.lot_name};
 				storage.replace(parent_record);
+				parent_names.push_back(parent.lot_name);
 			}
+			db::refresh_lot_closure(storage, {lot_name});
+			generation_after = db::cache_generation(storage);
 			return true; // Commit
 		});
+		HierarchyCache::add_parents(lot_name, parent_names);
+		advance_cache_generation(generation_before, generation_after);
 
 		return std::make_pair(true, "");
 	} catch (const std::exception &e) {
@@ -1013,13 +2110,20 @@ std::pair<bool, std::string> Lot::remove_parents_from_db(const std::vector<std::
 		using namespace sqlite_orm;
 
 		// Use transaction for batch delete atomicity
-		storage.transaction([&] {
+		int64_t generation_before = 0;
+		int64_t generation_after = 0;
+		db::immediate_transaction(storage, [&] {
+			generation_before = db::cache_generation(storage);
 			for (const auto &parent : parents) {
 				storage.remove_all<db::Parent>(
 					where(c(&db::Parent::lot_name) == lot_name and c(&db::Parent::parent) == parent));
 			}
+			db::refresh_lot_closure(storage, {lot_name});
+			generation_after = db::cache_generation(storage);
 			return true; // Commit
 		});
+		HierarchyCache::remove_parents(lot_name, parents);
+		advance_cache_generation(generation_before, generation_after);
 
 		return std::make_pair(true, "");
 	} catch (const std::exception &e) {
@@ -1027,21 +2131,55 @@ std::pair<bool, std::string> Lot::remove_parents_from_db(const std::vector<std::
 	}
 }
 
+std::pair<bool, std::string> Lot::store_parent_update(const std::string &current_parent,
+													  const std::string &new_parent) {
+	try {
+		auto &storage = db::StorageManager::get_storage();
+		using namespace sqlite_orm;
+
+		int64_t generation_before = 0;
+		int64_t generation_after = 0;
+		db::immediate_transaction(storage, [&] {
+			generation_before = db::cache_generation(storage);
+			storage.update_all(
+				set(c(&db::Parent::parent) = new_parent),
+				where(c(&db::Parent::lot_name) == lot_name and c(&db::Parent::parent) == current_parent));
+			db::refresh_lot_closure(storage, {lot_name});
+			generation_after = db::cache_generation(storage);
+			return true; // Commit
+		});
+		HierarchyCache::replace_parent(lot_name, current_parent, new_parent);
+		advance_cache_generation(generation_before, generation_after);
+
+		return std::make_pair(true, "");
+	} catch (const std::exception &e) {
+		return std::make_pair(false, std::string("Failed to store parent update: ") + e.what());
+	}
+}
+
 std::pair<bool, std::string> Lot::remove_paths_from_db(const std::vector<std::string> &paths) {
 	try {
 		auto &storage = db::StorageManager::get_storage();
 		using namespace sqlite_orm;
 
 		// Use transaction for batch delete atomicity
-		storage.transaction([&] {
+		int64_t generation_before = 0;
+		int64_t generation_after = 0;
+		db::immediate_transaction(storage, [&] {
+			generation_before = db::cache_generation(storage);
 			for (const auto &path : paths) {
 				// Normalize path with trailing slash to match stored format
 				std::string normalized_path = ensure_trailing_slash(path);
 				// Paths are unique, so we don't need lot_name in the condition
 				storage.remove_all<db::Path>(where(c(&db::Path::path) == normalized_path));
 			}
+			generation_after = db::cache_generation(storage);
 			return true; // Commit
 		});
+		for (const auto &path : paths) {
+			PathCache::remove_path(ensure_trailing_slash(path));
+		}
+		advance_cache_generation(generation_before, generation_after);
 
 		return std::make_pair(true, "");
 	} catch (const std::exception &e) {
@@ -8,6 +8,8 @@
 #ifndef LOTMAN_DB_H
 #define LOTMAN_DB_H
 
+#include <array>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <sqlite3.h>
@@ -107,6 +109,36 @@ struct LotUsage {
 	int64_t children_objects_being_written;
 };
 
+/**
+ * Transitive closure of the parents table: one row for every lot and each of its ancestors, plus a
+ * (lot, lot, 0) row for every lot. depth is the length of the shortest parent chain between the two.
+ * Self-parent edges are not followed. Kept in step by every write to the parents table.
+ */
+struct LotClosure {
+	std::string ancestor;
+	std::string descendant;
+	int depth;
+};
+
+/**
+ * Checkpoint of the usage journal (see lotman_journal.h): the sequence number of the last record whose
+ * delta is included in lot_usage. Single row with id=1, written in the same transaction as the usage.
+ */
+struct UsageJournalCheckpoint {
+	int id;
+	int64_t applied_seq;
+};
+
+/**
+ * Counter of the writes to the tables LotMan's caches mirror (owners, parents and paths). Triggers on those tables
+ * bump it for every row written, so it moves with every write whichever process or context makes it. Single row
+ * with id=1.
+ */
+struct CacheGeneration {
+	int id;
+	int64_t generation;
+};
+
 /**
  * Tracks the database schema version for migration support.
  * There is always exactly one row in the schema_versions table with id=1.
@@ -117,6 +149,12 @@ struct SchemaVersion {
 	int version; // Current schema version number
 };
 
+/**
+ * Set up a connection opened by a sqlite_orm storage: wait for locks with LotMan's busy handler and trace its
+ * statements (see lotman_trace.h). Storages open a connection per operation, so this runs for each of them.
+ */
+void on_storage_open(sqlite3 *db);
+
 /**
  * Creates the sqlite_orm storage definition.
  * This defines the schema mapping between C++ structs and SQLite tables.
@@ -124,8 +162,14 @@ struct SchemaVersion {
 inline auto create_storage(const std::string &db_path) {
 	using namespace sqlite_orm;
 
-	return sqlite_orm::make_storage(
+	auto storage = sqlite_orm::make_storage(
 		db_path,
+		// Secondary indexes for the hot lookups that do not filter on a table's primary key:
+		// children by parent, a lot's paths, and the policy time sweeps of get_lots_past_exp/del.
+		make_index("idx_parents_parent", &Parent::parent), make_index("idx_paths_lot_name", &Path::lot_name),
+		make_index("idx_policy_expiration_time", &ManagementPolicyAttributes::expiration_time),
+		make_index("idx_policy_deletion_time", &ManagementPolicyAttributes::deletion_time),
+		make_index("idx_lot_closure_descendant", &LotClosure::descendant),
 		make_table("schema_versions", make_column("id", &SchemaVersion::id, primary_key()),
 				   make_column("version", &SchemaVersion::version)),
 		make_table("owners", make_column("lot_name", &Owner::lot_name, primary_key()),
@@ -150,44 +194,159 @@ inline auto create_storage(const std::string &db_path) {
 				   make_column("self_GB_being_written", &LotUsage::self_GB_being_written),
 				   make_column("children_GB_being_written", &LotUsage::children_GB_being_written),
 				   make_column("self_objects_being_written", &LotUsage::self_objects_being_written),
-				   make_column("children_objects_being_written", &LotUsage::children_objects_being_written)));
+				   make_column("children_objects_being_written", &LotUsage::children_objects_being_written)),
+		make_table("lot_closure", make_column("ancestor", &LotClosure::ancestor),
+				   make_column("descendant", &LotClosure::descendant), make_column("depth", &LotClosure::depth),
+				   primary_key(&LotClosure::ancestor, &LotClosure::descendant)),
+		make_table("usage_journal", make_column("id", &UsageJournalCheckpoint::id, primary_key()),
+				   make_column("applied_seq", &UsageJournalCheckpoint::applied_seq)),
+		make_table("cache_generation", make_column("id", &CacheGeneration::id, primary_key()),
+				   make_column("generation", &CacheGeneration::generation)));
+	storage.on_open = on_storage_open;
+	return storage;
 }
 
 // Type alias for the storage type
 using Storage = decltype(create_storage(""));
 
 /**
- * Storage manager that provides lazy-initialized access to the database.
- * The storage instance is created on first access and can be reset when
- * the database path changes (e.g., during testing).
+ * Run f in a transaction that takes the database write lock up front (BEGIN IMMEDIATE), committing
+ * if f returns true and rolling back if it returns false or throws.
+ * Storage::transaction() begins a deferred transaction, which cannot wait for the write lock once it
+ * has read: if another connection wrote in the meantime, its first write fails with SQLITE_BUSY
+ * at once instead of honouring the busy timeout. Use this for every transaction that writes.
+ * @return Whether the transaction was committed
+ */
+template <class F> bool immediate_transaction(Storage &storage, F f) {
+	storage.begin_immediate_transaction();
+	bool commit = false;
+	try {
+		commit = f();
+	} catch (...) {
+		storage.rollback();
+		throw;
+	}
+	if (commit) {
+		storage.commit();
+	} else {
+		storage.rollback();
+	}
+	return commit;
+}
+
+/**
+ * Recompute every lot's children_* usage columns from the parents table and the
+ * self_* usage of all descendants, in a single transaction.
+ * Usage updates keep these columns current incrementally; this is the repair path
+ * for databases where they have drifted (e.g. written by older versions).
+ * @param storage Reference to the ORM storage
+ * @throws std::system_error on database errors
+ */
+void recompute_children_usage(Storage &storage);
+
+/**
+ * Recompute the lot_closure rows of the given lots and all of their descendants from the parents table.
+ * Call this inside the transaction that changed the lots' parent rows. Rows between two affected lots
+ * must still be current, which holds because a lot's own parents never lie below it.
+ * @param storage Reference to the ORM storage
+ * @param lot_names Lots whose parent rows changed
+ * @throws std::system_error on database errors, std::runtime_error if the hierarchy has a cycle
+ */
+void refresh_lot_closure(Storage &storage, const std::vector<std::string> &lot_names);
+
+/**
+ * Drop and rebuild the whole lot_closure table from the parents table, in a single transaction.
+ * @param storage Reference to the ORM storage
+ * @throws std::system_error on database errors, std::runtime_error if the hierarchy has a cycle
+ */
+void rebuild_lot_closure(Storage &storage);
+
+/**
+ * Read the cache generation (see CacheGeneration) through the storage, e.g. inside one of its transactions.
+ * @param storage Reference to the ORM storage
+ * @return The generation, or 0 if the row has not been written yet
+ * @throws std::system_error on database errors
+ */
+int64_t cache_generation(Storage &storage);
+
+/**
+ * Read the cache generation (see CacheGeneration) on a pooled connection.
+ * @return Pair of (generation, error_message)
+ */
+std::pair<int64_t, std::string> cache_generation();
+
+/**
+ * Storage manager that provides lazy-initialized access to the database of the calling thread's
+ * current context (see lotman_ctx.h).
+ * The database is set up (schema sync and migration) once, by the first thread to ask for storage after
+ * start-up or a reset(), and is reset when the database path changes (e.g., during testing).
+ *
+ * A sqlite_orm storage on a database file opens a connection for each operation and closes it again,
+ * except while a transaction is open: the storage then holds the transaction's connection until it ends,
+ * and every operation made through the storage in the meantime runs on that connection, inside the
+ * transaction. Storage objects are therefore never shared between threads: each thread gets its own
+ * storage on the same database file, so a thread's transaction never takes in another thread's writes,
+ * and concurrent readers proceed in parallel. Each storage is retired by the next reset(), whose new
+ * generation may point at another database file.
  */
 class StorageManager {
   public:
 	/**
-	 * Get the storage instance. Initializes if needed.
+	 * Get the calling thread's storage instance. Initializes the database if needed.
+	 * Thread-safe. The reference stays valid on this thread until the next reset().
 	 * @return Reference to the storage, or throws on error
 	 */
 	static Storage &get_storage();
 
 	/**
 	 * Get the database file path, creating directories if needed.
+	 * The path is resolved once and cached until the next reset(), which also runs when the
+	 * lot home is changed. Later changes to $LOT_HOME or $HOME are not picked up before then.
 	 * @return Pair of (success, path_or_error_message)
 	 */
 	static std::pair<bool, std::string> get_db_path();
 
+	/**
+	 * Whether the storage has been initialized since the last reset().
+	 */
+	static bool initialized();
+
 	/**
 	 * Reset the storage (useful for testing or re-initialization).
 	 *
-	 * WARNING: Not thread-safe. Only call when no other threads are using
-	 * the database (e.g., during test setup or application shutdown).
-	 * Clears the connection pool and statement cache before resetting storage.
+	 * WARNING: Not safe to run concurrently with other database calls on the same context. Storage held
+	 * by other threads is only released on their next get_storage() call or when they exit, and a call
+	 * that is in flight during the reset may still see the old database.
+	 * Clears the context's connection pool, caches and cached database path
+	 * before resetting storage. Other contexts are not affected.
 	 */
 	static void reset();
 
+	// The database of one context, held by its lotman_ctx (see lotman_ctx.h)
+	struct State {
+		// Serializes initialization against reset(). Bumping m_generation retires every thread's storage.
+		std::mutex m_init_mutex;
+		std::atomic<bool> m_initialized{false};
+		std::atomic<uint64_t> m_generation{0};
+
+		// Resolved database path, empty until get_db_path() first succeeds
+		std::string m_db_path;
+		std::mutex m_db_path_mutex;
+	};
+
   private:
-	static std::unique_ptr<Storage> m_storage;
-	static bool m_initialized;
-	static bool m_wal_enabled;
+	struct ThreadStorage {
+		std::unique_ptr<Storage> storage;
+		uint64_t generation = 0; // State::m_generation when storage was opened
+	};
+
+	static State &state();
+
+	// Open storage on db_path, then create or migrate the schema. Runs under m_init_mutex.
+	static std::unique_ptr<Storage> initialize_storage(const std::string &db_path);
+
+	// Each thread's storage for every context it has used, keyed by context ID
+	static thread_local std::unordered_map<uint64_t, ThreadStorage> t_storage;
 };
 
 /**
@@ -261,23 +420,151 @@ class ScopedConnection {
 };
 
 /**
- * Connection pool for SQLite connections.
+ * The fixed queries LotMan issues. Each pooled connection prepares all of them when it is opened and keeps
+ * them in a StatementCatalogue, so running one takes an array lookup instead of building the query text and
+ * hashing it in the PreparedStatementCache. Queries assembled at runtime still go through that cache.
+ */
+enum class Query : size_t {
+	// Lot::get_lot_usage, by key. Recursive variants also report the usage of children.
+	DedicatedUsage,
+	DedicatedUsageRecursive,
+	OpportunisticUsage,
+	OpportunisticUsageRecursive,
+	TotalUsage,
+	TotalUsageRecursive,
+	ObjectUsage,
+	ObjectUsageRecursive,
+	GBBeingWritten,
+	GBBeingWrittenRecursive,
+	ObjectsBeingWritten,
+	ObjectsBeingWrittenRecursive,
+
+	// Lot::get_owners and Lot::recalculate_children_usage
+	OwnersRecursive,
+	ChildrenUsageSums,
+
+	// Lot::get_lots_past_*. Recursive variants count the usage of children against the quota,
+	// and WithDescendants variants also select every descendant of a matching lot.
+	LotsPastExpiration,
+	LotsPastExpirationWithDescendants,
+	LotsPastDeletion,
+	LotsPastDeletionWithDescendants,
+	LotsPastOpportunistic,
+	LotsPastOpportunisticWithDescendants,
+	LotsPastOpportunisticRecursive,
+	LotsPastOpportunisticRecursiveWithDescendants,
+	LotsPastDedicated,
+	LotsPastDedicatedWithDescendants,
+	LotsPastDedicatedRecursive,
+	LotsPastDedicatedRecursiveWithDescendants,
+	LotsPastObjects,
+	LotsPastObjectsWithDescendants,
+	LotsPastObjectsRecursive,
+	LotsPastObjectsRecursiveWithDescendants,
+
+	// Lot::get_eviction_candidates
+	EvictionCandidates,
+
+	// Lot::store_usage_batch and Lot::get_usage_record
+	SelfUsage,
+	UpdateSelfUsage,
+	AddChildrenUsage,
+	UsageRecord,
+
+	// HierarchyCache::walk_db
+	WalkParents,
+	WalkChildren,
+
+	// UsageJournal::replay_locked and Lot::store_usage_batch
+	JournalCheckpoint,
+	SetJournalCheckpoint,
+
+	// HierarchyCache, AuthorizationCache and PathCache, before they trust what they hold
+	CacheGeneration,
+
+	Count
+};
+
+constexpr size_t QUERY_COUNT = static_cast<size_t>(Query::Count);
+
+/**
+ * The SQL text of a catalogued query.
+ */
+const char *query_sql(Query id);
+
+/**
+ * A connection's prepared statements for every catalogued query.
+ * A connection has a single user at a time, so the catalogue needs no locking.
+ */
+class StatementCatalogue {
+  public:
+	StatementCatalogue() = default;
+
+	// Non-copyable
+	StatementCatalogue(const StatementCatalogue &) = delete;
+	StatementCatalogue &operator=(const StatementCatalogue &) = delete;
+
+	~StatementCatalogue();
+
+	/**
+	 * Prepare every catalogued query on a connection.
+	 * @param db SQLite connection the catalogue belongs to
+	 * @return Empty string on success, otherwise the error of the first query that failed to prepare
+	 */
+	std::string prepare(sqlite3 *db);
+
+	/**
+	 * Take the statement for a query.
+	 * @return The statement, or nullptr if it is already taken further up the stack
+	 */
+	sqlite3_stmt *checkout(Query id) {
+		size_t index = static_cast<size_t>(id);
+		if (m_checked_out[index]) {
+			return nullptr;
+		}
+		m_checked_out[index] = true;
+		return m_statements[index];
+	}
+
+	/**
+	 * Reset a statement taken with checkout() and make it available again.
+	 */
+	void checkin(Query id) {
+		size_t index = static_cast<size_t>(id);
+		sqlite3_reset(m_statements[index]);
+		sqlite3_clear_bindings(m_statements[index]);
+		m_checked_out[index] = false;
+	}
+
+  private:
+	std::array<sqlite3_stmt *, QUERY_COUNT> m_statements{};
+	std::array<bool, QUERY_COUNT> m_checked_out{};
+};
+
+/**
+ * Connection pool for SQLite connections. Every context has a pool of its own.
  * Reuses connections instead of opening/closing for each operation.
  * Thread-safe via mutex protection.
+ *
+ * With thread affinity enabled, each thread instead keeps a connection of its own, along with its own
+ * prepared statement cache, so acquiring a connection and preparing statements on it take no locks.
+ * A thread that acquires a second connection while still holding its own is served from the shared pool.
  */
 class ConnectionPool {
   public:
 	/**
 	 * Get a connection from the pool, creating one if none available.
+	 * @param catalogue Receives the connection's prepared statements, which travel with it until it is released
 	 * @return sqlite3* handle (caller must return via release())
 	 */
-	static sqlite3 *acquire();
+	static sqlite3 *acquire(std::unique_ptr<StatementCatalogue> &catalogue);
 
 	/**
 	 * Return a connection to the pool for reuse.
 	 * @param conn Connection to return
+	 * @param catalogue The catalogue acquire() handed out with the connection
 	 */
-	static void release(sqlite3 *conn);
+	static void release(sqlite3 *conn, std::unique_ptr<StatementCatalogue> catalogue);
 
 	/**
 	 * Clear all pooled connections (e.g., on shutdown or reset)
@@ -289,10 +576,91 @@ class ConnectionPool {
 	 */
 	static void set_max_size(size_t size);
 
+	/**
+	 * Set the number of connections kept open ahead of use (default: 1, capped at the maximum size).
+	 * The pool is filled up to it whenever the storage is initialized, so the first requests do not
+	 * pay for opening the database. If the storage is already initialized, the pool is filled now.
+	 */
+	static void set_min_size(size_t size);
+
+	/**
+	 * Get the number of connections kept open ahead of use.
+	 */
+	static size_t get_min_size();
+
+	/**
+	 * Open connections until the pool holds at least the minimum number of idle connections.
+	 */
+	static void warm();
+
+	/**
+	 * Number of idle connections currently in the pool.
+	 */
+	static size_t size();
+
+	/**
+	 * Enable or disable per-thread connections (default: disabled). Connections a thread already owns
+	 * are closed by that thread on its next acquire() after clear(), or when the thread exits.
+	 */
+	static void set_thread_affinity(bool enabled);
+
+	/**
+	 * Whether per-thread connections are enabled.
+	 */
+	static bool get_thread_affinity();
+
   private:
-	static std::vector<sqlite3 *> m_pool;
-	static std::mutex m_mutex;
-	static size_t m_max_size;
+	friend class PreparedStatementCache;
+
+	struct CachedStatement {
+		sqlite3_stmt *stmt;
+		bool checked_out;
+	};
+
+	// A thread's own connection and the statements prepared on it. Only ever touched by its thread.
+	struct ThreadConnection {
+		sqlite3 *conn = nullptr;
+		bool in_use = false;
+		uint64_t generation = 0;
+		std::unique_ptr<StatementCatalogue> catalogue; // Handed to the user while the connection is in use
+		std::unordered_map<std::string, CachedStatement> statements;
+
+		void close();
+		~ThreadConnection() {
+			close();
+		}
+	};
+
+	struct IdleConnection {
+		sqlite3 *conn;
+		std::unique_ptr<StatementCatalogue> catalogue;
+	};
+
+  public:
+	// The pool of one context, held by its lotman_ctx (see lotman_ctx.h)
+	struct State {
+		std::vector<IdleConnection> m_pool;
+		std::mutex m_mutex;
+		size_t m_max_size = 5;
+		size_t m_min_size = 1;
+
+		std::atomic<bool> m_thread_affinity{false};
+		// Bumped by clear() so that threads drop connections to a database that is no longer in use
+		std::atomic<uint64_t> m_generation{0};
+	};
+
+  private:
+	static State &state();
+
+	// The calling thread's own connection to the current context's database, or nullptr if it has none
+	static ThreadConnection *thread_connection();
+
+	// Opens a connection and prepares its catalogue. Returns nullptr if either fails.
+	static sqlite3 *open_connection(const std::string &db_path, std::unique_ptr<StatementCatalogue> &catalogue);
+	static void close_connection(sqlite3 *conn, std::unique_ptr<StatementCatalogue> catalogue);
+
+	// Each thread's own connection for every context it has used, keyed by context ID
+	static thread_local std::unordered_map<uint64_t, ThreadConnection> t_connections;
 };
 
 /**
@@ -325,17 +693,51 @@ class PooledConnection {
 	const std::string &error() const {
 		return m_error;
 	}
+	StatementCatalogue *catalogue() const {
+		return m_catalogue.get();
+	}
 
   private:
 	sqlite3 *m_db = nullptr;
+	std::unique_ptr<StatementCatalogue> m_catalogue;
 	bool m_in_transaction = false;
 	bool m_committed = false;
 	std::string m_error;
 };
 
 /**
- * Cache for prepared statements.
- * Caches statements per connection to avoid re-preparing.
+ * RAII handle on the prepared statement of a catalogued query, taken from the catalogue of a pooled connection.
+ * Should the statement already be in use further up the stack, a private copy is prepared instead.
+ * The statement is reset, or the copy finalized, on destruction.
+ */
+class QueryStmt {
+  public:
+	QueryStmt(const PooledConnection &conn, Query id);
+
+	// Non-copyable
+	QueryStmt(const QueryStmt &) = delete;
+	QueryStmt &operator=(const QueryStmt &) = delete;
+
+	~QueryStmt();
+
+	sqlite3_stmt *get() const {
+		return m_stmt;
+	}
+	const std::string &error() const {
+		return m_error;
+	}
+
+  private:
+	StatementCatalogue *m_catalogue = nullptr; // Null for a private copy
+	Query m_id;
+	sqlite3_stmt *m_stmt = nullptr;
+	std::string m_error;
+};
+
+/**
+ * Cache for prepared statements of queries built at runtime (catalogued queries use a StatementCatalogue).
+ * Caches statements per connection to avoid re-preparing. Statements of a thread's own
+ * connection (see ConnectionPool) are cached by that thread without taking the mutex.
  */
 class PreparedStatementCache {
   public:
@@ -356,6 +758,14 @@ class PreparedStatementCache {
 	 */
 	static void return_statement(sqlite3 *db, const std::string &query, sqlite3_stmt *stmt);
 
+	/**
+	 * Finalize a statement obtained from get_or_prepare() instead of returning it to the cache.
+	 * @param db SQLite connection the statement belongs to
+	 * @param query The original query string
+	 * @param stmt The prepared statement to finalize
+	 */
+	static void discard_statement(sqlite3 *db, const std::string &query, sqlite3_stmt *stmt);
+
 	/**
 	 * Clear all cached statements for a connection (call before closing connection).
 	 * @param db Connection whose statements should be cleared
@@ -413,7 +823,7 @@ class CachedStmtGuard {
 	// Discard the statement (don't cache it)
 	void discard() {
 		if (m_stmt) {
-			sqlite3_finalize(m_stmt);
+			PreparedStatementCache::discard_statement(m_db, m_query, m_stmt);
 			m_stmt = nullptr;
 		}
 	}
@@ -445,6 +855,21 @@ std::pair<std::vector<std::vector<std::string>>, std::string> SQL_get_matches_mu
 	const std::map<int64_t, std::vector<int>> &int_map = std::map<int64_t, std::vector<int>>(),
 	const std::map<double, std::vector<int>> &double_map = std::map<double, std::vector<int>>());
 
+/**
+ * Same as the overloads above, but run a catalogued query on its statement prepared ahead of time.
+ */
+std::pair<std::vector<std::string>, std::string>
+SQL_get_matches(Query query,
+				const std::map<std::string, std::vector<int>> &str_map = std::map<std::string, std::vector<int>>(),
+				const std::map<int64_t, std::vector<int>> &int_map = std::map<int64_t, std::vector<int>>(),
+				const std::map<double, std::vector<int>> &double_map = std::map<double, std::vector<int>>());
+
+std::pair<std::vector<std::vector<std::string>>, std::string> SQL_get_matches_multi_col(
+	Query query, int num_returns,
+	const std::map<std::string, std::vector<int>> &str_map = std::map<std::string, std::vector<int>>(),
+	const std::map<int64_t, std::vector<int>> &int_map = std::map<int64_t, std::vector<int>>(),
+	const std::map<double, std::vector<int>> &double_map = std::map<double, std::vector<int>>());
+
 } // namespace db
 } // namespace lotman
 
@@ -1,10 +1,18 @@
 #include "lotman_internal.h"
 
+#include "lotman.h"
+#include "lotman_accumulator.h"
+#include "lotman_cache.h"
+#include "lotman_ctx.h"
 #include "lotman_db.h"
 
+#include <array>
 #include <chrono>
 #include <nlohmann/json.hpp>
+#include <optional>
+#include <queue>
 #include <sys/stat.h>
+#include <unordered_map>
 
 using json = nlohmann::json;
 using namespace lotman;
@@ -103,7 +111,7 @@ std::pair<bool, std::string> lotman::Lot::store_lot() {
 	self_parent = (self_parent_iter != parents.end());
 	if (!children.empty() && ((parents.size() == 1 && !self_parent) ||
 							  (parents.size() > 1))) { // If there are children and a non-self parent
-		bool cycle_exists = lotman::Checks::cycle_check(lot_name, parents, children);
+		bool cycle_exists = lotman::Checks::cycle_check(parents, children);
 		if (cycle_exists) {
 			return std::make_pair(
 				false, "The lot cannot be added because the combination of parents/children would introduce a "
@@ -122,7 +130,7 @@ std::pair<bool, std::string> lotman::Lot::store_lot() {
 	bool parent_updated = true;
 	for (auto &parents_iter : parents) {
 		for (auto &children_iter : children) {
-			if (lotman::Checks::insertion_check(lot_name, parents_iter, children_iter)) {
+			if (lotman::Checks::insertion_check(parents_iter, children_iter)) {
 				// Update child to have lot_name as a parent instead of parents_iter. Later, save LTBA with all its
 				// specified parents.
 				Lot child(children_iter);
@@ -140,6 +148,21 @@ std::pair<bool, std::string> lotman::Lot::store_lot() {
 			}
 		}
 	}
+
+	// The new lot and everything above it may have gained descendants
+	auto rp_vec_str = HierarchyCache::get_parents(lot_name, true, false);
+	if (!rp_vec_str.second.empty()) {
+		std::string int_err = rp_vec_str.second;
+		std::string ext_err = "Failure on call to get_parents: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	rp_vec_str.first.push_back(lot_name);
+	rp = refresh_children_usage(rp_vec_str.first);
+	if (!rp.first) {
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to refresh_children_usage: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
 	return std::make_pair(true, "");
 }
 
@@ -205,6 +228,15 @@ std::pair<bool, std::string> lotman::Lot::destroy_lot() {
 		return std::make_pair(false, ext_err + int_err);
 	}
 
+	// Every ancestor of LTBR loses it as a descendant, so their children usage is refreshed once LTBR is gone
+	auto rp_vec_str = HierarchyCache::get_parents(lot_name, true, false);
+	if (!rp_vec_str.second.empty()) {
+		std::string int_err = rp_vec_str.second;
+		std::string ext_err = "Failed to get lot ancestors: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	std::vector<std::string> ancestors = rp_vec_str.first;
+
 	// std::vector<Lot> children = rp_lotvec_str.first;
 	//  If there are no children, the lot can be deleted without issue
 	if (self_children.empty()) {
@@ -214,6 +246,12 @@ std::pair<bool, std::string> lotman::Lot::destroy_lot() {
 			std::string ext_err = "Failed to delete the lot from the database: ";
 			return std::make_pair(false, ext_err + int_err);
 		}
+		rp_bool_str = refresh_children_usage(ancestors);
+		if (!rp_bool_str.first) {
+			std::string int_err = rp_bool_str.second;
+			std::string ext_err = "Failure on call to refresh_children_usage: ";
+			return std::make_pair(false, ext_err + int_err);
+		}
 		return std::make_pair(true, "");
 	}
 
@@ -280,6 +318,12 @@ std::pair<bool, std::string> lotman::Lot::destroy_lot() {
 		std::string ext_err = "Function call to lotman::Lot::delete_lot_from_db failed: ";
 		return std::make_pair(false, ext_err + int_err);
 	}
+	rp_bool_str = refresh_children_usage(ancestors);
+	if (!rp_bool_str.first) {
+		std::string int_err = rp_bool_str.second;
+		std::string ext_err = "Failure on call to refresh_children_usage: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
 	return std::make_pair(true, "");
 }
 
@@ -297,6 +341,14 @@ std::pair<bool, std::string> lotman::Lot::destroy_lot_recursive() {
 		return std::make_pair(false, ext_err + int_err);
 	}
 
+	auto rp_vec_str = HierarchyCache::get_parents(lot_name, true, false);
+	if (!rp_vec_str.second.empty()) {
+		std::string int_err = rp_vec_str.second;
+		std::string ext_err = "Failed to get lot ancestors: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	std::vector<std::string> ancestors = rp_vec_str.first;
+
 	for (auto &child : recursive_children) {
 		auto rp_bool_str = child.delete_lot_from_db();
 		if (!rp_bool_str.first) {
@@ -305,145 +357,92 @@ std::pair<bool, std::string> lotman::Lot::destroy_lot_recursive() {
 			return std::make_pair(false, ext_err + int_err);
 		}
 	}
-	this->delete_lot_from_db();
+	auto rp_bool_str = this->delete_lot_from_db();
+	if (!rp_bool_str.first) {
+		std::string int_err = rp_bool_str.second;
+		std::string ext_err = "Failed to delete a lot from the database: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+
+	rp_bool_str = refresh_children_usage(ancestors);
+	if (!rp_bool_str.first) {
+		std::string int_err = rp_bool_str.second;
+		std::string ext_err = "Failure on call to refresh_children_usage: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
 	return std::make_pair(true, "");
 }
 
 std::pair<std::vector<Lot>, std::string> lotman::Lot::get_parents(const bool recursive, const bool get_self) {
 
-	std::vector<Lot> parents;
-	std::vector<std::string> parent_names_vec;
-
-	try {
-		auto &storage = db::StorageManager::get_storage();
-		using namespace sqlite_orm;
-
-		if (get_self) {
-			parent_names_vec = storage.select(&db::Parent::parent, where(c(&db::Parent::lot_name) == lot_name));
-		} else {
-			parent_names_vec = storage.select(&db::Parent::parent, where(c(&db::Parent::lot_name) == lot_name and
-																		 c(&db::Parent::parent) != lot_name));
-		}
-
-		if (recursive) {
-			std::vector<std::string> current_parents{parent_names_vec};
-			while (current_parents.size() > 0) {
-				std::vector<std::string> grandparent_names;
-
-				// Do not set const, because we may be updating these parents later
-				for (auto &parent : current_parents) {
-					auto gp = storage.select(&db::Parent::parent, where(c(&db::Parent::lot_name) == parent and
-																		c(&db::Parent::parent) != parent));
-					grandparent_names.insert(grandparent_names.end(), gp.begin(), gp.end());
-				}
-
-				// grandparent_names might have duplicates. Sort and make unique
-				std::sort(grandparent_names.begin(), grandparent_names.end());
-				auto last = std::unique(grandparent_names.begin(), grandparent_names.end());
-				grandparent_names.erase(last, grandparent_names.end());
-
-				current_parents = grandparent_names;
-				parent_names_vec.insert(parent_names_vec.end(), grandparent_names.begin(), grandparent_names.end());
-			}
-		}
-
-		// Final sort
-		std::sort(parent_names_vec.begin(), parent_names_vec.end());
-		auto last = std::unique(parent_names_vec.begin(), parent_names_vec.end());
-		parent_names_vec.erase(last, parent_names_vec.end());
+	// The hierarchy cache mirrors the parents table, so recursive walks no longer cost one query per node
+	auto rp = HierarchyCache::get_parents(lot_name, recursive, get_self);
+	if (!rp.second.empty()) { // There is an error message
+		return std::make_pair(std::vector<Lot>(), "get_parents failed: " + rp.second);
+	}
 
-		// children_names now has names of all children according to get_self and recursion.
-		// Create lot objects and return vector of lots
-		for (const auto &parent_name : parent_names_vec) {
-			Lot lot(parent_name);
-			parents.push_back(lot);
-		}
+	// parent_names is sorted and unique according to get_self and recursion.
+	// Create lot objects and return vector of lots
+	std::vector<Lot> parents;
+	for (const auto &parent_name : rp.first) {
+		Lot lot(parent_name);
+		parents.push_back(lot);
+	}
 
-		// Assign to lot member vars.
-		if (recursive) {
-			recursive_parents = parents;
-			recursive_parents_loaded = true;
-		} else {
-			self_parents = parents;
-			self_parents_loaded = true;
-		}
-		return std::make_pair(parents, "");
-	} catch (const std::exception &e) {
-		return std::make_pair(std::vector<Lot>(), std::string("get_parents failed: ") + e.what());
+	// Assign to lot member vars.
+	if (recursive) {
+		recursive_parents = parents;
+		recursive_parents_loaded = true;
+	} else {
+		self_parents = parents;
+		self_parents_loaded = true;
 	}
+	return std::make_pair(parents, "");
 }
 
 std::pair<std::vector<Lot>, std::string> lotman::Lot::get_children(const bool recursive, const bool get_self) {
 
-	/*
-	FUNCTION FLOW
-	* Create queries and maps based on get_self
-	* Get vector of immediate children
-	* If recursive, get children of children
-	*/
+	// See get_parents(). The walk runs over the cached child adjacency lists.
+	auto rp = HierarchyCache::get_children(lot_name, recursive, get_self);
+	if (!rp.second.empty()) { // There is an error message
+		return std::make_pair(std::vector<Lot>(), "get_children failed: " + rp.second);
+	}
 
-	std::vector<std::string> children_names;
+	// children_names is sorted and unique according to get_self and recursion.
+	// Create lot objects and return vector of lots
 	std::vector<Lot> children;
-	try {
-		auto &storage = db::StorageManager::get_storage();
-		using namespace sqlite_orm;
-
-		// Get first round of children
-		if (get_self) {
-			children_names = storage.select(&db::Parent::lot_name, where(c(&db::Parent::parent) == lot_name));
-		} else {
-			children_names = storage.select(&db::Parent::lot_name, where(c(&db::Parent::parent) == lot_name and
-																		 c(&db::Parent::lot_name) != lot_name));
-		}
-
-		if (recursive) {
-			std::vector<std::string> current_children_names{children_names};
-			while (current_children_names.size() > 0) {
-				std::vector<std::string> grandchildren_names;
-				for (const auto &child_name : current_children_names) {
-					auto gc = storage.select(&db::Parent::lot_name, where(c(&db::Parent::parent) == child_name and
-																		  c(&db::Parent::lot_name) != child_name));
-					grandchildren_names.insert(grandchildren_names.end(), gc.begin(), gc.end());
-				}
-				// grandchildren_names might have duplicates. Sort and make unique
-				std::sort(grandchildren_names.begin(), grandchildren_names.end());
-				auto last = std::unique(grandchildren_names.begin(), grandchildren_names.end());
-				grandchildren_names.erase(last, grandchildren_names.end());
-
-				current_children_names = grandchildren_names;
-				children_names.insert(children_names.end(), grandchildren_names.begin(), grandchildren_names.end());
-			}
-		}
-
-		// Final sort
-		std::sort(children_names.begin(), children_names.end());
-		auto last = std::unique(children_names.begin(), children_names.end());
-		children_names.erase(last, children_names.end());
-
-		// children_names now has names of all children according to get_self and recursion.
-		// Create lot objects and return vector of lots
-		for (const auto &child_name : children_names) {
-			Lot lot(child_name);
-			children.push_back(lot);
-		}
+	for (const auto &child_name : rp.first) {
+		Lot lot(child_name);
+		children.push_back(lot);
+	}
 
-		// Assign to lot member vars
-		if (recursive) {
-			recursive_children = children;
-			recursive_children_loaded = true;
-		} else {
-			self_children = children;
-			self_children_loaded = true;
-		}
-		return std::make_pair(children, "");
-	} catch (const std::exception &e) {
-		return std::make_pair(std::vector<Lot>(), std::string("get_children failed: ") + e.what());
+	// Assign to lot member vars
+	if (recursive) {
+		recursive_children = children;
+		recursive_children_loaded = true;
+	} else {
+		self_children = children;
+		self_children_loaded = true;
 	}
+	return std::make_pair(children, "");
 }
 
 std::pair<std::vector<std::string>, std::string> lotman::Lot::get_owners(const bool recursive) {
 	std::vector<std::string> lot_owners_vec;
 
+	if (recursive) {
+		// The closure lists the lot itself and all of its ancestors, so this is one indexed join
+		std::map<std::string, std::vector<int>> owners_query_str_map{{lot_name, {1}}};
+		auto rp = lotman::db::SQL_get_matches(lotman::db::Query::OwnersRecursive, owners_query_str_map);
+		if (!rp.second.empty()) { // There was an error
+			std::string int_err = rp.second;
+			std::string ext_err = "Failure on call to SQL_get_matches: ";
+			return std::make_pair(std::vector<std::string>(), ext_err + int_err);
+		}
+		recursive_owners = rp.first;
+		return std::make_pair(rp.first, "");
+	}
+
 	try {
 		auto &storage = db::StorageManager::get_storage();
 		using namespace sqlite_orm;
@@ -451,36 +450,7 @@ std::pair<std::vector<std::string>, std::string> lotman::Lot::get_owners(const b
 		auto owners = storage.select(&db::Owner::owner, where(c(&db::Owner::lot_name) == lot_name));
 		if (!owners.empty()) {
 			lot_owners_vec.push_back(owners[0]);
-		}
-
-		if (recursive) {
-			auto rp2 = this->get_parents(true, false);
-			if (!rp2.second.empty()) { // There is an error message
-				std::string int_err = rp2.second;
-				std::string ext_err = "Failure to get parents: ";
-				return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-			}
-			std::vector<Lot> parents = rp2.first;
-
-			for (const auto &parent : parents) {
-				auto parent_owners =
-					storage.select(&db::Owner::owner, where(c(&db::Owner::lot_name) == parent.lot_name));
-				lot_owners_vec.insert(lot_owners_vec.end(), parent_owners.begin(), parent_owners.end());
-			}
-		}
-
-		// Sort and remove any duplicates
-		std::sort(lot_owners_vec.begin(), lot_owners_vec.end());
-		auto last = std::unique(lot_owners_vec.begin(), lot_owners_vec.end());
-		lot_owners_vec.erase(last, lot_owners_vec.end());
-
-		// Assign to lot vars
-		if (recursive) {
-			recursive_owners = lot_owners_vec;
-		} else {
-			if (!lot_owners_vec.empty()) {
-				self_owner = lot_owners_vec[0]; // Lots only have one explicit owner
-			}
+			self_owner = owners[0]; // Lots only have one explicit owner
 		}
 		return std::make_pair(lot_owners_vec, "");
 	} catch (const std::exception &e) {
@@ -566,23 +536,27 @@ std::pair<json, std::string> lotman::Lot::get_lot_dirs(const bool recursive) {
 		}
 
 		if (recursive) { // Not recursion of path, but recursion of dirs associated to a lot
-			auto rp_vec_str = this->get_children(true);
-			if (!rp_vec_str.second.empty()) { // There was an error
-				std::string int_err = rp_vec_str.second;
-				std::string ext_err = "Failure to get children.";
+			// Collect the paths of every descendant in one statement. Rows come back grouped by lot,
+			// children in name order, each lot's paths in insertion order.
+			std::string child_paths_query =
+				"SELECT paths.lot_name, paths.path, paths.recursive, paths.exclude FROM lot_closure "
+				"INNER JOIN paths ON paths.lot_name = lot_closure.descendant "
+				"WHERE lot_closure.ancestor = ?1 AND lot_closure.descendant != ?1 "
+				"ORDER BY paths.lot_name, paths.rowid;";
+			std::map<std::string, std::vector<int>> child_paths_query_str_map{{lot_name, {1}}};
+			auto rp_multi = lotman::db::SQL_get_matches_multi_col(child_paths_query, 4, child_paths_query_str_map);
+			if (!rp_multi.second.empty()) { // There was an error
+				std::string int_err = rp_multi.second;
+				std::string ext_err = "Failure on call to SQL_get_matches_multi_col: ";
 				return std::make_pair(json::array(), ext_err + int_err);
 			}
-			for (const auto &child : recursive_children) {
-				auto child_path_records = storage.get_all<db::Path>(where(c(&db::Path::lot_name) == child.lot_name));
-
-				for (const auto &path_rec : child_path_records) {
-					json path_obj_internal;
-					path_obj_internal["lot_name"] = child.lot_name;
-					path_obj_internal["recursive"] = static_cast<bool>(path_rec.recursive);
-					path_obj_internal["path"] = path_rec.path;
-					path_obj_internal["exclude"] = static_cast<bool>(path_rec.exclude);
-					path_arr.push_back(path_obj_internal);
-				}
+			for (const auto &row : rp_multi.first) {
+				json path_obj_internal;
+				path_obj_internal["lot_name"] = row[0];
+				path_obj_internal["recursive"] = std::stoi(row[2]) != 0;
+				path_obj_internal["path"] = row[1];
+				path_obj_internal["exclude"] = std::stoi(row[3]) != 0;
+				path_arr.push_back(path_obj_internal);
 			}
 		}
 
@@ -630,29 +604,9 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 
 	if (key == "dedicated_GB") {
 		if (recursive) {
-			std::string rec_ded_usage_query =
-				"SELECT "
-				"CASE "
-				"WHEN lot_usage.self_GB + lot_usage.children_GB <= management_policy_attributes.dedicated_GB THEN "
-				"lot_usage.self_GB + lot_usage.children_GB "
-				"ELSE management_policy_attributes.dedicated_GB "
-				"END AS total, " // For readability, not actually referencing these column names
-				"CASE "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN "
-				"management_policy_attributes.dedicated_GB "
-				"ELSE lot_usage.self_GB "
-				"END AS self_contrib, "
-				"CASE "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN '0' "
-				"WHEN lot_usage.self_GB + lot_usage.children_GB >= management_policy_attributes.dedicated_GB THEN "
-				"management_policy_attributes.dedicated_GB - lot_usage.self_GB "
-				"ELSE lot_usage.children_GB "
-				"END AS children_contrib "
-				"FROM lot_usage "
-				"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-				"WHERE lot_usage.lot_name = ?;";
 			std::map<std::string, std::vector<int>> ded_GB_query_str_map{{lot_name, {1}}};
-			auto rp_multi = lotman::db::SQL_get_matches_multi_col(rec_ded_usage_query, 3, ded_GB_query_str_map);
+			auto rp_multi = lotman::db::SQL_get_matches_multi_col(lotman::db::Query::DedicatedUsageRecursive, 3,
+																  ded_GB_query_str_map);
 			if (!rp_multi.second.empty()) { // There was an error
 				std::string int_err = rp_multi.second;
 				std::string ext_err = "Failure on call to SQL_get_matches_multi_col: ";
@@ -666,20 +620,8 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 			output_obj["self_contrib"] = std::stod(query_multi_out[0][1]);
 			output_obj["children_contrib"] = std::stod(query_multi_out[0][2]);
 		} else {
-			std::string ded_GB_query =
-				"SELECT "
-				"CASE "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN "
-				"management_policy_attributes.dedicated_GB "
-				"ELSE lot_usage.self_GB "
-				"END AS total "
-				"FROM "
-				"lot_usage "
-				"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-				"WHERE lot_usage.lot_name = ?;";
-
 			std::map<std::string, std::vector<int>> ded_GB_query_str_map{{lot_name, {1}}};
-			auto rp_single = lotman::db::SQL_get_matches(ded_GB_query, ded_GB_query_str_map);
+			auto rp_single = lotman::db::SQL_get_matches(lotman::db::Query::DedicatedUsage, ded_GB_query_str_map);
 			if (!rp_single.second.empty()) { // There was an error
 				std::string int_err = rp_single.second;
 				std::string ext_err = "Failure on call to SQL_get_matches: ";
@@ -695,46 +637,9 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 
 	else if (key == "opportunistic_GB") {
 		if (recursive) {
-			std::string rec_opp_usage_query =
-				"SELECT "
-				"CASE "
-				"WHEN lot_usage.self_GB + lot_usage.children_GB >= management_policy_attributes.opportunistic_GB "
-				"+management_policy_attributes.dedicated_GB THEN management_policy_attributes.opportunistic_GB "
-				"WHEN lot_usage.self_GB + lot_usage.children_GB >= management_policy_attributes.dedicated_GB THEN "
-				"lot_usage.self_GB + lot_usage.children_GB - management_policy_attributes.dedicated_GB "
-				"ELSE '0' "
-				"END AS total, "
-				"CASE "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.opportunistic_GB + "
-				"management_policy_attributes.dedicated_GB THEN management_policy_attributes.opportunistic_GB "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN  lot_usage.self_GB - "
-				"management_policy_attributes.dedicated_GB "
-				"ELSE '0' "
-				"END AS self_contrib, "
-				"CASE "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.opportunistic_GB + "
-				"management_policy_attributes.dedicated_GB THEN '0' "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB AND lot_usage.self_GB + "
-				"lot_usage.children_GB >= management_policy_attributes.opportunistic_GB + "
-				"management_policy_attributes.dedicated_GB THEN management_policy_attributes.opportunistic_GB + "
-				"management_policy_attributes.dedicated_GB - lot_usage.self_GB "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB AND lot_usage.self_GB + "
-				"lot_usage.children_GB < management_policy_attributes.opportunistic_GB + "
-				"management_policy_attributes.dedicated_GB THEN lot_usage.children_GB "
-				"WHEN lot_usage.self_GB < management_policy_attributes.dedicated_GB AND lot_usage.self_GB + "
-				"lot_usage.children_GB >= management_policy_attributes.opportunistic_GB + "
-				"management_policy_attributes.dedicated_GB THEN management_policy_attributes.opportunistic_GB "
-				"WHEN lot_usage.self_GB < management_policy_attributes.dedicated_GB AND lot_usage.self_GB + "
-				"lot_usage.children_GB > management_policy_attributes.dedicated_GB THEN lot_usage.self_GB + "
-				"lot_usage.children_GB - management_policy_attributes.dedicated_GB "
-				"ELSE '0' "
-				"END AS children_contrib "
-				"FROM "
-				"lot_usage "
-				"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-				"WHERE lot_usage.lot_name = ?;";
 			std::map<std::string, std::vector<int>> opp_GB_query_str_map{{lot_name, {1}}};
-			auto rp_multi = lotman::db::SQL_get_matches_multi_col(rec_opp_usage_query, 3, opp_GB_query_str_map);
+			auto rp_multi = lotman::db::SQL_get_matches_multi_col(lotman::db::Query::OpportunisticUsageRecursive, 3,
+																  opp_GB_query_str_map);
 			if (!rp_multi.second.empty()) { // There was an error
 				std::string int_err = rp_multi.second;
 				std::string ext_err = "Failure on call to SQL_get_matches_multi_col: ";
@@ -748,22 +653,8 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 			output_obj["self_contrib"] = std::stod(query_multi_out[0][1]);
 			output_obj["children_contrib"] = std::stod(query_multi_out[0][2]);
 		} else {
-			std::string opp_GB_query =
-				"SELECT "
-				"CASE "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB + "
-				"management_policy_attributes.opportunistic_GB THEN management_policy_attributes.opportunistic_GB "
-				"WHEN lot_usage.self_GB >= management_policy_attributes.dedicated_GB THEN lot_usage.self_GB = "
-				"management_policy_attributes.dedicated_GB "
-				"ELSE '0' "
-				"END AS total "
-				"FROM "
-				"lot_usage "
-				"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-				"WHERE lot_usage.lot_name = ?;";
-
 			std::map<std::string, std::vector<int>> opp_GB_query_str_map{{lot_name, {1}}};
-			auto rp_single = lotman::db::SQL_get_matches(opp_GB_query, opp_GB_query_str_map);
+			auto rp_single = lotman::db::SQL_get_matches(lotman::db::Query::OpportunisticUsage, opp_GB_query_str_map);
 			if (!rp_single.second.empty()) { // There was an error
 				std::string int_err = rp_single.second;
 				std::string ext_err = "Failure on call to SQL_get_matches: ";
@@ -781,9 +672,9 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 		// Get the total usage
 		if (recursive) {
 			// Need to consider usage from children
-			std::string child_usage_GB_query = "SELECT self_GB, children_GB FROM lot_usage WHERE lot_name = ?;";
 			std::map<std::string, std::vector<int>> child_usage_GB_str_map{{lot_name, {1}}};
-			auto rp_multi = lotman::db::SQL_get_matches_multi_col(child_usage_GB_query, 2, child_usage_GB_str_map);
+			auto rp_multi = lotman::db::SQL_get_matches_multi_col(lotman::db::Query::TotalUsageRecursive, 2,
+																  child_usage_GB_str_map);
 			if (!rp_multi.second.empty()) { // There was an error
 				std::string int_err = rp_multi.second;
 				std::string ext_err = "Failure on call to SQL_get_matches_multi_col: ";
@@ -797,9 +688,8 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 			output_obj["children_contrib"] = std::stod(query_multi_out[0][1]);
 			output_obj["total"] = std::stod(query_multi_out[0][0]) + std::stod(query_multi_out[0][1]);
 		} else {
-			std::string usage_GB_query = "SELECT self_GB FROM lot_usage WHERE lot_name = ?;";
 			std::map<std::string, std::vector<int>> usage_GB_str_map{{lot_name, {1}}};
-			auto rp_single = lotman::db::SQL_get_matches(usage_GB_query, usage_GB_str_map);
+			auto rp_single = lotman::db::SQL_get_matches(lotman::db::Query::TotalUsage, usage_GB_str_map);
 			if (!rp_single.second.empty()) { // There was an error
 				std::string int_err = rp_single.second;
 				std::string ext_err = "Failure on call to SQL_get_matches: ";
@@ -815,9 +705,9 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 
 	else if (key == "num_objects") {
 		if (recursive) {
-			std::string rec_num_obj_query = "SELECT self_objects, children_objects FROM lot_usage WHERE lot_name = ?;";
 			std::map<std::string, std::vector<int>> rec_num_obj_str_map{{lot_name, {1}}};
-			auto rp_multi = lotman::db::SQL_get_matches_multi_col(rec_num_obj_query, 2, rec_num_obj_str_map);
+			auto rp_multi = lotman::db::SQL_get_matches_multi_col(lotman::db::Query::ObjectUsageRecursive, 2,
+																  rec_num_obj_str_map);
 			if (!rp_multi.second.empty()) { // There was an error
 				std::string int_err = rp_multi.second;
 				std::string ext_err = "Failure on call to SQL_get_matches_multi_col: ";
@@ -831,10 +721,8 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 			output_obj["children_contrib"] = std::stod(query_multi_out[0][1]);
 			output_obj["total"] = std::stod(query_multi_out[0][0]) + std::stod(query_multi_out[0][1]);
 		} else {
-
-			std::string num_obj_query = "SELECT self_objects FROM lot_usage WHERE lot_name = ?;";
 			std::map<std::string, std::vector<int>> num_obj_str_map{{lot_name, {1}}};
-			auto rp_single = lotman::db::SQL_get_matches(num_obj_query, num_obj_str_map);
+			auto rp_single = lotman::db::SQL_get_matches(lotman::db::Query::ObjectUsage, num_obj_str_map);
 			if (!rp_single.second.empty()) { // There was an error
 				std::string int_err = rp_single.second;
 				std::string ext_err = "Failure on call to SQL_get_matches: ";
@@ -850,11 +738,10 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 
 	else if (key == "GB_being_written") {
 		if (recursive) {
-			std::string rec_GB_being_written_query =
-				"SELECT self_GB_being_written, children_GB_being_written FROM lot_usage WHERE lot_name = ?;";
 			std::map<std::string, std::vector<int>> rec_GB_being_written_str_map{{lot_name, {1}}};
 			auto rp_multi =
-				lotman::db::SQL_get_matches_multi_col(rec_GB_being_written_query, 2, rec_GB_being_written_str_map);
+				lotman::db::SQL_get_matches_multi_col(lotman::db::Query::GBBeingWrittenRecursive, 2,
+													  rec_GB_being_written_str_map);
 			if (!rp_multi.second.empty()) { // There was an error
 				std::string int_err = rp_multi.second;
 				std::string ext_err = "Failure on call to SQL_get_matches_multi_col: ";
@@ -869,10 +756,8 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 			output_obj["children_contrib"] = std::stod(query_multi_out[0][1]);
 			output_obj["total"] = std::stod(query_multi_out[0][0]) + std::stod(query_multi_out[0][1]);
 		} else {
-
-			std::string GB_being_written_query = "SELECT self_GB_being_written FROM lot_usage WHERE lot_name = ?;";
 			std::map<std::string, std::vector<int>> GB_being_written_str_map{{lot_name, {1}}};
-			auto rp_single = lotman::db::SQL_get_matches(GB_being_written_query, GB_being_written_str_map);
+			auto rp_single = lotman::db::SQL_get_matches(lotman::db::Query::GBBeingWritten, GB_being_written_str_map);
 			if (!rp_single.second.empty()) { // There was an error
 				std::string int_err = rp_single.second;
 				std::string ext_err = "Failure on call to SQL_get_matches: ";
@@ -888,10 +773,8 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 
 	else if (key == "objects_being_written") {
 		if (recursive) {
-			std::string rec_objects_being_written_query =
-				"SELECT self_objects_being_written, children_objects_being_written FROM lot_usage WHERE lot_name = ?;";
 			std::map<std::string, std::vector<int>> rec_objects_being_written_str_map{{lot_name, {1}}};
-			auto rp_multi = lotman::db::SQL_get_matches_multi_col(rec_objects_being_written_query, 2,
+			auto rp_multi = lotman::db::SQL_get_matches_multi_col(lotman::db::Query::ObjectsBeingWrittenRecursive, 2,
 																  rec_objects_being_written_str_map);
 			if (!rp_multi.second.empty()) { // There was an error
 				std::string int_err = rp_multi.second;
@@ -906,11 +789,9 @@ std::pair<json, std::string> lotman::Lot::get_lot_usage(const std::string &key,
 			output_obj["children_contrib"] = std::stod(query_multi_out[0][1]);
 			output_obj["total"] = std::stod(query_multi_out[0][0]) + std::stod(query_multi_out[0][1]);
 		} else {
-
-			std::string objects_being_written_query =
-				"SELECT self_objects_being_written FROM lot_usage WHERE lot_name = ?;";
 			std::map<std::string, std::vector<int>> objects_being_written_str_map{{lot_name, {1}}};
-			auto rp_single = lotman::db::SQL_get_matches(objects_being_written_query, objects_being_written_str_map);
+			auto rp_single = lotman::db::SQL_get_matches(lotman::db::Query::ObjectsBeingWritten,
+														 objects_being_written_str_map);
 			if (!rp_single.second.empty()) { // There was an error
 				std::string int_err = rp_single.second;
 				std::string ext_err = "Failure on call to SQL_get_matches: ";
@@ -947,7 +828,7 @@ std::pair<bool, std::string> lotman::Lot::add_parents(const std::vector<Lot> &pa
 	}
 
 	// Perform the cycle check
-	if (Checks::cycle_check(lot_name, parent_names, children_names)) {
+	if (Checks::cycle_check(parent_names, children_names)) {
 		std::string err = "The requested parent addition would introduce a dependency cycle.";
 		return std::make_pair(false, err);
 	}
@@ -959,6 +840,20 @@ std::pair<bool, std::string> lotman::Lot::add_parents(const std::vector<Lot> &pa
 		std::string ext_err = "Call to lotman::Lot::store_new_parents failed: ";
 		return std::make_pair(false, ext_err + int_err);
 	}
+
+	// The new parents and their ancestors now count this lot's subtree as children usage
+	auto rp_vec_str = HierarchyCache::get_parents(lot_name, true, false);
+	if (!rp_vec_str.second.empty()) {
+		std::string int_err = rp_vec_str.second;
+		std::string ext_err = "Failure on call to get_parents: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	rp = refresh_children_usage(rp_vec_str.first);
+	if (!rp.first) {
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to refresh_children_usage: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
 	return std::make_pair(true, "");
 }
 
@@ -1000,6 +895,15 @@ std::pair<bool, std::string> lotman::Lot::remove_parents(const std::vector<std::
 		return std::make_pair(false, "Could not remove parents because doing so would orphan the lot.");
 	}
 
+	// Ancestors reachable only through the removed parents stop counting this lot's subtree
+	auto rp_vec_str = HierarchyCache::get_parents(lot_name, true, false);
+	if (!rp_vec_str.second.empty()) {
+		std::string int_err = rp_vec_str.second;
+		std::string ext_err = "Failure on call to get_parents: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	std::vector<std::string> ancestors = rp_vec_str.first;
+
 	auto rp = remove_parents_from_db(parents_copy);
 
 	if (!rp.first) {
@@ -1007,6 +911,12 @@ std::pair<bool, std::string> lotman::Lot::remove_parents(const std::vector<std::
 		std::string ext_err = "Call to lotman::Lot::remove_parents failed: ";
 		return std::make_pair(false, ext_err + int_err);
 	}
+	rp = refresh_children_usage(ancestors);
+	if (!rp.first) {
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to refresh_children_usage: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
 	return std::make_pair(true, "");
 }
 
@@ -1030,6 +940,7 @@ std::pair<bool, std::string> lotman::Lot::update_owner(const std::string &update
 		std::string ext_err = "Failure on call to lotman::Lot::store_updates when storing owner update: ";
 		return std::make_pair(false, ext_err + int_err);
 	}
+	AuthorizationCache::set_owner(lot_name, update_val);
 	return std::make_pair(true, "");
 }
 
@@ -1046,6 +957,8 @@ std::pair<bool, std::string> lotman::Lot::update_parents(const json &update_arr)
 	for (const auto &parent_lot : recursive_parents) {
 		parents.push_back(parent_lot.lot_name);
 	}
+	std::vector<std::string> affected_lots = parents; // Ancestors before the update, for refreshing children usage
+
 	// for each existing parent, if it's being updated, swap it out with the new parent.
 	for (const auto &update : update_arr) {
 		auto parent_iter = std::find(parents.begin(), parents.end(), update["current"]);
@@ -1063,27 +976,35 @@ std::pair<bool, std::string> lotman::Lot::update_parents(const json &update_arr)
 		children.push_back(child_lot.lot_name);
 	}
 
-	if (Checks::cycle_check(lot_name, parents, children)) {
+	if (Checks::cycle_check(parents, children)) {
 		std::string err = "The requested parent update would introduce a dependency cycle.";
 		return std::make_pair(false, err);
 	}
 
-	std::string parents_update_stmt = "UPDATE parents SET parent=? WHERE lot_name=? AND parent=?";
 	// Need to store modifications per map entry
 	for (const auto &update_obj : update_arr) {
-		std::map<std::string, std::vector<int>> parents_update_str_map;
-		if (update_obj["current"] == lot_name) {
-			parents_update_str_map = {{update_obj["new"], {1}}, {update_obj["current"], {2, 3}}};
-		} else {
-			parents_update_str_map = {{update_obj["new"], {1}}, {lot_name, {2}}, {update_obj["current"], {3}}};
-		}
-		auto rp = store_updates(parents_update_stmt, parents_update_str_map);
+		auto rp = store_parent_update(update_obj["current"], update_obj["new"]);
 		if (!rp.first) {
 			std::string int_err = rp.second;
-			std::string ext_err = "Failure on call to lotman::Lot::store_updates when storing parents update: ";
+			std::string ext_err = "Failure on call to lotman::Lot::store_parent_update: ";
 			return std::make_pair(false, ext_err + int_err);
 		}
 	}
+
+	// Both the old and the new ancestors see a different set of descendants
+	auto rp_vec_str = HierarchyCache::get_parents(lot_name, true, false);
+	if (!rp_vec_str.second.empty()) {
+		std::string int_err = rp_vec_str.second;
+		std::string ext_err = "Failure on call to get_parents: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	affected_lots.insert(affected_lots.end(), rp_vec_str.first.begin(), rp_vec_str.first.end());
+	auto rp = refresh_children_usage(affected_lots);
+	if (!rp.first) {
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to refresh_children_usage: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
 	return std::make_pair(true, "");
 }
 
@@ -1105,6 +1026,7 @@ std::pair<bool, std::string> lotman::Lot::update_paths(const json &update_arr) {
 		std::map<std::string, std::vector<int>> recursive_update_str_map{{lot_name, {2}}, {current_path, {3}}};
 		auto rp = store_updates(recursive_update_stmt, recursive_update_str_map, recursive_update_int_map);
 		if (!rp.first) {
+			PathCache::invalidate(); // Earlier updates in the array were stored, so the cached rules are unknown
 			std::string int_err = rp.second;
 			std::string ext_err = "Failure on call to lotman::Lot::store_updates when storing paths recursive update: ";
 			return std::make_pair(false, ext_err + int_err);
@@ -1116,6 +1038,7 @@ std::pair<bool, std::string> lotman::Lot::update_paths(const json &update_arr) {
 			std::map<std::string, std::vector<int>> exclude_update_str_map{{lot_name, {2}}, {current_path, {3}}};
 			rp = store_updates(exclude_update_stmt, exclude_update_str_map, exclude_update_int_map);
 			if (!rp.first) {
+				PathCache::invalidate();
 				std::string int_err = rp.second;
 				std::string ext_err =
 					"Failure on call to lotman::Lot::store_updates when storing paths exclude update: ";
@@ -1128,10 +1051,17 @@ std::pair<bool, std::string> lotman::Lot::update_paths(const json &update_arr) {
 			{new_path, {1}}, {lot_name, {2}}, {current_path, {3}}};
 		rp = store_updates(paths_update_stmt, paths_update_str_map);
 		if (!rp.first) {
+			PathCache::invalidate();
 			std::string int_err = rp.second;
 			std::string ext_err = "Failure on call to lotman::Lot::store_updates when storing paths path update: ";
 			return std::make_pair(false, ext_err + int_err);
 		}
+
+		std::optional<bool> exclude;
+		if (update_obj.contains("exclude")) {
+			exclude = update_obj["exclude"].get<int>() != 0;
+		}
+		PathCache::update_path(lot_name, current_path, new_path, update_obj["recursive"].get<int>() != 0, exclude);
 	}
 	return std::make_pair(true, "");
 }
@@ -1195,297 +1125,181 @@ std::pair<bool, std::string> lotman::Lot::update_self_usage(const std::string &k
 	/*
 	Function Flow for update_lot_usage:
 	* Sanitize inputs by making sure key is allowed/known
-	* Get the current usage, used to calculate delta for updating parents' children_* columns
-	* Calculate delta
-	* Update lot proper
-	* For each parent of lot proper, update children_key += delta
+	* Get the lot's ancestors from the hierarchy cache
+	* In a single transaction: get the current usage, calculate the delta, update the lot proper and
+	  add the delta to children_key for each ancestor
 	*/
 
-	std::array<std::string, 2> allowed_int_keys = {"self_objects", "self_objects_being_written"};
-	std::array<std::string, 2> allowed_double_keys = {"self_GB", "self_GB_being_written"};
-
-	std::string children_key =
-		"children" + key.substr(4); // here, we strip out the "self" from the key to target the children col
-	std::string update_parent_usage_stmt =
-		"UPDATE lot_usage SET " + children_key + " = " + children_key + " + ? WHERE lot_name = ?;";
-
-	// Get the current usage, which is needed in later sections
-	std::string get_usage_query = "SELECT " + key + " FROM lot_usage WHERE lot_name = ?;";
-	std::map<std::string, std::vector<int>> get_usage_query_str_map{{lot_name, {1}}};
-	auto rp_vec_str = lotman::db::SQL_get_matches(get_usage_query, get_usage_query_str_map);
+	std::array<std::string, 4> allowed_keys = {"self_GB", "self_GB_being_written", "self_objects",
+											   "self_objects_being_written"};
+	if (std::find(allowed_keys.begin(), allowed_keys.end(), key) == allowed_keys.end()) {
+		return std::make_pair(false, "The key " + key + " is not a valid usage key.");
+	}
 
+	auto rp_vec_str = HierarchyCache::get_parents(lot_name, true, false);
 	if (!rp_vec_str.second.empty()) { // There was an error
 		std::string int_err = rp_vec_str.second;
-		std::string ext_err = "Failure on call to SQL_get_matches: ";
+		std::string ext_err = "Failure on call to get_parents: ";
 		return std::make_pair(false, ext_err + int_err);
 	}
 
-	if (deltaMode) {
-		std::map<std::string, std::vector<int>> update_usage_str_map = {{lot_name, {2}}};
-		std::string update_usage_delta_stmt = "UPDATE lot_usage SET " + key + " = " + key + " + ? WHERE lot_name = ?;";
-
-		if (std::find(allowed_int_keys.begin(), allowed_int_keys.end(), key) != allowed_int_keys.end()) {
-			int delta = value;
-			int current_usage = std::stod(rp_vec_str.first[0]);
-
-			if (current_usage + delta < 0) {
-				return std::make_pair(
-					false,
-					"The attempted delta update would result in storing negative values for the key " + key + ".");
-			}
-
-			// Store updates for lot proper
-			std::map<int64_t, std::vector<int>> update_usage_int_map = {{value, {1}}};
-			auto rp_bool_str = this->store_updates(update_usage_delta_stmt, update_usage_str_map, update_usage_int_map);
-			if (!rp_bool_str.first) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to store_updates: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
+	std::vector<UsageUpdate> updates{UsageUpdate{lot_name, {{key, value}}, rp_vec_str.first, ""}};
+	auto rp_bool_str = store_usage_batch(updates, deltaMode);
+	if (!rp_bool_str.first) {
+		std::string int_err = rp_bool_str.second;
+		std::string ext_err = "Failure on call to store_usage_batch: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	if (!updates[0].error.empty()) {
+		return std::make_pair(false, updates[0].error);
+	}
+	return std::make_pair(true, "");
+}
 
-			// // Get the parents that need to be updated
-			// auto rp_lotvec_str = this->get_parents(true);
-			// if (!rp_lotvec_str.second.empty()) { // There was an error
-			//     std::string int_err = rp_lotvec_str.second;
-			//     std::string ext_err = "Failure on call to get_parents: ";
-			//     return std::make_pair(false, ext_err + int_err);
-			// }
-
-			// for (const auto &parent : recursive_parents) {
-			//     std::map<std::string, std::vector<int>> update_parent_str_map{{parent.lot_name, {2}}};
-			//     std::map<int64_t, std::vector<int>> update_parent_int_map{{delta, {1}}}; // Update children_key to
-			//     current_usage + delta rp_bool_str = this->update_parent_usage(parent, update_parent_usage_stmt,
-			//     update_parent_str_map, update_parent_int_map); if (!rp_bool_str.first) { // There was an error
-			//         std::string int_err = rp_bool_str.second;
-			//         std::string ext_err = "Failure on call to store_updates when updating parent usage: ";
-			//         return std::make_pair(false, ext_err + int_err);
-			//     }
-			// }
-		} else if (std::find(allowed_double_keys.begin(), allowed_double_keys.end(), key) !=
-				   allowed_double_keys.end()) {
-			double delta = value;
-			double current_usage = std::stod(rp_vec_str.first[0]);
-
-			if (current_usage + delta < 0) {
-				return std::make_pair(
-					false,
-					"The attempted delta update would result in storing negative values for the key " + key + ".");
+std::pair<std::vector<std::string>, std::string> lotman::Lot::update_usage_batch(const json &update_arr,
+																				  bool deltaMode) {
+	std::vector<UsageUpdate> items;
+	items.reserve(update_arr.size());
+	for (const auto &update_obj : update_arr) {
+		UsageUpdate item{update_obj["lot_name"], {}, {}, ""};
+		for (const auto &pair : update_obj.items()) {
+			if (pair.key() != "lot_name") {
+				item.values[pair.key()] = pair.value().get<double>();
 			}
+		}
+		items.push_back(std::move(item));
+	}
+	return update_usage_batch(items, deltaMode);
+}
 
-			std::map<double, std::vector<int>> update_usage_double_map = {{value, {1}}};
-			std::map<int64_t, std::vector<int>> plc_hldr_int_map;
-			auto rp_bool_str = this->store_updates(update_usage_delta_stmt, update_usage_str_map, plc_hldr_int_map,
-												   update_usage_double_map);
-			if (!rp_bool_str.first) { // There was an error
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to store_updates for lot proper: ";
-				return std::make_pair(false, ext_err + int_err);
+std::pair<std::vector<std::string>, std::string> lotman::Lot::update_usage_batch(const std::vector<UsageUpdate> &items,
+																				  bool deltaMode) {
+	/*
+	Function flow for update_usage_batch:
+	* Coalesce the update objects per lot. In delta mode values for the same key are summed, otherwise the
+	  last value wins.
+	* For each distinct lot, check that it exists and that the caller may update it, and look up its ancestors
+	* Apply everything in a single transaction with store_usage_batch
+	* Map each lot's outcome back onto the update objects that contributed to it
+	*/
+	std::vector<std::string> item_errors(items.size());
+	std::vector<UsageUpdate> updates;
+	std::vector<std::vector<size_t>> update_items;
+	std::unordered_map<std::string, size_t> update_index;
+
+	for (size_t i = 0; i < items.size(); ++i) {
+		const auto &item = items[i];
+		auto index_iter = update_index.find(item.lot_name);
+		if (index_iter == update_index.end()) {
+			index_iter = update_index.emplace(item.lot_name, updates.size()).first;
+			updates.push_back(UsageUpdate{item.lot_name, {}, {}, ""});
+			update_items.emplace_back();
+		}
+		auto &update = updates[index_iter->second];
+		update_items[index_iter->second].push_back(i);
+
+		for (const auto &[key, value] : item.values) {
+			if (deltaMode) {
+				update.values[key] += value;
+			} else {
+				update.values[key] = value;
 			}
-
-			// // Get parents to be updated
-			// auto rp_lotvec_str = this->get_parents(true);
-			// if (!rp_lotvec_str.second.empty()) { // There was an error
-			//     std::string int_err = rp_lotvec_str.second;
-			//     std::string ext_err = "Failure on call to get_parents: ";
-			//     return std::make_pair(false, ext_err + int_err);
-			// }
-
-			// // Update the parents
-			// for (const auto &parent : recursive_parents) {
-			//     std::map<std::string, std::vector<int>> update_parent_str_map{{parent.lot_name, {2}}};
-			//     std::map<double, std::vector<int>> update_parent_dbl_map{{delta, {1}}}; // Update children_key to
-			//     current_usage + delta std::map<int64_t, std::vector<int>> plc_hldr_int_map; rp_bool_str =
-			//     this->update_parent_usage(parent, update_parent_usage_stmt, update_parent_str_map, plc_hldr_int_map,
-			//     update_parent_dbl_map); if (!rp_bool_str.first) { // There was an error
-			//         std::string int_err = rp_bool_str.second;
-			//         std::string ext_err = "Failure on call to store_updates";
-			//         return std::make_pair(false, ext_err + int_err);
-			//     }
-			// }
 		}
-	} else {
-		std::map<std::string, std::vector<int>> update_usage_str_map = {{lot_name, {2}}};
-		std::string update_usage_stmt = "UPDATE lot_usage SET " + key + "=? WHERE lot_name=?;";
-		std::string get_usage_query = "SELECT " + key + " FROM lot_usage WHERE lot_name = ?;";
-
-		// std::string children_key = "children" + key.substr(4);
-		std::string parent_usage_query = "SELECT " + children_key + " FROM lot_usage WHERE lot_name = ?;";
-		// std::string update_parent_usage_stmt = "UPDATE lot_usage SET " + children_key + "=? WHERE lot_name=?;";
+	}
 
-		if (std::find(allowed_int_keys.begin(), allowed_int_keys.end(), key) != allowed_int_keys.end()) {
-			int current_usage = std::stoi(rp_vec_str.first[0]);
-			int delta = value - current_usage;
+	for (auto &update : updates) {
+		auto rp = lot_exists(update.lot_name);
+		if (!rp.first) {
+			update.error = rp.second.empty() ? "The lot does not exist." : rp.second;
+			continue;
+		}
 
-			// Update lot proper
-			std::map<int64_t, std::vector<int>> update_usage_int_map = {{value, {1}}};
+		Lot lot(update.lot_name);
+		lot.get_parents(true, true);
+		rp = lot.check_context_for_parents(lot.recursive_parents, true);
+		if (!rp.first) {
+			update.error = rp.second;
+			continue;
+		}
 
-			auto rp_bool_str = this->store_updates(update_usage_stmt, update_usage_str_map, update_usage_int_map);
-			if (!rp_bool_str.first) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to store_updates: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
+		auto rp_vec_str = HierarchyCache::get_parents(update.lot_name, true, false);
+		if (!rp_vec_str.second.empty()) {
+			std::string int_err = rp_vec_str.second;
+			std::string ext_err = "Failure on call to get_parents: ";
+			return std::make_pair(item_errors, ext_err + int_err);
+		}
+		update.ancestors = rp_vec_str.first;
+	}
 
-			/* TODO: need some kind of recovery file if we start updating parents and then fail --> for each parent,
-			   store  in temp file current usage for key and delete temp file after done. Use a function "repair_db"
-			   that checks for existence of temp file and restores things to those values, deleting the temp file upon
-			   completion.
-			*/
-
-			// // Update parents
-			// auto rp_lotvec_str = this->get_parents(true);
-			// if (!rp_lotvec_str.second.empty()) { // There was an error
-			//     std::string int_err = rp_lotvec_str.second;
-			//     std::string ext_err = "Failure on call to get_parents: ";
-			//     return std::make_pair(false, ext_err + int_err);
-			// }
-
-			// for (const auto &parent : recursive_parents) {
-			//     std::map<std::string, std::vector<int>> parent_usage_query_str_map{{parent.lot_name, {1}}};
-			//     auto rp_vec_str = lotman::db::SQL_get_matches(parent_usage_query, parent_usage_query_str_map);
-			//     if (!rp_vec_str.second.empty()) { // There was an error
-			//         std::string int_err = rp_vec_str.second;
-			//         std::string ext_err = "Failure on call to get_parents: ";
-			//         return std::make_pair(false, ext_err + int_err);
-			//     }
-			//     int current_usage = std::stoi(rp_vec_str.first[0]);
-			//     std::map<std::string, std::vector<int>> update_parent_str_map{{parent.lot_name, {2}}};
-			//     std::map<int64_t, std::vector<int>> update_parent_dbl_map{{delta, {1}}}; // Update children_key to
-			//     current_usage + delta rp_bool_str = this->update_parent_usage(parent, update_parent_usage_stmt,
-			//     update_parent_str_map, update_parent_dbl_map); if (!rp_bool_str.first) { // There was an error
-			//         std::string int_err = rp_bool_str.second;
-			//         std::string ext_err = "Failure on call to store_updates when updating parent usage: ";
-			//         return std::make_pair(false, ext_err + int_err);
-			//     }
-			// }
-
-		} else if (std::find(allowed_double_keys.begin(), allowed_double_keys.end(), key) !=
-				   allowed_double_keys.end()) {
-			double current_usage = std::stod(rp_vec_str.first[0]);
-			double delta = value - current_usage;
-
-			// Update lot proper
-			std::map<std::string, std::vector<int>> update_usage_str_map = {{lot_name, {2}}};
-			std::map<double, std::vector<int>> update_usage_dbl_map = {{value, {1}}};
-			std::map<int64_t, std::vector<int>> plc_hldr_int_map;
-			auto rp_bool_str =
-				this->store_updates(update_usage_stmt, update_usage_str_map, plc_hldr_int_map, update_usage_dbl_map);
-			if (!rp_bool_str.first) { // There was an error
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure on call to store_updates for lot proper: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
+	auto rp = store_usage_batch(updates, deltaMode);
+	if (!rp.first) {
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to store_usage_batch: ";
+		return std::make_pair(item_errors, ext_err + int_err);
+	}
 
-			// // Update parents
-			// auto rp_lotvec_str = this->get_parents(true);
-			// if (!rp_lotvec_str.second.empty()) { // There was an error
-			//     std::string int_err = rp_lotvec_str.second;
-			//     std::string ext_err = "Failure on call to get_parents: ";
-			//     return std::make_pair(false, ext_err + int_err);
-			// }
-
-			// std::string children_key = "children" + key.substr(4);
-			// for (const auto &parent : recursive_parents) {
-			//     std::map<std::string, std::vector<int>> parent_usage_query_str_map{{parent.lot_name, {1}}};
-			//     rp_vec_str = lotman::db::SQL_get_matches(parent_usage_query, parent_usage_query_str_map);
-			//     if (!rp_vec_str.second.empty()) { // There was an error
-			//         std::string int_err = rp_vec_str.second;
-			//         std::string ext_err = "Failure on call to SQL_get_matches: ";
-			//         return std::make_pair(false, ext_err + int_err);
-			//     }
-			//     double current_usage = std::stod(rp_vec_str.first[0]);
-			//     std::map<std::string, std::vector<int>> update_parent_str_map{{parent.lot_name, {2}}};
-			//     std::map<double, std::vector<int>> update_parent_dbl_map{{delta, {1}}}; // Update children_key to
-			//     current_usage + delta std::map<int64_t, std::vector<int>> plc_hldr_int_map; rp_bool_str =
-			//     this->update_parent_usage(parent, update_parent_usage_stmt, update_parent_str_map, plc_hldr_int_map,
-			//     update_parent_dbl_map); if (!rp_bool_str.first) { // There was an error
-			//         std::string int_err = rp_bool_str.second;
-			//         std::string ext_err = "Failure on call to store_updates for parents: ";
-			//         return std::make_pair(false, ext_err + int_err);
-			//     }
-			// }
+	for (size_t u = 0; u < updates.size(); ++u) {
+		for (size_t item : update_items[u]) {
+			item_errors[item] = updates[u].error;
 		}
 	}
-	return std::make_pair(true, "");
+	return std::make_pair(item_errors, "");
 }
 
-// SECTION UNDER MAINTENANCE
-
 std::pair<bool, std::string> lotman::Lot::update_db_children_usage() {
 	/*
-	Function flow:
-	- enumerate all the lots
-	- For each lot, update it's children_usage.
+	Usage updates push their deltas into every ancestor's children_* columns as they happen, so this full
+	recompute is only needed to repair a database whose children_* columns have drifted.
 	*/
-
-	// Enumerate lots
-	auto rp = list_all_lots();
-	if (!rp.second.empty()) {
-		std::string int_err = rp.second;
-		std::string ext_err = "Failure on call to lotman::Lot::list_all_lots: ";
-		return std::make_pair(false, ext_err + int_err);
+	try {
+		auto &storage = db::StorageManager::get_storage();
+		db::recompute_children_usage(storage);
+	} catch (const std::exception &e) {
+		return std::make_pair(false, std::string("Failed to recompute children usage: ") + e.what());
 	}
 
-	// For each lot, update usage
-	for (auto &lot_name : rp.first) {
-		Lot lot(lot_name);
+	return std::make_pair(true, "");
+}
+
+std::pair<bool, std::string> lotman::Lot::refresh_children_usage(const std::vector<std::string> &lot_names) {
+	// Used after hierarchy changes, where the set of descendants (not their usage) changed for these lots
+	std::vector<std::string> names = lot_names;
+	std::sort(names.begin(), names.end());
+	names.erase(std::unique(names.begin(), names.end()), names.end());
+
+	for (const auto &name : names) {
+		Lot lot(name);
 		auto rp_bool_str = lot.recalculate_children_usage();
 		if (!rp_bool_str.first) {
 			std::string int_err = rp_bool_str.second;
-			std::string ext_err = "Failure on call to recalculate_children_usage for lot " + lot_name + ": ";
+			std::string ext_err = "Failure on call to recalculate_children_usage for lot " + name + ": ";
+			return std::make_pair(false, ext_err + int_err);
 		}
 	}
-
 	return std::make_pair(true, "");
 }
 
 std::pair<bool, std::string> lotman::Lot::recalculate_children_usage() {
 	/*
 	Function flow for the lot this is being called on:
-	- Get all the children
-	- Sum the childrens' usage stats
+	- Sum the usage stats of all descendants
 	- Write to db
 	*/
 
-	if (!recursive_children_loaded) {
-		this->get_children(true, false);
+	// Sum over every descendant through the closure, one indexed join whatever the size of the subtree.
+	// A lot without descendants gets one row of NULL sums.
+	std::map<std::string, std::vector<int>> sum_str_map{{lot_name, {1}}};
+	auto rp_vec_vec_str = lotman::db::SQL_get_matches_multi_col(lotman::db::Query::ChildrenUsageSums, 4, sum_str_map);
+	if (!rp_vec_vec_str.second.empty()) {
+		std::string int_err = rp_vec_vec_str.second;
+		std::string ext_err = "Failure on call to SQL_get_matches_multi_col while summing child usage: ";
+		return std::make_pair(false, ext_err + int_err);
 	}
-
-	std::vector<std::vector<std::string>> updated_usages;
-	if (recursive_children.size() > 0) {
-		std::map<std::string, std::vector<int>> sum_str_map{};
-		std::string sum_query =
-			"SELECT SUM(self_GB), SUM(self_GB_being_written), SUM(self_objects), SUM(self_objects_being_written) "
-			"FROM lot_usage WHERE lot_name IN (";
-
-		// For each child we need to update both the query and the str map
-		for (int i = 0; i < recursive_children.size(); i++) {
-			// Update the query
-			sum_query += "?";
-			if (i != recursive_children.size() - 1) {
-				sum_query += ", ";
-			}
-
-			// Update the str map
-			sum_str_map[recursive_children[i].lot_name] = {i + 1};
-		}
-		sum_query += ");";
-
-		// Get the sum
-		auto rp_vec_vec_str = lotman::db::SQL_get_matches_multi_col(sum_query, 4, sum_str_map);
-		if (!rp_vec_vec_str.second.empty()) {
-			std::string int_err = rp_vec_vec_str.second;
-			std::string ext_err = "Failure on call to SQL_get_matches_multi_col while summing child usage: ";
-			return std::make_pair(false, ext_err + int_err);
-		}
-		if (rp_vec_vec_str.first.size() == 0) {
-			return std::make_pair(false, "lotman::db::SQL_get_matches_multi_col returned an empty vector when "
-										 "querying for child usage sums, but it shouldn't have");
-		}
-		updated_usages = rp_vec_vec_str.first;
-	} else {
-		updated_usages.push_back({"0", "0", "0", "0"}); // set the values to 0, there are no children!
+	if (rp_vec_vec_str.first.size() == 0) {
+		return std::make_pair(false, "lotman::db::SQL_get_matches_multi_col returned an empty vector when "
+									 "querying for child usage sums, but it shouldn't have");
 	}
+	std::vector<std::vector<std::string>> updated_usages = rp_vec_vec_str.first;
 
 	// // Get current usages
 	// std::string current_usage_query =   "SELECT children_GB, children_GB_being_written, children_objects,
@@ -1505,13 +1319,15 @@ std::pair<bool, std::string> lotman::Lot::recalculate_children_usage() {
 	// std::vector<std::vector<std::string>> outdated_usages = rp_vec_vec_str.first;
 
 	// // Calculate the deltas
+	// SUM() is NULL when none of the children have a usage record (e.g. they were just deleted)
+	auto to_num = [](const std::string &sum) { return sum.empty() ? 0.0 : std::stod(sum); };
 	double children_GB = 0, children_GB_being_written = 0;
 	int64_t children_objects = 0, children_objects_being_written = 0;
-	children_GB = std::stod(updated_usages[0][0]);
-	children_GB_being_written = std::stod(updated_usages[0][1]);
+	children_GB = to_num(updated_usages[0][0]);
+	children_GB_being_written = to_num(updated_usages[0][1]);
 	// std::stoi will narrow the number, which should be int64_t, so we interpret string as double and cast to int64_t
-	children_objects = (int64_t)std::stod(updated_usages[0][2]);
-	children_objects_being_written = (int64_t)std::stod(updated_usages[0][3]);
+	children_objects = (int64_t)to_num(updated_usages[0][2]);
+	children_objects_being_written = (int64_t)to_num(updated_usages[0][3]);
 
 	std::string update_stmt = "UPDATE lot_usage "
 							  "SET "
@@ -1544,25 +1360,41 @@ std::pair<bool, std::string> lotman::Lot::recalculate_children_usage() {
 	return std::make_pair(true, "");
 }
 
-// END SECTION
-
 std::pair<bool, std::string> lotman::Lot::update_usage_by_dirs(const json &update_JSON, bool deltaMode) {
 	// TODO: Should lots who don't show up when connecting lots to dirs be reset to have
 	//       0 usage, or should the be kept the way they are?
 	// --> kept the way they are, probably.
 
 	DirUsageUpdate dirUpdate;
-	std::vector<Lot> return_lots;
-	auto rp = dirUpdate.JSON_math(update_JSON, &return_lots);
+	auto rp = dirUpdate.JSON_math(update_JSON);
+	if (!rp.first) {
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to JSON_math: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+
+	auto updates = dirUpdate.take_updates();
+	return store_dir_usage(updates, deltaMode);
+}
+
+std::pair<bool, std::string> lotman::Lot::update_usage_by_dirs(std::istream &update_stream, bool deltaMode,
+															   const std::function<void(const json &)> &validate_dir) {
+	DirUsageUpdate dirUpdate;
+	auto rp = dirUpdate.JSON_math(update_stream, validate_dir);
 	if (!rp.first) {
 		std::string int_err = rp.second;
 		std::string ext_err = "Failure on call to JSON_math: ";
 		return std::make_pair(false, ext_err + int_err);
 	}
 
-	for (auto &lot : return_lots) {
+	auto updates = dirUpdate.take_updates();
+	return store_dir_usage(updates, deltaMode);
+}
+
+std::pair<bool, std::string> lotman::Lot::store_dir_usage(std::vector<UsageUpdate> &updates, bool deltaMode) {
+	for (auto &update : updates) {
 		// Since we don't know the lots beforehand, we have to check for their existence here.
-		auto exists = lot_exists(lot.lot_name);
+		auto exists = lot_exists(update.lot_name);
 		if (!exists.second.empty()) {
 			std::string int_err = exists.second;
 			std::string ext_err = "Failed to check if lot exists: ";
@@ -1570,58 +1402,44 @@ std::pair<bool, std::string> lotman::Lot::update_usage_by_dirs(const json &updat
 		}
 
 		if (!exists.first) {
-			std::string err = "The lot " + lot.lot_name + " does not exist in the db, so it cannot be updated...";
+			std::string err = "The lot " + update.lot_name + " does not exist in the db, so it cannot be updated...";
 			return std::make_pair(false, err);
 		}
 
-		if (lot.usage.self_GB_update_staged) {
-			auto rp_bool_str = lot.update_self_usage("self_GB", lot.usage.self_GB, deltaMode);
-			if (!rp_bool_str.first) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure to update lot's self_GB: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
+		auto rp_vec_str = HierarchyCache::get_parents(update.lot_name, true, false);
+		if (!rp_vec_str.second.empty()) {
+			std::string int_err = rp_vec_str.second;
+			std::string ext_err = "Failure on call to get_parents: ";
+			return std::make_pair(false, ext_err + int_err);
 		}
+		update.ancestors = rp_vec_str.first;
+	}
 
-		if (lot.usage.self_objects_update_staged) {
-			auto rp_bool_str = lot.update_self_usage("self_objects", lot.usage.self_objects, deltaMode);
-			if (!rp_bool_str.first) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure to update lot's self_objects: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
+	// Every lot's totals are applied in one transaction, and nothing is stored if any lot is rejected
+	auto rp_bool_str = store_usage_batch(updates, deltaMode, true);
+	if (!rp_bool_str.first) {
+		std::string int_err = rp_bool_str.second;
+		std::string ext_err = "Failure on call to store_usage_batch: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	for (const auto &update : updates) {
+		if (!update.error.empty()) {
+			std::string int_err = update.error;
+			std::string ext_err = "Failure to update usage of lot " + update.lot_name + ": ";
+			return std::make_pair(false, ext_err + int_err);
 		}
+	}
 
-		if (lot.usage.self_GB_being_written_update_staged) {
-			auto rp_bool_str =
-				lot.update_self_usage("self_GB_being_written", lot.usage.self_GB_being_written, deltaMode);
-			if (!rp_bool_str.first) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure to update lot's self_GB_being_written: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
-		}
-
-		if (lot.usage.self_objects_being_written_update_staged) {
-			auto rp_bool_str =
-				lot.update_self_usage("self_objects_being_written", lot.usage.self_objects_being_written, deltaMode);
-			if (!rp_bool_str.first) {
-				std::string int_err = rp_bool_str.second;
-				std::string ext_err = "Failure to update lot's self_objects_being_written: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
-		}
-	}
-
-	return std::make_pair(true, "");
-}
+	return std::make_pair(true, "");
+}
 
 std::pair<std::vector<std::string>, std::string> lotman::Lot::get_lots_past_exp(const bool recursive) {
-	std::vector<std::string> expired_lots;
 	auto now = std::chrono::system_clock::now();
 	int64_t ms_since_epoch = std::chrono::time_point_cast<std::chrono::milliseconds>(now).time_since_epoch().count();
 
-	std::string expired_query = "SELECT lot_name FROM management_policy_attributes WHERE expiration_time <= ?;";
+	// Any child of an expired lot is also expired
+	auto expired_query =
+		recursive ? lotman::db::Query::LotsPastExpirationWithDescendants : lotman::db::Query::LotsPastExpiration;
 	std::map<int64_t, std::vector<int>> expired_map{{ms_since_epoch, {1}}};
 	auto rp = lotman::db::SQL_get_matches(expired_query, std::map<std::string, std::vector<int>>(), expired_map);
 	if (!rp.second.empty()) { // There was an error
@@ -1630,39 +1448,16 @@ std::pair<std::vector<std::string>, std::string> lotman::Lot::get_lots_past_exp(
 		return std::make_pair(std::vector<std::string>(), ext_err + int_err);
 	}
 
-	expired_lots = rp.first;
-	if (recursive) { // Any child of an expired lot is also expired
-		std::vector<std::string> tmp;
-		for (auto &lot_name : expired_lots) {
-			Lot _lot(lot_name);
-			auto rp_lotvec_str = _lot.get_children(true);
-			if (!rp_lotvec_str.second.empty()) { // There was an error
-				std::string int_err = rp_lotvec_str.second;
-				std::string ext_err = "Failure on call to get_children.";
-				return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-			}
-
-			std::vector<std::string> tmp;
-			for (const auto &child : _lot.recursive_children) {
-				tmp.push_back(child.lot_name);
-			}
-		}
-		expired_lots.insert(expired_lots.end(), tmp.begin(), tmp.end());
-
-		// Sort and remove any duplicates
-		std::sort(expired_lots.begin(), expired_lots.end());
-		auto last = std::unique(expired_lots.begin(), expired_lots.end());
-		expired_lots.erase(last, expired_lots.end());
-	}
-
-	return std::make_pair(expired_lots, "");
+	return std::make_pair(rp.first, "");
 }
 
 std::pair<std::vector<std::string>, std::string> lotman::Lot::get_lots_past_del(const bool recursive) {
 	auto now = std::chrono::system_clock::now();
 	int64_t ms_since_epoch = std::chrono::time_point_cast<std::chrono::milliseconds>(now).time_since_epoch().count();
 
-	std::string deletion_query = "SELECT lot_name FROM management_policy_attributes WHERE deletion_time <= ?;";
+	// Any child of a lot past deletion is also past deletion
+	auto deletion_query =
+		recursive ? lotman::db::Query::LotsPastDeletionWithDescendants : lotman::db::Query::LotsPastDeletion;
 	std::map<int64_t, std::vector<int>> deletion_map{{ms_since_epoch, {1}}};
 	auto rp = lotman::db::SQL_get_matches(deletion_query, std::map<std::string, std::vector<int>>(), deletion_map);
 	if (!rp.second.empty()) { // There was an error
@@ -1671,217 +1466,240 @@ std::pair<std::vector<std::string>, std::string> lotman::Lot::get_lots_past_del(
 		return std::make_pair(std::vector<std::string>(), ext_err + int_err);
 	}
 
-	std::vector<std::string> deletion_lots = rp.first;
-
-	if (recursive) { // Any child of an expired lot is also expired
-		std::vector<std::string> tmp;
-		for (auto &lot_name : deletion_lots) {
-			Lot _lot(lot_name);
-			auto rp_lotvec_str = _lot.get_children(true);
-			if (!rp_lotvec_str.second.empty()) { // There was an error
-				std::string int_err = rp_lotvec_str.second;
-				std::string ext_err = "Failure on call to get_children.";
-				return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-			}
-
-			for (const auto &child : _lot.recursive_children) {
-				tmp.push_back(child.lot_name);
-			}
-		}
-		deletion_lots.insert(deletion_lots.end(), tmp.begin(), tmp.end());
-
-		// Sort and remove any duplicates
-		std::sort(deletion_lots.begin(), deletion_lots.end());
-		auto last = std::unique(deletion_lots.begin(), deletion_lots.end());
-		deletion_lots.erase(last, deletion_lots.end());
-	}
-
-	return std::make_pair(deletion_lots, "");
+	return std::make_pair(rp.first, "");
 }
 
 std::pair<std::vector<std::string>, std::string> lotman::Lot::get_lots_past_opp(const bool recursive_quota,
 																				const bool recursive_children) {
-	std::vector<std::string> lots_past_opp;
+	// Recursive queries count the usage of children against the quota, and WithDescendants queries also
+	// get all children of the lots past opp
+	lotman::db::Query opp_usage_query;
 	if (recursive_quota) {
-		std::string rec_opp_usage_query =
-			"SELECT "
-			"lot_usage.lot_name "
-			"FROM lot_usage "
-			"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-			"WHERE lot_usage.self_GB + lot_usage.children_GB >= management_policy_attributes.dedicated_GB + "
-			"management_policy_attributes.opportunistic_GB;";
-		auto rp = lotman::db::SQL_get_matches(rec_opp_usage_query);
-		if (!rp.second.empty()) { // There was an error
-			std::string int_err = rp.second;
-			std::string ext_err = "Failure on call to SQL_get_matches: ";
-			return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-		}
-		lots_past_opp = rp.first;
+		opp_usage_query = recursive_children ? lotman::db::Query::LotsPastOpportunisticRecursiveWithDescendants
+											 : lotman::db::Query::LotsPastOpportunisticRecursive;
 	} else {
-		std::string opp_usage_query =
-			"SELECT "
-			"lot_usage.lot_name "
-			"FROM lot_usage "
-			"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-			"WHERE lot_usage.self_GB >= management_policy_attributes.dedicated_GB + "
-			"management_policy_attributes.opportunistic_GB;";
-
-		auto rp = lotman::db::SQL_get_matches(opp_usage_query);
-		if (!rp.second.empty()) { // There was an error
-			std::string int_err = rp.second;
-			std::string ext_err = "Failure on call to SQL_get_matches: ";
-			return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-		}
-		lots_past_opp = rp.first;
+		opp_usage_query = recursive_children ? lotman::db::Query::LotsPastOpportunisticWithDescendants
+											 : lotman::db::Query::LotsPastOpportunistic;
 	}
 
-	if (recursive_children) { // Get all children of the lots past opp
-		std::vector<std::string> tmp;
-		for (const auto lot_past_opp : lots_past_opp) {
-			Lot _lot(lot_past_opp);
-			auto rp_lotvec_str = _lot.get_children(true);
-			if (!rp_lotvec_str.second.empty()) { // There was an error
-				std::string int_err = rp_lotvec_str.second;
-				std::string ext_err = "Failure on call to get_children.";
-				return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-			}
-
-			for (const auto &child : _lot.recursive_children) {
-				tmp.push_back(child.lot_name);
-			}
-		}
-		lots_past_opp.insert(lots_past_opp.end(), tmp.begin(), tmp.end());
-
-		// Sort and remove any duplicates
-		std::sort(lots_past_opp.begin(), lots_past_opp.end());
-		auto last = std::unique(lots_past_opp.begin(), lots_past_opp.end());
-		lots_past_opp.erase(last, lots_past_opp.end());
+	auto rp = lotman::db::SQL_get_matches(opp_usage_query);
+	if (!rp.second.empty()) { // There was an error
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to SQL_get_matches: ";
+		return std::make_pair(std::vector<std::string>(), ext_err + int_err);
 	}
-
-	return std::make_pair(lots_past_opp, "");
+	return std::make_pair(rp.first, "");
 }
 
 std::pair<std::vector<std::string>, std::string> lotman::Lot::get_lots_past_ded(const bool recursive_quota,
 																				const bool recursive_children) {
-	std::vector<std::string> lots_past_ded;
+	// Recursive queries count the usage of children against the quota, and WithDescendants queries also
+	// get all children of the lots past ded
+	lotman::db::Query ded_usage_query;
 	if (recursive_quota) {
-		std::string rec_ded_usage_query =
-			"SELECT "
-			"lot_usage.lot_name "
-			"FROM lot_usage "
-			"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-			"WHERE lot_usage.self_GB + lot_usage.children_GB >= management_policy_attributes.dedicated_GB;";
-
-		auto rp = lotman::db::SQL_get_matches(rec_ded_usage_query);
-		if (!rp.second.empty()) { // There was an error
-			std::string int_err = rp.second;
-			std::string ext_err = "Failure on call to SQL_get_matches: ";
-			return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-		}
-		lots_past_ded = rp.first;
+		ded_usage_query = recursive_children ? lotman::db::Query::LotsPastDedicatedRecursiveWithDescendants
+											 : lotman::db::Query::LotsPastDedicatedRecursive;
 	} else {
-		std::string ded_usage_query =
-			"SELECT "
-			"lot_usage.lot_name "
-			"FROM lot_usage "
-			"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-			"WHERE lot_usage.self_GB >= management_policy_attributes.dedicated_GB;";
-
-		auto rp = lotman::db::SQL_get_matches(ded_usage_query);
-		if (!rp.second.empty()) { // There was an error
-			std::string int_err = rp.second;
-			std::string ext_err = "Failure on call to SQL_get_matches: ";
-			return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-		}
-		lots_past_ded = rp.first;
+		ded_usage_query = recursive_children ? lotman::db::Query::LotsPastDedicatedWithDescendants
+											 : lotman::db::Query::LotsPastDedicated;
 	}
 
-	if (recursive_children) { // Get all children of the lots past opp
-		std::vector<std::string> tmp;
-		for (const auto lot_past_ded : lots_past_ded) {
-			Lot _lot(lot_past_ded);
-			auto rp_lotvec_str = _lot.get_children(true);
-			if (!rp_lotvec_str.second.empty()) { // There was an error
-				std::string int_err = rp_lotvec_str.second;
-				std::string ext_err = "Failure on call to get_children.";
-				return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-			}
-
-			for (const auto &child : _lot.recursive_children) {
-				tmp.push_back(child.lot_name);
-			}
-		}
-		lots_past_ded.insert(lots_past_ded.end(), tmp.begin(), tmp.end());
-
-		// Sort and remove any duplicates
-		std::sort(lots_past_ded.begin(), lots_past_ded.end());
-		auto last = std::unique(lots_past_ded.begin(), lots_past_ded.end());
-		lots_past_ded.erase(last, lots_past_ded.end());
+	auto rp = lotman::db::SQL_get_matches(ded_usage_query);
+	if (!rp.second.empty()) { // There was an error
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to SQL_get_matches: ";
+		return std::make_pair(std::vector<std::string>(), ext_err + int_err);
 	}
-
-	return std::make_pair(lots_past_ded, "");
+	return std::make_pair(rp.first, "");
 }
 
 std::pair<std::vector<std::string>, std::string> lotman::Lot::get_lots_past_obj(const bool recursive_quota,
 																				const bool recursive_children) {
-	std::vector<std::string> lots_past_obj;
+	// Recursive queries count the usage of children against the quota, and WithDescendants queries also
+	// get all children of the lots past obj
+	lotman::db::Query obj_usage_query;
 	if (recursive_quota) {
-		std::string rec_obj_usage_query =
-			"SELECT "
-			"lot_usage.lot_name "
-			"FROM lot_usage "
-			"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-			"WHERE lot_usage.self_objects + lot_usage.children_objects >= "
-			"management_policy_attributes.max_num_objects;";
-
-		auto rp = lotman::db::SQL_get_matches(rec_obj_usage_query);
-		if (!rp.second.empty()) { // There was an error
-			std::string int_err = rp.second;
-			std::string ext_err = "Failure on call to SQL_get_matches: ";
-			return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-		}
-		lots_past_obj = rp.first;
+		obj_usage_query = recursive_children ? lotman::db::Query::LotsPastObjectsRecursiveWithDescendants
+											 : lotman::db::Query::LotsPastObjectsRecursive;
 	} else {
-		std::string obj_usage_query =
-			"SELECT "
-			"lot_usage.lot_name "
-			"FROM lot_usage "
-			"INNER JOIN management_policy_attributes ON lot_usage.lot_name=management_policy_attributes.lot_name "
-			"WHERE lot_usage.self_objects >= management_policy_attributes.max_num_objects;";
-
-		auto rp = lotman::db::SQL_get_matches(obj_usage_query);
-		if (!rp.second.empty()) { // There was an error
-			std::string int_err = rp.second;
-			std::string ext_err = "Failure on call to SQL_get_matches: ";
-			return std::make_pair(std::vector<std::string>(), ext_err + int_err);
-		}
-		lots_past_obj = rp.first;
+		obj_usage_query = recursive_children ? lotman::db::Query::LotsPastObjectsWithDescendants
+											 : lotman::db::Query::LotsPastObjects;
+	}
+
+	auto rp = lotman::db::SQL_get_matches(obj_usage_query);
+	if (!rp.second.empty()) { // There was an error
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to SQL_get_matches: ";
+		return std::make_pair(std::vector<std::string>(), ext_err + int_err);
 	}
+	return std::make_pair(rp.first, "");
+}
+
+std::pair<std::vector<lotman::PolicyViolation>, std::string>
+lotman::Lot::get_policy_violations(const bool recursive_quota, const bool recursive_children) {
+	auto now = std::chrono::system_clock::now();
+	int64_t ms_since_epoch = std::chrono::time_point_cast<std::chrono::milliseconds>(now).time_since_epoch().count();
+
+	const std::string GB_usage =
+		recursive_quota ? "(lot_usage.self_GB + lot_usage.children_GB)" : "lot_usage.self_GB";
+	const std::string obj_usage =
+		recursive_quota ? "(lot_usage.self_objects + lot_usage.children_objects)" : "lot_usage.self_objects";
+	const std::string opp_limit =
+		"(management_policy_attributes.dedicated_GB + management_policy_attributes.opportunistic_GB)";
+	const std::string ded_limit = "management_policy_attributes.dedicated_GB";
+	const std::string obj_limit = "management_policy_attributes.max_num_objects";
+
+	auto flag_if = [](const std::string &condition, unsigned int flag) {
+		return "((" + condition + ") * " + std::to_string(flag) + ")";
+	};
+
+	// Every lot with the policies it violates itself and by how much its usage exceeds each quota. Quotas are
+	// violated once usage reaches them, like in get_lots_past_opp/ded/obj, so the overage of a violated quota
+	// can be zero. ?1 is the current time.
+	std::string own_query =
+		"own AS (SELECT management_policy_attributes.lot_name AS lot_name, " +
+		flag_if("management_policy_attributes.expiration_time <= ?1", LOTMAN_VIOLATION_EXPIRED) + " | " +
+		flag_if("management_policy_attributes.deletion_time <= ?1", LOTMAN_VIOLATION_DELETION) + " | " +
+		flag_if(GB_usage + " >= " + opp_limit, LOTMAN_VIOLATION_OPPORTUNISTIC) + " | " +
+		flag_if(GB_usage + " >= " + ded_limit, LOTMAN_VIOLATION_DEDICATED) + " | " +
+		flag_if(obj_usage + " >= " + obj_limit, LOTMAN_VIOLATION_OBJECTS) + " AS flags, " +
+		"MAX(" + GB_usage + " - " + opp_limit + ", 0) AS opp_overage, " +
+		"MAX(" + GB_usage + " - " + ded_limit + ", 0) AS ded_overage, " +
+		"MAX(" + obj_usage + " - " + obj_limit + ", 0) AS obj_overage " +
+		"FROM management_policy_attributes "
+		"INNER JOIN lot_usage ON lot_usage.lot_name = management_policy_attributes.lot_name)";
+
+	std::string violations_query;
+	if (recursive_children) {
+		// Descendants of an offending lot inherit its flags. SQLite has no bitwise OR aggregate,
+		// so the inherited flags are OR-ed together one bit at a time.
+		std::string inherited_flags;
+		for (unsigned int flag : {LOTMAN_VIOLATION_EXPIRED, LOTMAN_VIOLATION_DELETION, LOTMAN_VIOLATION_OPPORTUNISTIC,
+								  LOTMAN_VIOLATION_DEDICATED, LOTMAN_VIOLATION_OBJECTS}) {
+			inherited_flags += (inherited_flags.empty() ? "MAX(own.flags & " : " | MAX(own.flags & ");
+			inherited_flags += std::to_string(flag) + ")";
+		}
+		violations_query = "WITH " + own_query + ", inherited AS (SELECT lot_closure.descendant AS lot_name, " +
+						   inherited_flags +
+						   " AS flags FROM lot_closure INNER JOIN own ON own.lot_name = lot_closure.ancestor "
+						   "WHERE lot_closure.depth > 0 AND own.flags != 0 GROUP BY lot_closure.descendant) "
+						   "SELECT own.lot_name, own.flags, COALESCE(inherited.flags, 0), "
+						   "own.opp_overage, own.ded_overage, own.obj_overage "
+						   "FROM own LEFT JOIN inherited ON inherited.lot_name = own.lot_name "
+						   "WHERE own.flags != 0 OR inherited.flags IS NOT NULL ORDER BY own.lot_name;";
+	} else {
+		violations_query = "WITH " + own_query +
+						   " SELECT lot_name, flags, 0, opp_overage, ded_overage, obj_overage "
+						   "FROM own WHERE flags != 0 ORDER BY lot_name;";
+	}
+
+	std::map<int64_t, std::vector<int>> violations_map{{ms_since_epoch, {1}}};
+	auto rp = lotman::db::SQL_get_matches_multi_col(violations_query, 6, std::map<std::string, std::vector<int>>(),
+												   violations_map);
+	if (!rp.second.empty()) { // There was an error
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to SQL_get_matches_multi_col: ";
+		return std::make_pair(std::vector<PolicyViolation>(), ext_err + int_err);
+	}
+
+	std::vector<PolicyViolation> violations;
+	violations.reserve(rp.first.size());
+	for (const auto &row : rp.first) {
+		PolicyViolation violation;
+		violation.lot_name = row[0];
+		violation.flags = std::stoul(row[1]);
+		violation.inherited_flags = std::stoul(row[2]);
+		violation.opportunistic_overage_GB = std::stod(row[3]);
+		violation.dedicated_overage_GB = std::stod(row[4]);
+		violation.objects_overage = std::stoll(row[5]);
+		violations.push_back(std::move(violation));
+	}
+	return std::make_pair(violations, "");
+}
+
+std::pair<std::vector<lotman::EvictionCandidate>, std::string>
+lotman::Lot::get_eviction_candidates(const double target_GB, const size_t k) {
+	auto now = std::chrono::system_clock::now();
+	int64_t ms_since_epoch = std::chrono::time_point_cast<std::chrono::milliseconds>(now).time_since_epoch().count();
 
-	if (recursive_children) { // Get all children of the lots past opp
-		std::vector<std::string> tmp;
-		for (const auto lot_past_obj : lots_past_obj) {
-			Lot _lot(lot_past_obj);
-			auto rp_lotvec_str = _lot.get_children(true);
-			if (!rp_lotvec_str.second.empty()) { // There was an error
-				std::string int_err = rp_lotvec_str.second;
-				std::string ext_err = "Failure on call to get_children.";
-				return std::make_pair(std::vector<std::string>(), ext_err + int_err);
+	// Every lot holding data, with the most restricting dedicated_GB, expiration_time and deletion_time over the lot
+	// and its ancestors (see get_restricting_attribute). The closure holds a depth 0 row for the lot itself.
+	auto rp = lotman::db::SQL_get_matches_multi_col(lotman::db::Query::EvictionCandidates, 5);
+	if (!rp.second.empty()) { // There was an error
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to SQL_get_matches_multi_col: ";
+		return std::make_pair(std::vector<EvictionCandidate>(), ext_err + int_err);
+	}
+
+	// Data past deletion goes first, then expired data, both oldest deadline first. Within the dedicated
+	// guarantee data is never a candidate, but anything above it is opportunistic and goes last, largest first.
+	auto rank = [](unsigned int reason) {
+		return reason == LOTMAN_VIOLATION_DELETION ? 0 : reason == LOTMAN_VIOLATION_EXPIRED ? 1 : 2;
+	};
+	auto ranks_before = [&rank](const EvictionCandidate &lhs, const EvictionCandidate &rhs) {
+		if (rank(lhs.reason) != rank(rhs.reason)) {
+			return rank(lhs.reason) < rank(rhs.reason);
+		}
+		if (lhs.deadline != rhs.deadline) {
+			return lhs.deadline < rhs.deadline;
+		}
+		if (lhs.reclaimable_GB != rhs.reclaimable_GB) {
+			return lhs.reclaimable_GB > rhs.reclaimable_GB;
+		}
+		return lhs.lot_name < rhs.lot_name;
+	};
+
+	// Keep the best k in a heap whose top is the worst of them, so n lots cost O(n log k).
+	// k = 0 keeps every candidate.
+	std::priority_queue<EvictionCandidate, std::vector<EvictionCandidate>, decltype(ranks_before)> best(ranks_before);
+	for (const auto &row : rp.first) {
+		EvictionCandidate candidate;
+		candidate.lot_name = row[0];
+		double self_GB = std::stod(row[1]);
+		int64_t deletion_time = std::stoll(row[4]);
+		int64_t expiration_time = std::stoll(row[3]);
+		if (deletion_time <= ms_since_epoch) {
+			candidate.reason = LOTMAN_VIOLATION_DELETION;
+			candidate.deadline = deletion_time;
+			candidate.reclaimable_GB = self_GB;
+		} else if (expiration_time <= ms_since_epoch) {
+			candidate.reason = LOTMAN_VIOLATION_EXPIRED;
+			candidate.deadline = expiration_time;
+			candidate.reclaimable_GB = self_GB;
+		} else {
+			candidate.reason = LOTMAN_VIOLATION_OPPORTUNISTIC;
+			candidate.reclaimable_GB = self_GB - std::stod(row[2]);
+			if (candidate.reclaimable_GB <= 0) {
+				continue;
 			}
+		}
 
-			for (const auto &child : _lot.recursive_children) {
-				tmp.push_back(child.lot_name);
+		if (k > 0 && best.size() == k) {
+			if (!ranks_before(candidate, best.top())) {
+				continue;
 			}
+			best.pop();
 		}
-		lots_past_obj.insert(lots_past_obj.end(), tmp.begin(), tmp.end());
+		best.push(std::move(candidate));
+	}
 
-		// Sort and remove any duplicates
-		std::sort(lots_past_obj.begin(), lots_past_obj.end());
-		auto last = std::unique(lots_past_obj.begin(), lots_past_obj.end());
-		lots_past_obj.erase(last, lots_past_obj.end());
+	std::vector<EvictionCandidate> candidates(best.size());
+	for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+		*it = best.top();
+		best.pop();
 	}
 
-	return std::make_pair(lots_past_obj, "");
+	// Stop at the first candidate that frees enough to reach the target
+	double cumulative_GB = 0;
+	for (size_t idx = 0; idx < candidates.size(); idx++) {
+		cumulative_GB += candidates[idx].reclaimable_GB;
+		candidates[idx].cumulative_GB = cumulative_GB;
+		if (target_GB > 0 && cumulative_GB >= target_GB) {
+			candidates.resize(idx + 1);
+			break;
+		}
+	}
+	return std::make_pair(candidates, "");
 }
 
 std::pair<std::vector<std::string>, std::string> lotman::Lot::list_all_lots() {
@@ -1901,55 +1719,16 @@ std::pair<std::vector<std::string>, std::string> lotman::Lot::get_lots_from_dir(
 	// Database paths always have trailing slashes (e.g., "/foo/bar/")
 	std::string dir = ensure_trailing_slash(dir_input);
 
-	// For the LIKE comparison, we need the input path without trailing slash.
-	// This is because: stored path "/foo/" with LIKE pattern means we check if
-	// the input starts with "/foo/". Using "/foo/bar" LIKE "/foo/" || '%' works,
-	// but "/foobar" LIKE "/foo/" || '%' correctly fails (no match).
-	std::string dir_for_like = dir;
-	if (dir_for_like.length() > 1 && dir_for_like.back() == '/') {
-		dir_for_like.pop_back();
-	}
-
-	// Query logic for path exclusions:
-	// We need to find the best matching path rule for this directory. The algorithm is:
-	// 1. Find all path rules (both inclusions and exclusions) that match this directory
-	// 2. The longest matching path "wins" - if it's an exclusion, the path is not in that lot
-	// 3. If the longest match is an exclusion, we need to find the next longest inclusion
-	//    that is NOT overridden by an exclusion
-	//
-	// The query uses a subquery to check if there's a longer exclusion that would override
-	// any given inclusion match.
-	//
-	// Path matching rules:
-	// - path = ?1 : exact match (normalized input matches stored path exactly)
-	// - ?2 LIKE path || '%' : input is a subdirectory of a stored recursive path
-	// - For non-recursive paths, only exact matches count
+	// Path matching rules, resolved against the in-memory path trie:
+	// - A recursive path matches itself and any of its subdirectories, a non-recursive path only matches itself
 	// - exclude = 0 means this is an inclusion (the path IS tracked)
 	// - exclude = 1 means this is an exclusion (the path is NOT tracked by this lot)
-	//
-	// We select the longest non-excluded path that doesn't have a longer exclusion overriding it
-	std::string lots_from_dir_query =
-		"SELECT lot_name FROM paths p "
-		"WHERE "
-		"(p.path = ?1 OR ?2 LIKE p.path || '%') " // Exact match or subdirectory of stored path
-		"AND "
-		"(p.recursive OR p.path = ?3) " // If not recursive, only match exact path
-		"AND "
-		"p.exclude = 0 "	// Only consider inclusion paths
-		"AND NOT EXISTS ( " // Ensure no longer exclusion overrides this inclusion
-		"    SELECT 1 FROM paths e "
-		"    WHERE e.lot_name = p.lot_name "			  // Same lot
-		"    AND e.exclude = 1 "						  // Is an exclusion
-		"    AND (e.path = ?1 OR ?2 LIKE e.path || '%') " // Matches the input path
-		"    AND (e.recursive OR e.path = ?3) "			  // Respects recursive flag
-		"    AND LENGTH(e.path) > LENGTH(p.path) "		  // Exclusion is more specific (longer)
-		") "
-		"ORDER BY LENGTH(p.path) DESC LIMIT 1;"; // Prefer longest matching inclusion
-	std::map<std::string, std::vector<int>> dir_str_map{{dir, {1, 3}}, {dir_for_like, {2}}};
-	auto rp = lotman::db::SQL_get_matches(lots_from_dir_query, dir_str_map);
+	// - The longest matching inclusion wins, unless a longer matching exclusion of the same lot overrides it,
+	//   in which case the next longest inclusion is considered
+	auto rp = PathCache::resolve(dir);
 	if (!rp.second.empty()) {
 		std::string int_err = rp.second;
-		std::string ext_err = "Failure on call to SQL_get_matches: ";
+		std::string ext_err = "Failure on call to PathCache::resolve: ";
 		return std::make_pair(std::vector<std::string>(), ext_err + int_err);
 	}
 
@@ -1958,7 +1737,7 @@ std::pair<std::vector<std::string>, std::string> lotman::Lot::get_lots_from_dir(
 							// default lot
 		matching_lots_vec = {"default"};
 	} else {
-		matching_lots_vec = rp.first;
+		matching_lots_vec = {rp.first};
 	}
 
 	if (recursive) { // Indicates we want all of the parent lots.
@@ -1979,43 +1758,19 @@ std::pair<bool, std::string> lotman::Lot::check_context_for_parents(const std::v
 		return std::make_pair(true, "");
 	}
 
-	std::string caller = lotman::Context::get_caller();
-	bool allowed = false;
-	if (!include_self) {
-		for (const auto &parent : parents) {
-
-			if (parent != lot_name) {
-				Lot parent_lot(parent);
-				auto rp = parent_lot.get_owners(true);
-				if (!rp.second.empty()) { // There was an error
-					std::string int_err = rp.second;
-					std::string ext_err = "Failed to get parent owners while checking validity of context: ";
-					return std::make_pair(false, ext_err + int_err);
-				}
-				if (std::find(parent_lot.recursive_owners.begin(), parent_lot.recursive_owners.end(), caller) !=
-					parent_lot.recursive_owners.end()) { // Caller is an owner
-					allowed = true;
-					break;
-				}
-			}
-		}
-	} else {
-		for (const auto &parent : parents) {
-			Lot parent_lot(parent);
-			auto rp = parent_lot.get_owners(true);
-			if (!rp.second.empty()) { // There was an error
-				std::string int_err = rp.second;
-				std::string ext_err = "Failed to get parent owners while checking validity of context: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
-			if (std::find(parent_lot.recursive_owners.begin(), parent_lot.recursive_owners.end(), caller) !=
-				parent_lot.recursive_owners.end()) { // Caller is an owner
-				allowed = true;
-				break;
-			}
+	std::vector<std::string> checked_parents;
+	for (const auto &parent : parents) {
+		if (include_self || parent != lot_name) {
+			checked_parents.push_back(parent);
 		}
 	}
-	if (!allowed) {
+	auto rp = AuthorizationCache::caller_owns_any(checked_parents);
+	if (!rp.second.empty()) { // There was an error
+		std::string int_err = rp.second;
+		std::string ext_err = "Failed to get parent owners while checking validity of context: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	if (!rp.first) {
 		return std::make_pair(false, "Current context prohibits action on lot: Caller does not have proper ownership.");
 	}
 
@@ -2023,52 +1778,15 @@ std::pair<bool, std::string> lotman::Lot::check_context_for_parents(const std::v
 }
 std::pair<bool, std::string> lotman::Lot::check_context_for_parents(const std::vector<Lot> &parents, bool include_self,
 																	bool new_lot) {
-	if (new_lot && parents.size() == 1 &&
-		parents[0].lot_name ==
-			lot_name) { // This is a self parent new lot with no other parents. No need to check context.
-		return std::make_pair(true, "");
+	if (!include_self && parents.size() == 1 && parents[0].lot_name == lot_name) {
+		return std::make_pair(true, ""); // The lot is its own only parent
 	}
 
-	std::string caller = lotman::Context::get_caller();
-	bool allowed = false;
-	if (!include_self) {
-		if (parents.size() == 1 && parents[0].lot_name == lot_name) {
-			allowed = true;
-		}
-		for (const auto &parent : parents) {
-			if (parent.lot_name != lot_name) {
-				Lot temp_lot(parent.lot_name);
-				auto rp = temp_lot.get_owners(true);
-				if (!rp.second.empty()) {
-					return std::make_pair(false, "Failed to get parent owners while checking validity of context: " +
-													 rp.second);
-				}
-				const auto &owners = rp.first;
-				if (std::find(owners.begin(), owners.end(), caller) != owners.end()) {
-					allowed = true;
-					break;
-				}
-			}
-		}
-	} else {
-		for (const auto &parent : parents) {
-			Lot temp_lot(parent.lot_name);
-			auto rp = temp_lot.get_owners(true);
-			if (!rp.second.empty()) {
-				return std::make_pair(false,
-									  "Failed to get parent owners while checking validity of context: " + rp.second);
-			}
-			const auto &owners = rp.first;
-			if (std::find(owners.begin(), owners.end(), caller) != owners.end()) {
-				allowed = true;
-				break;
-			}
-		}
-	}
-	if (!allowed) {
-		return std::make_pair(false, "Current context prohibits action on lot: Caller does not have proper ownership.");
+	std::vector<std::string> parent_names;
+	for (const auto &parent : parents) {
+		parent_names.push_back(parent.lot_name);
 	}
-	return std::make_pair(true, "");
+	return check_context_for_parents(parent_names, include_self, new_lot);
 }
 std::pair<bool, std::string> lotman::Lot::check_context_for_children(const std::vector<std::string> &children,
 																	 bool include_self) {
@@ -2076,164 +1794,380 @@ std::pair<bool, std::string> lotman::Lot::check_context_for_children(const std::
 		return std::make_pair(true, "");
 	}
 
-	std::string caller = lotman::Context::get_caller();
-	bool allowed = false;
-	if (!include_self) {
-		for (const auto &child : children) {
-			if (child != lot_name) {
-				Lot child_lot(child);
-				auto rp = child_lot.get_owners(true);
-				if (!rp.second.empty()) { // There was an error
-					std::string int_err = rp.second;
-					std::string ext_err = "Failed to get child owners while checking validity of context: ";
-					return std::make_pair(false, ext_err + int_err);
-				}
-				if (std::find(child_lot.recursive_owners.begin(), child_lot.recursive_owners.end(), caller) !=
-					child_lot.recursive_owners.end()) { // Caller is an owner
-					allowed = true;
-					break;
-				}
-			}
-		}
-	} else {
-		for (const auto &child : children) {
-			Lot child_lot(child);
-			auto rp = child_lot.get_owners(true);
-			if (!rp.second.empty()) { // There was an error
-				std::string int_err = rp.second;
-				std::string ext_err = "Failed to get child owners while checking validity of context: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
-			if (std::find(child_lot.recursive_owners.begin(), child_lot.recursive_owners.end(), caller) !=
-				child_lot.recursive_owners.end()) { // Caller is an owner
-				allowed = true;
-				break;
-			}
+	std::vector<std::string> checked_children;
+	for (const auto &child : children) {
+		if (include_self || child != lot_name) {
+			checked_children.push_back(child);
 		}
 	}
-	if (!allowed) {
+	auto rp = AuthorizationCache::caller_owns_any(checked_children);
+	if (!rp.second.empty()) { // There was an error
+		std::string int_err = rp.second;
+		std::string ext_err = "Failed to get child owners while checking validity of context: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	if (!rp.first) {
 		return std::make_pair(false, "Current context prohibits action on lot: Caller does not have proper ownership.");
 	}
 	return std::make_pair(true, "");
 }
 std::pair<bool, std::string> lotman::Lot::check_context_for_children(const std::vector<Lot> &children,
 																	 bool include_self) {
-	if (children.size() == 0) { // No children means no need to check for context.
-		return std::make_pair(true, "");
+	std::vector<std::string> child_names;
+	for (const auto &child : children) {
+		child_names.push_back(child.lot_name);
 	}
+	return check_context_for_children(child_names, include_self);
+}
 
-	std::string caller = lotman::Context::get_caller();
-	bool allowed = false;
-	if (!include_self) {
-		for (const auto &child : children) {
-			if (child.lot_name != lot_name) {
-				Lot temp_lot(child.lot_name);
-				auto rp = temp_lot.get_owners(true);
-				if (!rp.second.empty()) {
-					return std::make_pair(false, "Failed to get child owners while checking validity of context: " +
-													 rp.second);
-				}
-				const auto &owners = rp.first;
-				if (std::find(owners.begin(), owners.end(), caller) != owners.end()) {
-					allowed = true;
-					break;
-				}
-			}
+/**
+ * Functions specific to DirUsageUpdate class
+ */
+
+namespace {
+
+// Usage keys accepted on directory entries, the lot usage key each one feeds and whether it holds integers
+struct DirUsageKey {
+	const char *dir_key;
+	const char *usage_key;
+	bool is_int;
+};
+const std::array<DirUsageKey, 4> dir_usage_keys = {{{"size_GB", "self_GB", false},
+													 {"num_obj", "self_objects", true},
+													 {"GB_being_written", "self_GB_being_written", false},
+													 {"objects_being_written", "self_objects_being_written", true}}};
+
+double dir_usage_value(const json &value, const DirUsageKey &key) {
+	// Integer keys go through int64_t, so fractional object counts are truncated as they are when stored
+	return key.is_int ? static_cast<double>(value.get<int64_t>()) : value.get<double>();
+}
+
+} // namespace
+
+std::pair<bool, std::string> lotman::DirUsageUpdate::JSON_math(const json &update_JSON) {
+	for (const auto &entry : update_JSON) {
+		ResolvedDir dir;
+		auto rp = resolve(entry, "", dir);
+		if (!rp.first) {
+			return rp;
 		}
+		rp = process_dir(dir);
+		if (!rp.first) {
+			return rp;
+		}
+	}
+	return std::make_pair(true, "");
+}
+
+std::vector<UsageUpdate> lotman::DirUsageUpdate::take_updates() {
+	m_lot_index.clear();
+	return std::move(m_updates);
+}
+
+std::pair<bool, std::string> lotman::DirUsageUpdate::resolve(const json &entry, const std::string &parent_path,
+															 ResolvedDir &dir) {
+	dir.entry = &entry;
+	return resolve(entry["path"].get<std::string>(), parent_path, dir);
+}
+
+std::pair<bool, std::string> lotman::DirUsageUpdate::resolve(const std::string &path, const std::string &parent_path,
+															 ResolvedDir &dir) {
+	if (path.substr(0, 1) != "/") { // get rid of preceding extra slash
+		dir.path = parent_path + "/" + path;
 	} else {
-		for (const auto &child : children) {
-			Lot temp_lot(child.lot_name);
-			auto rp = temp_lot.get_owners(true);
-			if (!rp.second.empty()) {
-				return std::make_pair(false,
-									  "Failed to get child owners while checking validity of context: " + rp.second);
+		dir.path = parent_path + path;
+	}
+
+	// The recursive flag only counts when the directory itself is stored as a path of the lot that tracks it
+	auto rp = PathCache::resolve(ensure_trailing_slash(dir.path), &dir.recursive);
+	if (!rp.second.empty()) {
+		std::string int_err = rp.second;
+		std::string ext_err = "Failure on call to PathCache::resolve: ";
+		return std::make_pair(false, ext_err + int_err);
+	}
+	dir.lot_name = rp.first.empty() ? "default" : rp.first;
+	return std::make_pair(true, "");
+}
+
+std::pair<bool, std::string> lotman::DirUsageUpdate::process_dir(const ResolvedDir &dir) {
+	const json &entry = *dir.entry;
+
+	std::array<double, 4> own_usage{};
+	for (size_t i = 0; i < dir_usage_keys.size(); ++i) {
+		if (entry.contains(dir_usage_keys[i].dir_key)) {
+			own_usage[i] = dir_usage_value(entry[dir_usage_keys[i].dir_key], dir_usage_keys[i]);
+		}
+	}
+
+	// Subdirs are only broken out when the entry's usage includes them. For a non-recursive path every subdir
+	// belongs elsewhere, while for a recursive path only subdirs that resolve to a different lot (e.g. because
+	// they are excluded) do. Their usage is taken out of this directory's and attributed to them instead.
+	if (entry["includes_subdirs"].get<bool>() && !entry["subdirs"].empty()) {
+		std::vector<ResolvedDir> subdirs;
+		for (const auto &subdir_entry : entry["subdirs"]) {
+			ResolvedDir subdir;
+			auto rp = resolve(subdir_entry, dir.path, subdir);
+			if (!rp.first) {
+				return rp;
+			}
+			if (!dir.recursive || subdir.lot_name != dir.lot_name) {
+				subdirs.push_back(std::move(subdir));
 			}
-			const auto &owners = rp.first;
-			if (std::find(owners.begin(), owners.end(), caller) != owners.end()) {
-				allowed = true;
-				break;
+		}
+
+		for (const auto &subdir : subdirs) {
+			for (size_t i = 0; i < dir_usage_keys.size(); ++i) {
+				const auto &key = dir_usage_keys[i];
+				if (subdir.entry->contains(key.dir_key)) {
+					own_usage[i] -= dir_usage_value((*subdir.entry)[key.dir_key], key);
+				}
+			}
+		}
+		for (const auto &subdir : subdirs) {
+			auto rp = process_dir(subdir);
+			if (!rp.first) {
+				return rp;
 			}
 		}
 	}
-	if (!allowed) {
-		return std::make_pair(false, "Current context prohibits action on lot: Caller does not have proper ownership.");
+
+	for (size_t i = 0; i < dir_usage_keys.size(); ++i) {
+		if (entry.contains(dir_usage_keys[i].dir_key)) {
+			add_usage(dir.lot_name, dir_usage_keys[i].usage_key, own_usage[i]);
+		}
 	}
+
 	return std::make_pair(true, "");
 }
 
+void lotman::DirUsageUpdate::add_usage(const std::string &lot_name, const char *usage_key, double value) {
+	auto index_iter = m_lot_index.find(lot_name);
+	if (index_iter == m_lot_index.end()) {
+		index_iter = m_lot_index.emplace(lot_name, m_updates.size()).first;
+		m_updates.push_back(UsageUpdate{lot_name, {}, {}, ""});
+	}
+	m_updates[index_iter->second].values[usage_key] += value;
+}
+
 /**
- * Functions specific to Checks class
+ * SAX handler behind the streaming JSON_math. It keeps one frame per open directory object, holding only what
+ * is needed to attribute that directory once it closes: its own members, its resolved lot and its usage with
+ * broken-out subdirs already taken out. Subdirs are attributed by the same rules as process_dir().
  */
+class lotman::DirUsageUpdate::SaxHandler : public nlohmann::json_sax<json> {
+  public:
+	SaxHandler(DirUsageUpdate &update, const std::function<void(const json &)> &validate_dir)
+		: m_update{update}, m_validate_dir{validate_dir} {}
 
-bool lotman::Checks::cycle_check(
-	const std::string &start_node, const std::vector<std::string> &start_parents,
-	const std::vector<std::string> &start_children) { // Returns true if invalid cycle is detected, else returns false
-	// Basic DFS algorithm to check for cycle creation when adding a lot that has both parents and children.
-
-	// Algorithm initialization
-	std::vector<std::string> dfs_nodes_to_visit;
-	dfs_nodes_to_visit.insert(dfs_nodes_to_visit.end(), start_parents.begin(), start_parents.end());
-	for (const auto &children_iter : start_children) {
-		auto check_iter = std::find(dfs_nodes_to_visit.begin(), dfs_nodes_to_visit.end(), children_iter);
-		if (check_iter != dfs_nodes_to_visit.end()) {
-			// Run, Luke! It's a trap! Erm... a cycle!
+	const std::string &error() const {
+		return m_error;
+	}
+
+	bool null() override {
+		return scalar(nullptr);
+	}
+	bool boolean(bool val) override {
+		return scalar(val);
+	}
+	bool number_integer(number_integer_t val) override {
+		return scalar(val);
+	}
+	bool number_unsigned(number_unsigned_t val) override {
+		return scalar(val);
+	}
+	bool number_float(number_float_t val, const string_t &) override {
+		return scalar(val);
+	}
+	bool string(string_t &val) override {
+		return scalar(val);
+	}
+	bool binary(binary_t &) override {
+		return fail("Binary values are not supported in the update JSON");
+	}
+
+	bool start_object(std::size_t) override {
+		if (m_containers.empty() || m_containers.back() == Container::Dir) {
+			return fail("The update JSON must be an array of directory objects, and only \"subdirs\" may nest them");
+		}
+
+		Frame frame;
+		if (m_containers.back() == Container::Subdirs) {
+			const Frame &parent = m_frames.back();
+			frame.parent_path = parent.dir.path;
+			frame.counted = parent.counted && parent.includes_subdirs;
+		}
+		m_frames.push_back(std::move(frame));
+		m_containers.push_back(Container::Dir);
+		return true;
+	}
+
+	bool key(string_t &val) override {
+		m_key = val;
+		return true;
+	}
+
+	bool end_object() override {
+		Frame frame = std::move(m_frames.back());
+		m_frames.pop_back();
+		m_containers.pop_back();
+		if (!validate(frame.fields)) {
+			return false;
+		}
+		if (!frame.counted) {
 			return true;
 		}
+
+		for (size_t i = 0; i < dir_usage_keys.size(); ++i) {
+			if (frame.fields.contains(dir_usage_keys[i].dir_key)) {
+				m_update.add_usage(frame.dir.lot_name, dir_usage_keys[i].usage_key, frame.own_usage[i]);
+			}
+		}
+		// A counted subdir is attributed on its own, so its usage comes out of the parent directory's
+		if (!m_frames.empty()) {
+			Frame &parent = m_frames.back();
+			for (size_t i = 0; i < dir_usage_keys.size(); ++i) {
+				const auto &key = dir_usage_keys[i];
+				if (frame.fields.contains(key.dir_key)) {
+					parent.own_usage[i] -= dir_usage_value(frame.fields[key.dir_key], key);
+				}
+			}
+		}
+		return true;
 	}
 
-	// Iterate
-	while (dfs_nodes_to_visit.size() > 0) { // When dfs_nodes_to_visit has size 0, we're done checking
-		lotman::Lot lot(dfs_nodes_to_visit[0]);
-		auto rp = lot.get_parents();
+	bool start_array(std::size_t) override {
+		if (m_containers.empty()) {
+			m_containers.push_back(Container::Updates);
+			return true;
+		}
+		if (m_containers.back() != Container::Dir || m_key != "subdirs") {
+			return fail("Only \"subdirs\" may hold an array in the update JSON");
+		}
 
-		// TODO: expose errors
-		if (!rp.second.empty()) { // There was an error
-			std::string int_err = rp.second;
-			std::string ext_err = "Failure on call to get_parents(): ";
+		// Subdirs are attributed as they stream past, so their parent must already be resolved
+		Frame &frame = m_frames.back();
+		if (!frame.fields.contains("path") || !frame.fields.contains("includes_subdirs")) {
+			return fail("A directory's \"path\" and \"includes_subdirs\" must come before its \"subdirs\"");
+		}
+		if (!validate(frame.fields)) {
 			return false;
 		}
+		frame.includes_subdirs = frame.fields["includes_subdirs"].get<bool>();
+		m_containers.push_back(Container::Subdirs);
+		return true;
+	}
+
+	bool end_array() override {
+		m_containers.pop_back();
+		return true;
+	}
+
+	bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &ex) override {
+		return fail(ex.what());
+	}
+
+  private:
+	enum class Container { Updates, Dir, Subdirs };
+
+	struct Frame {
+		json fields = json::object(); // The directory's own members, without "subdirs"
+		std::string parent_path;
+		ResolvedDir dir{nullptr, "", "", false};
+		bool counted = true; // Whether the directory is attributed on its own rather than through its parent
+		bool includes_subdirs = false;
+		std::array<double, 4> own_usage{};
+	};
+
+	bool fail(const std::string &err) {
+		if (m_error.empty()) {
+			m_error = err;
+		}
+		return false;
+	}
 
-		// convert to vec of strings instead of vec of lots
-		std::vector<std::string> dfs_node_parents;
-		for (const auto &parent : rp.first) {
-			dfs_node_parents.push_back(parent.lot_name);
+	bool validate(const json &fields) {
+		try {
+			m_validate_dir(fields);
+		} catch (const std::exception &exc) {
+			return fail(exc.what());
 		}
+		return true;
+	}
 
-		dfs_nodes_to_visit.insert(dfs_nodes_to_visit.end(), dfs_node_parents.begin(), dfs_node_parents.end());
+	bool scalar(json val) {
+		if (m_containers.empty() || m_containers.back() != Container::Dir) {
+			return fail("The update JSON must be an array of directory objects");
+		}
 
-		for (const auto &children_iter : start_children) { // For each specified child of start node ...
-			auto check_iter = std::find(dfs_nodes_to_visit.begin(), dfs_nodes_to_visit.end(),
-										children_iter); // ... check if that child is going to be visited ...
-			if (check_iter != dfs_nodes_to_visit.end()) {
-				// ... If it is going to be visited, cycle found!
-				return true;
+		Frame &frame = m_frames.back();
+		if (m_key == "path" && val.is_string() && frame.counted) {
+			auto rp = m_update.resolve(val.get<std::string>(), frame.parent_path, frame.dir);
+			if (!rp.first) {
+				return fail(rp.second);
+			}
+			// Below a recursive path, only subdirs that resolve to another lot are broken out
+			if (m_frames.size() > 1) {
+				const Frame &parent = m_frames[m_frames.size() - 2];
+				frame.counted = !parent.dir.recursive || frame.dir.lot_name != parent.dir.lot_name;
+			}
+		}
+		for (size_t i = 0; i < dir_usage_keys.size(); ++i) {
+			if (m_key == dir_usage_keys[i].dir_key && val.is_number()) {
+				// Subdirs streamed before the value have already been subtracted from own_usage
+				frame.own_usage[i] = dir_usage_value(val, dir_usage_keys[i]) + frame.own_usage[i];
 			}
 		}
-		dfs_nodes_to_visit.erase(
-			dfs_nodes_to_visit.begin()); // Nothing consequential from this node, remove it from the nodes to visit
+		frame.fields[m_key] = std::move(val);
+		return true;
 	}
 
-	return false;
+	DirUsageUpdate &m_update;
+	const std::function<void(const json &)> &m_validate_dir;
+	std::vector<Container> m_containers;
+	std::vector<Frame> m_frames;
+	std::string m_key;
+	std::string m_error;
+};
+
+std::pair<bool, std::string> lotman::DirUsageUpdate::JSON_math(std::istream &input,
+															   const std::function<void(const json &)> &validate_dir) {
+	SaxHandler handler(*this, validate_dir);
+	if (!json::sax_parse(input, &handler)) {
+		std::string err = handler.error().empty() ? "Failed to parse the update JSON" : handler.error();
+		return std::make_pair(false, err);
+	}
+	return std::make_pair(true, "");
 }
 
-bool lotman::Checks::insertion_check(
-	const std::string &LTBA, const std::string &parent,
-	const std::string &child) { // Checks whether LTBA is being inserted between a parent and child.
+/**
+ * Functions specific to Checks class
+ */
+
+bool lotman::Checks::cycle_check(
+	const std::vector<std::string> &start_parents,
+	const std::vector<std::string> &start_children) { // Returns true if invalid cycle is detected, else returns false
+	// A cycle is created exactly when one of the specified children is also one of the specified parents or one of
+	// their ancestors. The walk over the ancestors runs on the cached hierarchy and visits each lot at most once.
 
 	// TODO: expose errors
-	lotman::Lot lot(child);
-	auto rp = lot.get_parents();
+	auto rp = HierarchyCache::ancestors_contain_any(start_parents, start_children);
 	if (!rp.second.empty()) { // There was an error
-		std::string int_err = rp.second;
-		std::string ext_err = "Failure on call to get_parents(): ";
 		return false;
 	}
+	return rp.first;
+}
 
-	std::vector<std::string> parents_vec;
-	for (const auto &parent_lot : rp.first) {
-		parents_vec.push_back(parent_lot.lot_name);
+bool lotman::Checks::insertion_check(
+	const std::string &parent, const std::string &child) { // Checks whether a lot-to-be-added is being inserted
+														   // between a parent and child.
+
+	// TODO: expose errors
+	auto rp = HierarchyCache::get_parents(child, false, false);
+	if (!rp.second.empty()) { // There was an error
+		return false;
 	}
 
+	const auto &parents_vec = rp.first;
 	auto parent_iter = std::find(parents_vec.begin(), parents_vec.end(),
 								 parent); // Check if the specified parent is listed as a parent to the child
 	if (!(parent_iter == parents_vec.end())) {
@@ -2246,34 +2180,52 @@ bool lotman::Checks::insertion_check(
 bool lotman::Checks::will_be_orphaned(const std::string &LTBR, const std::string &child) {
 
 	// TODO: expose errors
-	lotman::Lot lot(child);
-	auto rp = lot.get_parents();
+	auto rp = HierarchyCache::get_parents(child, false, false);
 	if (!rp.second.empty()) { // There was an error
-		std::string int_err = rp.second;
-		std::string ext_err = "Failure on call to get_parents(): ";
 		return false;
 	}
 
-	std::vector<std::string> parents_vec;
-	for (const auto &parent : rp.first) {
-		parents_vec.push_back(parent.lot_name);
-	}
-
+	const auto &parents_vec = rp.first;
 	if (parents_vec.size() == 1 && parents_vec[0] == LTBR) {
 		return true;
 	}
 	return false;
 }
 
+lotman::Context::State &lotman::Context::state() {
+	return current_ctx().context;
+}
+
+std::string lotman::Context::get_caller() {
+	if (!t_caller.empty()) {
+		return t_caller;
+	}
+	return *std::atomic_load(&state().m_caller);
+}
+
+std::string lotman::Context::get_lot_home() {
+	return *std::atomic_load(&state().m_home);
+}
+
 void lotman::Context::set_caller(const std::string caller) {
-	m_caller = std::make_shared<std::string>(caller);
+	std::atomic_store(&state().m_caller, std::make_shared<std::string>(caller));
+}
+
+void lotman::Context::set_thread_caller(const std::string caller) {
+	t_caller = caller;
 }
 
 std::pair<bool, std::string> lotman::Context::set_lot_home(const std::string dir_path) {
+	// Pending usage deltas belong to the database that is about to be closed
+	auto rp_flush = UsageAccumulator::flush();
+	if (!rp_flush.first) {
+		return std::make_pair(false, "Failed to flush pending usage updates: " + rp_flush.second);
+	}
+
 	// If setting to "", then we should treat as though it is unsetting the
 	// config
 	if (dir_path.length() == 0) { // User is configuring to empty string
-		m_home = std::make_shared<std::string>(dir_path);
+		std::atomic_store(&state().m_home, std::make_shared<std::string>(dir_path));
 		return std::make_pair(true, "");
 	}
 
@@ -2292,7 +2244,7 @@ std::pair<bool, std::string> lotman::Context::set_lot_home(const std::string dir
 
 	// Now it exists and we can write to it, set the value and let
 	// scitokens_cache handle the rest
-	m_home = std::make_shared<std::string>(cleaned_dir_path);
+	std::atomic_store(&state().m_home, std::make_shared<std::string>(cleaned_dir_path));
 
 	// Reset the ORM storage manager so it re-initializes with the new path
 	lotman::db::StorageManager::reset();
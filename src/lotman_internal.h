@@ -1,7 +1,15 @@
+#ifndef LOTMAN_INTERNAL_H
+#define LOTMAN_INTERNAL_H
+
 // #include <algorithm>
 // #include <stdio.h>
 // #include <string>
+#include <functional>
+#include <istream>
+#include <map>
+#include <memory>
 #include <nlohmann/json.hpp>
+#include <unordered_map>
 #include <vector>
 
 namespace lotman {
@@ -26,6 +34,60 @@ inline std::string ensure_trailing_slash(const std::string &path) {
 	return path;
 }
 
+/**
+ * A coalesced usage update for a single lot, as applied by Lot::store_usage_batch().
+ * values maps self_* usage keys to either a delta or an absolute value, depending on
+ * the mode of the batch. ancestors are the lots whose children_* columns receive the
+ * resulting deltas. error is filled in if the update was rejected.
+ */
+struct UsageUpdate {
+	std::string lot_name;
+	std::map<std::string, double> values;
+	std::vector<std::string> ancestors;
+	std::string error;
+};
+
+/**
+ * A lot's raw usage counters, as stored in the lot_usage table.
+ */
+struct UsageRecord {
+	double self_GB = 0;
+	double children_GB = 0;
+	int64_t self_objects = 0;
+	int64_t children_objects = 0;
+	double self_GB_being_written = 0;
+	double children_GB_being_written = 0;
+	int64_t self_objects_being_written = 0;
+	int64_t children_objects_being_written = 0;
+};
+
+/**
+ * A lot that violates at least one management policy, either itself or through one of its ancestors.
+ * Flags are bitwise ORs of the LOTMAN_VIOLATION_* values from lotman.h, and overages are zero for quotas
+ * the lot itself does not violate.
+ */
+struct PolicyViolation {
+	std::string lot_name;
+	unsigned int flags = 0;
+	unsigned int inherited_flags = 0;
+	double opportunistic_overage_GB = 0;
+	double dedicated_overage_GB = 0;
+	int64_t objects_overage = 0;
+};
+
+/**
+ * A lot whose own data may be purged, as ranked by get_eviction_candidates. reason is the LOTMAN_VIOLATION_*
+ * flag that makes the data purgeable, and deadline is the deletion or expiration time that passed, or 0 for
+ * opportunistic overage.
+ */
+struct EvictionCandidate {
+	std::string lot_name;
+	unsigned int reason = 0;
+	int64_t deadline = 0;
+	double reclaimable_GB = 0;
+	double cumulative_GB = 0;
+};
+
 class Checks;
 class Context;
 /**
@@ -196,15 +258,23 @@ class Lot {
 	std::pair<bool, std::string> update_paths(const json &update_arr);
 	std::pair<bool, std::string> update_man_policy_attrs(const std::string &update_key, double update_val);
 	std::pair<bool, std::string> update_self_usage(const std::string &key, const double value, bool deltaMode);
+	static std::pair<std::vector<std::string>, std::string> update_usage_batch(const json &update_arr,
+																				bool deltaMode);
+	static std::pair<std::vector<std::string>, std::string> update_usage_batch(const std::vector<UsageUpdate> &items,
+																				bool deltaMode);
+	static std::pair<bool, std::string> get_usage_record(const std::string &lot_name, UsageRecord &record);
 
 	std::pair<bool, std::string> recalculate_children_usage();
 	static std::pair<bool, std::string> update_db_children_usage();
+	static std::pair<bool, std::string> refresh_children_usage(const std::vector<std::string> &lot_names);
 	std::pair<bool, std::string> update_parent_usage(
 		Lot parent, const std::string &update_stmt,
 		const std::map<std::string, std::vector<int>> &update_str_map = std::map<std::string, std::vector<int>>(),
 		const std::map<int64_t, std::vector<int>> &update_int_map = std::map<int64_t, std::vector<int>>(),
 		const std::map<double, std::vector<int>> &update_dbl_map = std::map<double, std::vector<int>>());
 	static std::pair<bool, std::string> update_usage_by_dirs(const json &update_JSON, bool deltaMode);
+	static std::pair<bool, std::string> update_usage_by_dirs(std::istream &update_stream, bool deltaMode,
+															 const std::function<void(const json &)> &validate_dir);
 	std::pair<bool, std::string> check_context_for_parents(const std::vector<std::string> &parents,
 														   bool include_self = false, bool new_lot = false);
 	std::pair<bool, std::string> check_context_for_parents(const std::vector<Lot> &parents, bool include_self = false,
@@ -222,11 +292,18 @@ class Lot {
 																			  const bool recursive_children);
 	static std::pair<std::vector<std::string>, std::string> get_lots_past_obj(const bool recursive_quota,
 																			  const bool recursive_children);
+	static std::pair<std::vector<PolicyViolation>, std::string> get_policy_violations(const bool recursive_quota,
+																					   const bool recursive_children);
+	static std::pair<std::vector<EvictionCandidate>, std::string> get_eviction_candidates(const double target_GB,
+																						   const size_t k);
 	static std::pair<std::vector<std::string>, std::string> list_all_lots();
 	static std::pair<std::vector<std::string>, std::string> get_lots_from_dir(const std::string &dir,
 																			  const bool recursive);
 
   private:
+	friend class UsageAccumulator;
+	friend class UsageJournal;
+
 	std::pair<bool, std::string> write_new();
 	std::pair<bool, std::string> delete_lot_from_db();
 	std::pair<bool, std::string> store_new_paths(const std::vector<json> &new_paths);
@@ -236,218 +313,94 @@ class Lot {
 		const std::map<std::string, std::vector<int>> &update_str_map = std::map<std::string, std::vector<int>>(),
 		const std::map<int64_t, std::vector<int>> &update_int_map = std::map<int64_t, std::vector<int>>(),
 		const std::map<double, std::vector<int>> &update_dbl_map = std::map<double, std::vector<int>>());
+	// With all_or_nothing set, the first rejected update rolls back the whole batch. A journal_seq of 0 or more
+	// is stored as the usage journal's checkpoint in the same transaction.
+	static std::pair<bool, std::string> store_usage_batch(std::vector<UsageUpdate> &updates, bool deltaMode,
+														  bool all_or_nothing = false, int64_t journal_seq = -1);
 	std::pair<bool, std::string> remove_parents_from_db(const std::vector<std::string> &parents);
+	std::pair<bool, std::string> store_parent_update(const std::string &current_parent, const std::string &new_parent);
 	std::pair<bool, std::string> remove_paths_from_db(const std::vector<std::string> &paths);
+	static std::pair<bool, std::string> store_dir_usage(std::vector<UsageUpdate> &updates, bool deltaMode);
 };
 
-class DirUsageUpdate : public Lot {
+/**
+ * Attributes a du-style directory tree to lots in a single traversal.
+ *
+ * Each directory is resolved once against the in-memory path trie and its usage is added to a
+ * per-lot total, so the cost grows linearly with the number of entries in the tree. Usage of
+ * subdirectories that are tracked separately is taken out of the parent directory's contribution
+ * and attributed to the subdirectory's own lot instead.
+ */
+class DirUsageUpdate {
   public:
-	int m_depth;
-	std::string m_current_path;
-	std::string m_parent_prefix;
-
-	DirUsageUpdate() : m_depth{0}, m_current_path{}, m_parent_prefix{} {}
-	DirUsageUpdate(int depth, std::string path) : m_depth{depth}, m_current_path{}, m_parent_prefix{path} {}
-
-	std::pair<bool, std::string> JSON_math(json update_JSON, std::vector<Lot> *return_lots) {
-		std::map<std::string, double> size_updates;
-		std::map<std::string, int64_t> obj_updates;
-		std::map<std::string, double> size_writing_updates;
-		std::map<std::string, int64_t> obj_writing_updates;
-
-		for (const auto &update : update_JSON) {
-
-			double usage_GB;
-			int64_t num_obj;
-			double GB_being_written;
-			int64_t objects_being_written;
-			if (update.contains("size_GB")) {
-				usage_GB = update["size_GB"].get<double>();
-			}
-			if (update.contains("num_obj")) {
-				num_obj = update["num_obj"].get<int64_t>();
-			}
-
-			if (update.contains("GB_being_written")) {
-				GB_being_written = update["GB_being_written"].get<double>();
-			}
-			if (update.contains("objects_being_written")) {
-				objects_being_written = update["objects_being_written"].get<int64_t>();
-			}
-
-			std::string path = update["path"];
-
-			if (path.substr(0, 1) != "/") { // get rid of preceding extra slash
-				m_current_path = m_parent_prefix + "/" + path;
-			} else {
-				m_current_path = m_parent_prefix + path;
-			}
-
-			// Figure out which lot to associate with the dir
-			auto rp_vec_str = get_lots_from_dir(m_current_path, false);
-			if (!rp_vec_str.second.empty()) { // There was an error
-				std::string int_err = rp_vec_str.second;
-				std::string ext_err = "Failure on call to get_lots_from_dir: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
-			if (rp_vec_str.first.empty()) {
-				return std::make_pair(false, "get_lots_from_dir returned empty result");
-			}
-
-			Lot lot(rp_vec_str.first[0]);
-			lot.init_self_usage();
-
-			// Need a way to check if the path is stored as recursive
-			auto rp_json_str = lot.get_lot_dirs(
-				false); // Probably don't need all the dirs unless the plan is to use this more than once...
-
-			if (!rp_json_str.second.empty()) { // There was an error
-				std::string int_err = rp_json_str.second;
-				std::string ext_err = "Failure on call to get_lots_from_dir: ";
-				return std::make_pair(false, ext_err + int_err);
-			}
-
-			json lot_dirs_json = rp_json_str.first;
-			bool recursive = false;
-			// Normalize path with trailing slash to match stored format
-			std::string normalized_current_path = ensure_trailing_slash(m_current_path);
-			// lot_dirs_json is an array of path objects, search for matching path
-			for (const auto &path_obj : lot_dirs_json) {
-				if (path_obj["path"].get<std::string>() == normalized_current_path) {
-					recursive = path_obj["recursive"].get<bool>();
-					break;
-				}
-			}
-
-			// Handle subdirs when includes_subdirs is true.
-			// We need to process subdirs in two cases:
-			// 1. The lot's path is not recursive - standard behavior, process each subdir
-			// 2. The lot's path IS recursive BUT some subdirs might be excluded - we need to
-			//    check each subdir and attribute excluded subdirs to their proper lot
-			//
-			// To handle case 2, we check if any subdir maps to a different lot than the parent.
-			// If so, we subtract that subdir's usage from the parent and process it separately.
-			if (update["includes_subdirs"].get<bool>() && !update["subdirs"].empty()) {
-				// Helper to subtract subdir values from parent totals
-				auto subtract_subdir_values = [&](const json &subdir) {
-					if (subdir.contains("size_GB")) {
-						usage_GB -= subdir["size_GB"].get<double>();
-					}
-					if (subdir.contains("num_obj")) {
-						num_obj -= subdir["num_obj"].get<int64_t>();
-					}
-					if (subdir.contains("GB_being_written")) {
-						GB_being_written -= subdir["GB_being_written"].get<double>();
-					}
-					if (subdir.contains("objects_being_written")) {
-						objects_being_written -= subdir["objects_being_written"].get<int64_t>();
-					}
-				};
-
-				// Separate subdirs into those belonging to other lots (due to exclusions)
-				json other_lot_subdirs = json::array();
-
-				for (const auto &subdir : update["subdirs"]) {
-					std::string subdir_path;
-					if (subdir["path"].get<std::string>().substr(0, 1) != "/") {
-						subdir_path = m_current_path + "/" + subdir["path"].get<std::string>();
-					} else {
-						subdir_path = m_current_path + subdir["path"].get<std::string>();
-					}
-
-					auto subdir_lot_rp = get_lots_from_dir(subdir_path, false);
-					if (subdir_lot_rp.second.empty() && !subdir_lot_rp.first.empty() &&
-						subdir_lot_rp.first[0] != lot.lot_name) {
-						// Subdir belongs to a different lot (e.g., due to exclusion)
-						other_lot_subdirs.push_back(subdir);
-					}
-					// If we can't determine the lot or it's the same lot, no special handling needed
-				}
-
-				// For non-recursive paths, always subtract ALL subdirs and process them
-				// For recursive paths, only subtract subdirs that belong to OTHER lots
-				if (!recursive) {
-					// Non-recursive: subtract all subdirs from parent, process all subdirs
-					for (const auto &subdir : update["subdirs"]) {
-						subtract_subdir_values(subdir);
-					}
-					DirUsageUpdate dirUpdate(m_depth + 1, m_current_path);
-					dirUpdate.JSON_math(update["subdirs"], return_lots);
-				} else if (!other_lot_subdirs.empty()) {
-					// Recursive path but some subdirs are excluded - subtract only those
-					for (const auto &subdir : other_lot_subdirs) {
-						subtract_subdir_values(subdir);
-					}
-					// Process only the subdirs that belong to other lots
-					DirUsageUpdate dirUpdate(m_depth + 1, m_current_path);
-					dirUpdate.JSON_math(other_lot_subdirs, return_lots);
-				}
-				// If recursive and all subdirs belong to same lot, do nothing extra -
-				// the full usage_GB already includes them correctly
-			}
-
-			std::vector<std::string> lot_update_keys;
-			// For each of the updates contained in the update json, start staging usage updates on per-lot basis
-			if (update.contains("size_GB")) {
-				lot.usage.self_GB += usage_GB;
-				lot.usage.self_GB_update_staged = true;
-			}
-			if (update.contains("num_obj")) {
-				lot.usage.self_objects += num_obj;
-				lot.usage.self_objects_update_staged = true;
-			}
-			if (update.contains("GB_being_written")) {
-				lot.usage.self_GB_being_written += GB_being_written;
-				lot.usage.self_GB_being_written_update_staged = true;
-			}
-			if (update.contains("objects_being_written")) {
-				lot.usage.self_objects_being_written += objects_being_written;
-				lot.usage.self_objects_being_written_update_staged = true;
-			}
-
-			// Get a list of the lot names currently in return_lots
-			// the vector of names acts as a proxy for the lots in return_lots
-			std::vector<std::string> return_lot_names;
-			for (auto &return_lot : *return_lots) {
-				return_lot_names.push_back(return_lot.lot_name);
-			}
-
-			// If the current lot is not in return_lots, add it
-			if (std::find(return_lot_names.begin(), return_lot_names.end(), lot.lot_name) == return_lot_names.end()) {
-				return_lots->push_back(lot);
-			} else {
-				for (auto &return_lot : *return_lots) {
-					if (return_lot.lot_name ==
-						lot.lot_name) { // They should be treated as same obj, so add their values
-						return_lot.usage.self_GB += lot.usage.self_GB;
-						return_lot.usage.self_objects += lot.usage.self_objects;
-						return_lot.usage.self_GB_being_written += lot.usage.self_GB_being_written;
-						return_lot.usage.self_objects_being_written += lot.usage.self_objects_being_written;
-					}
-				}
-			}
-		}
-
-		return std::make_pair(true, "");
-	}
+	DirUsageUpdate() {}
+
+	/**
+	 * Walk the update JSON and add the usage of every directory to the lot that tracks it.
+	 * Can be called more than once to accumulate several trees.
+	 */
+	std::pair<bool, std::string> JSON_math(const json &update_JSON);
+
+	/**
+	 * Streaming counterpart of JSON_math, producing the same totals. The tree is read with a SAX parser and
+	 * each directory is attributed as soon as its object closes, so memory grows with the depth of the tree
+	 * rather than its size. validate_dir is called with each directory's own members (without "subdirs") and
+	 * should throw if they are invalid. A directory's "path" and "includes_subdirs" must precede its "subdirs".
+	 */
+	std::pair<bool, std::string> JSON_math(std::istream &input, const std::function<void(const json &)> &validate_dir);
+
+	/**
+	 * Hand over the accumulated per-lot totals, in the order the lots were first seen. Only the
+	 * usage keys that appeared in the update are set, and ancestors are left for the caller to fill in.
+	 */
+	std::vector<UsageUpdate> take_updates();
+
+  private:
+	struct ResolvedDir {
+		const json *entry;
+		std::string path;
+		std::string lot_name;
+		bool recursive;
+	};
+
+	class SaxHandler;
+
+	std::pair<bool, std::string> resolve(const json &entry, const std::string &parent_path, ResolvedDir &dir);
+	std::pair<bool, std::string> resolve(const std::string &path, const std::string &parent_path, ResolvedDir &dir);
+	std::pair<bool, std::string> process_dir(const ResolvedDir &dir);
+	void add_usage(const std::string &lot_name, const char *usage_key, double value);
+
+	std::unordered_map<std::string, size_t> m_lot_index;
+	std::vector<UsageUpdate> m_updates;
 };
 
 class Context {
   public:
 	Context() {}
 	static void set_caller(const std::string caller);
+	static void set_thread_caller(const std::string caller);
 	static std::pair<bool, std::string> set_lot_home(const std::string lot_home);
 
-	static std::string get_caller() {
-		return *m_caller;
-	}
-	static std::string get_lot_home() {
-		return *m_home;
+	// The calling thread's own caller if it set one, else the current context's caller
+	static std::string get_caller();
+	static std::string get_thread_caller() {
+		return t_caller;
 	}
+	static std::string get_lot_home();
+
+	// The caller and lot home of one context, held by its lotman_ctx (see lotman_ctx.h).
+	// Values are replaced wholesale and accessed through std::atomic_load/atomic_store,
+	// so a reader always gets a complete string while another thread sets a new one.
+	struct State {
+		std::shared_ptr<std::string> m_caller = std::make_shared<std::string>();
+		std::shared_ptr<std::string> m_home = std::make_shared<std::string>();
+	};
 
   private:
-	static std::shared_ptr<std::string> m_caller;
-	static std::shared_ptr<std::string> m_home;
+	static State &state();
+
+	// Applies to whichever context the thread is working on
+	static thread_local std::string t_caller;
 
 	static std::vector<std::string> path_split(const std::string dir_path);
 	static std::pair<bool, std::string> mkdir_and_parents_if_needed(const std::string dir_path);
@@ -463,13 +416,15 @@ class Checks {
 	friend class lotman::Lot;
 
   public:
-	static bool
-	cycle_check(const std::string &start_node, const std::vector<std::string> &start_parents,
-				const std::vector<std::string> &start_children); // Only checks for cycles that return to start_node.
-																 // Returns true if cycle found, false otherwise
-	static bool insertion_check(const std::string &LTBA, const std::string &parent,
-								const std::string &child); // Check if lot-to-be-added (LTBA) is being inserted between
-														   // a parent/child, which should update data for the child
+	static bool cycle_check(const std::vector<std::string> &start_parents,
+							const std::vector<std::string> &start_children); // Checks whether any of the children is
+																			 // one of the parents or their ancestors.
+																			 // Returns true if cycle found
+	static bool insertion_check(const std::string &parent,
+								const std::string &child); // Check if a lot-to-be-added is being inserted between a
+														   // parent/child, which should update data for the child
 	static bool will_be_orphaned(const std::string &LTBR, const std::string &child);
 };
 } // namespace lotman
+
+#endif // LOTMAN_INTERNAL_H
@@ -0,0 +1,400 @@
+#include "lotman_journal.h"
+
+#include "lotman_accumulator.h"
+#include "lotman_cache.h"
+#include "lotman_ctx.h"
+#include "lotman_db.h"
+#include "lotman_internal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+namespace lotman {
+
+UsageJournal::State &UsageJournal::state() {
+	return current_ctx().journal;
+}
+
+namespace {
+
+// The file starts with a magic string and a format version, padded to 16 bytes
+constexpr char file_magic[8] = {'L', 'O', 'T', 'J', 'R', 'N', 'L', '1'};
+constexpr size_t header_size = 16;
+constexpr size_t initial_capacity = 1 << 20;
+
+constexpr uint32_t record_magic = 0x4C4D4452; // "RDML"
+
+// Followed by the lot name, then zero padding up to size, a multiple of 8
+struct RecordHeader {
+	uint32_t magic;
+	uint32_t crc; // Of everything after this field, up to size
+	uint64_t seq;
+	uint32_t size;
+	uint32_t name_len;
+	double values[4];
+};
+
+constexpr size_t align8(size_t n) {
+	return (n + 7) & ~size_t(7);
+}
+
+// CRC-32 (IEEE 802.3) lookup table
+constexpr std::array<uint32_t, 256> make_crc_table() {
+	std::array<uint32_t, 256> table{};
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; ++k) {
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		}
+		table[i] = c;
+	}
+	return table;
+}
+
+constexpr std::array<uint32_t, 256> crc_table = make_crc_table();
+
+uint32_t crc32(const char *data, size_t len) {
+	uint32_t c = 0xFFFFFFFFu;
+	for (size_t i = 0; i < len; ++i) {
+		c = crc_table[(c ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (c >> 8);
+	}
+	return c ^ 0xFFFFFFFFu;
+}
+
+constexpr size_t crc_offset = offsetof(RecordHeader, seq);
+
+std::string errno_string(const std::string &what) {
+	return what + ": " + std::strerror(errno);
+}
+
+} // namespace
+
+std::pair<bool, std::string> UsageJournal::open() {
+	// Initializing the storage recovers the journal, which takes the lock itself
+	try {
+		db::StorageManager::get_storage();
+	} catch (const std::exception &e) {
+		return std::make_pair(false, std::string("Failed to initialize storage: ") + e.what());
+	}
+
+	auto &s = state();
+	std::unique_lock<std::shared_mutex> lock(s.m_mutex);
+	return open_locked(s);
+}
+
+std::pair<bool, std::string> UsageJournal::open_locked(State &s, bool *in_use) {
+	if (s.m_map) {
+		return std::make_pair(true, "");
+	}
+
+	auto rp = db::StorageManager::get_db_path();
+	if (!rp.first) {
+		return std::make_pair(false, "Failed to get database path: " + rp.second);
+	}
+	std::string path = rp.second + "-usage-journal";
+
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return std::make_pair(false, errno_string("Failed to open the usage journal " + path));
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		::close(fd);
+		if (in_use) {
+			*in_use = true;
+		}
+		return std::make_pair(false, "The usage journal " + path + " is held open by another process or context.");
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		std::string err = errno_string("Failed to stat the usage journal " + path);
+		::close(fd);
+		return std::make_pair(false, err);
+	}
+	size_t capacity = std::max(align8(static_cast<size_t>(st.st_size)), initial_capacity);
+	if (static_cast<size_t>(st.st_size) < capacity && ftruncate(fd, static_cast<off_t>(capacity)) != 0) {
+		std::string err = errno_string("Failed to size the usage journal " + path);
+		::close(fd);
+		return std::make_pair(false, err);
+	}
+
+	void *map = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		std::string err = errno_string("Failed to map the usage journal " + path);
+		::close(fd);
+		return std::make_pair(false, err);
+	}
+
+	char *data = static_cast<char *>(map);
+	static const char zero_header[header_size] = {};
+	if (std::memcmp(data, zero_header, header_size) == 0) {
+		std::memcpy(data, file_magic, sizeof(file_magic));
+	} else if (std::memcmp(data, file_magic, sizeof(file_magic)) != 0) {
+		munmap(map, capacity);
+		::close(fd);
+		return std::make_pair(false, "The file " + path + " is not a LotMan usage journal.");
+	}
+
+	s.m_path = path;
+	s.m_fd = fd;
+	s.m_map = data;
+	s.m_capacity = capacity;
+	s.m_generation++;
+	// Until the replay has emptied it, the journal must not be mistaken for an empty one
+	s.m_end = capacity;
+
+	rp = replay_locked(s);
+	if (!rp.first) {
+		close_locked(s);
+		return std::make_pair(false, "Failed to replay the usage journal " + path + ": " + rp.second);
+	}
+	return std::make_pair(true, "");
+}
+
+std::pair<bool, std::string> UsageJournal::replay_locked(State &s) {
+	/*
+	Function flow for replay_locked:
+	* Read the sequence number of the last record applied to the database
+	* Scan the file for valid records past it, skipping anything torn and every record seen before
+	* Sum the deltas per lot and apply them, and the new checkpoint, in one transaction
+	* Empty the file
+	*/
+	uint64_t applied_seq = 0;
+	{
+		db::PooledConnection conn;
+		if (!conn.valid()) {
+			return std::make_pair(false, conn.error());
+		}
+		db::QueryStmt guard(conn, db::Query::JournalCheckpoint);
+		if (!guard.get()) {
+			return std::make_pair(false, guard.error());
+		}
+		int rc = sqlite3_step(guard.get());
+		if (rc == SQLITE_ROW) {
+			applied_seq = static_cast<uint64_t>(sqlite3_column_int64(guard.get(), 0));
+		} else if (rc != SQLITE_DONE) {
+			return std::make_pair(false, "Failed to read the journal checkpoint: sqlite errno: " + std::to_string(rc));
+		}
+	}
+
+	uint64_t max_seq = applied_seq;
+	std::unordered_set<uint64_t> seen;
+	std::map<std::string, std::array<double, 4>> deltas;
+	size_t offset = header_size;
+	while (offset + sizeof(RecordHeader) <= s.m_capacity) {
+		RecordHeader header;
+		std::memcpy(&header, s.m_map + offset, sizeof(header));
+		bool valid = header.magic == record_magic && header.size % 8 == 0 &&
+					 header.size >= sizeof(RecordHeader) + header.name_len && header.size <= s.m_capacity - offset &&
+					 crc32(s.m_map + offset + crc_offset, header.size - crc_offset) == header.crc;
+		if (!valid) {
+			offset += 8;
+			continue;
+		}
+		offset += header.size;
+
+		if (header.seq <= applied_seq || !seen.insert(header.seq).second) {
+			continue;
+		}
+		max_seq = std::max(max_seq, header.seq);
+		std::string lot_name(s.m_map + offset - header.size + sizeof(RecordHeader), header.name_len);
+		auto &lot_deltas = deltas[lot_name];
+		for (size_t i = 0; i < lot_deltas.size(); ++i) {
+			lot_deltas[i] += header.values[i];
+		}
+	}
+
+	if (!deltas.empty()) {
+		const std::array<std::string, 4> usage_keys = {"self_GB", "self_objects", "self_GB_being_written",
+													   "self_objects_being_written"};
+		std::vector<UsageUpdate> updates;
+		for (const auto &[lot_name, lot_deltas] : deltas) {
+			UsageUpdate update{lot_name, {}, {}, ""};
+			for (size_t i = 0; i < usage_keys.size(); ++i) {
+				if (lot_deltas[i] != 0) {
+					update.values[usage_keys[i]] = lot_deltas[i];
+				}
+			}
+			auto rp = Lot::lot_exists(lot_name);
+			if (!rp.first) {
+				if (!rp.second.empty()) {
+					return std::make_pair(false, "Function call to lotman::Lot::lot_exists failed: " + rp.second);
+				}
+				continue; // Deleted since, like a flush would find it
+			}
+			auto rp_vec_str = HierarchyCache::get_parents(lot_name, true, false);
+			if (!rp_vec_str.second.empty()) {
+				return std::make_pair(false, "Failure on call to get_parents: " + rp_vec_str.second);
+			}
+			update.ancestors = rp_vec_str.first;
+			updates.push_back(std::move(update));
+		}
+
+		// Deltas that would make usage negative are dropped like a flush drops them. The checkpoint is stored
+		// even if no update is left.
+		auto rp = Lot::store_usage_batch(updates, true, false, static_cast<int64_t>(max_seq));
+		if (!rp.first) {
+			return std::make_pair(false, "Failure on call to store_usage_batch: " + rp.second);
+		}
+	}
+
+	std::memset(s.m_map + header_size, 0, s.m_capacity - header_size);
+	s.m_end = header_size;
+	s.m_next_seq = max_seq + 1;
+	return std::make_pair(true, "");
+}
+
+void UsageJournal::close() {
+	auto &s = state();
+	std::unique_lock<std::shared_mutex> lock(s.m_mutex);
+	close_locked(s);
+}
+
+void UsageJournal::close_locked(State &s) {
+	if (!s.m_map) {
+		return;
+	}
+	bool empty = s.m_end.load() == header_size;
+	munmap(s.m_map, s.m_capacity);
+	// Unlink while the file is still locked, so no other process can open it in between
+	if (empty) {
+		unlink(s.m_path.c_str());
+	}
+	::close(s.m_fd);
+	s.m_map = nullptr;
+	s.m_fd = -1;
+	s.m_capacity = 0;
+	s.m_end = 0;
+}
+
+bool UsageJournal::is_open() {
+	auto &s = state();
+	std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+	return s.m_map != nullptr;
+}
+
+std::pair<bool, std::string> UsageJournal::append(const std::string &lot_name, const std::array<double, 4> &values) {
+	const size_t size = align8(sizeof(RecordHeader) + lot_name.size());
+	std::string record(size, '\0');
+	RecordHeader header{};
+	header.magic = record_magic;
+	header.size = static_cast<uint32_t>(size);
+	header.name_len = static_cast<uint32_t>(lot_name.size());
+	std::copy(values.begin(), values.end(), header.values);
+	std::memcpy(&record[sizeof(RecordHeader)], lot_name.data(), lot_name.size());
+
+	auto &s = state();
+	while (true) {
+		size_t end;
+		{
+			std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+			if (!s.m_map) {
+				return std::make_pair(false, "The usage journal is not open.");
+			}
+
+			size_t offset = s.m_end.load();
+			while (offset + size <= s.m_capacity) {
+				if (s.m_end.compare_exchange_weak(offset, offset + size)) {
+					header.seq = s.m_next_seq.fetch_add(1);
+					std::memcpy(&record[0], &header, sizeof(header));
+					header.crc = crc32(record.data() + crc_offset, size - crc_offset);
+					std::memcpy(&record[0], &header, sizeof(header));
+					std::memcpy(s.m_map + offset, record.data(), size);
+					return std::make_pair(true, "");
+				}
+			}
+			end = offset;
+		}
+
+		std::unique_lock<std::shared_mutex> lock(s.m_mutex);
+		if (s.m_map && s.m_end.load() == end) {
+			auto rp = grow_locked(s, end + size);
+			if (!rp.first) {
+				return rp;
+			}
+		}
+	}
+}
+
+std::pair<bool, std::string> UsageJournal::grow_locked(State &s, size_t min_capacity) {
+	if (min_capacity <= s.m_capacity) {
+		return std::make_pair(true, "");
+	}
+
+	size_t capacity = std::max(s.m_capacity * 2, align8(min_capacity));
+	if (ftruncate(s.m_fd, static_cast<off_t>(capacity)) != 0) {
+		return std::make_pair(false, errno_string("Failed to grow the usage journal " + s.m_path));
+	}
+	void *map = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, s.m_fd, 0);
+	if (map == MAP_FAILED) {
+		return std::make_pair(false, errno_string("Failed to map the usage journal " + s.m_path));
+	}
+	munmap(s.m_map, s.m_capacity);
+	s.m_map = static_cast<char *>(map);
+	s.m_capacity = capacity;
+	return std::make_pair(true, "");
+}
+
+UsageJournal::Cut UsageJournal::cut() {
+	auto &s = state();
+	std::shared_lock<std::shared_mutex> lock(s.m_mutex);
+	if (!s.m_map) {
+		return Cut{};
+	}
+	return Cut{s.m_generation, s.m_next_seq.load() - 1, s.m_end.load()};
+}
+
+void UsageJournal::compact(const Cut &cut) {
+	auto &s = state();
+	std::unique_lock<std::shared_mutex> lock(s.m_mutex);
+	if (!s.m_map || s.m_generation != cut.generation || cut.offset <= header_size) {
+		return;
+	}
+
+	// Records appended since the cut move to the front. Should the process die halfway, replay finds
+	// each of them at least once and skips the copies.
+	size_t end = s.m_end.load();
+	size_t tail = end - cut.offset;
+	std::memmove(s.m_map + header_size, s.m_map + cut.offset, tail);
+	std::memset(s.m_map + header_size + tail, 0, end - header_size - tail);
+	s.m_end = header_size + tail;
+}
+
+std::pair<bool, std::string> UsageJournal::recover() {
+	auto &s = state();
+	std::unique_lock<std::shared_mutex> lock(s.m_mutex);
+	if (s.m_map) {
+		return std::make_pair(true, "");
+	}
+
+	auto rp = db::StorageManager::get_db_path();
+	if (!rp.first) {
+		return std::make_pair(false, "Failed to get database path: " + rp.second);
+	}
+	struct stat st;
+	if (stat((rp.second + "-usage-journal").c_str(), &st) != 0) {
+		return std::make_pair(true, ""); // Nothing was left behind
+	}
+
+	bool in_use = false;
+	rp = open_locked(s, &in_use);
+	if (!rp.first) {
+		// A journal that is in use belongs to a live process, which applies it itself
+		return in_use ? std::make_pair(true, std::string()) : rp;
+	}
+	if (!UsageAccumulator::enabled()) {
+		close_locked(s);
+	}
+	return std::make_pair(true, "");
+}
+
+} // namespace lotman
@@ -0,0 +1,121 @@
+/**
+ * Durable journal of queued usage deltas
+ *
+ * While write-behind is enabled (see lotman_accumulator.h), every delta that is
+ * queued in memory is also appended to a journal file next to the database, so
+ * that it survives the death of the process before it is flushed. The journal is
+ * memory-mapped: an append reserves space with an atomic bump of the end offset
+ * and copies the record in, with no system call and no SQLite transaction. Data
+ * written to a shared mapping is in the page cache as soon as it is copied, so
+ * it outlives the process, though not a crash of the machine itself.
+ *
+ * Each flush records the sequence number of the last record it applied in the
+ * usage_journal table, in the same transaction as the usage itself, and then
+ * compacts the records it applied out of the file. When a database is opened,
+ * the records past that checkpoint are replayed, so every delta is applied
+ * exactly once no matter where a process died.
+ */
+
+#ifndef LOTMAN_JOURNAL_H
+#define LOTMAN_JOURNAL_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+
+namespace lotman {
+
+/**
+ * The usage journal of one context's database.
+ *
+ * Records carry a sequence number and a checksum, and are 8-byte aligned. Replay scans the
+ * whole file for valid records, so neither a record that was torn by the death of its writer
+ * nor a half-finished compaction hides the records around it. A record that shows up twice
+ * is applied once.
+ *
+ * Only one process (and one context) can have a database's journal open at a time, which is
+ * enforced with an advisory lock on the file.
+ *
+ * Thread-safe. Appends share a reader lock and run in parallel; opening, growing, compacting
+ * and closing the journal take it exclusively.
+ */
+class UsageJournal {
+  public:
+	// The end of the journal at the start of a flush. Every record before it is part of the flush.
+	struct Cut {
+		uint64_t generation = 0; // Of the open journal, or 0 if it was not open
+		uint64_t last_seq = 0;	 // Sequence number of the last record before the cut, 0 if none
+		size_t offset = 0;
+	};
+
+	/**
+	 * Open the journal of the current database for appending, replaying and compacting whatever
+	 * it holds past the database's checkpoint first. Does nothing if the journal is already open.
+	 * @return Pair of (success, error_message)
+	 */
+	static std::pair<bool, std::string> open();
+
+	/**
+	 * Close the journal, deleting the file if it holds no records.
+	 */
+	static void close();
+
+	static bool is_open();
+
+	/**
+	 * Append the deltas of one update. values are the deltas of the self_* usage keys, in the
+	 * order of Lot::store_usage_batch.
+	 * @return Pair of (success, error_message). Fails if the journal is not open or cannot grow.
+	 */
+	static std::pair<bool, std::string> append(const std::string &lot_name, const std::array<double, 4> &values);
+
+	/**
+	 * Mark the current end of the journal. The caller must keep appends from running concurrently.
+	 */
+	static Cut cut();
+
+	/**
+	 * Drop the records before the cut from the file, once they are committed along with a
+	 * checkpoint of cut.last_seq. Does nothing if the journal was closed since the cut.
+	 */
+	static void compact(const Cut &cut);
+
+	/**
+	 * Replay the journal a process left behind when it died, if there is one that no other
+	 * process holds open. Called when storage is initialized. The journal is left open if
+	 * write-behind is enabled, and closed otherwise.
+	 * @return Pair of (success, error_message)
+	 */
+	static std::pair<bool, std::string> recover();
+
+	// The journal of one context, held by its lotman_ctx (see lotman_ctx.h)
+	struct State {
+		std::shared_mutex m_mutex;
+		std::string m_path;
+		int m_fd = -1;
+		char *m_map = nullptr;
+		size_t m_capacity = 0;
+		uint64_t m_generation = 0;
+
+		// Offset at which the next record goes, and the sequence number it gets
+		std::atomic<size_t> m_end{0};
+		std::atomic<uint64_t> m_next_seq{1};
+	};
+
+  private:
+	// The calling thread's current context's journal
+	static State &state();
+
+	// Sets *in_use if the file is locked by another process or context
+	static std::pair<bool, std::string> open_locked(State &s, bool *in_use = nullptr);
+	static std::pair<bool, std::string> replay_locked(State &s);
+	static std::pair<bool, std::string> grow_locked(State &s, size_t min_capacity);
+	static void close_locked(State &s);
+};
+
+} // namespace lotman
+
+#endif // LOTMAN_JOURNAL_H
@@ -0,0 +1,327 @@
+#include "lotman_metrics.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <unordered_set>
+
+namespace lotman {
+
+namespace {
+
+const char *const api_call_names[] = {
+	"add_lot",
+	"remove_lot",
+	"remove_lots_recursive",
+	"update_lot",
+	"rm_parents_from_lot",
+	"rm_paths_from_lots",
+	"add_to_lot",
+	"is_root",
+	"lot_exists",
+	"get_owners",
+	"get_parent_names",
+	"get_children_names",
+	"get_policy_attributes",
+	"get_lot_dirs",
+	"update_lot_usage",
+	"update_lot_usage_batch",
+	"update_lot_usage_struct",
+	"get_lot_usage_struct",
+	"update_lot_usage_by_dir",
+	"update_lot_usage_by_dir_file",
+	"repair_children_usage",
+	"get_lot_usage",
+	"get_lots_past_exp",
+	"get_lots_past_del",
+	"get_lots_past_opp",
+	"get_lots_past_ded",
+	"get_lots_past_obj",
+	"get_policy_violations",
+	"get_eviction_candidates",
+	"list_all_lots",
+	"get_lot_as_json",
+	"get_lots_from_dir",
+	"set_context_str",
+	"get_context_str",
+	"set_context_int",
+	"get_context_int",
+	"flush",
+	"ctx_create",
+};
+static_assert(std::size(api_call_names) == API_CALL_COUNT, "Every ApiCall needs exactly one name");
+
+const char *const sql_kind_names[] = {"query", "update", "usage_batch"};
+static_assert(std::size(sql_kind_names) == SQL_KIND_COUNT, "Every SqlKind needs exactly one name");
+
+// Only the owning thread writes its counters, so a plain load and store is enough and takes no locked instruction
+void bump(std::atomic<uint64_t> &counter, uint64_t amount = 1) {
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// A point-in-time sum of the metrics of one operation
+struct OperationTotals {
+	uint64_t calls = 0;
+	uint64_t errors = 0;
+	uint64_t total_ns = 0;
+	uint64_t max_ns = 0;
+	std::array<uint64_t, Metrics::num_buckets> buckets{};
+
+	void add(const Metrics::Operation &op) {
+		calls += op.calls.load(std::memory_order_relaxed);
+		errors += op.errors.load(std::memory_order_relaxed);
+		total_ns += op.total_ns.load(std::memory_order_relaxed);
+		max_ns = std::max(max_ns, op.max_ns.load(std::memory_order_relaxed));
+		for (size_t i = 0; i < buckets.size(); ++i) {
+			buckets[i] += op.buckets[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	// Upper bound of the bucket holding the given quantile, capped at the slowest call seen
+	double quantile_seconds(double quantile) const {
+		uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(calls));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < buckets.size(); ++i) {
+			seen += buckets[i];
+			if (seen > rank) {
+				uint64_t bound = Metrics::bucket_bound(i);
+				return static_cast<double>(bound == 0 ? max_ns : std::min(bound, max_ns)) / 1e9;
+			}
+		}
+		return static_cast<double>(max_ns) / 1e9;
+	}
+};
+
+struct Totals {
+	std::array<OperationTotals, API_CALL_COUNT> api;
+	std::array<OperationTotals, SQL_KIND_COUNT> sql;
+	std::array<uint64_t, COUNTER_COUNT> counters{};
+
+	void add(const Metrics::ThreadMetrics &metrics) {
+		for (size_t i = 0; i < api.size(); ++i) {
+			api[i].add(metrics.api[i]);
+		}
+		for (size_t i = 0; i < sql.size(); ++i) {
+			sql[i].add(metrics.sql[i]);
+		}
+		for (size_t i = 0; i < counters.size(); ++i) {
+			counters[i] += metrics.counters[i].load(std::memory_order_relaxed);
+		}
+	}
+};
+
+// Every live thread's metrics, and the sum of those of the threads that exited
+struct Registry {
+	std::mutex mutex;
+	std::unordered_set<Metrics::ThreadMetrics *> threads;
+	Totals exited;
+};
+
+Registry &registry() {
+	// Never destroyed, as threads can exit after static destructors have run
+	static Registry *registry = new Registry;
+	return *registry;
+}
+
+// Registers the calling thread's metrics, and folds them into the registry's totals when the thread exits
+struct ThreadSlot {
+	std::unique_ptr<Metrics::ThreadMetrics> metrics = std::make_unique<Metrics::ThreadMetrics>();
+
+	ThreadSlot() {
+		auto &reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.threads.insert(metrics.get());
+	}
+
+	~ThreadSlot() {
+		auto &reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.exited.add(*metrics);
+		reg.threads.erase(metrics.get());
+	}
+};
+
+Totals snapshot() {
+	auto &reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	Totals totals = reg.exited;
+	for (const auto *metrics : reg.threads) {
+		totals.add(*metrics);
+	}
+	return totals;
+}
+
+nlohmann::json operation_json(const OperationTotals &op) {
+	nlohmann::json histogram = nlohmann::json::array();
+	for (size_t i = 0; i < op.buckets.size(); ++i) {
+		if (op.buckets[i] == 0) {
+			continue;
+		}
+		uint64_t bound = Metrics::bucket_bound(i);
+		nlohmann::json le = bound ? nlohmann::json(static_cast<double>(bound) / 1e9) : nlohmann::json("+Inf");
+		histogram.push_back({{"le_seconds", le}, {"count", op.buckets[i]}});
+	}
+
+	return {{"calls", op.calls},
+			{"errors", op.errors},
+			{"total_seconds", static_cast<double>(op.total_ns) / 1e9},
+			{"max_seconds", static_cast<double>(op.max_ns) / 1e9},
+			{"p50_seconds", op.quantile_seconds(0.5)},
+			{"p90_seconds", op.quantile_seconds(0.9)},
+			{"p99_seconds", op.quantile_seconds(0.99)},
+			{"histogram", histogram}};
+}
+
+// Writes the counters and the latency histogram of one kind of operation, labelled by label="name"
+void write_prometheus(std::ostringstream &out, const std::string &prefix, const std::string &count_suffix,
+					  const std::string &latency_suffix, const std::string &label, const char *const names[],
+					  const OperationTotals *ops, size_t num_ops) {
+	out << "# TYPE " << prefix << count_suffix << " counter\n";
+	for (size_t i = 0; i < num_ops; ++i) {
+		out << prefix << count_suffix << "{" << label << "=\"" << names[i] << "\"} " << ops[i].calls << "\n";
+	}
+	out << "# TYPE " << prefix << "_errors_total counter\n";
+	for (size_t i = 0; i < num_ops; ++i) {
+		out << prefix << "_errors_total{" << label << "=\"" << names[i] << "\"} " << ops[i].errors << "\n";
+	}
+
+	// Only the bounds between powers of two are exposed, which keeps the series count down
+	const std::string histogram = prefix + latency_suffix;
+	out << "# TYPE " << histogram << " histogram\n";
+	for (size_t i = 0; i < num_ops; ++i) {
+		const std::string labels = label + "=\"" + names[i] + "\"";
+		uint64_t cumulative = 0;
+		for (size_t b = 0; b + 1 < Metrics::num_buckets; ++b) {
+			cumulative += ops[i].buckets[b];
+			if (b % (1 << Metrics::sub_bucket_bits) != 0) {
+				continue;
+			}
+			out << histogram << "_bucket{" << labels << ",le=\""
+				<< static_cast<double>(Metrics::bucket_bound(b)) / 1e9 << "\"} " << cumulative << "\n";
+		}
+		out << histogram << "_bucket{" << labels << ",le=\"+Inf\"} " << ops[i].calls << "\n";
+		out << histogram << "_sum{" << labels << "} " << static_cast<double>(ops[i].total_ns) / 1e9 << "\n";
+		out << histogram << "_count{" << labels << "} " << ops[i].calls << "\n";
+	}
+}
+
+} // namespace
+
+size_t Metrics::bucket_for(uint64_t ns) {
+	if (ns < (uint64_t(1) << min_exponent)) {
+		return 0;
+	}
+	int exponent = 63 - __builtin_clzll(ns);
+	if (exponent >= max_exponent) {
+		return num_buckets - 1;
+	}
+	size_t sub_bucket = (ns >> (exponent - sub_bucket_bits)) & ((1 << sub_bucket_bits) - 1);
+	return 1 + (static_cast<size_t>(exponent - min_exponent) << sub_bucket_bits) + sub_bucket;
+}
+
+uint64_t Metrics::bucket_bound(size_t bucket) {
+	if (bucket == 0) {
+		return uint64_t(1) << min_exponent;
+	}
+	if (bucket >= num_buckets - 1) {
+		return 0;
+	}
+	int exponent = min_exponent + static_cast<int>((bucket - 1) >> sub_bucket_bits);
+	uint64_t sub_bucket = (bucket - 1) & ((1 << sub_bucket_bits) - 1);
+	return ((uint64_t(1) << sub_bucket_bits) + sub_bucket + 1) << (exponent - sub_bucket_bits);
+}
+
+Metrics::ThreadMetrics &Metrics::local() {
+	thread_local ThreadSlot slot;
+	return *slot.metrics;
+}
+
+void Metrics::record(Operation &op, uint64_t ns, bool error) {
+	bump(op.calls);
+	if (error) {
+		bump(op.errors);
+	}
+	bump(op.total_ns, ns);
+	if (ns > op.max_ns.load(std::memory_order_relaxed)) {
+		op.max_ns.store(ns, std::memory_order_relaxed);
+	}
+	bump(op.buckets[bucket_for(ns)]);
+}
+
+void Metrics::record(ApiCall call, uint64_t ns, bool error) {
+	record(local().api[static_cast<size_t>(call)], ns, error);
+}
+
+void Metrics::record(SqlKind kind, uint64_t ns, bool error) {
+	record(local().sql[static_cast<size_t>(kind)], ns, error);
+}
+
+void Metrics::increment(Counter counter) {
+	bump(local().counters[static_cast<size_t>(counter)]);
+}
+
+std::string Metrics::to_json() {
+	Totals totals = snapshot();
+
+	// Calls that were never made are left out
+	nlohmann::json api = nlohmann::json::object();
+	for (size_t i = 0; i < API_CALL_COUNT; ++i) {
+		if (totals.api[i].calls) {
+			api[api_call_names[i]] = operation_json(totals.api[i]);
+		}
+	}
+	nlohmann::json sql = nlohmann::json::object();
+	for (size_t i = 0; i < SQL_KIND_COUNT; ++i) {
+		sql[sql_kind_names[i]] = operation_json(totals.sql[i]);
+	}
+
+	auto counter = [&totals](Counter c) { return totals.counters[static_cast<size_t>(c)]; };
+	nlohmann::json metrics = {
+		{"api", api},
+		{"sql", sql},
+		{"connection_pool", {{"hits", counter(Counter::PoolHits)}, {"misses", counter(Counter::PoolMisses)}}},
+		{"statement_cache",
+		 {{"hits", counter(Counter::StatementCacheHits)}, {"misses", counter(Counter::StatementCacheMisses)}}},
+		{"busy_retries", counter(Counter::BusyRetries)}};
+	return metrics.dump();
+}
+
+std::string Metrics::to_prometheus() {
+	Totals totals = snapshot();
+
+	std::ostringstream out;
+	out << std::setprecision(9);
+	write_prometheus(out, "lotman_api", "_calls_total", "_latency_seconds", "call", api_call_names,
+					 totals.api.data(), API_CALL_COUNT);
+	write_prometheus(out, "lotman_sql", "_statements_total", "_duration_seconds", "kind", sql_kind_names,
+					 totals.sql.data(), SQL_KIND_COUNT);
+
+	const std::pair<const char *, Counter> counters[] = {
+		{"lotman_connection_pool_hits_total", Counter::PoolHits},
+		{"lotman_connection_pool_misses_total", Counter::PoolMisses},
+		{"lotman_statement_cache_hits_total", Counter::StatementCacheHits},
+		{"lotman_statement_cache_misses_total", Counter::StatementCacheMisses},
+		{"lotman_sql_busy_retries_total", Counter::BusyRetries},
+	};
+	for (const auto &[name, counter] : counters) {
+		out << "# TYPE " << name << " counter\n";
+		out << name << " " << totals.counters[static_cast<size_t>(counter)] << "\n";
+	}
+	return out.str();
+}
+
+ApiCallTimer::~ApiCallTimer() {
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start);
+	bool error = m_err_msg && *m_err_msg != m_initial_err;
+	Metrics::record(m_call, static_cast<uint64_t>(ns.count()), error);
+}
+
+SqlTimer::~SqlTimer() {
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start);
+	Metrics::record(m_kind, static_cast<uint64_t>(ns.count()), !m_succeeded);
+}
+
+} // namespace lotman
@@ -0,0 +1,202 @@
+/**
+ * Built-in metrics
+ *
+ * LotMan counts the calls to each C entry point, the SQL statements it runs
+ * and the behaviour of its connection pool and statement caches, and keeps a
+ * latency histogram for every call and kind of statement. The counters live in
+ * a block of memory per thread that only its thread writes, so recording a
+ * call costs two clock reads and a few uncontended stores; lotman_get_metrics()
+ * adds up the blocks of every thread when it is called.
+ *
+ * Metrics cover the whole process, across all contexts.
+ */
+
+#ifndef LOTMAN_METRICS_H
+#define LOTMAN_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace lotman {
+
+/**
+ * The C entry points that report metrics. The lotman_ctx_* variants count as the call they wrap.
+ */
+enum class ApiCall : size_t {
+	AddLot,
+	RemoveLot,
+	RemoveLotsRecursive,
+	UpdateLot,
+	RmParentsFromLot,
+	RmPathsFromLots,
+	AddToLot,
+	IsRoot,
+	LotExists,
+	GetOwners,
+	GetParentNames,
+	GetChildrenNames,
+	GetPolicyAttributes,
+	GetLotDirs,
+	UpdateLotUsage,
+	UpdateLotUsageBatch,
+	UpdateLotUsageStruct,
+	GetLotUsageStruct,
+	UpdateLotUsageByDir,
+	UpdateLotUsageByDirFile,
+	RepairChildrenUsage,
+	GetLotUsage,
+	GetLotsPastExp,
+	GetLotsPastDel,
+	GetLotsPastOpp,
+	GetLotsPastDed,
+	GetLotsPastObj,
+	GetPolicyViolations,
+	GetEvictionCandidates,
+	ListAllLots,
+	GetLotAsJson,
+	GetLotsFromDir,
+	SetContextStr,
+	GetContextStr,
+	SetContextInt,
+	GetContextInt,
+	Flush,
+	CtxCreate,
+
+	Count
+};
+
+constexpr size_t API_CALL_COUNT = static_cast<size_t>(ApiCall::Count);
+
+/**
+ * The layers SQL statements are timed in.
+ */
+enum class SqlKind : size_t {
+	Query,		// db::SQL_get_matches and SQL_get_matches_multi_col
+	Update,		// Lot::store_updates
+	UsageBatch, // Lot::store_usage_batch, one transaction per batch
+
+	Count
+};
+
+constexpr size_t SQL_KIND_COUNT = static_cast<size_t>(SqlKind::Count);
+
+enum class Counter : size_t {
+	PoolHits,			   // Connections handed out by ConnectionPool::acquire without opening one
+	PoolMisses,			   // Connections ConnectionPool::acquire had to open
+	StatementCacheHits,	   // Statements found prepared in a StatementCatalogue or the PreparedStatementCache
+	StatementCacheMisses,  // Statements that had to be prepared
+	BusyRetries,		   // Times a statement waited for a lock held by another connection
+
+	Count
+};
+
+constexpr size_t COUNTER_COUNT = static_cast<size_t>(Counter::Count);
+
+class Metrics {
+  public:
+	/**
+	 * Latencies are sorted into log-linear buckets, like an HDR histogram with two significant bits: each
+	 * power of two from 2^10 ns (about 1 us) up to 2^36 ns (about 69 s) is split into four equal buckets,
+	 * so a bucket's bounds are within 25% of each other. The first bucket holds everything faster, and the
+	 * last everything slower.
+	 */
+	static constexpr int min_exponent = 10;
+	static constexpr int max_exponent = 36;
+	static constexpr int sub_bucket_bits = 2;
+	static constexpr size_t num_buckets = ((max_exponent - min_exponent) << sub_bucket_bits) + 2;
+
+	static size_t bucket_for(uint64_t ns);
+
+	// Exclusive upper bound of a bucket in nanoseconds, or 0 for the last one, which has none
+	static uint64_t bucket_bound(size_t bucket);
+
+	static void record(ApiCall call, uint64_t ns, bool error);
+	static void record(SqlKind kind, uint64_t ns, bool error);
+	static void increment(Counter counter);
+
+	/**
+	 * Every metric, summed over all threads, as a JSON object.
+	 */
+	static std::string to_json();
+
+	/**
+	 * Every metric, summed over all threads, in the Prometheus text exposition format.
+	 */
+	static std::string to_prometheus();
+
+	// The metrics of one operation. Only its thread writes them, other threads read them.
+	struct Operation {
+		std::atomic<uint64_t> calls{0};
+		std::atomic<uint64_t> errors{0};
+		std::atomic<uint64_t> total_ns{0};
+		std::atomic<uint64_t> max_ns{0};
+		std::array<std::atomic<uint64_t>, num_buckets> buckets{};
+	};
+
+	// Everything one thread recorded
+	struct ThreadMetrics {
+		std::array<Operation, API_CALL_COUNT> api;
+		std::array<Operation, SQL_KIND_COUNT> sql;
+		std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters{};
+	};
+
+  private:
+	// The calling thread's metrics, registered on first use
+	static ThreadMetrics &local();
+	static void record(Operation &op, uint64_t ns, bool error);
+};
+
+/**
+ * Times a C entry point from construction to destruction. The call counts as an error if it left a message
+ * in err_msg, so calls made without somewhere to put one are never counted as errors.
+ */
+class ApiCallTimer {
+  public:
+	ApiCallTimer(ApiCall call, char **err_msg)
+		: m_call(call), m_err_msg(err_msg), m_initial_err(err_msg ? *err_msg : nullptr),
+		  m_start(std::chrono::steady_clock::now()) {}
+
+	// Non-copyable
+	ApiCallTimer(const ApiCallTimer &) = delete;
+	ApiCallTimer &operator=(const ApiCallTimer &) = delete;
+
+	~ApiCallTimer();
+
+  private:
+	ApiCall m_call;
+	char **m_err_msg;
+	char *m_initial_err;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+/**
+ * Times a SQL statement, or a transaction of them, from construction to destruction. The statement counts
+ * as an error unless succeeded() is called, so that none of the early returns of a failure can miss it.
+ */
+class SqlTimer {
+  public:
+	explicit SqlTimer(SqlKind kind) : m_kind(kind), m_start(std::chrono::steady_clock::now()) {}
+
+	// Non-copyable
+	SqlTimer(const SqlTimer &) = delete;
+	SqlTimer &operator=(const SqlTimer &) = delete;
+
+	~SqlTimer();
+
+	void succeeded() {
+		m_succeeded = true;
+	}
+
+  private:
+	SqlKind m_kind;
+	bool m_succeeded = false;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+} // namespace lotman
+
+#endif // LOTMAN_METRICS_H
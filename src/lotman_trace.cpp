@@ -0,0 +1,130 @@
+#include "lotman_trace.h"
+
+#include <memory>
+#include <unordered_map>
+
+namespace lotman {
+
+namespace {
+
+struct TraceConfig {
+	lotman_sql_trace_callback_t callback = nullptr;
+	void *user_data = nullptr;
+	uint64_t threshold_ns = 0;
+};
+
+// Replaced as a whole, so a statement that is being reported keeps the configuration it started with
+std::shared_ptr<const TraceConfig> &config() {
+	static std::shared_ptr<const TraceConfig> instance = std::make_shared<TraceConfig>();
+	return instance;
+}
+
+thread_local uint64_t t_busy_wait_ns = 0;
+
+// A statement of an attached connection that has started running on this thread
+struct RunningStmt {
+	std::chrono::steady_clock::time_point start;
+	uint64_t busy_start = 0;
+	int64_t rows = 0;
+};
+
+thread_local std::unordered_map<sqlite3_stmt *, RunningStmt> t_running;
+
+int trace_event(unsigned type, void *, void *p, void *x) {
+	auto *stmt = static_cast<sqlite3_stmt *>(p);
+	if (!SqlTrace::enabled()) {
+		if (!t_running.empty()) {
+			t_running.clear();
+		}
+		return 0;
+	}
+
+	switch (type) {
+		case SQLITE_TRACE_STMT: {
+			// Statements run by triggers are reported with the same statement and a "--" comment for text
+			const char *text = static_cast<const char *>(x);
+			if (text && text[0] == '-' && text[1] == '-') {
+				break;
+			}
+			SqlTrace::reset_counters(stmt);
+			t_running[stmt] = RunningStmt{std::chrono::steady_clock::now(), SqlTrace::busy_wait_ns(), 0};
+			break;
+		}
+		case SQLITE_TRACE_ROW: {
+			auto it = t_running.find(stmt);
+			if (it != t_running.end()) {
+				++it->second.rows;
+			}
+			break;
+		}
+		case SQLITE_TRACE_PROFILE: {
+			auto it = t_running.find(stmt);
+			if (it == t_running.end()) {
+				break; // Started before tracing was turned on
+			}
+			auto elapsed = std::chrono::steady_clock::now() - it->second.start;
+			uint64_t step_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+			int result_code = sqlite3_errcode(sqlite3_db_handle(stmt));
+			if (result_code == SQLITE_OK || result_code == SQLITE_ROW) {
+				result_code = SQLITE_DONE;
+			}
+			SqlTrace::report(stmt, it->second.rows, step_ns, SqlTrace::busy_wait_ns() - it->second.busy_start,
+							 result_code);
+			t_running.erase(it);
+			break;
+		}
+	}
+	return 0;
+}
+
+} // namespace
+
+std::atomic<bool> SqlTrace::s_enabled{false};
+
+void SqlTrace::set_callback(lotman_sql_trace_callback_t callback, void *user_data, int64_t threshold_us) {
+	auto new_config = std::make_shared<TraceConfig>();
+	new_config->callback = callback;
+	new_config->user_data = user_data;
+	new_config->threshold_ns = static_cast<uint64_t>(threshold_us) * 1000;
+	std::atomic_store(&config(), std::shared_ptr<const TraceConfig>(std::move(new_config)));
+	s_enabled.store(callback != nullptr, std::memory_order_relaxed);
+}
+
+void SqlTrace::add_busy_wait(std::chrono::nanoseconds wait) {
+	t_busy_wait_ns += wait.count();
+}
+
+uint64_t SqlTrace::busy_wait_ns() {
+	return t_busy_wait_ns;
+}
+
+void SqlTrace::attach(sqlite3 *db) {
+	sqlite3_trace_v2(db, SQLITE_TRACE_STMT | SQLITE_TRACE_ROW | SQLITE_TRACE_PROFILE, trace_event, nullptr);
+}
+
+void SqlTrace::reset_counters(sqlite3_stmt *stmt) {
+	sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+	sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1);
+	sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+}
+
+void SqlTrace::report(sqlite3_stmt *stmt, int64_t rows, uint64_t step_ns, uint64_t busy_wait_ns, int result_code) {
+	auto current = std::atomic_load(&config());
+	if (!current->callback || step_ns < current->threshold_ns) {
+		return;
+	}
+
+	lotman_sql_trace_t trace;
+	trace.sql = sqlite3_sql(stmt);
+	trace.num_params = sqlite3_bind_parameter_count(stmt);
+	trace.result_code = result_code;
+	trace.rows = rows;
+	trace.step_ns = static_cast<int64_t>(step_ns);
+	trace.busy_wait_ns = static_cast<int64_t>(busy_wait_ns);
+	trace.fullscan_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+	trace.sorts = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1);
+	trace.autoindexes = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+	current->callback(&trace, current->user_data);
+}
+
+} // namespace lotman
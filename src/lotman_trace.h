@@ -0,0 +1,121 @@
+/**
+ * SQL statement tracing
+ *
+ * When an application registers a trace callback (see lotman_set_sql_trace_callback),
+ * every statement LotMan runs through SQL_get_matches, SQL_get_matches_multi_col,
+ * Lot::store_updates or a sqlite_orm storage is timed, and those that take at
+ * least the configured threshold are handed to the callback along with their row
+ * count, the time they spent waiting for locks and SQLite's own counters of full
+ * table scan steps, sorts and automatic indexes.
+ *
+ * Tracing is off until a callback is registered. While it is off, each statement
+ * only pays for one relaxed atomic load.
+ *
+ * The callback is process-wide, across all contexts.
+ */
+
+#ifndef LOTMAN_TRACE_H
+#define LOTMAN_TRACE_H
+
+#include "lotman.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sqlite3.h>
+
+namespace lotman {
+
+class SqlTrace {
+  public:
+	/**
+	 * Register the callback that receives statements taking at least threshold_us microseconds, or turn
+	 * tracing off if callback is null. Safe to call while statements are being traced on other threads.
+	 */
+	static void set_callback(lotman_sql_trace_callback_t callback, void *user_data, int64_t threshold_us);
+
+	static bool enabled() {
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Count time the calling thread spent waiting for a lock held by another connection.
+	 */
+	static void add_busy_wait(std::chrono::nanoseconds wait);
+
+	/**
+	 * Total time the calling thread has spent waiting for locks.
+	 */
+	static uint64_t busy_wait_ns();
+
+	/**
+	 * Trace the statements of a connection that LotMan does not step itself, such as those of a sqlite_orm
+	 * storage, with sqlite3_trace_v2.
+	 */
+	static void attach(sqlite3 *db);
+
+	/**
+	 * Hand one execution of stmt to the callback if it took at least the threshold. Reads and resets the
+	 * statement's sqlite3_stmt_status counters.
+	 */
+	static void report(sqlite3_stmt *stmt, int64_t rows, uint64_t step_ns, uint64_t busy_wait_ns, int result_code);
+
+	/**
+	 * Reset the sqlite3_stmt_status counters of stmt, which count across executions of a cached statement.
+	 */
+	static void reset_counters(sqlite3_stmt *stmt);
+
+  private:
+	static std::atomic<bool> s_enabled;
+};
+
+/**
+ * Traces one execution of a statement that LotMan steps itself. Steps go through step(), which times them and
+ * counts the rows they return, so that work done between steps is not counted. The execution is reported when
+ * the StmtTrace is destroyed.
+ */
+class StmtTrace {
+  public:
+	explicit StmtTrace(sqlite3_stmt *stmt) : m_stmt(stmt), m_traced(SqlTrace::enabled()) {
+		if (m_traced) {
+			SqlTrace::reset_counters(stmt);
+			m_busy_start = SqlTrace::busy_wait_ns();
+		}
+	}
+
+	// Non-copyable
+	StmtTrace(const StmtTrace &) = delete;
+	StmtTrace &operator=(const StmtTrace &) = delete;
+
+	~StmtTrace() {
+		if (m_traced) {
+			SqlTrace::report(m_stmt, m_rows, m_step_ns, SqlTrace::busy_wait_ns() - m_busy_start, m_result_code);
+		}
+	}
+
+	int step() {
+		if (!m_traced) {
+			return sqlite3_step(m_stmt);
+		}
+		auto start = std::chrono::steady_clock::now();
+		m_result_code = sqlite3_step(m_stmt);
+		m_step_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+						 .count();
+		if (m_result_code == SQLITE_ROW) {
+			++m_rows;
+		}
+		return m_result_code;
+	}
+
+  private:
+	sqlite3_stmt *m_stmt;
+	bool m_traced;
+	int m_result_code = SQLITE_OK;
+	int64_t m_rows = 0;
+	uint64_t m_step_ns = 0;
+	uint64_t m_busy_start = 0;
+};
+
+} // namespace lotman
+
+#endif // LOTMAN_TRACE_H
@@ -1,3 +1,6 @@
+#ifndef LOTMAN_SCHEMAS_H
+#define LOTMAN_SCHEMAS_H
+
 #include <nlohmann/json-schema.hpp>
 
 using json = nlohmann::json;
@@ -5,7 +8,7 @@ using json_validator = nlohmann::json_schema::json_validator;
 
 namespace lotman_schemas {
 
-json new_lot_schema = R"(
+inline const json new_lot_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -107,7 +110,7 @@ json new_lot_schema = R"(
 }
 )"_json;
 
-json lot_update_schema = R"(
+inline const json lot_update_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -218,7 +221,7 @@ json lot_update_schema = R"(
 }
 )"_json;
 
-json lot_rm_parents_schema = R"(
+inline const json lot_rm_parents_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -244,7 +247,7 @@ json lot_rm_parents_schema = R"(
 }
 )"_json;
 
-json lot_rm_paths_schema = R"(
+inline const json lot_rm_paths_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -264,7 +267,7 @@ json lot_rm_paths_schema = R"(
 }
 )"_json;
 
-json lot_additions_schema = R"(
+inline const json lot_additions_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -315,7 +318,7 @@ json lot_additions_schema = R"(
 }
 )"_json;
 
-json get_policy_attrs_schema = R"(
+inline const json get_policy_attrs_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -362,7 +365,7 @@ json get_policy_attrs_schema = R"(
 }
 )"_json;
 
-json get_usage_schema = R"(
+inline const json get_usage_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -409,7 +412,7 @@ json get_usage_schema = R"(
 }
 )"_json;
 
-json update_usage_schema = R"(
+inline const json update_usage_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -448,7 +451,7 @@ json update_usage_schema = R"(
 }
 )"_json;
 
-json update_usage_delta_schema = R"(
+inline const json update_usage_delta_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -482,6 +485,86 @@ json update_usage_delta_schema = R"(
     "required": ["lot_name"]
 }
 )"_json;
+
+inline const json update_usage_batch_schema = R"(
+{
+    "$schema": "http://json-schema.org/draft-07/schema#",
+    "type": "array",
+    "title": "update usage batch arr",
+    "items": {
+        "type": "object",
+        "additionalProperties": false,
+        "properties": {
+            "lot_name": {
+                "description": "Name of lot whose usage is to be updated",
+                "type": "string",
+                "minLength": 1
+            },
+            "self_GB": {
+                "description": "The number of GB a lot is using, not including children usage.",
+                "type": "number",
+                "minimum": 0
+            },
+            "self_objects": {
+                "description": "The number of objects attributed to a lot, not including children.",
+                "type": "number",
+                "minimum": 0,
+                "multipleOf": 1
+            },
+            "self_GB_being_written": {
+                "description": "GB currently being written to a lot, not including children.",
+                "type": "number",
+                "minimum": 0
+            },
+            "self_objects_being_written": {
+                "description": "The number of objects being written to a lot, not including children.",
+                "type": "number",
+                "minimum": 0,
+                "multipleOf": 1
+            }
+        },
+        "required": ["lot_name"]
+    }
+}
+)"_json;
+
+inline const json update_usage_batch_delta_schema = R"(
+{
+    "$schema": "http://json-schema.org/draft-07/schema#",
+    "type": "array",
+    "title": "update usage batch arr",
+    "items": {
+        "type": "object",
+        "additionalProperties": false,
+        "properties": {
+            "lot_name": {
+                "description": "Name of lot whose usage is to be updated",
+                "type": "string",
+                "minLength": 1
+            },
+            "self_GB": {
+                "description": "The number of GB a lot is using, not including children usage.",
+                "type": "number"
+            },
+            "self_objects": {
+                "description": "The number of objects attributed to a lot, not including children.",
+                "type": "number",
+                "multipleOf": 1
+            },
+            "self_GB_being_written": {
+                "description": "GB currently being written to a lot, not including children.",
+                "type": "number"
+            },
+            "self_objects_being_written": {
+                "description": "The number of objects being written to a lot, not including children.",
+                "type": "number",
+                "multipleOf": 1
+            }
+        },
+        "required": ["lot_name"]
+    }
+}
+)"_json;
 /*
 NOTE: This schema only validates a single top level object, but does get the array of objects
 	  after "subdirs". To validate the top array of these objects, iterate through the array
@@ -490,7 +573,7 @@ NOTE: This schema only validates a single top level object, but does get the arr
 TODO: Fix this so it validates the top level array instead of validating each individualobject
 	  in the array
 */
-json update_usage_by_dir_schema = R"(
+inline const json update_usage_by_dir_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -529,7 +612,7 @@ json update_usage_by_dir_schema = R"(
 }
 )"_json;
 
-json update_usage_by_dir_delta_schema = R"(
+inline const json update_usage_by_dir_delta_schema = R"(
 {
     "$schema": "http://json-schema.org/draft-07/schema#",
     "type": "object",
@@ -566,4 +649,33 @@ json update_usage_by_dir_delta_schema = R"(
 }
 )"_json;
 
+/*
+Validators for the schemas above, each compiled once on first use. Compiling a schema costs far more
+than validating a small document against it, so the C API shares these instead of building a validator
+per call. json_validator::validate() is const and keeps no state between calls, so the same instance can
+be used from several threads at once.
+*/
+struct compiled_validators {
+	const json_validator new_lot{new_lot_schema};
+	const json_validator lot_update{lot_update_schema};
+	const json_validator lot_rm_parents{lot_rm_parents_schema};
+	const json_validator lot_rm_paths{lot_rm_paths_schema};
+	const json_validator lot_additions{lot_additions_schema};
+	const json_validator get_policy_attrs{get_policy_attrs_schema};
+	const json_validator get_usage{get_usage_schema};
+	const json_validator update_usage{update_usage_schema};
+	const json_validator update_usage_delta{update_usage_delta_schema};
+	const json_validator update_usage_batch{update_usage_batch_schema};
+	const json_validator update_usage_batch_delta{update_usage_batch_delta_schema};
+	const json_validator update_usage_by_dir{update_usage_by_dir_schema};
+	const json_validator update_usage_by_dir_delta{update_usage_by_dir_delta_schema};
+};
+
+inline const compiled_validators &validators() {
+	static const compiled_validators instance;
+	return instance;
+}
+
 } // namespace lotman_schemas
+
+#endif // LOTMAN_SCHEMAS_H
@@ -1,13 +1,23 @@
 #include "../src/lotman.h"
+#include <algorithm>
 
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
 #include <gtest/gtest.h>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include <sqlite3.h>
+#include <sys/wait.h>
+#include <thread>
 #include <typeinfo>
+#include <unistd.h>
+#include <vector>
 
 using json = nlohmann::json;
 
@@ -949,6 +959,155 @@ TEST_F(LotManTest, SetGetUsageTest) {
 	rv = lotman_update_lot_usage_by_dir(update3_JSON_str, deltaMode, &raw_err);
 	err_msg.reset(raw_err);
 	ASSERT_NE(rv, 0) << err_msg.get();
+
+	// A rejected lot rolls back the whole update, including lots that were valid on their own
+	const char *update4_JSON_str = R"([{
+		"includes_subdirs": false,
+		"path": "/foo/bar",
+		"size_GB": 1,
+		"subdirs": []
+	},
+	{
+		"includes_subdirs": false,
+		"path": "/1/2/3/4",
+		"size_GB": -10,
+		"subdirs": []
+	}])";
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage_by_dir(update4_JSON_str, deltaMode, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_NE(rv, 0);
+
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_lot_usage(lot1_usage_query, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	lot1_output.reset(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	lot1_json_out = json::parse(lot1_output.get());
+	ASSERT_EQ(lot1_json_out["total_GB"]["self_contrib"], 10.383) << lot1_json_out.dump();
+}
+
+TEST_F(LotManTest, UpdateUsageBatchTest) {
+	setupFullHierarchy();
+
+	// Deltas for lot4 are coalesced, and a bad lot or a negative result only rejects that lot's updates
+	const char *batch_JSON = R"([
+		{"lot_name": "lot4", "self_GB": 2, "self_objects": 3},
+		{"lot_name": "lot5", "self_GB": 1.5},
+		{"lot_name": "lot4", "self_GB": 0.5},
+		{"lot_name": "non_existent_lot", "self_GB": 1},
+		{"lot_name": "lot3", "self_objects": -1}
+	])";
+	char *raw_output = nullptr;
+	char *raw_err = nullptr;
+	int rv = lotman_update_lot_usage_batch(batch_JSON, true, &raw_output, &raw_err);
+	UniqueCString err_msg(raw_err);
+	UniqueCString output(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	json status = json::parse(output.get());
+	ASSERT_EQ(status.size(), 5);
+	for (int i = 0; i < 3; i++) {
+		EXPECT_TRUE(status[i]["success"]) << status[i];
+	}
+	EXPECT_FALSE(status[3]["success"]);
+	EXPECT_EQ(status[3]["lot_name"], "non_existent_lot");
+	EXPECT_FALSE(status[4]["success"]);
+	EXPECT_TRUE(status[4].contains("error"));
+
+	// lot3 is an ancestor of lot5 and lot4, and lot5 is an ancestor of lot4
+	const char *lot3_query = R"({"lot_name": "lot3", "total_GB": true, "num_objects": true})";
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_lot_usage(lot3_query, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	output.reset(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	json json_out = json::parse(output.get());
+	EXPECT_EQ(json_out["total_GB"]["children_contrib"], 4.0);
+	EXPECT_EQ(json_out["total_GB"]["self_contrib"], 0.0);
+	EXPECT_EQ(json_out["num_objects"]["children_contrib"], 3);
+
+	const char *lot5_query = R"({"lot_name": "lot5", "total_GB": true})";
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_lot_usage(lot5_query, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	output.reset(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	json_out = json::parse(output.get());
+	EXPECT_EQ(json_out["total_GB"]["children_contrib"], 2.5);
+	EXPECT_EQ(json_out["total_GB"]["self_contrib"], 1.5);
+
+	// A batch that fails validation is rejected as a whole
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage_batch(R"([{"lot_name": "lot4", "self_GB": -1}])", false, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_NE(rv, 0);
+}
+
+TEST_F(LotManTest, UpdateUsageStructTest) {
+	setupFullHierarchy();
+
+	// Same batch as UpdateUsageBatchTest, without any JSON
+	std::vector<lotman_usage_delta_t> updates = {
+		{"lot4", LOTMAN_USAGE_SELF_GB | LOTMAN_USAGE_SELF_OBJECTS, 2, 3, 0, 0},
+		{"lot5", LOTMAN_USAGE_SELF_GB, 1.5, 0, 0, 0},
+		{"lot4", LOTMAN_USAGE_SELF_GB, 0.5, 0, 0, 0},
+		{"non_existent_lot", LOTMAN_USAGE_SELF_GB, 1, 0, 0, 0},
+		{"lot3", LOTMAN_USAGE_SELF_OBJECTS, 0, -1, 0, 0}};
+	std::vector<int> statuses(updates.size(), 1);
+	char *raw_err = nullptr;
+	int rv = lotman_update_lot_usage_struct(updates.data(), updates.size(), true, statuses.data(), &raw_err);
+	UniqueCString err_msg(raw_err);
+	// Rejections are reported through statuses, not as a failure of the call
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(err_msg.get(), nullptr);
+	EXPECT_EQ(statuses, std::vector<int>({0, 0, 0, -1, -1}));
+
+	lotman_usage_t usage;
+	raw_err = nullptr;
+	rv = lotman_get_lot_usage_struct("lot3", &usage, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.self_GB, 0.0);
+	EXPECT_EQ(usage.children_GB, 4.0);
+	EXPECT_EQ(usage.self_objects, 0);
+	EXPECT_EQ(usage.children_objects, 3);
+
+	raw_err = nullptr;
+	rv = lotman_get_lot_usage_struct("lot5", &usage, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.self_GB, 1.5);
+	EXPECT_EQ(usage.children_GB, 2.5);
+
+	// Flags select which values are applied, so an absolute update can leave the other values alone
+	updates = {{"lot4", LOTMAN_USAGE_SELF_OBJECTS, 100, 7, 0, 0}};
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage_struct(updates.data(), updates.size(), false, nullptr, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	rv = lotman_get_lot_usage_struct("lot4", &usage, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.self_GB, 2.5);
+	EXPECT_EQ(usage.self_objects, 7);
+
+	// Negative values are only valid in delta mode, and fail the whole call like a schema violation would
+	updates = {{"lot5", LOTMAN_USAGE_SELF_GB, 3, 0, 0, 0}, {"lot4", LOTMAN_USAGE_SELF_GB, -1, 0, 0, 0}};
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage_struct(updates.data(), updates.size(), false, nullptr, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_LT(rv, 0);
+
+	raw_err = nullptr;
+	rv = lotman_get_lot_usage_struct("non_existent_lot", &usage, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_NE(rv, 0);
 }
 
 TEST_F(LotManTest, GetOwnersTest) {
@@ -1069,6 +1228,153 @@ TEST_F(LotManTest, GetChildrenTest) {
 	}
 }
 
+TEST_F(LotManTest, HierarchyCacheCoherenceTest) {
+	// Parent/child lookups are answered from an in-memory copy of the hierarchy. Make sure every write path
+	// that touches the parents table keeps that copy in step with the database.
+	setupFullHierarchy();
+
+	auto names = [](const char *lot_name, bool children, bool recursive) {
+		char **raw_output = nullptr;
+		char *raw_err = nullptr;
+		int rv = children ? lotman_get_children_names(lot_name, recursive, false, &raw_output, &raw_err)
+						  : lotman_get_parent_names(lot_name, recursive, false, &raw_output, &raw_err);
+		UniqueCString err_msg(raw_err);
+		UniqueStringList output(raw_output);
+		std::vector<std::string> result;
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		for (int iter = 0; rv == 0 && output.get()[iter]; iter++) {
+			result.push_back(output.get()[iter]);
+		}
+		return result;
+	};
+
+	// Warm the cache before mutating anything
+	ASSERT_EQ(names("lot3", true, true), (std::vector<std::string>{"lot4", "lot5"}));
+	ASSERT_EQ(names("lot4", false, true), (std::vector<std::string>{"lot1", "lot2", "lot3", "lot5"}));
+
+	// Re-parent lot3 under sep_node
+	char *raw_err = nullptr;
+	int rv = lotman_update_lot(R"({"lot_name": "lot3", "parents": [{"current": "lot3", "new": "sep_node"}]})",
+							   &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_EQ(names("sep_node", true, true), (std::vector<std::string>{"lot3", "lot4", "lot5"}));
+	ASSERT_EQ(names("lot4", false, true), (std::vector<std::string>{"lot1", "lot2", "lot3", "lot5", "sep_node"}));
+
+	// Drop lot4's direct link to lot2
+	raw_err = nullptr;
+	rv = lotman_rm_parents_from_lot(R"({"lot_name": "lot4", "parents": ["lot2"]})", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_EQ(names("lot4", false, false), (std::vector<std::string>{"lot5"}));
+	ASSERT_EQ(names("lot1", true, true), (std::vector<std::string>{"lot2"}));
+
+	// Introducing a cycle must still be caught
+	raw_err = nullptr;
+	rv = lotman_add_to_lot(R"({"lot_name": "sep_node", "parents": ["lot4"]})", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_NE(rv, 0);
+
+	// Removing lot5 hands lot4 over to lot5's parent
+	raw_err = nullptr;
+	rv = lotman_remove_lot("lot5", true, true, false, false, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_EQ(names("lot3", true, false), (std::vector<std::string>{"lot4"}));
+	ASSERT_EQ(names("sep_node", true, true), (std::vector<std::string>{"lot3", "lot4"}));
+}
+
+TEST_F(LotManTest, HierarchyColdLookupTest) {
+	// The first lookup after the hierarchy cache is dropped is answered by a recursive SQL query rather than
+	// the in-memory graph. Both must give the same answers, including for self-parent edges.
+	setupFullHierarchy();
+
+	auto names = [](const std::string &lot_name, bool children, bool recursive, bool get_self) {
+		char **raw_output = nullptr;
+		char *raw_err = nullptr;
+		int rv = children ? lotman_get_children_names(lot_name.c_str(), recursive, get_self, &raw_output, &raw_err)
+						  : lotman_get_parent_names(lot_name.c_str(), recursive, get_self, &raw_output, &raw_err);
+		UniqueCString err_msg(raw_err);
+		UniqueStringList output(raw_output);
+		std::vector<std::string> result;
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		for (int iter = 0; rv == 0 && output.get()[iter]; iter++) {
+			result.push_back(output.get()[iter]);
+		}
+		return result;
+	};
+
+	for (const std::string lot_name : {"default", "lot1", "lot2", "lot3", "lot4", "lot5", "sep_node"}) {
+		for (int flags = 0; flags < 8; flags++) {
+			bool children = flags & 1, recursive = flags & 2, get_self = flags & 4;
+
+			// Setting lot_home resets the storage manager, which drops the cached hierarchy
+			char *raw_err = nullptr;
+			int rv = lotman_set_context_str("lot_home", tmp_dir.c_str(), &raw_err);
+			UniqueCString err_msg(raw_err);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			auto cold = names(lot_name, children, recursive, get_self);
+			auto warm = names(lot_name, children, recursive, get_self);
+			EXPECT_EQ(cold, warm) << lot_name << " children=" << children << " recursive=" << recursive
+								  << " get_self=" << get_self;
+		}
+	}
+}
+
+TEST_F(LotManTest, PathCacheCoherenceTest) {
+	// Directory lookups are answered from an in-memory trie of the paths table. Make sure every write path
+	// that touches the paths table keeps it in step with the database.
+	setupStandardHierarchy();
+
+	auto lot_for = [](const char *dir) {
+		char **raw_output = nullptr;
+		char *raw_err = nullptr;
+		int rv = lotman_get_lots_from_dir(dir, false, &raw_output, &raw_err);
+		UniqueCString err_msg(raw_err);
+		UniqueStringList output(raw_output);
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		return rv == 0 ? std::string(output.get()[0]) : std::string();
+	};
+
+	// Warm the cache before mutating anything
+	ASSERT_EQ(lot_for("/foo/bar/qux"), "lot1");
+	ASSERT_EQ(lot_for("/1/2/3"), "lot1");
+	ASSERT_EQ(lot_for("/1/2/3/x"), "default"); // lot1's /1/2/3 is not recursive
+	ASSERT_EQ(lot_for("/foo/barr/x"), "default");
+	ASSERT_EQ(lot_for("/345/a"), "lot4");
+
+	char *raw_err = nullptr;
+	int rv = lotman_add_to_lot(R"({"lot_name": "sep_node", "paths": [{"path": "/foo/bar/qux", "recursive": true}]})",
+							   &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_EQ(lot_for("/foo/bar/qux/y"), "sep_node");
+
+	// Turning lot1's /foo/bar into an exclusion leaves sep_node's longer path alone
+	raw_err = nullptr;
+	rv = lotman_update_lot(R"({"lot_name": "lot1", "paths": [
+			{"current": "/foo/bar", "new": "/foo/bar", "recursive": true, "exclude": true}
+		]})",
+						   &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_EQ(lot_for("/foo/bar/zzz"), "default");
+	ASSERT_EQ(lot_for("/foo/bar/qux/y"), "sep_node");
+
+	raw_err = nullptr;
+	rv = lotman_rm_paths_from_lots(R"({"paths": ["/foo/bar/qux"]})", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_EQ(lot_for("/foo/bar/qux/y"), "default");
+
+	raw_err = nullptr;
+	rv = lotman_remove_lot("lot4", true, true, false, false, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_EQ(lot_for("/345/a"), "default");
+}
+
 TEST_F(LotManTest, GetPolicyAttrs) {
 	// Set up fresh database with full hierarchy
 	setupFullHierarchy();
@@ -1257,6 +1563,64 @@ TEST_F(LotManTest, ContextTest) {
 	ASSERT_NE(rv, 0);
 }
 
+TEST_F(LotManTest, AuthorizationCacheTest) {
+	// Ownership checks are answered from per-caller bitmaps. Make sure owner and parent changes are seen by
+	// callers whose bitmaps were computed before the change.
+	setupFullHierarchy();
+
+	auto update_usage_as = [](const char *caller, const char *lot_name) {
+		char *raw_err = nullptr;
+		int rv = lotman_set_context_str("caller", caller, &raw_err);
+		UniqueCString err_msg(raw_err);
+		EXPECT_EQ(rv, 0) << err_msg.get();
+
+		std::string usage_update_JSON = R"({"lot_name": ")" + std::string(lot_name) + R"(", "self_GB": 1})";
+		raw_err = nullptr;
+		rv = lotman_update_lot_usage(usage_update_JSON.c_str(), false, &raw_err);
+		err_msg.reset(raw_err);
+		return rv == 0;
+	};
+	auto update_as = [](const char *caller, const char *update_JSON, bool add_parents) {
+		char *raw_err = nullptr;
+		int rv = lotman_set_context_str("caller", caller, &raw_err);
+		UniqueCString err_msg(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+
+		raw_err = nullptr;
+		rv = add_parents ? lotman_add_to_lot(update_JSON, &raw_err) : lotman_update_lot(update_JSON, &raw_err);
+		err_msg.reset(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+	};
+
+	// Asking twice answers once from the database and once from the cache
+	ASSERT_FALSE(update_usage_as("alice", "lot5"));
+	ASSERT_FALSE(update_usage_as("alice", "lot5"));
+	ASSERT_TRUE(update_usage_as("owner1", "lot5"));
+
+	// Handing lot3 to alice gives her lot3 and everything below it, and nothing above
+	update_as("owner1", R"({"lot_name": "lot3", "owner": "alice"})", false);
+	ASSERT_TRUE(update_usage_as("alice", "lot5"));
+	ASSERT_TRUE(update_usage_as("alice", "lot4"));
+	ASSERT_FALSE(update_usage_as("alice", "lot2"));
+
+	// Parent changes reach the bitmap she already has
+	update_as("owner1", R"({"lot_name": "lot2", "parents": ["lot3"]})", true);
+	ASSERT_TRUE(update_usage_as("alice", "lot2"));
+
+	// Owning lot2 through lot3, alice may cut the link herself
+	char *raw_err = nullptr;
+	int rv = lotman_rm_parents_from_lot(R"({"lot_name": "lot2", "parents": ["lot3"]})", &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_FALSE(update_usage_as("alice", "lot2"));
+
+	// Only alice can hand lot3 back now, and doing so revokes all of it
+	update_as("alice", R"({"lot_name": "lot3", "owner": "owner1"})", false);
+	ASSERT_FALSE(update_usage_as("alice", "lot5"));
+	ASSERT_FALSE(update_usage_as("alice", "lot3"));
+	ASSERT_TRUE(update_usage_as("owner1", "lot5"));
+}
+
 TEST_F(LotManTest, LotsQueryTest) {
 	// Set up fresh database with full hierarchy (already includes default lot)
 	setupFullHierarchy();
@@ -1343,6 +1707,265 @@ TEST_F(LotManTest, LotsQueryTest) {
 	ASSERT_FALSE(check);
 }
 
+TEST_F(LotManTest, LotsQueryRecursiveTest) {
+	// lot1 -> lot2 -> lot4, lot3 -> lot5 -> lot4, sep_node
+	setupFullHierarchy();
+
+	auto as_vector = [](char **list) {
+		std::vector<std::string> names;
+		for (int iter = 0; list[iter]; iter++) {
+			names.emplace_back(list[iter]);
+		}
+		return names;
+	};
+
+	// Push lot1 past its opportunistic limit. Only lot1 is over, but asking for
+	// children must flag every descendant exactly once and in sorted order.
+	const char *usage_JSON = R"({"lot_name": "lot1", "self_GB": 10})";
+	char *raw_err = nullptr;
+	auto rv = lotman_update_lot_usage(usage_JSON, false, &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	char **raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_lots_past_opp(false, false, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueStringList opp(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_EQ(as_vector(opp.get()), (std::vector<std::string>{"lot1"}));
+
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_lots_past_opp(false, true, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueStringList opp_recursive(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_EQ(as_vector(opp_recursive.get()), (std::vector<std::string>{"lot1", "lot2", "lot4"}));
+
+	// sep_node has not expired, but once it is a child of the expired lot3 it is
+	// reported when children are requested.
+	const char *addition_JSON = R"({"lot_name": "sep_node", "parents": ["lot3"]})";
+	raw_err = nullptr;
+	rv = lotman_add_to_lot(addition_JSON, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_lots_past_exp(false, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueStringList exp(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	auto exp_names = as_vector(exp.get());
+	ASSERT_EQ(std::count(exp_names.begin(), exp_names.end(), "sep_node"), 0);
+
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_lots_past_exp(true, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueStringList exp_recursive(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	auto exp_recursive_names = as_vector(exp_recursive.get());
+	ASSERT_EQ(std::count(exp_recursive_names.begin(), exp_recursive_names.end(), "sep_node"), 1);
+	ASSERT_EQ(std::count(exp_recursive_names.begin(), exp_recursive_names.end(), "lot4"), 1);
+	ASSERT_TRUE(std::is_sorted(exp_recursive_names.begin(), exp_recursive_names.end()));
+
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_lots_past_del(true, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueStringList del_recursive(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	auto del_recursive_names = as_vector(del_recursive.get());
+	ASSERT_EQ(std::count(del_recursive_names.begin(), del_recursive_names.end(), "sep_node"), 1);
+}
+
+TEST_F(LotManTest, PolicyViolationsTest) {
+	setupFullHierarchy();
+
+	// lot1 has 5 dedicated GB, 2.5 opportunistic GB and 20 objects
+	const char *usage_JSON = R"({"lot_name": "lot1", "self_GB": 10, "self_objects": 25})";
+	char *raw_err = nullptr;
+	auto rv = lotman_update_lot_usage(usage_JSON, false, &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	// Make the unexpired sep_node a child of the expired lot3
+	const char *addition_JSON = R"({"lot_name": "sep_node", "parents": ["lot3"]})";
+	raw_err = nullptr;
+	rv = lotman_add_to_lot(addition_JSON, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	using past_fn = int (*)(const bool, const bool, char ***, char **);
+	const std::vector<std::pair<unsigned int, past_fn>> quota_checks{
+		{LOTMAN_VIOLATION_OPPORTUNISTIC, lotman_get_lots_past_opp},
+		{LOTMAN_VIOLATION_DEDICATED, lotman_get_lots_past_ded},
+		{LOTMAN_VIOLATION_OBJECTS, lotman_get_lots_past_obj}};
+
+	for (bool recursive_quota : {false, true}) {
+		for (bool recursive_children : {false, true}) {
+			lotman_policy_violation_t *violations = nullptr;
+			size_t num_violations = 0;
+			raw_err = nullptr;
+			rv = lotman_get_policy_violations(recursive_quota, recursive_children, &violations, &num_violations,
+											  &raw_err);
+			err_msg.reset(raw_err);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+			std::unique_ptr<lotman_policy_violation_t, std::function<void(lotman_policy_violation_t *)>> guard(
+				violations, [num_violations](lotman_policy_violation_t *ptr) {
+					lotman_free_policy_violations(ptr, num_violations);
+				});
+
+			std::map<std::string, lotman_policy_violation_t> by_lot;
+			for (size_t idx = 0; idx < num_violations; idx++) {
+				ASSERT_TRUE(by_lot.emplace(violations[idx].lot_name, violations[idx]).second);
+				if (!recursive_children) {
+					ASSERT_EQ(violations[idx].inherited_flags, 0u);
+				}
+			}
+
+			// Each flag matches the lots reported by the corresponding single-policy function
+			auto lots_with = [&](unsigned int flag) {
+				std::vector<std::string> names;
+				for (const auto &[name, violation] : by_lot) {
+					if ((violation.flags | violation.inherited_flags) & flag) {
+						names.push_back(name);
+					}
+				}
+				return names;
+			};
+			auto as_sorted_vector = [](char **list) {
+				std::vector<std::string> names;
+				for (int iter = 0; list[iter]; iter++) {
+					names.emplace_back(list[iter]);
+				}
+				std::sort(names.begin(), names.end());
+				return names;
+			};
+
+			char **raw_output = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_lots_past_exp(recursive_children, &raw_output, &raw_err);
+			err_msg.reset(raw_err);
+			UniqueStringList exp(raw_output);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+			ASSERT_EQ(lots_with(LOTMAN_VIOLATION_EXPIRED), as_sorted_vector(exp.get()));
+
+			raw_output = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_lots_past_del(recursive_children, &raw_output, &raw_err);
+			err_msg.reset(raw_err);
+			UniqueStringList del(raw_output);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+			ASSERT_EQ(lots_with(LOTMAN_VIOLATION_DELETION), as_sorted_vector(del.get()));
+
+			for (const auto &[flag, past] : quota_checks) {
+				raw_output = nullptr;
+				raw_err = nullptr;
+				rv = past(recursive_quota, recursive_children, &raw_output, &raw_err);
+				err_msg.reset(raw_err);
+				UniqueStringList past_lots(raw_output);
+				ASSERT_EQ(rv, 0) << err_msg.get();
+				ASSERT_EQ(lots_with(flag), as_sorted_vector(past_lots.get())) << "flag " << flag;
+			}
+
+			ASSERT_EQ(by_lot.count("lot1"), 1u);
+			const auto &lot1 = by_lot["lot1"];
+			ASSERT_EQ(lot1.flags, LOTMAN_VIOLATION_EXPIRED | LOTMAN_VIOLATION_DELETION |
+									  LOTMAN_VIOLATION_OPPORTUNISTIC | LOTMAN_VIOLATION_DEDICATED |
+									  LOTMAN_VIOLATION_OBJECTS);
+			ASSERT_DOUBLE_EQ(lot1.opportunistic_overage_GB, 2.5);
+			ASSERT_DOUBLE_EQ(lot1.dedicated_overage_GB, 5);
+			ASSERT_EQ(lot1.objects_overage, 5);
+
+			// sep_node violates nothing itself and is only reported through lot3
+			if (recursive_children) {
+				ASSERT_EQ(by_lot.count("sep_node"), 1u);
+				ASSERT_EQ(by_lot["sep_node"].flags, 0u);
+				ASSERT_EQ(by_lot["sep_node"].inherited_flags, LOTMAN_VIOLATION_EXPIRED | LOTMAN_VIOLATION_DELETION);
+			} else {
+				ASSERT_EQ(by_lot.count("sep_node"), 0u);
+			}
+		}
+	}
+}
+
+TEST_F(LotManTest, EvictionCandidatesTest) {
+	// Everything but sep_node is past deletion
+	setupFullHierarchy();
+
+	// sep_child's own dedicated_GB is 5, but sep_node only guarantees 3
+	addLot(R"({
+		"lot_name": "sep_child",
+		"owner": "owner1",
+		"parents": ["sep_node"],
+		"management_policy_attrs": {
+			"dedicated_GB": 5,
+			"opportunistic_GB": 1,
+			"max_num_objects": 10,
+			"creation_time": 123,
+			"expiration_time": 99679525853643,
+			"deletion_time": 9267952553643
+		}
+	})");
+
+	const char *usage_JSON = R"([
+		{"lot_name": "lot1", "self_GB": 4},
+		{"lot_name": "lot4", "self_GB": 1},
+		{"lot_name": "lot5", "self_GB": 2},
+		{"lot_name": "sep_node", "self_GB": 10},
+		{"lot_name": "sep_child", "self_GB": 4}
+	])";
+	char *raw_err = nullptr;
+	char *raw_statuses = nullptr;
+	auto rv = lotman_update_lot_usage_batch(usage_JSON, false, &raw_statuses, &raw_err);
+	UniqueCString err_msg(raw_err);
+	UniqueCString statuses(raw_statuses);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	struct Expected {
+		std::string lot_name;
+		unsigned int reason;
+		double reclaimable_GB;
+		double cumulative_GB;
+	};
+	// lot4 and lot5 both inherit lot5's deletion time of 300, so the larger one goes first
+	const std::vector<Expected> ranking{{"lot5", LOTMAN_VIOLATION_DELETION, 2, 2},
+										{"lot4", LOTMAN_VIOLATION_DELETION, 1, 3},
+										{"lot1", LOTMAN_VIOLATION_DELETION, 4, 7},
+										{"sep_node", LOTMAN_VIOLATION_OPPORTUNISTIC, 7, 14},
+										{"sep_child", LOTMAN_VIOLATION_OPPORTUNISTIC, 1, 15}};
+
+	auto check = [&](double target_GB, size_t k, size_t expected_count) {
+		lotman_eviction_candidate_t *candidates = nullptr;
+		size_t num_candidates = 0;
+		char *raw_err = nullptr;
+		int rv = lotman_get_eviction_candidates(target_GB, k, &candidates, &num_candidates, &raw_err);
+		UniqueCString err_msg(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+		ASSERT_EQ(num_candidates, expected_count) << "target " << target_GB << ", k " << k;
+		for (size_t idx = 0; idx < num_candidates; idx++) {
+			EXPECT_EQ(candidates[idx].lot_name, ranking[idx].lot_name);
+			EXPECT_EQ(candidates[idx].reason, ranking[idx].reason);
+			EXPECT_DOUBLE_EQ(candidates[idx].reclaimable_GB, ranking[idx].reclaimable_GB);
+			EXPECT_DOUBLE_EQ(candidates[idx].cumulative_GB, ranking[idx].cumulative_GB);
+		}
+		if (num_candidates > 0) {
+			EXPECT_EQ(candidates[0].deadline, 300);
+		}
+		lotman_free_eviction_candidates(candidates, num_candidates);
+	};
+
+	check(0, 0, 5);	   // Everything
+	check(0, 2, 2);	   // Top 2
+	check(6, 0, 3);	   // lot1 brings the total to 7
+	check(7, 0, 3);	   // Reaching the target exactly is enough
+	check(6, 2, 2);	   // k wins when it is the tighter bound
+	check(100, 10, 5); // Not enough data to reach the target
+}
+
 TEST_F(LotManTest, GetAllLotsTest) {
 	// Set up fresh database with full hierarchy (7 lots: default, lot1-5, sep_node)
 	setupFullHierarchy();
@@ -1689,162 +2312,1136 @@ TEST_F(LotManTest, LotsFromDirTest) {
 					static_cast<std::string>(output.get()[iter]) == "sep_node");
 	}
 
-	raw_output = nullptr;
+	raw_output = nullptr;
+	raw_err = nullptr;
+	const char *dir2 = "/foo/barr"; // Make sure parsing doesn't grab lot associated with /foo/bar
+	rv = lotman_get_lots_from_dir(dir2, false, &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueStringList output2(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	ASSERT_EQ(strcmp(output2.get()[0], "lot3"), 0);
+}
+
+TEST_F(LotManTest, GetVersionTest) {
+	const char *version = lotman_version();
+	std::string version_cpp(version);
+
+	EXPECT_EQ(version_cpp, "v0.0.1");
+}
+
+TEST_F(LotManTest, IsRootTest) {
+	// Set up a hierarchy: default (root), lot1 (root), lot2 (child of lot1), lot3 (root), lot4 (child)
+	setupStandardHierarchy();
+
+	char *raw_err = nullptr;
+
+	// Test with non-existent lot
+	auto rv = lotman_is_root("non_existent_lot", &raw_err);
+	UniqueCString err_msg(raw_err);
+	EXPECT_EQ(rv, -1) << "Expected error for non-existent lot";
+
+	// "default" should be a root lot (self-parent)
+	raw_err = nullptr;
+	rv = lotman_is_root("default", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_GE(rv, 0) << err_msg.get();
+	EXPECT_EQ(rv, 1) << "default should be a root lot";
+
+	// "lot1" IS a root lot (self-parent)
+	raw_err = nullptr;
+	rv = lotman_is_root("lot1", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_GE(rv, 0) << err_msg.get();
+	EXPECT_EQ(rv, 1) << "lot1 should be a root lot (self-parent)";
+
+	// "lot2" should NOT be a root (has lot1 as parent)
+	raw_err = nullptr;
+	rv = lotman_is_root("lot2", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_GE(rv, 0) << err_msg.get();
+	EXPECT_EQ(rv, 0) << "lot2 should not be a root lot";
+
+	// "lot3" IS a root lot (self-parent)
+	raw_err = nullptr;
+	rv = lotman_is_root("lot3", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_GE(rv, 0) << err_msg.get();
+	EXPECT_EQ(rv, 1) << "lot3 should be a root lot (self-parent)";
+
+	// "lot4" should NOT be a root (has lot2 and lot3 as parents)
+	raw_err = nullptr;
+	rv = lotman_is_root("lot4", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_GE(rv, 0) << err_msg.get();
+	EXPECT_EQ(rv, 0) << "lot4 should not be a root lot";
+}
+
+TEST_F(LotManTest, ContextStrTest) {
+	char *raw_err = nullptr;
+	char *raw_output = nullptr;
+
+	// Test getting lot_home that was set in SetUp
+	auto rv = lotman_get_context_str("lot_home", &raw_output, &raw_err);
+	UniqueCString err_msg(raw_err);
+	UniqueCString output(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_NE(output.get(), nullptr);
+	// The lot_home should contain our temp directory path
+	std::string lot_home(output.get());
+	EXPECT_FALSE(lot_home.empty());
+
+	// Test getting caller that was set in SetUp
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_context_str("caller", &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	output.reset(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_NE(output.get(), nullptr);
+	EXPECT_STREQ(output.get(), "owner1");
+
+	// Test setting and getting a new caller
+	raw_err = nullptr;
+	rv = lotman_set_context_str("caller", "new_owner", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_context_str("caller", &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	output.reset(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_NE(output.get(), nullptr);
+	EXPECT_STREQ(output.get(), "new_owner");
+
+	// Reset caller back to owner1 for any subsequent operations
+	raw_err = nullptr;
+	rv = lotman_set_context_str("caller", "owner1", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	// Test with invalid context key
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_context_str("invalid_key", &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	EXPECT_EQ(rv, -1) << "Expected error for invalid context key";
+}
+
+TEST_F(LotManTest, ContextIntTest) {
+	char *raw_err = nullptr;
+	int output = 0;
+
+	// Test setting db_timeout
+	auto rv = lotman_set_context_int("db_timeout", 5000, &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	// Test getting db_timeout
+	raw_err = nullptr;
+	rv = lotman_get_context_int("db_timeout", &output, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(output, 5000);
+
+	// Test setting a different value
+	raw_err = nullptr;
+	rv = lotman_set_context_int("db_timeout", 10000, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	raw_err = nullptr;
+	rv = lotman_get_context_int("db_timeout", &output, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(output, 10000);
+
+	// Test with invalid context key
+	raw_err = nullptr;
+	rv = lotman_set_context_int("invalid_key", 100, &raw_err);
+	err_msg.reset(raw_err);
+	EXPECT_EQ(rv, -1) << "Expected error for invalid context key";
+
+	raw_err = nullptr;
+	rv = lotman_get_context_int("invalid_key", &output, &raw_err);
+	err_msg.reset(raw_err);
+	EXPECT_EQ(rv, -1) << "Expected error for invalid context key";
+}
+
+TEST_F(LotManTest, ConcurrentStressTest) {
+	// Every public API is called from many threads at once, while other threads add and remove lots. Meant to be
+	// run under ThreadSanitizer as well, where a data race fails the test.
+	setupFullHierarchy();
+
+	constexpr int num_threads = 8;
+	constexpr int num_iterations = 10;
+
+	auto worker = [](int thread_idx) {
+		// Even threads run as owner1, who owns every lot. Odd threads run as a stranger whose writes are rejected.
+		bool is_owner = (thread_idx % 2 == 0);
+		std::string caller = is_owner ? "owner1" : "stranger" + std::to_string(thread_idx);
+		char *raw_err = nullptr;
+		int rv = lotman_set_context_str("thread_caller", caller.c_str(), &raw_err);
+		UniqueCString err_msg(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+
+		char *raw_output = nullptr;
+		raw_err = nullptr;
+		rv = lotman_get_context_str("caller", &raw_output, &raw_err);
+		err_msg.reset(raw_err);
+		UniqueCString output(raw_output);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+		EXPECT_EQ(std::string(output.get()), caller);
+
+		for (int i = 0; i < num_iterations; i++) {
+			// Writes
+			raw_err = nullptr;
+			rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": 1, "self_objects": 1})", true, &raw_err);
+			err_msg.reset(raw_err);
+			if (is_owner) {
+				EXPECT_EQ(rv, 0) << err_msg.get();
+			} else {
+				EXPECT_NE(rv, 0);
+			}
+
+			std::string lot_name = "stress_" + std::to_string(thread_idx) + "_" + std::to_string(i);
+			json lot_JSON = {{"lot_name", lot_name},
+							 {"owner", caller},
+							 {"parents", {"lot1"}},
+							 {"paths", {{{"path", "/stress/" + lot_name}, {"recursive", true}}}},
+							 {"management_policy_attrs",
+							  {{"dedicated_GB", 1},
+							   {"opportunistic_GB", 1},
+							   {"max_num_objects", 10},
+							   {"creation_time", 123},
+							   {"expiration_time", 234},
+							   {"deletion_time", 345}}}};
+			raw_err = nullptr;
+			rv = lotman_add_lot(lot_JSON.dump().c_str(), &raw_err);
+			err_msg.reset(raw_err);
+			if (is_owner) {
+				EXPECT_EQ(rv, 0) << err_msg.get();
+			} else {
+				EXPECT_NE(rv, 0);
+			}
+
+			raw_err = nullptr;
+			rv = lotman_set_context_int("db_timeout", 5000 + i, &raw_err);
+			err_msg.reset(raw_err);
+			EXPECT_EQ(rv, 0) << err_msg.get();
+
+			// Reads of the fixed hierarchy, which the concurrent writes must not disturb
+			raw_err = nullptr;
+			EXPECT_EQ(lotman_lot_exists("lot4", &raw_err), 1);
+			err_msg.reset(raw_err);
+
+			raw_err = nullptr;
+			EXPECT_EQ(lotman_is_root("lot1", &raw_err), 1);
+			err_msg.reset(raw_err);
+
+			char **raw_list = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_parent_names("lot4", true, false, &raw_list, &raw_err);
+			err_msg.reset(raw_err);
+			UniqueStringList list(raw_list);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+			std::vector<std::string> names;
+			for (size_t j = 0; list.get()[j]; j++) {
+				names.push_back(list.get()[j]);
+			}
+			EXPECT_EQ(names, std::vector<std::string>({"lot1", "lot2", "lot3", "lot5"}));
+
+			raw_list = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_children_names("lot3", true, false, &raw_list, &raw_err);
+			err_msg.reset(raw_err);
+			list.reset(raw_list);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			raw_list = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_owners("lot4", true, &raw_list, &raw_err);
+			err_msg.reset(raw_err);
+			list.reset(raw_list);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			raw_list = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_lots_from_dir("/1/2/3/4/5", false, &raw_list, &raw_err);
+			err_msg.reset(raw_err);
+			list.reset(raw_list);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+			ASSERT_NE(list.get()[0], nullptr);
+			EXPECT_STREQ(list.get()[0], "lot4");
+
+			raw_list = nullptr;
+			raw_err = nullptr;
+			rv = lotman_list_all_lots(&raw_list, &raw_err);
+			err_msg.reset(raw_err);
+			list.reset(raw_list);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			raw_list = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_lots_past_exp(true, &raw_list, &raw_err);
+			err_msg.reset(raw_err);
+			list.reset(raw_list);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			raw_list = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_lots_past_opp(true, true, &raw_list, &raw_err);
+			err_msg.reset(raw_err);
+			list.reset(raw_list);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			raw_output = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_lot_usage(R"({"lot_name": "lot3", "total_GB": true, "num_objects": true})", &raw_output,
+									  &raw_err);
+			err_msg.reset(raw_err);
+			output.reset(raw_output);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			lotman_usage_t usage;
+			raw_err = nullptr;
+			rv = lotman_get_lot_usage_struct("lot4", &usage, &raw_err);
+			err_msg.reset(raw_err);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			raw_output = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_lot_as_json("lot3", true, &raw_output, &raw_err);
+			err_msg.reset(raw_err);
+			output.reset(raw_output);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			raw_output = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_lot_dirs("lot1", true, &raw_output, &raw_err);
+			err_msg.reset(raw_err);
+			output.reset(raw_output);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			raw_output = nullptr;
+			raw_err = nullptr;
+			rv = lotman_get_policy_attributes(R"({"lot_name": "lot4", "dedicated_GB": true})", &raw_output, &raw_err);
+			err_msg.reset(raw_err);
+			output.reset(raw_output);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+
+			lotman_policy_violation_t *violations = nullptr;
+			size_t num_violations = 0;
+			raw_err = nullptr;
+			rv = lotman_get_policy_violations(true, true, &violations, &num_violations, &raw_err);
+			err_msg.reset(raw_err);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+			lotman_free_policy_violations(violations, num_violations);
+
+			lotman_eviction_candidate_t *candidates = nullptr;
+			size_t num_candidates = 0;
+			raw_err = nullptr;
+			rv = lotman_get_eviction_candidates(0, 0, &candidates, &num_candidates, &raw_err);
+			err_msg.reset(raw_err);
+			ASSERT_EQ(rv, 0) << err_msg.get();
+			lotman_free_eviction_candidates(candidates, num_candidates);
+
+			if (is_owner) {
+				raw_err = nullptr;
+				rv = lotman_remove_lots_recursive(lot_name.c_str(), &raw_err);
+				err_msg.reset(raw_err);
+				EXPECT_EQ(rv, 0) << err_msg.get();
+			}
+		}
+
+		// Leave the thread as it was found, for the pool's sake
+		raw_err = nullptr;
+		rv = lotman_set_context_str("thread_caller", "", &raw_err);
+		err_msg.reset(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.emplace_back(worker, t);
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	// Every owner update landed exactly once, and every added lot is gone again
+	lotman_usage_t usage;
+	char *raw_err = nullptr;
+	int rv = lotman_get_lot_usage_struct("lot3", &usage, &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.children_GB, num_threads / 2 * num_iterations);
+	EXPECT_EQ(usage.children_objects, num_threads / 2 * num_iterations);
+
+	char **raw_list = nullptr;
+	raw_err = nullptr;
+	rv = lotman_list_all_lots(&raw_list, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueStringList list(raw_list);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	size_t num_lots = 0;
+	while (list.get()[num_lots]) {
+		num_lots++;
+	}
+	EXPECT_EQ(num_lots, 7);
+
+	// The process-wide caller was never touched by the threads
+	char *raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_context_str("caller", &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueCString output(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_STREQ(output.get(), "owner1");
+}
+
+struct CtxDeleter {
+	void operator()(lotman_ctx_t *ctx) const {
+		lotman_ctx_free(ctx);
+	}
+};
+using UniqueCtx = std::unique_ptr<lotman_ctx_t, CtxDeleter>;
+
+TEST_F(LotManTest, ContextHandleTest) {
+	// Two handles, each on its own database, used side by side and alongside the default context
+	std::vector<std::string> names = {"ctx_a", "ctx_b"};
+	std::vector<UniqueCtx> ctxs;
+	for (const auto &name : names) {
+		lotman_ctx_t *raw_ctx = nullptr;
+		char *raw_err = nullptr;
+		int rv = lotman_ctx_create((tmp_dir + "/" + name).c_str(), &raw_ctx, &raw_err);
+		UniqueCString err_msg(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+		ctxs.emplace_back(raw_ctx);
+
+		std::string owner = "owner_" + name;
+		raw_err = nullptr;
+		rv = lotman_ctx_set_context_str(raw_ctx, "caller", owner.c_str(), &raw_err);
+		err_msg.reset(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+
+		json default_lot = {{"lot_name", "default"},
+							{"owner", owner},
+							{"parents", {"default"}},
+							{"paths", {{{"path", "/" + name}, {"recursive", true}}}},
+							{"management_policy_attrs",
+							 {{"dedicated_GB", 5},
+							  {"opportunistic_GB", 2.5},
+							  {"max_num_objects", 100},
+							  {"creation_time", 123},
+							  {"expiration_time", 234},
+							  {"deletion_time", 345}}}};
+		raw_err = nullptr;
+		rv = lotman_ctx_add_lot(raw_ctx, default_lot.dump().c_str(), &raw_err);
+		err_msg.reset(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+	}
+
+	json only_b = {{"lot_name", "only_b"},
+				   {"owner", "owner_ctx_b"},
+				   {"parents", {"default"}},
+				   {"paths", {{{"path", "/only_b"}, {"recursive", true}}}},
+				   {"management_policy_attrs",
+					{{"dedicated_GB", 1},
+					 {"opportunistic_GB", 1},
+					 {"max_num_objects", 10},
+					 {"creation_time", 123},
+					 {"expiration_time", 234},
+					 {"deletion_time", 345}}}};
+	char *raw_err = nullptr;
+	int rv = lotman_ctx_add_lot(ctxs[1].get(), only_b.dump().c_str(), &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	// Each handle sees only its own lots, and the default context sees neither
+	raw_err = nullptr;
+	EXPECT_EQ(lotman_ctx_lot_exists(ctxs[1].get(), "only_b", &raw_err), 1);
+	err_msg.reset(raw_err);
+	raw_err = nullptr;
+	EXPECT_EQ(lotman_ctx_lot_exists(ctxs[0].get(), "only_b", &raw_err), 0);
+	err_msg.reset(raw_err);
+	raw_err = nullptr;
+	EXPECT_EQ(lotman_lot_exists("default", &raw_err), 0);
+	err_msg.reset(raw_err);
+
+	char **raw_list = nullptr;
+	raw_err = nullptr;
+	rv = lotman_ctx_get_lots_from_dir(ctxs[1].get(), "/only_b/file", false, &raw_list, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueStringList list(raw_list);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ASSERT_NE(list.get()[0], nullptr);
+	EXPECT_STREQ(list.get()[0], "only_b");
+
+	char *raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_ctx_get_context_str(ctxs[0].get(), "lot_home", &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	UniqueCString output(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(std::string(output.get()), tmp_dir + "/ctx_a");
+
+	raw_output = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_context_str("caller", &raw_output, &raw_err);
+	err_msg.reset(raw_err);
+	output.reset(raw_output);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_STREQ(output.get(), "owner1");
+
+	// Threads on different handles run concurrently, even while the default context is reopened over and over
+	constexpr int num_iterations = 20;
+	std::vector<std::thread> threads;
+	for (auto &ctx : ctxs) {
+		threads.emplace_back([&ctx]() {
+			for (int i = 0; i < num_iterations; i++) {
+				char *raw_err = nullptr;
+				int rv = lotman_ctx_update_lot_usage(ctx.get(), R"({"lot_name": "default", "self_GB": 1})", true,
+													 &raw_err);
+				UniqueCString err_msg(raw_err);
+				EXPECT_EQ(rv, 0) << err_msg.get();
+			}
+		});
+	}
+	threads.emplace_back([this]() {
+		for (int i = 0; i < num_iterations; i++) {
+			char *raw_err = nullptr;
+			int rv = lotman_set_context_str("lot_home", tmp_dir.c_str(), &raw_err);
+			UniqueCString err_msg(raw_err);
+			EXPECT_EQ(rv, 0) << err_msg.get();
+		}
+	});
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	for (auto &ctx : ctxs) {
+		lotman_usage_t usage;
+		raw_err = nullptr;
+		rv = lotman_ctx_get_lot_usage_struct(ctx.get(), "default", &usage, &raw_err);
+		err_msg.reset(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+		EXPECT_EQ(usage.self_GB, num_iterations);
+	}
+
+	// Binding a handle redirects the global API on this thread until the default context is bound again
+	raw_err = nullptr;
+	rv = lotman_ctx_make_current(ctxs[0].get(), &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	EXPECT_EQ(lotman_lot_exists("default", &raw_err), 1);
+	err_msg.reset(raw_err);
+
+	raw_err = nullptr;
+	rv = lotman_ctx_make_current(nullptr, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	EXPECT_EQ(lotman_lot_exists("default", &raw_err), 0);
+	err_msg.reset(raw_err);
+
+	// Invalid arguments
+	raw_err = nullptr;
+	EXPECT_NE(lotman_ctx_lot_exists(nullptr, "default", &raw_err), 0);
+	err_msg.reset(raw_err);
+	EXPECT_NE(err_msg.get(), nullptr);
+
+	lotman_ctx_t *raw_ctx = nullptr;
+	raw_err = nullptr;
+	EXPECT_NE(lotman_ctx_create("", &raw_ctx, &raw_err), 0);
+	err_msg.reset(raw_err);
+	EXPECT_EQ(raw_ctx, nullptr);
+
+	// A freed handle cannot be bound, and the thread stays on the default context
+	raw_err = nullptr;
+	rv = lotman_ctx_create((tmp_dir + "/ctx_freed").c_str(), &raw_ctx, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	lotman_ctx_free(raw_ctx);
+	raw_err = nullptr;
+	EXPECT_EQ(lotman_ctx_make_current(raw_ctx, &raw_err), -1);
+	err_msg.reset(raw_err);
+	EXPECT_NE(err_msg.get(), nullptr);
+	raw_err = nullptr;
+	EXPECT_EQ(lotman_lot_exists("default", &raw_err), 0);
+	err_msg.reset(raw_err);
+}
+
+TEST_F(LotManTest, CrossContextCacheTest) {
+	// The hierarchy and path caches must notice writes made through another connection to the same database
+	setupFullHierarchy();
+
+	lotman_ctx_t *raw_ctx = nullptr;
+	char *raw_err = nullptr;
+	int rv = lotman_ctx_create(tmp_dir.c_str(), &raw_ctx, &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	UniqueCtx writer(raw_ctx);
+	raw_err = nullptr;
+	rv = lotman_ctx_set_context_str(writer.get(), "caller", "owner1", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	auto add_to_lot_as_writer = [&](const char *update_JSON) {
+		char *raw_err = nullptr;
+		int rv = lotman_ctx_make_current(writer.get(), &raw_err);
+		UniqueCString err_msg(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+		raw_err = nullptr;
+		rv = lotman_add_to_lot(update_JSON, &raw_err);
+		err_msg.reset(raw_err);
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		raw_err = nullptr;
+		rv = lotman_ctx_make_current(nullptr, &raw_err);
+		err_msg.reset(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+	};
+	auto parents_of = [](const char *lot_name) {
+		char **raw_output = nullptr;
+		char *raw_err = nullptr;
+		int rv = lotman_get_parent_names(lot_name, false, false, &raw_output, &raw_err);
+		UniqueCString err_msg(raw_err);
+		UniqueStringList output(raw_output);
+		std::vector<std::string> result;
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		for (int iter = 0; rv == 0 && output.get()[iter]; iter++) {
+			result.push_back(output.get()[iter]);
+		}
+		return result;
+	};
+	auto lot_for = [](const char *dir) {
+		char **raw_output = nullptr;
+		char *raw_err = nullptr;
+		int rv = lotman_get_lots_from_dir(dir, false, &raw_output, &raw_err);
+		UniqueCString err_msg(raw_err);
+		UniqueStringList output(raw_output);
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		return rv == 0 ? std::string(output.get()[0]) : std::string();
+	};
+
+	// Warm the default context's caches, then make sep_node a parent of lot3 through the other handle
+	ASSERT_EQ(parents_of("lot3"), std::vector<std::string>{});
+	ASSERT_EQ(lot_for("/foo/bar/qux"), "lot1");
+	add_to_lot_as_writer(R"({"lot_name": "lot3", "parents": ["sep_node"]})");
+
+	ASSERT_EQ(parents_of("lot3"), std::vector<std::string>{"sep_node"});
 	raw_err = nullptr;
-	const char *dir2 = "/foo/barr"; // Make sure parsing doesn't grab lot associated with /foo/bar
-	rv = lotman_get_lots_from_dir(dir2, false, &raw_output, &raw_err);
+	rv = lotman_update_lot_usage(R"({"lot_name": "lot3", "self_GB": 1})", true, &raw_err);
 	err_msg.reset(raw_err);
-	UniqueStringList output2(raw_output);
 	ASSERT_EQ(rv, 0) << err_msg.get();
+	lotman_usage_t usage;
+	raw_err = nullptr;
+	rv = lotman_get_lot_usage_struct("sep_node", &usage, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.children_GB, 1);
 
-	ASSERT_EQ(strcmp(output2.get()[0], "lot3"), 0);
+	// A path added elsewhere is found by the next directory lookup
+	add_to_lot_as_writer(R"({"lot_name": "sep_node", "paths": [{"path": "/foo/bar/qux", "recursive": true}]})");
+	EXPECT_EQ(lot_for("/foo/bar/qux"), "sep_node");
 }
 
-TEST_F(LotManTest, GetVersionTest) {
-	const char *version = lotman_version();
-	std::string version_cpp(version);
+TEST_F(LotManTest, CrossContextAuthorizationTest) {
+	// Ownership handed out or taken back through another connection reaches callers already cached here
+	setupFullHierarchy();
 
-	EXPECT_EQ(version_cpp, "v0.0.1");
+	lotman_ctx_t *raw_ctx = nullptr;
+	char *raw_err = nullptr;
+	int rv = lotman_ctx_create(tmp_dir.c_str(), &raw_ctx, &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	UniqueCtx writer(raw_ctx);
+
+	auto update_as_writer = [&](const char *caller, const char *update_JSON) {
+		char *raw_err = nullptr;
+		int rv = lotman_ctx_set_context_str(writer.get(), "caller", caller, &raw_err);
+		UniqueCString err_msg(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+		raw_err = nullptr;
+		rv = lotman_ctx_make_current(writer.get(), &raw_err);
+		err_msg.reset(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+		raw_err = nullptr;
+		rv = lotman_update_lot(update_JSON, &raw_err);
+		err_msg.reset(raw_err);
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		raw_err = nullptr;
+		rv = lotman_ctx_make_current(nullptr, &raw_err);
+		err_msg.reset(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+	};
+	auto update_usage_as = [](const std::string &caller, const char *lot_name) {
+		char *raw_err = nullptr;
+		int rv = lotman_set_context_str("caller", caller.c_str(), &raw_err);
+		UniqueCString err_msg(raw_err);
+		EXPECT_EQ(rv, 0) << err_msg.get();
+
+		std::string usage_update_JSON = R"({"lot_name": ")" + std::string(lot_name) + R"(", "self_GB": 1})";
+		raw_err = nullptr;
+		rv = lotman_update_lot_usage(usage_update_JSON.c_str(), false, &raw_err);
+		err_msg.reset(raw_err);
+		return rv == 0;
+	};
+
+	ASSERT_FALSE(update_usage_as("alice", "lot5"));
+	update_as_writer("owner1", R"({"lot_name": "lot3", "owner": "alice"})");
+	ASSERT_TRUE(update_usage_as("alice", "lot5"));
+
+	// Handing lot3 back elsewhere revokes alice's cached access with her next check
+	update_as_writer("alice", R"({"lot_name": "lot3", "owner": "owner1"})");
+	ASSERT_FALSE(update_usage_as("alice", "lot5"));
+	ASSERT_TRUE(update_usage_as("owner1", "lot5"));
+
+	// More callers than the cache holds still get the right answers
+	for (int i = 0; i < 200; i++) {
+		ASSERT_FALSE(update_usage_as("caller" + std::to_string(i), "lot5"));
+	}
+	ASSERT_TRUE(update_usage_as("owner1", "lot5"));
+	ASSERT_FALSE(update_usage_as("alice", "lot5"));
 }
 
-TEST_F(LotManTest, IsRootTest) {
-	// Set up a hierarchy: default (root), lot1 (root), lot2 (child of lot1), lot3 (root), lot4 (child)
-	setupStandardHierarchy();
+TEST_F(LotManTest, WriteBehindUsageTest) {
+	setupFullHierarchy();
 
+	// A handle on the same database reads what has been written, without the default context's pending deltas
+	lotman_ctx_t *raw_ctx = nullptr;
 	char *raw_err = nullptr;
-
-	// Test with non-existent lot
-	auto rv = lotman_is_root("non_existent_lot", &raw_err);
+	int rv = lotman_ctx_create(tmp_dir.c_str(), &raw_ctx, &raw_err);
 	UniqueCString err_msg(raw_err);
-	EXPECT_EQ(rv, -1) << "Expected error for non-existent lot";
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	UniqueCtx reader(raw_ctx);
+	auto written_GB = [&](const char *lot_name) {
+		lotman_usage_t usage;
+		char *raw_err = nullptr;
+		int rv = lotman_ctx_get_lot_usage_struct(reader.get(), lot_name, &usage, &raw_err);
+		UniqueCString err_msg(raw_err);
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		return usage.self_GB + usage.children_GB;
+	};
 
-	// "default" should be a root lot (self-parent)
 	raw_err = nullptr;
-	rv = lotman_is_root("default", &raw_err);
+	rv = lotman_set_context_int("usage_flush_interval_ms", 60000, &raw_err);
 	err_msg.reset(raw_err);
-	ASSERT_GE(rv, 0) << err_msg.get();
-	EXPECT_EQ(rv, 1) << "default should be a root lot";
+	ASSERT_EQ(rv, 0) << err_msg.get();
 
-	// "lot1" IS a root lot (self-parent)
+	for (int i = 0; i < 10; i++) {
+		raw_err = nullptr;
+		rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": 1, "self_objects": 2})", true, &raw_err);
+		err_msg.reset(raw_err);
+		ASSERT_EQ(rv, 0) << err_msg.get();
+	}
+	EXPECT_EQ(written_GB("lot4"), 0);
+
+	// Reads merge the pending deltas into the lot and its ancestors
+	lotman_usage_t usage;
 	raw_err = nullptr;
-	rv = lotman_is_root("lot1", &raw_err);
+	rv = lotman_get_lot_usage_struct("lot4", &usage, &raw_err);
 	err_msg.reset(raw_err);
-	ASSERT_GE(rv, 0) << err_msg.get();
-	EXPECT_EQ(rv, 1) << "lot1 should be a root lot (self-parent)";
-
-	// "lot2" should NOT be a root (has lot1 as parent)
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.self_GB, 10);
+	EXPECT_EQ(usage.self_objects, 20);
 	raw_err = nullptr;
-	rv = lotman_is_root("lot2", &raw_err);
+	rv = lotman_get_lot_usage_struct("lot3", &usage, &raw_err);
 	err_msg.reset(raw_err);
-	ASSERT_GE(rv, 0) << err_msg.get();
-	EXPECT_EQ(rv, 0) << "lot2 should not be a root lot";
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.children_GB, 10);
+	EXPECT_EQ(usage.children_objects, 20);
 
-	// "lot3" IS a root lot (self-parent)
 	raw_err = nullptr;
-	rv = lotman_is_root("lot3", &raw_err);
+	rv = lotman_flush(&raw_err);
 	err_msg.reset(raw_err);
-	ASSERT_GE(rv, 0) << err_msg.get();
-	EXPECT_EQ(rv, 1) << "lot3 should be a root lot (self-parent)";
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(written_GB("lot4"), 10);
+	EXPECT_EQ(written_GB("lot3"), 10);
 
-	// "lot4" should NOT be a root (has lot2 and lot3 as parents)
+	// Reads that query the database write the pending deltas first
 	raw_err = nullptr;
-	rv = lotman_is_root("lot4", &raw_err);
+	rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": 5})", true, &raw_err);
 	err_msg.reset(raw_err);
-	ASSERT_GE(rv, 0) << err_msg.get();
-	EXPECT_EQ(rv, 0) << "lot4 should not be a root lot";
-}
-
-TEST_F(LotManTest, ContextStrTest) {
-	char *raw_err = nullptr;
+	ASSERT_EQ(rv, 0) << err_msg.get();
 	char *raw_output = nullptr;
-
-	// Test getting lot_home that was set in SetUp
-	auto rv = lotman_get_context_str("lot_home", &raw_output, &raw_err);
-	UniqueCString err_msg(raw_err);
+	raw_err = nullptr;
+	rv = lotman_get_lot_usage(R"({"lot_name": "lot4", "total_GB": false})", &raw_output, &raw_err);
+	err_msg.reset(raw_err);
 	UniqueCString output(raw_output);
 	ASSERT_EQ(rv, 0) << err_msg.get();
-	ASSERT_NE(output.get(), nullptr);
-	// The lot_home should contain our temp directory path
-	std::string lot_home(output.get());
-	EXPECT_FALSE(lot_home.empty());
+	EXPECT_EQ(json::parse(output.get())["total_GB"]["self_contrib"], 15);
 
-	// Test getting caller that was set in SetUp
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": 3})", true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
 	raw_output = nullptr;
 	raw_err = nullptr;
-	rv = lotman_get_context_str("caller", &raw_output, &raw_err);
+	rv = lotman_get_lot_as_json("lot4", false, &raw_output, &raw_err);
 	err_msg.reset(raw_err);
 	output.reset(raw_output);
 	ASSERT_EQ(rv, 0) << err_msg.get();
-	ASSERT_NE(output.get(), nullptr);
-	EXPECT_STREQ(output.get(), "owner1");
+	EXPECT_EQ(json::parse(output.get())["usage"]["total_GB"]["self_contrib"], 18);
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": -3})", true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
 
-	// Test setting and getting a new caller
+	// A delta that would make usage negative, counting what is still pending, is rejected on the spot and
+	// leaves the pending deltas alone
 	raw_err = nullptr;
-	rv = lotman_set_context_str("caller", "new_owner", &raw_err);
+	rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": 10})", true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": -30, "self_objects": 1})", true, &raw_err);
+	err_msg.reset(raw_err);
+	EXPECT_NE(rv, 0);
+	EXPECT_NE(err_msg.get(), nullptr);
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": -10})", true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	rv = lotman_flush(&raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(written_GB("lot4"), 15);
+	raw_err = nullptr;
+	rv = lotman_ctx_get_lot_usage_struct(reader.get(), "lot4", &usage, &raw_err);
 	err_msg.reset(raw_err);
 	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.self_objects, 20);
 
-	raw_output = nullptr;
+	// Many threads queueing at once lose nothing, while the update count keeps waking the background thread
 	raw_err = nullptr;
-	rv = lotman_get_context_str("caller", &raw_output, &raw_err);
+	rv = lotman_set_context_int("usage_flush_max_updates", 16, &raw_err);
 	err_msg.reset(raw_err);
-	output.reset(raw_output);
 	ASSERT_EQ(rv, 0) << err_msg.get();
-	ASSERT_NE(output.get(), nullptr);
-	EXPECT_STREQ(output.get(), "new_owner");
+	constexpr int num_threads = 4;
+	constexpr int num_iterations = 100;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.emplace_back([]() {
+			for (int i = 0; i < num_iterations; i++) {
+				char *raw_err = nullptr;
+				int rv = lotman_update_lot_usage(R"({"lot_name": "lot5", "self_GB": 1})", true, &raw_err);
+				UniqueCString err_msg(raw_err);
+				EXPECT_EQ(rv, 0) << err_msg.get();
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	raw_err = nullptr;
+	rv = lotman_flush(&raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	rv = lotman_ctx_get_lot_usage_struct(reader.get(), "lot5", &usage, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.self_GB, num_threads * num_iterations);
 
-	// Reset caller back to owner1 for any subsequent operations
+	// The background thread writes on its own once the interval is up
 	raw_err = nullptr;
-	rv = lotman_set_context_str("caller", "owner1", &raw_err);
+	rv = lotman_set_context_int("usage_flush_interval_ms", 10, &raw_err);
 	err_msg.reset(raw_err);
 	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": 1})", true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	for (int i = 0; i < 500 && written_GB("lot4") != 16; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	EXPECT_EQ(written_GB("lot4"), 16);
 
-	// Test with invalid context key
-	raw_output = nullptr;
+	// Turning write-behind off writes directly again
 	raw_err = nullptr;
-	rv = lotman_get_context_str("invalid_key", &raw_output, &raw_err);
+	rv = lotman_set_context_int("usage_flush_interval_ms", 0, &raw_err);
 	err_msg.reset(raw_err);
-	EXPECT_EQ(rv, -1) << "Expected error for invalid context key";
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage(R"({"lot_name": "lot4", "self_GB": 1})", true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(written_GB("lot4"), 17);
 }
 
-TEST_F(LotManTest, ContextIntTest) {
+TEST_F(LotManTest, UsageJournalRecoveryTest) {
+	setupFullHierarchy();
+
+	auto journal_files = [&]() {
+		int count = 0;
+		for (const auto &entry : std::filesystem::recursive_directory_iterator(tmp_dir)) {
+			const std::string name = entry.path().filename().string();
+			if (name.size() > 14 && name.compare(name.size() - 14, 14, "-usage-journal") == 0) {
+				count++;
+			}
+		}
+		return count;
+	};
+
+	// A process that dies with deltas still pending, some of them after a flush
+	pid_t pid = fork();
+	ASSERT_GE(pid, 0);
+	if (pid == 0) {
+		lotman_ctx_t *ctx = nullptr;
+		char *err = nullptr;
+		auto update = [&](const char *update_json) {
+			if (lotman_ctx_update_lot_usage(ctx, update_json, true, &err) != 0) {
+				_exit(2);
+			}
+		};
+		if (lotman_ctx_create(tmp_dir.c_str(), &ctx, &err) != 0 ||
+			lotman_ctx_set_context_str(ctx, "caller", "owner1", &err) != 0 ||
+			lotman_ctx_set_context_int(ctx, "usage_flush_interval_ms", 60000, &err) != 0) {
+			_exit(1);
+		}
+		for (int i = 0; i < 3; i++) {
+			update(R"({"lot_name": "lot4", "self_GB": 1, "self_objects": 2})");
+		}
+		if (lotman_ctx_flush(ctx, &err) != 0) {
+			_exit(3);
+		}
+		update(R"({"lot_name": "lot4", "self_GB": 2})");
+		update(R"({"lot_name": "lot5", "self_objects": 7})");
+		_exit(0);
+	}
+	int status = 0;
+	ASSERT_EQ(waitpid(pid, &status, 0), pid);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+	EXPECT_EQ(journal_files(), 1);
+
+	// The next context to open the database replays what was not flushed, exactly once
+	lotman_ctx_t *raw_ctx = nullptr;
 	char *raw_err = nullptr;
-	int output = 0;
+	int rv = lotman_ctx_create(tmp_dir.c_str(), &raw_ctx, &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	UniqueCtx ctx(raw_ctx);
+	lotman_usage_t usage;
+	raw_err = nullptr;
+	rv = lotman_ctx_get_lot_usage_struct(ctx.get(), "lot4", &usage, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.self_GB, 5);
+	EXPECT_EQ(usage.self_objects, 6);
+	raw_err = nullptr;
+	rv = lotman_ctx_get_lot_usage_struct(ctx.get(), "lot3", &usage, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.children_GB, 5);
+	EXPECT_EQ(usage.children_objects, 13);
+	EXPECT_EQ(journal_files(), 0);
 
-	// Test setting db_timeout
-	auto rv = lotman_set_context_int("db_timeout", 5000, &raw_err);
+	// Opening the database again replays nothing twice
+	ctx.reset();
+	raw_ctx = nullptr;
+	raw_err = nullptr;
+	rv = lotman_ctx_create(tmp_dir.c_str(), &raw_ctx, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	ctx.reset(raw_ctx);
+	raw_err = nullptr;
+	rv = lotman_ctx_get_lot_usage_struct(ctx.get(), "lot4", &usage, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(usage.self_GB, 5);
+
+	// Only one context journals updates to a database at a time
+	raw_err = nullptr;
+	rv = lotman_ctx_set_context_int(ctx.get(), "usage_flush_interval_ms", 60000, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	rv = lotman_set_context_int("usage_flush_interval_ms", 60000, &raw_err);
+	err_msg.reset(raw_err);
+	EXPECT_NE(rv, 0);
+	EXPECT_NE(err_msg.get(), nullptr);
+	raw_err = nullptr;
+	rv = lotman_ctx_set_context_int(ctx.get(), "usage_flush_interval_ms", 0, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(journal_files(), 0);
+}
+
+TEST_F(LotManTest, MetricsTest) {
+	setupFullHierarchy();
+
+	auto get_metrics = []() {
+		char *raw_output = nullptr;
+		char *raw_err = nullptr;
+		int rv = lotman_get_metrics(&raw_output, &raw_err);
+		UniqueCString err_msg(raw_err);
+		UniqueCString output(raw_output);
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		return json::parse(output.get());
+	};
+	auto api_count = [](const json &metrics, const char *call, const char *key) -> uint64_t {
+		return metrics["api"].contains(call) ? metrics["api"][call][key].get<uint64_t>() : 0;
+	};
+
+	json before = get_metrics();
+	for (int i = 0; i < 3; i++) {
+		char *raw_err = nullptr;
+		int rv = lotman_lot_exists("lot1", &raw_err);
+		UniqueCString err_msg(raw_err);
+		ASSERT_EQ(rv, 1) << err_msg.get();
+	}
+	char *raw_output = nullptr;
+	char *raw_err = nullptr;
+	int rv = lotman_get_lot_usage(R"({"lot_name": "lot1", "total_GB": false})", &raw_output, &raw_err);
 	UniqueCString err_msg(raw_err);
+	UniqueCString output(raw_output);
 	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_err = nullptr;
+	rv = lotman_add_lot("not json", &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_NE(rv, 0);
+	json after = get_metrics();
+
+	// Calls are counted, and only those that report an error count as errors
+	EXPECT_EQ(api_count(after, "lot_exists", "calls") - api_count(before, "lot_exists", "calls"), 3);
+	EXPECT_EQ(api_count(after, "lot_exists", "errors"), api_count(before, "lot_exists", "errors"));
+	EXPECT_EQ(api_count(after, "add_lot", "calls") - api_count(before, "add_lot", "calls"), 1);
+	EXPECT_EQ(api_count(after, "add_lot", "errors") - api_count(before, "add_lot", "errors"), 1);
+
+	const json &lot_exists = after["api"]["lot_exists"];
+	EXPECT_GT(lot_exists["total_seconds"].get<double>(), 0);
+	EXPECT_LE(lot_exists["p50_seconds"].get<double>(), lot_exists["max_seconds"].get<double>());
+	uint64_t histogram_count = 0;
+	for (const auto &bucket : lot_exists["histogram"]) {
+		histogram_count += bucket["count"].get<uint64_t>();
+	}
+	EXPECT_EQ(histogram_count, lot_exists["calls"].get<uint64_t>());
 
-	// Test getting db_timeout
+	EXPECT_GT(after["sql"]["query"]["calls"].get<uint64_t>(), before["sql"]["query"]["calls"].get<uint64_t>());
+	EXPECT_GT(after["connection_pool"]["hits"].get<uint64_t>(), before["connection_pool"]["hits"].get<uint64_t>());
+	EXPECT_GT(after["statement_cache"]["hits"].get<uint64_t>(), before["statement_cache"]["hits"].get<uint64_t>());
+	EXPECT_TRUE(after.contains("busy_retries"));
+
+	// Threads that exited still count
+	uint64_t calls_before_thread = api_count(after, "lot_exists", "calls");
+	std::thread([]() {
+		char *raw_err = nullptr;
+		lotman_lot_exists("lot1", &raw_err);
+		free(raw_err);
+	}).join();
+	EXPECT_EQ(api_count(get_metrics(), "lot_exists", "calls"), calls_before_thread + 1);
+
+	raw_output = nullptr;
 	raw_err = nullptr;
-	rv = lotman_get_context_int("db_timeout", &output, &raw_err);
+	rv = lotman_get_metrics_prometheus(&raw_output, &raw_err);
 	err_msg.reset(raw_err);
+	output.reset(raw_output);
 	ASSERT_EQ(rv, 0) << err_msg.get();
-	EXPECT_EQ(output, 5000);
+	std::string text(output.get());
+	EXPECT_NE(text.find("# TYPE lotman_api_latency_seconds histogram"), std::string::npos);
+	EXPECT_NE(text.find("lotman_api_calls_total{call=\"lot_exists\"} " + std::to_string(calls_before_thread + 1)),
+			  std::string::npos);
+	EXPECT_NE(text.find("lotman_api_latency_seconds_bucket{call=\"lot_exists\",le=\"+Inf\"}"), std::string::npos);
+	EXPECT_NE(text.find("lotman_sql_busy_retries_total"), std::string::npos);
+}
+
+TEST_F(LotManTest, SqlTraceTest) {
+	setupFullHierarchy();
+
+	struct Traced {
+		std::string sql;
+		int num_params;
+		int result_code;
+		int64_t rows;
+		int64_t step_ns;
+		int64_t fullscan_steps;
+	};
+	std::vector<Traced> traces;
+	auto collect = [](const lotman_sql_trace_t *trace, void *user_data) {
+		static_cast<std::vector<Traced> *>(user_data)->push_back(
+			{trace->sql, trace->num_params, trace->result_code, trace->rows, trace->step_ns, trace->fullscan_steps});
+	};
+	auto find_trace = [&traces](const std::string &fragment) -> const Traced * {
+		for (const auto &trace : traces) {
+			if (trace.sql.find(fragment) != std::string::npos) {
+				return &trace;
+			}
+		}
+		return nullptr;
+	};
+
+	char *raw_err = nullptr;
+	int rv = lotman_set_sql_trace_callback(collect, &traces, -1, &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_NE(rv, 0);
 
-	// Test setting a different value
 	raw_err = nullptr;
-	rv = lotman_set_context_int("db_timeout", 10000, &raw_err);
+	rv = lotman_set_sql_trace_callback(collect, &traces, 0, &raw_err);
 	err_msg.reset(raw_err);
 	ASSERT_EQ(rv, 0) << err_msg.get();
 
+	// A catalogued query run through SQL_get_matches, which scans every lot's policy
+	char **raw_list = nullptr;
 	raw_err = nullptr;
-	rv = lotman_get_context_int("db_timeout", &output, &raw_err);
+	rv = lotman_get_lots_past_exp(false, &raw_list, &raw_err);
 	err_msg.reset(raw_err);
+	UniqueStringList expired(raw_list);
 	ASSERT_EQ(rv, 0) << err_msg.get();
-	EXPECT_EQ(output, 10000);
+	const Traced *query = find_trace("expiration_time");
+	ASSERT_NE(query, nullptr);
+	EXPECT_EQ(query->result_code, SQLITE_DONE);
+	EXPECT_GE(query->num_params, 1);
+	EXPECT_GT(query->step_ns, 0);
+	size_t num_expired = 0;
+	while (expired.get()[num_expired]) {
+		num_expired++;
+	}
+	EXPECT_EQ(query->rows, static_cast<int64_t>(num_expired));
 
-	// Test with invalid context key
+	// A sqlite_orm storage call, which reads the whole owners table
+	traces.clear();
+	raw_list = nullptr;
 	raw_err = nullptr;
-	rv = lotman_set_context_int("invalid_key", 100, &raw_err);
+	rv = lotman_list_all_lots(&raw_list, &raw_err);
 	err_msg.reset(raw_err);
-	EXPECT_EQ(rv, -1) << "Expected error for invalid context key";
+	UniqueStringList all_lots(raw_list);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	const Traced *orm = find_trace("owners");
+	ASSERT_NE(orm, nullptr);
+	EXPECT_EQ(orm->rows, 7);
+	EXPECT_GT(orm->fullscan_steps, 0);
 
+	// Nothing reaches the callback below the threshold or once it is removed
 	raw_err = nullptr;
-	rv = lotman_get_context_int("invalid_key", &output, &raw_err);
+	rv = lotman_set_sql_trace_callback(collect, &traces, 60 * 1000 * 1000, &raw_err);
 	err_msg.reset(raw_err);
-	EXPECT_EQ(rv, -1) << "Expected error for invalid context key";
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	size_t num_traces = traces.size();
+	raw_list = nullptr;
+	raw_err = nullptr;
+	rv = lotman_get_lots_past_exp(false, &raw_list, &raw_err);
+	err_msg.reset(raw_err);
+	lotman_free_string_list(raw_list);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(traces.size(), num_traces);
+
+	raw_err = nullptr;
+	rv = lotman_set_sql_trace_callback(nullptr, nullptr, 0, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	raw_list = nullptr;
+	raw_err = nullptr;
+	rv = lotman_list_all_lots(&raw_list, &raw_err);
+	err_msg.reset(raw_err);
+	lotman_free_string_list(raw_list);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	EXPECT_EQ(traces.size(), num_traces);
 }
 
 TEST_F(LotManTest, PathTrailingSlashNormalizationTest) {
@@ -2761,6 +4358,113 @@ TEST_F(LotManTest, UpdateUsageByDirIncludesSubdirsWithExclusionsTest) {
 	// Objects: (100 - 30) + (80 - 50) + 50 = 70 + 30 + 50 = 150
 	EXPECT_EQ(usage_json["num_objects"]["self_contrib"].get<int64_t>(), 150) << "default should have 150 objects";
 }
+
+TEST_F(LotManTest, UpdateUsageByDirFileTest) {
+	setupFullHierarchy();
+
+	auto get_self_usage = [](const std::string &lot_name) {
+		json query = {{"lot_name", lot_name}, {"total_GB", false}, {"num_objects", false}};
+		char *raw_output = nullptr;
+		char *raw_err = nullptr;
+		int rv = lotman_get_lot_usage(query.dump().c_str(), &raw_output, &raw_err);
+		UniqueCString err_msg(raw_err);
+		UniqueCString output(raw_output);
+		EXPECT_EQ(rv, 0) << err_msg.get();
+		json usage = json::parse(output.get());
+		return std::make_pair(usage["total_GB"]["self_contrib"].get<double>(),
+							  usage["num_objects"]["self_contrib"].get<int64_t>());
+	};
+
+	// /1 and /1/2 fall to default, /1/2/3 is lot1 (non-recursive), /1/2/3/4 is lot4 (recursive, so /1/2/3/4/5
+	// stays with it), /1/2/4 is lot2, /foo/bar is lot1 and /foo/baz is lot2
+	const char *tree = R"([
+		{"path": "1", "includes_subdirs": true, "size_GB": 20, "num_obj": 40, "subdirs": [
+			{"path": "2", "includes_subdirs": true, "size_GB": 15, "num_obj": 30, "subdirs": [
+				{"path": "3", "includes_subdirs": true, "size_GB": 6, "num_obj": 12, "subdirs": [
+					{"path": "4", "includes_subdirs": true, "size_GB": 2.5, "num_obj": 5, "subdirs": [
+						{"path": "5", "includes_subdirs": false, "size_GB": 1, "num_obj": 1, "subdirs": []}
+					]}
+				]},
+				{"path": "4", "includes_subdirs": false, "size_GB": 4, "num_obj": 8, "subdirs": []}
+			]}
+		]},
+		{"path": "/foo", "includes_subdirs": true, "size_GB": 9, "num_obj": 9, "subdirs": [
+			{"path": "bar", "includes_subdirs": false, "size_GB": 3, "num_obj": 3},
+			{"path": "baz", "includes_subdirs": false, "size_GB": 1.5, "num_obj": 2}
+		]}
+	])";
+	char *raw_err = nullptr;
+	int rv = lotman_update_lot_usage_by_dir(tree, false, &raw_err);
+	UniqueCString err_msg(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+
+	std::map<std::string, std::pair<double, int64_t>> expected = {
+		{"default", {14.5, 24}}, {"lot1", {6.5, 10}}, {"lot2", {5.5, 10}}, {"lot4", {2.5, 5}}};
+	for (const auto &[lot_name, usage] : expected) {
+		ASSERT_EQ(get_self_usage(lot_name), usage) << lot_name;
+	}
+
+	// Streaming the same tree from a file in delta mode must attribute exactly the same amounts. Usage values
+	// may come before or after subdirs.
+	std::string tree_path = tmp_dir + "/tree.json";
+	{
+		std::ofstream tree_file(tree_path);
+		tree_file << R"([
+			{"path": "1", "includes_subdirs": true, "subdirs": [
+				{"includes_subdirs": true, "path": "2", "size_GB": 15, "subdirs": [
+					{"path": "3", "includes_subdirs": true, "subdirs": [
+						{"path": "4", "includes_subdirs": true, "size_GB": 2.5, "num_obj": 5, "subdirs": [
+							{"path": "5", "includes_subdirs": false, "size_GB": 1, "num_obj": 1, "subdirs": []}
+						]}
+					], "num_obj": 12, "size_GB": 6},
+					{"path": "4", "includes_subdirs": false, "size_GB": 4, "num_obj": 8, "subdirs": []}
+				], "num_obj": 30}
+			], "size_GB": 20, "num_obj": 40},
+			{"path": "/foo", "includes_subdirs": true, "size_GB": 9, "num_obj": 9, "subdirs": [
+				{"path": "bar", "includes_subdirs": false, "size_GB": 3, "num_obj": 3},
+				{"path": "baz", "includes_subdirs": false, "size_GB": 1.5, "num_obj": 2}
+			]}
+		])";
+	}
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage_by_dir_file(tree_path.c_str(), true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_EQ(rv, 0) << err_msg.get();
+	for (const auto &[lot_name, usage] : expected) {
+		ASSERT_EQ(get_self_usage(lot_name), std::make_pair(2 * usage.first, 2 * usage.second)) << lot_name;
+	}
+
+	// Subdirs can't be attributed before their parent's path is known. The whole update is rejected, including
+	// the first directory, which is fine on its own.
+	{
+		std::ofstream tree_file(tree_path);
+		tree_file << R"([
+			{"path": "/foo/bar", "includes_subdirs": false, "size_GB": 1},
+			{"includes_subdirs": true, "subdirs": [{"path": "baz", "includes_subdirs": false}], "path": "/foo"}
+		])";
+	}
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage_by_dir_file(tree_path.c_str(), true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_NE(rv, 0);
+	ASSERT_NE(std::string(err_msg.get()).find("must come before"), std::string::npos) << err_msg.get();
+	ASSERT_EQ(get_self_usage("lot1"), std::make_pair(13.0, int64_t{20}));
+
+	// Invalid directory objects are rejected by the schema, just like in the DOM path
+	{
+		std::ofstream tree_file(tree_path);
+		tree_file << R"([{"path": "/foo/bar", "includes_subdirs": false, "size_GB": "lots"}])";
+	}
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage_by_dir_file(tree_path.c_str(), true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_NE(rv, 0);
+
+	raw_err = nullptr;
+	rv = lotman_update_lot_usage_by_dir_file((tmp_dir + "/missing.json").c_str(), true, &raw_err);
+	err_msg.reset(raw_err);
+	ASSERT_NE(rv, 0);
+}
 } // namespace
 
 int main(int argc, char **argv) {